@@ -95,7 +95,8 @@ function set_compiler( settings, config, compiler )
         else
             SetDriversClang( settings )
         end    
-        settings.cc.flags:Add( "-std=c++11", "-Wconversion", "-Wextra", "-Wall", "-Werror", "-Wstrict-aliasing=2" )
+        settings.cc.flags:Add( "-std=c++11", "-Wconversion", "-Wextra", "-Wall", "-Werror", "-Wstrict-aliasing=2", "-pthread" )
+        settings.link.flags:Add( "-pthread" )
         if config == "release" then
             settings.cc.flags:Add( "-O2" )
         end
@@ -116,7 +117,11 @@ settings.lib.Output = output_func
 settings.link.Output = output_func
 
 settings.link.libpath:Add( 'local/' .. config .. '/' .. platform )
-local tests = Link( settings, 'coro_tests', Compile( settings, 'test/test_coro.cpp' ) )
+-- the tests cover the opt-in per-coroutine context-block, coroutine-local storage and
+-- scheduler registry.
+local test_settings = settings:Copy()
+test_settings.cc.defines:Add( "CORO_CONTEXT_SIZE=32", "CORO_LOCAL_SLOTS=8", "CORO_SCHED_REGISTRY=1" )
+local tests = Link( test_settings, 'coro_tests', Compile( test_settings, Collect( 'test/*.cpp' ) ) )
 
 -- examples
 local examples = {}
@@ -126,6 +131,22 @@ for _, file in ipairs(Collect( "example/*.cpp" )) do
     table.insert( examples, exe )
 end
 
+-- benchmarks
+local benchmarks = {}
+for _, file in ipairs(Collect( "bench/*.cpp" )) do
+    local name = PathFilename(PathBase(file))
+    local exe  = Link( settings, name, Compile( settings, file ) )
+    table.insert( benchmarks, exe )
+end
+
+-- tools
+local tools = {}
+for _, file in ipairs(Collect( "tools/*.cpp" )) do
+    local name = PathFilename(PathBase(file))
+    local exe  = Link( settings, name, Compile( settings, file ) )
+    table.insert( tools, exe )
+end
+
 test_args = " -v"
 if ScriptArgs["test"]     then test_args = test_args .. " -t " .. ScriptArgs["test"] end
 if ScriptArgs["suite"]    then test_args = test_args .. " -s " .. ScriptArgs["suite"] end
@@ -138,6 +159,8 @@ else
 end
 
 PseudoTarget( "examples", examples )
+PseudoTarget( "benchmarks", benchmarks )
+PseudoTarget( "tools", tools )
 PseudoTarget( "all", tests )
 DefaultTarget( "all" )
 
@@ -0,0 +1,277 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Wake-to-resume latency of a coroutine parked on a reactor, blocking vs. busy-polling.
+
+    usage: bench_busy_poll [samples] [reactor-cpu] [waker-cpu]
+
+    A waker-thread stores a timestamp and signals an eventfd, the coroutine reading the
+    eventfd records the time from the signal until it was resumed. Reports p50/p99/max for
+    epoll and io_uring, both blocking and busy-polling, and io_uring with SQPOLL.
+
+    Busy-polling only makes sense with the reactor and waker on different cpus, preferably
+    with the reactor-cpu isolated with isolcpus= or similar.
+*/
+
+#if defined(__linux__)
+
+#include "../coro_io.h"
+#include "../coro_uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+static uint64_t now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static cpu_set_t g_main_affinity; ///< affinity of the main thread at startup.
+
+static void pin_thread(int cpu)
+{
+    if(cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+struct bench_state
+{
+    int                   efd;
+    int                   samples;
+    uint64_t              signal_time;  ///< written by the waker before signalling.
+    int                   acked;        ///< samples consumed by the reactor.
+    std::vector<uint64_t> latencies;
+    co_io_fd              f;
+    co_uring              ring;
+};
+
+static bench_state g_bench;
+
+static void record_sample()
+{
+    uint64_t t = now_ns();
+    g_bench.latencies.push_back(t - __atomic_load_n(&g_bench.signal_time, __ATOMIC_ACQUIRE));
+    __atomic_store_n(&g_bench.acked, g_bench.acked + 1, __ATOMIC_RELEASE);
+}
+
+static void waker(int cpu)
+{
+    pin_thread(cpu);
+    for(int i = 0; i < g_bench.samples; ++i)
+    {
+        // wait for the previous sample to be consumed and a bit more to let the reactor park.
+        while(__atomic_load_n(&g_bench.acked, __ATOMIC_ACQUIRE) < i)
+            std::this_thread::yield();
+        uint64_t until = now_ns() + 20000;
+        while(now_ns() < until)
+            ;
+
+        __atomic_store_n(&g_bench.signal_time, now_ns(), __ATOMIC_RELEASE);
+        uint64_t one = 1;
+        if(write(g_bench.efd, &one, sizeof(one)) != sizeof(one))
+            abort();
+    }
+}
+
+static void epoll_reader(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        uint64_t value;
+        ssize_t  res;
+    co_locals_end(co);
+
+    co_begin(co);
+    while(g_bench.acked < g_bench.samples)
+    {
+        co_io_read(co, &g_bench.f, &locals.value, sizeof(locals.value), locals.res);
+        if(locals.res != sizeof(locals.value))
+            co_exit(co);
+        record_sample();
+    }
+    co_end(co);
+}
+
+static void uring_reader(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        co_uring_op op;
+        uint64_t    value;
+    co_locals_end(co);
+
+    co_begin(co);
+    while(g_bench.acked < g_bench.samples)
+    {
+        co_uring_read(co, &g_bench.ring, &locals.op, g_bench.efd, &locals.value, sizeof(locals.value), (uint64_t)-1);
+        if(locals.op.res != sizeof(locals.value))
+            co_exit(co);
+        record_sample();
+    }
+    co_end(co);
+}
+
+static void report(const char* name)
+{
+    std::vector<uint64_t>& l = g_bench.latencies;
+    if(l.empty())
+    {
+        printf("%-18s failed\n", name);
+        return;
+    }
+    std::sort(l.begin(), l.end());
+    printf("%-18s p50 %8.2f us   p99 %8.2f us   max %9.2f us\n", name,
+           (double)l[l.size() / 2] / 1000.0,
+           (double)l[l.size() * 99 / 100] / 1000.0,
+           (double)l.back() / 1000.0);
+}
+
+enum bench_mode
+{
+    EPOLL_BLOCKING,
+    EPOLL_BUSY,
+    URING_BLOCKING,
+    URING_BUSY,
+    URING_SQPOLL_BUSY
+};
+
+static void run(const char* name, bench_mode mode, int reactor_cpu, int waker_cpu)
+{
+    g_bench.efd         = eventfd(0, EFD_CLOEXEC);
+    g_bench.acked       = 0;
+    g_bench.signal_time = 0;
+    g_bench.latencies.clear();
+    g_bench.latencies.reserve((size_t)g_bench.samples);
+
+    co_sched sched;
+    co_sched_init(&sched, 1024, nullptr);
+
+    co_io io;
+    bool epoll = mode == EPOLL_BLOCKING || mode == EPOLL_BUSY;
+    if(epoll)
+    {
+        co_io_init(&io);
+        co_io_add(&io, &g_bench.f, g_bench.efd);
+        co_sched_spawn(&sched, epoll_reader);
+    }
+    else
+    {
+        uint32_t flags = mode == URING_SQPOLL_BUSY ? IORING_SETUP_SQPOLL : 0;
+        if(!co_uring_init(&g_bench.ring, 64, flags))
+        {
+            printf("%-18s not supported (%s)\n", name, strerror(errno));
+            close(g_bench.efd);
+            return;
+        }
+        co_sched_spawn(&sched, uring_reader);
+    }
+
+    // the waker is started before pinning the reactor so it do not inherit its affinity.
+    std::thread t(waker, waker_cpu);
+    pin_thread(reactor_cpu);
+
+    switch(mode)
+    {
+        case EPOLL_BLOCKING:
+            while(co_sched_live(&sched) > 0)
+            {
+                co_sched_run(&sched);
+                if(co_sched_live(&sched) > 0)
+                    co_io_poll(&io, -1);
+            }
+            break;
+        case EPOLL_BUSY:
+            co_io_run_busy(&io, &sched, nullptr);
+            break;
+        case URING_BLOCKING:
+            while(co_sched_live(&sched) > 0)
+            {
+                co_sched_run(&sched);
+                if(co_sched_live(&sched) > 0)
+                    co_uring_poll(&g_bench.ring, true);
+            }
+            break;
+        case URING_BUSY:
+        case URING_SQPOLL_BUSY:
+            co_uring_run_busy(&g_bench.ring, &sched, nullptr);
+            break;
+    }
+
+    t.join();
+    pthread_setaffinity_np(pthread_self(), sizeof(g_main_affinity), &g_main_affinity);
+    report(name);
+
+    co_sched_destroy(&sched);
+    if(epoll)
+        co_io_destroy(&io);
+    else
+        co_uring_destroy(&g_bench.ring);
+    close(g_bench.efd);
+}
+
+int main(int argc, const char** argv)
+{
+    g_bench.samples = argc > 1 ? atoi(argv[1]) : 10000;
+    int reactor_cpu = argc > 2 ? atoi(argv[2]) : -1;
+    int waker_cpu   = argc > 3 ? atoi(argv[3]) : -1;
+    pthread_getaffinity_np(pthread_self(), sizeof(g_main_affinity), &g_main_affinity);
+
+    unsigned cpus = std::thread::hardware_concurrency();
+    printf("%d samples, %u cpus\n", g_bench.samples, cpus);
+    if(cpus < 2)
+        printf("WARNING: busy-polling with fewer than 2 cpus starves the waker, busy-results are meaningless.\n");
+
+    run("epoll blocking",     EPOLL_BLOCKING,    reactor_cpu, waker_cpu);
+    run("epoll busy",         EPOLL_BUSY,        reactor_cpu, waker_cpu);
+    run("io_uring blocking",  URING_BLOCKING,    reactor_cpu, waker_cpu);
+    run("io_uring busy",      URING_BUSY,        reactor_cpu, waker_cpu);
+    run("io_uring sqpoll",    URING_SQPOLL_BUSY, reactor_cpu, waker_cpu);
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("bench_busy_poll is linux-only\n");
+    return 0;
+}
+
+#endif
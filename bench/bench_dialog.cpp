@@ -0,0 +1,207 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    example/dialog_example.cpp scaled up to many concurrent dialogs, headless.
+
+    usage: bench_dialog [dialogs] [stack-size]
+
+    The same print_dialog()/print_line() coroutines as the example, print_dialog() co_call():s
+    print_line() for each line and both keep their state in locals, but each dialog is a
+    coroutine in a co_sched, the sleep between characters and lines is a co_timer_sleep() and
+    characters go to a sink that only counts them. Time is virtual, the host jumps straight
+    to the next timer, so this measures the overhead of running the scripts and not the
+    sleeps.
+
+    Runs 100000 dialogs by default, all of them live at the same time, on stacks of 512 bytes
+    that co_sched grows if needed. Prints characters/sec, seconds of dialog simulated per
+    second and memory per dialog, both as RSS and as the stack and task memory of the
+    scheduler. Lines starting with 'dialog,' are csv:
+
+    dialog,<dialogs>,<chars>,<sec>,<chars-per-sec>,<rss-bytes-per-dialog>,<sched-bytes-per-dialog>
+*/
+
+#if defined(__linux__)
+
+#include "../coro_timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <sys/resource.h>
+
+static const uint64_t MS = 1000000;
+
+static co_timer_wheel g_wheel;
+static uint64_t       g_chars;
+static uint32_t       g_rand = 1;
+
+static double now_sec()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// rand() from the example, but the same sequence on all platforms.
+static uint32_t dialog_rand()
+{
+    g_rand = g_rand * 1103515245u + 12345u;
+    return (g_rand >> 16) & 0x7fff;
+}
+
+static void print_char(char c)
+{
+    g_chars += (uint8_t)c != 0;
+}
+
+static void print_line(coro* co, void*, const char** args)
+{
+    const char* line = *args;
+
+    co_locals_begin(co);
+        int      curr_char = 8;
+        co_timer timer;
+    co_locals_end(co);
+
+    co_begin(co);
+    co_timer_init(&locals.timer);
+
+    for(int i = 0; i < 8; ++i)
+        print_char(line[i]);
+
+    while(line[locals.curr_char] != '\0')
+    {
+        print_char(line[locals.curr_char++]);
+        co_timer_sleep(co, &g_wheel, &locals.timer, (30 + dialog_rand() % 150) * MS);
+    }
+    print_char('\n');
+    co_end(co);
+}
+
+struct print_dialog_arg
+{
+    const char** lines;
+    size_t       line_cnt;
+};
+
+static void print_dialog(coro* co, void*, print_dialog_arg* args)
+{
+    co_locals_begin(co);
+        size_t   curr_line = 0;
+        co_timer timer;
+    co_locals_end(co);
+
+    co_begin(co);
+    co_timer_init(&locals.timer);
+
+    while(locals.curr_line != args->line_cnt)
+    {
+        co_call(co, (co_func)print_line, args->lines[locals.curr_line++]);
+        co_timer_sleep(co, &g_wheel, &locals.timer, (500 + dialog_rand() % 200) * MS);
+    }
+
+    co_end(co);
+}
+
+int main(int argc, const char** argv)
+{
+    uint32_t dialogs    = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+    int      stack_size = argc > 2 ? atoi(argv[2]) : 512;
+
+    static const char* LINES[] = {
+        "Bob     Yo alice. I heard you like mudkips.",
+        "Alice   No Bob. Not me. Who told you such a thing?",
+        "Bob     Alice please, don't lie to me. We've known each other a long time.",
+        "Alice   We have grown apart. I barely know myself.",
+        "Bob     OK.",
+        "Alice   Good bye Bob. I wish you the best.",
+        "Bob     But do you like mudkips?",
+        "Alice   <has left>",
+        "Bob     Well, I like mudkips :)"
+    };
+
+    print_dialog_arg dialog_args { LINES, sizeof(LINES) / sizeof(const char*) };
+
+    long rss_start = peak_rss_kb();
+
+    co_sched sched;
+    co_sched_init(&sched, stack_size, nullptr);
+    co_timer_wheel_init(&g_wheel, 1 * MS, 0);
+
+    double t0 = now_sec();
+    for(uint32_t i = 0; i < dialogs; ++i)
+        co_sched_spawn(&sched, (co_func)print_dialog, dialog_args);
+
+    uint64_t now = 0;
+    size_t   sched_bytes = 0;
+    co_sched_run(&sched);
+    while(co_sched_live(&sched) > 0)
+    {
+        if(sched_bytes == 0)
+            sched_bytes = sched.stack_bytes + (size_t)dialogs * sizeof(co_sched_task);
+        now += co_timer_next_ns(&g_wheel, now, 1000 * MS);
+        co_timer_advance(&g_wheel, now);
+        co_sched_run(&sched);
+    }
+    double sec = now_sec() - t0;
+
+    double rss_per_dialog   = (double)(peak_rss_kb() - rss_start) * 1024.0 / dialogs;
+    double sched_per_dialog = (double)sched_bytes / dialogs;
+    double chars_per_sec    = (double)g_chars / sec;
+
+    printf("dialogs             %u\n", dialogs);
+    printf("characters          %llu\n", (unsigned long long)g_chars);
+    printf("seconds             %.3f\n", sec);
+    printf("characters/sec      %.0f\n", chars_per_sec);
+    printf("simulated sec/sec   %.1f\n", (double)now / 1e9 / sec);
+    printf("rss per dialog      %.0f bytes\n", rss_per_dialog);
+    printf("sched per dialog    %.0f bytes (%d byte stacks, %llu grown)\n", sched_per_dialog, stack_size, (unsigned long long)sched.stack_grows);
+    printf("\ndialog,%u,%llu,%.3f,%.0f,%.0f,%.0f\n", dialogs, (unsigned long long)g_chars, sec, chars_per_sec, rss_per_dialog, sched_per_dialog);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("bench_dialog is linux-only\n");
+    return 0;
+}
+
+#endif
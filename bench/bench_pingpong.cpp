@@ -0,0 +1,408 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Round-trip latency of passing a message between two coroutines and back.
+
+    usage: bench_pingpong [round-trips] [cpu-ping] [cpu-pong]
+
+    A ping coroutine sends to a pong coroutine that replies, the time from send until the
+    reply is received is recorded for each round-trip. The scheduler has no channel types of
+    its own so the three usual shapes are built here the way systems on top of co_sched park
+    and wake coroutines, an atomic flag and the parked coroutine (co->call.root):
+
+    event       wakeup only, no payload, auto-reset.
+    channel     bounded spsc-ring, the sender only parks when the ring is full.
+    rendezvous  unbuffered, the sender parks until the receiver has taken the value.
+
+    Each is run with both coroutines in one co_sched, waking with co_sched_wake(), and with
+    one co_sched per thread, waking with co_sched_wake_remote(). The threads are pinned to
+    cpu-ping and cpu-pong (default 0 and 1) when there are enough cpus and busy-poll, when a
+    thread has nothing to run it only calls std::this_thread::yield(), so the cross-thread
+    numbers are the floor of the handoff and not the cost of sleeping in the kernel.
+
+    Prints mean and percentiles of the round-trip in ns, lines starting with 'pingpong,' are
+    csv:
+
+    pingpong,<primitive>,<same|cross>,<mean>,<p50>,<p90>,<p99>,<p999>,<max>
+*/
+
+#if defined(__linux__)
+
+#include "../coro_sched.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+
+static const int WARMUP     = 1000;
+static const int STACK_SIZE = 1024;
+
+static uint64_t now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void pin_thread(int cpu)
+{
+    if(cpu < 0 || cpu >= (int)std::thread::hardware_concurrency())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static bool             g_remote = false;
+static std::atomic<int> g_done;   ///< coroutines that have finished their round-trips.
+
+/**
+ * Flag with at most one parked waiter. The waiter publishes itself before re-checking the
+ * flag and the setter sets the flag before taking the waiter, so with seq_cst one of them
+ * always sees the other and no wakeup is lost. A late wake may hit a coroutine that already
+ * took the flag, all waits re-check their condition so that is only a spurious wake, and
+ * co_sched_wake_remote() ignores coroutines that are already ready.
+ */
+struct pp_signal
+{
+    std::atomic<uint32_t> set;
+    std::atomic<coro*>    waiter;
+};
+
+static void pp_signal_set(pp_signal* sig)
+{
+    sig->set.store(1);
+    coro* waiter = sig->waiter.exchange(nullptr);
+    if(waiter == nullptr)
+        return;
+    if(g_remote)
+        co_sched_wake_remote(waiter);
+    else
+        co_sched_wake(waiter);
+}
+
+/**
+ * Returns true if the flag was set, otherwise co is registered as waiter and need to co_wait().
+ */
+static bool pp_signal_take(coro* co, pp_signal* sig)
+{
+    if(sig->set.exchange(0) != 0)
+        return true;
+    sig->waiter.store(co->call.root);
+    if(sig->set.exchange(0) == 0)
+        return false;
+    coro* self = co->call.root;
+    sig->waiter.compare_exchange_strong(self, nullptr);
+    return true;
+}
+
+#define pp_signal_wait(co, sig) \
+    while(!pp_signal_take(co, sig)) co_wait(co)
+
+typedef pp_signal pp_event;
+
+#define pp_event_wait(co, ev) pp_signal_wait(co, ev)
+#define pp_event_set(ev)      pp_signal_set(ev)
+
+enum { PP_CHAN_CAP = 64 };
+
+struct pp_chan
+{
+    uint64_t              items[PP_CHAN_CAP];
+    std::atomic<uint32_t> head;   ///< written by receiver.
+    std::atomic<uint32_t> tail;   ///< written by sender.
+    pp_signal             not_empty;
+    pp_signal             not_full;
+};
+
+static bool pp_chan_try_send(pp_chan* ch, uint64_t v)
+{
+    uint32_t tail = ch->tail.load(std::memory_order_relaxed);
+    if(tail - ch->head.load(std::memory_order_acquire) == PP_CHAN_CAP)
+        return false;
+    ch->items[tail % PP_CHAN_CAP] = v;
+    ch->tail.store(tail + 1, std::memory_order_release);
+    pp_signal_set(&ch->not_empty);
+    return true;
+}
+
+static bool pp_chan_try_recv(pp_chan* ch, uint64_t* v)
+{
+    uint32_t head = ch->head.load(std::memory_order_relaxed);
+    if(head == ch->tail.load(std::memory_order_acquire))
+        return false;
+    *v = ch->items[head % PP_CHAN_CAP];
+    ch->head.store(head + 1, std::memory_order_release);
+    pp_signal_set(&ch->not_full);
+    return true;
+}
+
+#define pp_chan_send(co, ch, v) \
+    while(!pp_chan_try_send(ch, v)) { pp_signal_wait(co, &(ch)->not_full); }
+
+#define pp_chan_recv(co, ch, v) \
+    while(!pp_chan_try_recv(ch, &(v))) { pp_signal_wait(co, &(ch)->not_empty); }
+
+struct pp_rendezvous
+{
+    uint64_t  value;
+    pp_signal full;
+    pp_signal taken;
+};
+
+#define pp_rv_send(co, rv, v) \
+    do { (rv)->value = (v); pp_signal_set(&(rv)->full); pp_signal_wait(co, &(rv)->taken); } while(0)
+
+#define pp_rv_recv(co, rv, v) \
+    do { pp_signal_wait(co, &(rv)->full); (v) = (rv)->value; pp_signal_set(&(rv)->taken); } while(0)
+
+enum pp_kind
+{
+    PP_EVENT,
+    PP_CHANNEL,
+    PP_RENDEZVOUS,
+    PP_KIND_CNT
+};
+
+static const char* kind_names[] = { "event", "channel", "rendezvous" };
+
+struct pp_pair
+{
+    pp_kind               kind;
+    int                   round_trips;
+    pp_event              ev[2];    ///< [0] ping -> pong, [1] pong -> ping.
+    pp_chan               ch[2];
+    pp_rendezvous         rv[2];
+    std::vector<uint64_t> rtt;
+};
+
+static void pp_reset(pp_pair* p, pp_kind kind, int round_trips)
+{
+    p->kind        = kind;
+    p->round_trips = round_trips;
+    for(int i = 0; i < 2; ++i)
+    {
+        pp_signal* sigs[] = { &p->ev[i], &p->ch[i].not_empty, &p->ch[i].not_full, &p->rv[i].full, &p->rv[i].taken };
+        for(pp_signal* sig : sigs)
+        {
+            sig->set.store(0);
+            sig->waiter.store(nullptr);
+        }
+        p->ch[i].head.store(0);
+        p->ch[i].tail.store(0);
+    }
+    p->rtt.clear();
+    p->rtt.reserve((size_t)round_trips);
+    g_done.store(0);
+}
+
+/**
+ * The other side may still be about to wake this coroutine with a stale waiter, so neither
+ * coroutine completes, and neither scheduler is destroyed, until both are done signalling.
+ */
+#define pp_join(co)                  \
+    g_done.fetch_add(1);             \
+    while(g_done.load() < 2)         \
+        co_yield(co)
+
+static void ping(coro* co, void*, pp_pair** arg)
+{
+    pp_pair* p = *arg;
+
+    co_locals_begin(co);
+        int      i;
+        uint64_t start;
+        uint64_t value;
+    co_locals_end(co);
+
+    co_begin(co);
+    for(locals.i = 0; locals.i < p->round_trips + WARMUP; ++locals.i)
+    {
+        locals.start = now_ns();
+        if(p->kind == PP_EVENT)
+        {
+            pp_event_set(&p->ev[0]);
+            pp_event_wait(co, &p->ev[1]);
+        }
+        else if(p->kind == PP_CHANNEL)
+        {
+            pp_chan_send(co, &p->ch[0], (uint64_t)locals.i);
+            pp_chan_recv(co, &p->ch[1], locals.value);
+        }
+        else
+        {
+            pp_rv_send(co, &p->rv[0], (uint64_t)locals.i);
+            pp_rv_recv(co, &p->rv[1], locals.value);
+        }
+        if(locals.i >= WARMUP)
+            p->rtt.push_back(now_ns() - locals.start);
+    }
+    pp_join(co);
+    co_end(co);
+}
+
+static void pong(coro* co, void*, pp_pair** arg)
+{
+    pp_pair* p = *arg;
+
+    co_locals_begin(co);
+        int      i;
+        uint64_t value;
+    co_locals_end(co);
+
+    co_begin(co);
+    for(locals.i = 0; locals.i < p->round_trips + WARMUP; ++locals.i)
+    {
+        if(p->kind == PP_EVENT)
+        {
+            pp_event_wait(co, &p->ev[0]);
+            pp_event_set(&p->ev[1]);
+        }
+        else if(p->kind == PP_CHANNEL)
+        {
+            pp_chan_recv(co, &p->ch[0], locals.value);
+            pp_chan_send(co, &p->ch[1], locals.value);
+        }
+        else
+        {
+            pp_rv_recv(co, &p->rv[0], locals.value);
+            pp_rv_send(co, &p->rv[1], locals.value);
+        }
+    }
+    pp_join(co);
+    co_end(co);
+}
+
+static void run_same(pp_pair* p)
+{
+    g_remote = false;
+    co_sched sched;
+    co_sched_init(&sched, STACK_SIZE, nullptr);
+    co_sched_spawn(&sched, (co_func)ping, p);
+    co_sched_spawn(&sched, (co_func)pong, p);
+    co_sched_run(&sched);
+    if(co_sched_live(&sched) != 0)
+    {
+        fprintf(stderr, "%s deadlocked on one thread!\n", kind_names[p->kind]);
+        abort();
+    }
+    co_sched_destroy(&sched);
+}
+
+static void run_thread(pp_pair* p, co_func func, int cpu)
+{
+    pin_thread(cpu);
+    co_sched sched;
+    co_sched_init(&sched, STACK_SIZE, nullptr);
+    co_sched_spawn(&sched, func, p);
+    while(co_sched_live(&sched) > 0)
+    {
+        if(co_sched_step(&sched) == 0)
+            std::this_thread::yield();
+    }
+    co_sched_destroy(&sched);
+}
+
+static void run_cross(pp_pair* p, int cpu_ping, int cpu_pong)
+{
+    g_remote = true;
+    std::thread pong_thread(run_thread, p, (co_func)pong, cpu_pong);
+    run_thread(p, (co_func)ping, cpu_ping);
+    pong_thread.join();
+}
+
+int main(int argc, const char** argv)
+{
+    int round_trips = argc > 1 ? atoi(argv[1]) : 100000;
+    int cpu_ping    = argc > 2 ? atoi(argv[2]) : 0;
+    int cpu_pong    = argc > 3 ? atoi(argv[3]) : 1;
+    if(round_trips < 1)
+        round_trips = 1;
+    if(std::thread::hardware_concurrency() < 2)
+        printf("only one cpu, cross-thread numbers include context switches\n\n");
+
+    // pp_pair holds atomics and is only ever referenced, spawn passes a pointer to it.
+    pp_pair* p = new pp_pair;
+
+    printf("%-11s %-6s %9s %9s %9s %9s %9s %10s\n", "primitive", "thread", "mean", "p50", "p90", "p99", "p99.9", "max");
+    std::vector<char> csv;
+    for(int kind = 0; kind < PP_KIND_CNT; ++kind)
+    {
+        for(int cross = 0; cross < 2; ++cross)
+        {
+            pp_reset(p, (pp_kind)kind, round_trips);
+            if(cross)
+                run_cross(p, cpu_ping, cpu_pong);
+            else
+                run_same(p);
+
+            std::vector<uint64_t>& rtt = p->rtt;
+            double sum = 0.0;
+            for(uint64_t v : rtt)
+                sum += (double)v;
+            std::sort(rtt.begin(), rtt.end());
+            double   mean = sum / (double)rtt.size();
+            uint64_t p50  = rtt[rtt.size() / 2];
+            uint64_t p90  = rtt[rtt.size() * 90 / 100];
+            uint64_t p99  = rtt[rtt.size() * 99 / 100];
+            uint64_t p999 = rtt[rtt.size() * 999 / 1000];
+            const char* where = cross ? "cross" : "same";
+
+            printf("%-11s %-6s %9.0f %9llu %9llu %9llu %9llu %10llu\n", kind_names[kind], where, mean,
+                   (unsigned long long)p50, (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)p999, (unsigned long long)rtt.back());
+
+            char line[160];
+            int len = snprintf(line, sizeof(line), "pingpong,%s,%s,%.0f,%llu,%llu,%llu,%llu,%llu\n", kind_names[kind], where, mean,
+                               (unsigned long long)p50, (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)p999, (unsigned long long)rtt.back());
+            csv.insert(csv.end(), line, line + len);
+        }
+    }
+
+    printf("\n");
+    fwrite(csv.data(), 1, csv.size(), stdout);
+    delete p;
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("bench_pingpong is linux-only\n");
+    return 0;
+}
+
+#endif
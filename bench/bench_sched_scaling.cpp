@@ -0,0 +1,441 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Scaling of coroutine workloads over 1..N worker threads.
+
+    usage: bench_sched_scaling [max-threads] [jobs]
+
+    Each worker thread runs its own co_sched, coroutines are bound to the scheduler they were
+    spawned on. Three mixes are run at 1, 2, 4 ... max-threads workers:
+
+    cpu      jobs doing compute in slices, yielding between slices.
+    yield    jobs only yielding, measures the cost of the scheduler itself.
+    message  rings of coroutines spread over all workers passing tokens, every hop to a
+             coroutine on another worker is a cross-thread wake with co_sched_wake_remote().
+
+    Jobs for cpu and yield are all queued on worker 0, like an acceptor-thread would, and
+    the other workers steal batches of jobs when they have free capacity.
+
+    For each mix and thread-count ops/sec, stolen jobs/sec and efficiency, ops/sec divided by
+    threads * ops/sec of 1 thread, is printed. Lines starting with 'scaling,' are csv for
+    tracking the curve over time:
+
+    scaling,<mix>,<threads>,<ops/sec>,<steals/sec>,<efficiency>
+
+    Workers are pinned to cpu 0..threads-1 when there are enough cpus.
+*/
+
+#if defined(__linux__)
+
+#include "../coro_sched.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+static const uint32_t JOB_INFLIGHT  = 64;   // coroutines kept alive per worker.
+static const int      CPU_SLICES    = 8;
+static const int      CPU_WORK      = 2000; // iterations per slice.
+static const int      YIELDS        = 64;
+static const uint32_t RING_PER_WORKER   = 64;
+static const uint32_t TOKENS_PER_WORKER = 8;
+
+static double now_sec()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void pin_thread(int cpu)
+{
+    if(cpu < 0 || cpu >= (int)std::thread::hardware_concurrency())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+struct worker
+{
+    int               id;
+    co_sched          sched;
+    std::mutex        lock;
+    std::deque<co_func> jobs;
+    uint32_t          rng;
+
+    // only written by the worker, read after it has been joined.
+    uint64_t          ops;
+    uint64_t          stolen;
+};
+
+/**
+ * Member of a token-ring, tokens are passed from member i to member i + 1 that is on the
+ * next worker.
+ */
+struct ring_member
+{
+    std::atomic<uint32_t> tokens;
+    std::atomic<uint32_t> parked;  ///< 1 while the member is, or is about to be, parked.
+    coro*                 co;
+    worker*               owner;
+    uint32_t              index;
+};
+
+struct bench
+{
+    std::vector<worker*>      workers;
+    std::atomic<int64_t>      jobs_left;
+    std::atomic<int64_t>      hops_left;
+    std::atomic<bool>         start;
+    std::atomic<bool>         done;
+    std::vector<ring_member*> ring;
+};
+
+static bench g_bench;
+
+static std::atomic<uint32_t> g_sink;
+
+static void burn(int iterations)
+{
+    uint32_t x = 2463534242u;
+    for(int i = 0; i < iterations; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    g_sink.store(x, std::memory_order_relaxed);
+}
+
+static void job_done()
+{
+    if(g_bench.jobs_left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        g_bench.done.store(true, std::memory_order_release);
+}
+
+static void cpu_job(coro* co, void* userdata, void*)
+{
+    co_locals_begin(co);
+        int slice = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+    for(; locals.slice < CPU_SLICES; ++locals.slice)
+    {
+        burn(CPU_WORK);
+        ++((worker*)userdata)->ops;
+        co_yield(co);
+    }
+    job_done();
+    co_end(co);
+}
+
+static void yield_job(coro* co, void* userdata, void*)
+{
+    co_locals_begin(co);
+        int i = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+    for(; locals.i < YIELDS; ++locals.i)
+    {
+        ++((worker*)userdata)->ops;
+        co_yield(co);
+    }
+    job_done();
+    co_end(co);
+}
+
+/**
+ * Take a token or return false if the member need to co_wait() for one. A sender that sees
+ * parked == 1 clears it and wakes the member, if the member clears it first no wake is sent.
+ */
+static bool ring_take(ring_member* m)
+{
+    if(m->tokens.load(std::memory_order_acquire) == 0)
+    {
+        m->parked.store(1, std::memory_order_seq_cst);
+        if(m->tokens.load(std::memory_order_seq_cst) == 0)
+            return false;
+        if(m->parked.exchange(0, std::memory_order_seq_cst) == 0)
+            return false; // a sender already claimed the wake, wait for it to arrive.
+    }
+    m->tokens.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+static void ring_give(worker* self, ring_member* m)
+{
+    m->tokens.fetch_add(1, std::memory_order_seq_cst);
+    if(m->parked.exchange(0, std::memory_order_seq_cst) == 1)
+    {
+        if(m->owner == self)
+            co_sched_wake(m->co);
+        else
+            co_sched_wake_remote(m->co);
+    }
+}
+
+static void ring_job(coro* co, void* userdata, void* arg)
+{
+    worker*      self = (worker*)userdata;
+    ring_member* m    = g_bench.ring[*(uint32_t*)arg];
+
+    co_begin(co);
+    while(!g_bench.done.load(std::memory_order_acquire))
+    {
+        if(!ring_take(m))
+        {
+            co_wait(co);
+            continue;
+        }
+        ring_give(self, g_bench.ring[(m->index + 1) % g_bench.ring.size()]);
+        ++self->ops;
+        if(g_bench.hops_left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            g_bench.done.store(true, std::memory_order_release);
+    }
+    co_end(co);
+}
+
+static bool pop_own(worker* w, co_func* job)
+{
+    std::lock_guard<std::mutex> guard(w->lock);
+    if(w->jobs.empty())
+        return false;
+    *job = w->jobs.front();
+    w->jobs.pop_front();
+    return true;
+}
+
+/**
+ * Steal half of the queue of a random victim, at most 32 jobs. One job is returned and the
+ * rest put in the own queue.
+ */
+static bool steal(worker* w, co_func* job)
+{
+    size_t cnt = g_bench.workers.size();
+    if(cnt == 1)
+        return false;
+    w->rng = w->rng * 1664525u + 1013904223u;
+    size_t first = (w->rng >> 8) % cnt;
+    for(size_t i = 0; i < cnt; ++i)
+    {
+        worker* victim = g_bench.workers[(first + i) % cnt];
+        if(victim == w)
+            continue;
+
+        co_func batch[32];
+        size_t  taken = 0;
+        {
+            std::lock_guard<std::mutex> guard(victim->lock);
+            size_t n = (victim->jobs.size() + 1) / 2;
+            if(n > 32)
+                n = 32;
+            for(; taken < n; ++taken)
+            {
+                batch[taken] = victim->jobs.back();
+                victim->jobs.pop_back();
+            }
+        }
+        if(taken == 0)
+            continue;
+
+        w->stolen += taken;
+        *job = batch[0];
+        if(taken > 1)
+        {
+            std::lock_guard<std::mutex> guard(w->lock);
+            for(size_t j = 1; j < taken; ++j)
+                w->jobs.push_back(batch[j]);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void worker_main(worker* w)
+{
+    pin_thread(w->id);
+    while(!g_bench.start.load(std::memory_order_acquire)) {}
+
+    while(!g_bench.done.load(std::memory_order_acquire))
+    {
+        co_func job;
+        while(co_sched_live(&w->sched) < JOB_INFLIGHT && (pop_own(w, &job) || steal(w, &job)))
+            co_sched_spawn(&w->sched, job);
+
+        if(co_sched_step(&w->sched) == 0)
+            sched_yield();
+    }
+
+    // wake members still parked so they see done and complete, remote wakes sent to this
+    // worker before done will arrive through its inbox.
+    for(ring_member* m : g_bench.ring)
+        if(m->owner == w && m->parked.exchange(0) == 1)
+            co_sched_wake(m->co);
+    while(co_sched_live(&w->sched) > 0)
+        if(co_sched_step(&w->sched) == 0)
+            sched_yield();
+}
+
+enum bench_mix { MIX_CPU, MIX_YIELD, MIX_MESSAGE };
+
+struct bench_result
+{
+    double ops_per_sec;
+    double steals_per_sec;
+};
+
+static bench_result run(bench_mix mix, int threads, int jobs)
+{
+    g_bench.workers.clear();
+    g_bench.ring.clear();
+    g_bench.start.store(false);
+    g_bench.done.store(false);
+    g_bench.jobs_left.store(jobs);
+    g_bench.hops_left.store((int64_t)jobs * 16);
+
+    for(int i = 0; i < threads; ++i)
+    {
+        worker* w = new worker;
+        w->id     = i;
+        w->rng    = (uint32_t)i * 7919u + 1;
+        w->ops    = 0;
+        w->stolen = 0;
+        co_sched_init(&w->sched, 512, w);
+        g_bench.workers.push_back(w);
+    }
+
+    if(mix == MIX_MESSAGE)
+    {
+        // member i is on worker i % threads so every hop crosses to another worker when
+        // threads > 1. Spawned before the workers start so spawning from here is safe.
+        uint32_t ring_size = RING_PER_WORKER * (uint32_t)threads;
+        for(uint32_t i = 0; i < ring_size; ++i)
+        {
+            ring_member* m = new ring_member;
+            m->tokens.store(i % (RING_PER_WORKER / TOKENS_PER_WORKER) == 0 ? 1 : 0);
+            m->parked.store(0);
+            m->owner = g_bench.workers[i % (uint32_t)threads];
+            m->index = i;
+            g_bench.ring.push_back(m);
+        }
+        for(uint32_t i = 0; i < ring_size; ++i)
+            g_bench.ring[i]->co = co_sched_spawn(&g_bench.ring[i]->owner->sched, ring_job, i);
+    }
+    else
+    {
+        co_func job = mix == MIX_CPU ? cpu_job : yield_job;
+        for(int i = 0; i < jobs; ++i)
+            g_bench.workers[0]->jobs.push_back(job);
+    }
+
+    std::vector<std::thread> ts;
+    for(int i = 0; i < threads; ++i)
+        ts.push_back(std::thread(worker_main, g_bench.workers[(size_t)i]));
+
+    double start = now_sec();
+    g_bench.start.store(true, std::memory_order_release);
+    for(std::thread& t : ts)
+        t.join();
+    double elapsed = now_sec() - start;
+
+    uint64_t ops = 0, stolen = 0;
+    for(worker* w : g_bench.workers)
+    {
+        ops    += w->ops;
+        stolen += w->stolen;
+        co_sched_destroy(&w->sched);
+        delete w;
+    }
+    for(ring_member* m : g_bench.ring)
+        delete m;
+
+    bench_result res;
+    res.ops_per_sec    = (double)ops / elapsed;
+    res.steals_per_sec = (double)stolen / elapsed;
+    return res;
+}
+
+int main(int argc, const char** argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+    int jobs        = argc > 2 ? atoi(argv[2]) : 50000;
+    if(max_threads < 1)
+        max_threads = 1;
+
+    std::vector<int> counts;
+    for(int t = 1; t < max_threads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(max_threads);
+
+    static const char* names[] = { "cpu", "yield", "message" };
+
+    printf("%-8s %8s %14s %14s %11s\n", "mix", "threads", "ops/sec", "steals/sec", "efficiency");
+    std::vector<char> csv;
+    for(int mix = MIX_CPU; mix <= MIX_MESSAGE; ++mix)
+    {
+        double base = 0.0;
+        for(int threads : counts)
+        {
+            bench_result res = run((bench_mix)mix, threads, jobs);
+            if(threads == 1)
+                base = res.ops_per_sec;
+            double efficiency = base > 0.0 ? res.ops_per_sec / (base * threads) : 0.0;
+            printf("%-8s %8d %14.0f %14.0f %11.2f\n", names[mix], threads, res.ops_per_sec, res.steals_per_sec, efficiency);
+
+            char line[128];
+            int len = snprintf(line, sizeof(line), "scaling,%s,%d,%.0f,%.0f,%.3f\n", names[mix], threads, res.ops_per_sec, res.steals_per_sec, efficiency);
+            csv.insert(csv.end(), line, line + len);
+        }
+    }
+    printf("\n");
+    fwrite(csv.data(), 1, csv.size(), stdout);
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("bench_sched_scaling is linux-only\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Benchmark of co_split over a memory-mapped file.
+
+    usage: bench_split [file] [delim]
+
+    If no file is given a file of 256MB of log-like lines is generated, split and removed.
+    Reports GB/s for the different delimiter-search implementations and for pulling
+    records via co_split_next() and via the co_split_gen() coroutine.
+*/
+
+#include "../coro_split.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+static double now_sec()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool generate_file(const char* path, size_t size)
+{
+    FILE* f = fopen(path, "wb");
+    if(f == nullptr)
+        return false;
+
+    static const char* WORDS[] = { "INFO ", "WARN ", "request ", "id=1234 ", "took ", "17ms ", "user=bob ", "GET /index.html " };
+    char   line[512];
+    size_t written = 0;
+    srand(1337);
+    while(written < size)
+    {
+        size_t len = 0;
+        int words = 2 + rand() % 20;
+        for(int w = 0; w < words; ++w)
+        {
+            const char* word = WORDS[rand() % (int)(sizeof(WORDS) / sizeof(WORDS[0]))];
+            size_t wlen = strlen(word);
+            memcpy(line + len, word, wlen);
+            len += wlen;
+        }
+        line[len++] = '\n';
+        fwrite(line, 1, len, f);
+        written += len;
+    }
+    fclose(f);
+    return true;
+}
+
+typedef const char* (*find_func)(const char*, const char*, char);
+
+static void bench_find(const char* name, find_func find, co_split_source* src)
+{
+    double start = now_sec();
+    size_t records = 0;
+    const char* p   = src->data;
+    const char* end = src->data + src->size;
+    while(p < end)
+    {
+        p = find(p, end, src->delim) + 1;
+        ++records;
+    }
+    double t = now_sec() - start;
+    printf("%-22s %8.2f GB/s %12zu records\n", name, (double)src->size / t / 1e9, records);
+}
+
+int main(int argc, const char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "bench_split.txt";
+    char delim = argc > 2 ? argv[2][0] : '\n';
+
+    if(argc <= 1 && !generate_file(path, 256 * 1024 * 1024))
+    {
+        fprintf(stderr, "failed to generate %s\n", path);
+        return 1;
+    }
+
+    co_split_source src;
+    if(!co_split_open(&src, path, delim))
+    {
+        fprintf(stderr, "failed to open %s\n", path);
+        return 1;
+    }
+
+    printf("%s, %.1f MB\n", path, (double)src.size / (1024.0 * 1024.0));
+
+    // touch all pages once so all runs see a warm page-cache.
+    bench_find("scalar (cold)", _co_split_find_scalar, &src);
+    bench_find("scalar", _co_split_find_scalar, &src);
+#if CORO_SPLIT_SIMD >= 1
+    bench_find("sse2", _co_split_find_sse2, &src);
+#endif
+#if CORO_SPLIT_SIMD >= 2
+    if(_co_split_has_avx2())
+        bench_find("avx2", _co_split_find_avx2, &src);
+#endif
+
+    {
+        src.pos = 0;
+        double start = now_sec();
+        size_t bytes = 0;
+        co_split_record rec;
+        while(co_split_next(&src, &rec))
+            bytes += rec.len;
+        double t = now_sec() - start;
+        printf("%-22s %8.2f GB/s %12zu record-bytes\n", "co_split_next", (double)src.size / t / 1e9, bytes);
+    }
+
+    {
+        src.pos = 0;
+        co_split_source* src_ptr = &src;
+        uint8_t stack[256];
+        coro co;
+        co_init(&co, stack, sizeof(stack), co_split_gen, src_ptr);
+
+        double start = now_sec();
+        size_t bytes = 0;
+        co_split_record rec;
+        while(co_gen_next(&co, &rec))
+            bytes += rec.len;
+        double t = now_sec() - start;
+        printf("%-22s %8.2f GB/s %12zu record-bytes\n", "co_split_gen", (double)src.size / t / 1e9, bytes);
+    }
+
+    co_split_close(&src);
+
+    if(argc <= 1)
+        remove(path);
+    return 0;
+}
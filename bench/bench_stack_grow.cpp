@@ -0,0 +1,297 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Cost of growing coroutine stacks with different strategies.
+
+    usage: bench_stack_grow [coroutines]
+
+    Coroutines run a recursive co_call() workload on a stack that is too small for it. When
+    the stack overflows the coroutine yields with co_stack_overflowed() set and the host picks
+    a new size, moves the stack with co_replace_stack() and resumes, the strategies differ in
+    how the new size is picked:
+
+    double     2x the old size, what co_sched does.
+    x4         4x the old size, fewer overflows but more unused memory.
+    linear     old size + 1KB.
+    learned    like double but new coroutines start at the largest stack any completed
+               coroutine needed, i.e. the default stack size picked from data at runtime.
+    vm         no growth, each stack is a 1MB mmap() reservation that the OS commits page
+               by page as it is touched. Never copies but costs syscalls and a page per stack.
+
+    Segmented stacks or copying frames out to the heap is not possible as locals and
+    arguments are addressed directly in the stack.
+
+    Workloads, the depth of the recursion in frames of ~100 bytes:
+
+    shallow    4 - 8 frames, fits after one or two overflows.
+    deep       64 frames.
+    mixed      90% 4 frames and 10% 200 frames, a long tail.
+
+    Coroutines start on 256 byte stacks and run in 10 waves, all coroutines of a wave are
+    suspended at the bottom of their recursion at the same time. Every strategy/workload is
+    run in its own process to get its peak RSS. Prints total time, bytes copied by
+    co_replace_stack(), number of overflows and peak RSS above the start of the process.
+    Lines starting with 'stackgrow,' are csv:
+
+    stackgrow,<strategy>,<workload>,<ms>,<bytes-copied>,<overflows>,<peak-rss-kb>
+*/
+
+#if defined(__linux__)
+
+#include "../coro.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const int    INITIAL_STACK = 256;
+static const int    WAVES         = 10;
+static const size_t VM_RESERVE    = 1024 * 1024;
+
+enum grow_strategy
+{
+    GROW_DOUBLE,
+    GROW_X4,
+    GROW_LINEAR,
+    GROW_LEARNED,
+    GROW_VM,
+    GROW_CNT
+};
+
+enum grow_workload
+{
+    WORK_SHALLOW,
+    WORK_DEEP,
+    WORK_MIXED,
+    WORK_CNT
+};
+
+static const char* strategy_names[] = { "double", "x4", "linear", "learned", "vm" };
+static const char* workload_names[] = { "shallow", "deep", "mixed" };
+
+static double now_sec()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static volatile uint8_t g_sink;
+
+static void recurse(coro* co, void*, int* depth)
+{
+    co_locals_begin(co);
+        uint8_t pad[64];
+        int     next;
+    co_locals_end(co);
+
+    co_begin(co);
+    locals.pad[0] = (uint8_t)*depth;
+    locals.next   = *depth - 1;
+    if(locals.next > 0)
+        co_call(co, (co_func)recurse, locals.next);
+    else
+        co_yield(co); // all coroutines of the wave are at the bottom here.
+    g_sink = locals.pad[0];
+    co_end(co);
+}
+
+static int depth_of(grow_workload work, uint32_t i)
+{
+    switch(work)
+    {
+        case WORK_SHALLOW: return 4 + (int)(i % 5);
+        case WORK_DEEP:    return 64;
+        default:           return i % 10 == 0 ? 200 : 4;
+    }
+}
+
+struct grow_result
+{
+    double   ms;
+    uint64_t bytes_copied;
+    uint64_t overflows;
+    long     peak_rss_kb;
+};
+
+static void* stack_alloc(grow_strategy strategy, int size)
+{
+    if(strategy != GROW_VM)
+        return malloc((size_t)size);
+    void* mem = mmap(nullptr, VM_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return mem == MAP_FAILED ? nullptr : mem;
+}
+
+static void stack_free(grow_strategy strategy, void* stack)
+{
+    if(strategy != GROW_VM)
+        free(stack);
+    else
+        munmap(stack, VM_RESERVE);
+}
+
+static grow_result run(grow_strategy strategy, grow_workload work, uint32_t cnt)
+{
+    grow_result res = { 0.0, 0, 0, 0 };
+    long rss_start = peak_rss_kb();
+
+    uint32_t          wave_size = (cnt + WAVES - 1) / WAVES;
+    std::vector<coro> cos(wave_size);
+    int               learned = INITIAL_STACK;
+
+    double t0 = now_sec();
+    for(uint32_t first = 0; first < cnt; first += wave_size)
+    {
+        uint32_t n = cnt - first < wave_size ? cnt - first : wave_size;
+        for(uint32_t i = 0; i < n; ++i)
+        {
+            int size  = strategy == GROW_VM ? (int)VM_RESERVE : strategy == GROW_LEARNED ? learned : INITIAL_STACK;
+            int depth = depth_of(work, first + i);
+            co_init(&cos[i], stack_alloc(strategy, size), size, (co_func)recurse, depth);
+        }
+
+        uint32_t live = n;
+        while(live > 0)
+        {
+            for(uint32_t i = 0; i < n; ++i)
+            {
+                coro* co = &cos[i];
+                if(co_completed(co))
+                    continue;
+                co_resume(co, nullptr);
+                if(co_stack_overflowed(co))
+                {
+                    int new_size;
+                    switch(strategy)
+                    {
+                        case GROW_X4:     new_size = co->stack_size * 4;    break;
+                        case GROW_LINEAR: new_size = co->stack_size + 1024; break;
+                        default:          new_size = co->stack_size * 2;    break;
+                    }
+                    ++res.overflows;
+                    res.bytes_copied += (uint64_t)co_stack_usage(co);
+                    stack_free(strategy, co_replace_stack(co, stack_alloc(strategy, new_size), new_size));
+                }
+                else if(co_completed(co))
+                {
+                    if(co->stack_size > learned)
+                        learned = co->stack_size;
+                    stack_free(strategy, co->stack);
+                    --live;
+                }
+            }
+        }
+    }
+    res.ms          = (now_sec() - t0) * 1000.0;
+    res.peak_rss_kb = peak_rss_kb() - rss_start;
+    return res;
+}
+
+/**
+ * Run in a child process so that the peak RSS is not shared between runs.
+ */
+static bool run_isolated(grow_strategy strategy, grow_workload work, uint32_t cnt, grow_result* res)
+{
+    int fds[2];
+    if(pipe(fds) != 0)
+        return false;
+
+    pid_t pid = fork();
+    if(pid < 0)
+        return false;
+    if(pid == 0)
+    {
+        close(fds[0]);
+        grow_result r = run(strategy, work, cnt);
+        ssize_t written = write(fds[1], &r, sizeof(r));
+        _exit(written == (ssize_t)sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return got == (ssize_t)sizeof(*res) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, const char** argv)
+{
+    uint32_t cnt = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("%-8s %-8s %10s %14s %11s %12s\n", "strategy", "workload", "ms", "bytes-copied", "overflows", "peak-rss-kb");
+    std::vector<char> csv;
+    for(int work = 0; work < WORK_CNT; ++work)
+    {
+        for(int strategy = 0; strategy < GROW_CNT; ++strategy)
+        {
+            grow_result res;
+            if(!run_isolated((grow_strategy)strategy, (grow_workload)work, cnt, &res))
+            {
+                printf("%-8s %-8s %10s\n", strategy_names[strategy], workload_names[work], "failed");
+                continue;
+            }
+            printf("%-8s %-8s %10.1f %14llu %11llu %12ld\n", strategy_names[strategy], workload_names[work], res.ms,
+                   (unsigned long long)res.bytes_copied, (unsigned long long)res.overflows, res.peak_rss_kb);
+
+            char line[128];
+            int len = snprintf(line, sizeof(line), "stackgrow,%s,%s,%.1f,%llu,%llu,%ld\n", strategy_names[strategy], workload_names[work], res.ms,
+                               (unsigned long long)res.bytes_copied, (unsigned long long)res.overflows, res.peak_rss_kb);
+            csv.insert(csv.end(), line, line + len);
+        }
+    }
+
+    printf("\n");
+    fflush(stdout);
+    fwrite(csv.data(), 1, csv.size(), stdout);
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("bench_stack_grow is linux-only\n");
+    return 0;
+}
+
+#endif
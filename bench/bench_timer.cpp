@@ -0,0 +1,420 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Cost and accuracy of timers, coro_timer.h against polling deadlines per coroutine.
+
+    usage: bench_timer [max-timers]
+
+    The poll is what example/dialog_example.cpp does to sleep, every sleeping coroutine keeps
+    its own deadline and the host checks all of them each time it runs. That costs nothing to
+    start or cancel but every host tick scans all sleepers, the wheel pays a little on start
+    and on expiry instead.
+
+    Timers:
+    10^3 .. max-timers (default 10^6) timers are started, some cancelled and the rest expired
+    by advancing a virtual clock in host ticks of 1ms with a jitter of +-0.5ms, as a host loop
+    blocking in epoll_wait() with a timeout would. The wheel has a resolution of 100us.
+    Deadlines are distributed as:
+
+    uniform    1ms - 10s.
+    bimodal    90% 1 - 20ms, like retransmits or frame-waits, 10% 20 - 60s, like idle-timeouts.
+    cancel     1 - 5s and 90% of the timers are cancelled before they expire, like timeouts
+               on requests that mostly succeed.
+
+    For each implementation, distribution and count ns per start, cancel and expiry is printed,
+    expiry includes the cost of all host ticks, together with how late timers were seen by the
+    host (p50, p99, max) and bytes of memory per timer. The poll is skipped when it would do
+    more than 2*10^9 deadline checks.
+
+    Sleeps:
+    1000 - 100000 coroutines in a co_sched sleeping 8 times each for 1 - 50ms, with
+    co_timer_sleep() or with co_wait() and a deadline that the host loop polls. Prints ns of
+    host time per sleep.
+
+    Lines starting with 'timer,' and 'sleep,' are csv:
+
+    timer,<impl>,<dist>,<count>,<start-ns>,<cancel-ns>,<expire-ns>,<late-p50-us>,<late-p99-us>,<late-max-us>,<bytes-per-timer>
+    sleep,<impl>,<coroutines>,<ns-per-sleep>
+*/
+
+#include "../coro_timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static const uint64_t MS          = 1000000;
+static const uint64_t HOST_TICK   = 1 * MS;
+static const uint64_t WHEEL_TICK  = 100000; // finer than the host, timers are only late by the host tick.
+static const uint64_t POLL_BUDGET = 2000000000ull;
+
+enum bench_dist
+{
+    DIST_UNIFORM,
+    DIST_BIMODAL,
+    DIST_CANCEL
+};
+
+static const char* dist_names[] = { "uniform", "bimodal", "cancel" };
+
+static double now_sec()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t bench_rand(uint64_t* state)
+{
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (*state * 2685821657736338717ull) >> 11;
+}
+
+static uint64_t bench_range(uint64_t* state, uint64_t lo, uint64_t hi)
+{
+    return lo + bench_rand(state) % (hi - lo);
+}
+
+struct bench_workload
+{
+    std::vector<uint64_t> deadline;
+    std::vector<uint32_t> cancel;   ///< index of timers to cancel, in random order.
+    uint64_t              horizon;
+};
+
+static void make_workload(bench_workload* w, bench_dist dist, uint32_t cnt)
+{
+    uint64_t seed = 0x9e3779b97f4a7c15ull ^ cnt ^ ((uint64_t)dist << 32);
+    w->deadline.resize(cnt);
+    w->cancel.clear();
+    w->horizon = 0;
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        uint64_t d;
+        switch(dist)
+        {
+            case DIST_UNIFORM: d = bench_range(&seed, 1 * MS, 10000 * MS); break;
+            case DIST_BIMODAL: d = bench_rand(&seed) % 10 != 0 ? bench_range(&seed, 1 * MS, 20 * MS) : bench_range(&seed, 20000 * MS, 60000 * MS); break;
+            default:           d = bench_range(&seed, 1000 * MS, 5000 * MS); break;
+        }
+        w->deadline[i] = d;
+        w->horizon = std::max(w->horizon, d);
+        if(dist == DIST_CANCEL && bench_rand(&seed) % 10 != 0)
+            w->cancel.push_back(i);
+    }
+    for(size_t i = w->cancel.size(); i > 1; --i)
+        std::swap(w->cancel[i - 1], w->cancel[bench_rand(&seed) % i]);
+    w->horizon += 2 * HOST_TICK;
+}
+
+struct bench_result
+{
+    double   start_ns;
+    double   cancel_ns;
+    double   expire_ns;
+    double   late_p50_us;
+    double   late_p99_us;
+    double   late_max_us;
+    double   bytes_per_timer;
+    uint64_t expired;
+};
+
+static uint64_t              g_host_now;
+static const bench_workload* g_workload;
+static std::vector<uint32_t> g_late;
+
+static void record_late(uint32_t idx)
+{
+    g_late.push_back((uint32_t)((g_host_now - g_workload->deadline[idx]) / 1000));
+}
+
+static void finish_late(bench_result* res)
+{
+    res->expired = g_late.size();
+    res->late_p50_us = res->late_p99_us = res->late_max_us = 0.0;
+    if(g_late.empty())
+        return;
+    std::sort(g_late.begin(), g_late.end());
+    res->late_p50_us = g_late[g_late.size() / 2];
+    res->late_p99_us = g_late[(g_late.size() * 99) / 100];
+    res->late_max_us = g_late.back();
+}
+
+/**
+ * Host ticks are 1ms +-0.5ms, the same sequence for all runs.
+ */
+static uint64_t next_host_tick(uint64_t* seed)
+{
+    return HOST_TICK / 2 + bench_rand(seed) % HOST_TICK;
+}
+
+static co_timer* g_timers;
+
+static void wheel_fired(co_timer* timer, void*)
+{
+    record_late((uint32_t)(timer - g_timers));
+}
+
+static bench_result run_wheel(const bench_workload* w)
+{
+    uint32_t cnt = (uint32_t)w->deadline.size();
+    bench_result res;
+    g_workload = w;
+    g_late.clear();
+    g_late.reserve(cnt);
+
+    co_timer_wheel* wheel = new co_timer_wheel;
+    g_timers = new co_timer[cnt];
+    co_timer_wheel_init(wheel, WHEEL_TICK, 0);
+    for(uint32_t i = 0; i < cnt; ++i)
+        co_timer_init(&g_timers[i]);
+
+    double t0 = now_sec();
+    for(uint32_t i = 0; i < cnt; ++i)
+        co_timer_start(wheel, &g_timers[i], w->deadline[i], wheel_fired, nullptr);
+    double t1 = now_sec();
+    for(uint32_t idx : w->cancel)
+        co_timer_cancel(wheel, &g_timers[idx]);
+    double t2 = now_sec();
+    uint64_t seed = 1;
+    for(g_host_now = 0; g_host_now < w->horizon; g_host_now += next_host_tick(&seed))
+        co_timer_advance(wheel, g_host_now);
+    double t3 = now_sec();
+
+    finish_late(&res);
+    res.start_ns        = (t1 - t0) * 1e9 / cnt;
+    res.cancel_ns       = w->cancel.empty() ? 0.0 : (t2 - t1) * 1e9 / (double)w->cancel.size();
+    res.expire_ns       = res.expired == 0 ? 0.0 : (t3 - t2) * 1e9 / (double)res.expired;
+    res.bytes_per_timer = (double)sizeof(co_timer) + (double)sizeof(co_timer_wheel) / cnt;
+
+    delete[] g_timers;
+    delete wheel;
+    return res;
+}
+
+/**
+ * What every sleeping coroutine in dialog_example.cpp keeps, a deadline checked by the host.
+ */
+struct poll_sleeper
+{
+    uint64_t deadline;
+    bool     sleeping;
+};
+
+static bool poll_too_expensive(const bench_workload* w)
+{
+    return (double)w->deadline.size() * (double)(w->horizon / HOST_TICK) > (double)POLL_BUDGET;
+}
+
+static bench_result run_poll(const bench_workload* w)
+{
+    uint32_t cnt = (uint32_t)w->deadline.size();
+    bench_result res;
+    g_workload = w;
+    g_late.clear();
+    g_late.reserve(cnt);
+
+    poll_sleeper* sleepers = new poll_sleeper[cnt];
+
+    double t0 = now_sec();
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        sleepers[i].deadline = w->deadline[i];
+        sleepers[i].sleeping = true;
+    }
+    double t1 = now_sec();
+    for(uint32_t idx : w->cancel)
+        sleepers[idx].sleeping = false;
+    double t2 = now_sec();
+    uint64_t seed = 1;
+    for(g_host_now = 0; g_host_now < w->horizon; g_host_now += next_host_tick(&seed))
+    {
+        for(uint32_t i = 0; i < cnt; ++i)
+        {
+            if(sleepers[i].sleeping && sleepers[i].deadline <= g_host_now)
+            {
+                sleepers[i].sleeping = false;
+                record_late(i);
+            }
+        }
+    }
+    double t3 = now_sec();
+
+    finish_late(&res);
+    res.start_ns        = (t1 - t0) * 1e9 / cnt;
+    res.cancel_ns       = w->cancel.empty() ? 0.0 : (t2 - t1) * 1e9 / (double)w->cancel.size();
+    res.expire_ns       = res.expired == 0 ? 0.0 : (t3 - t2) * 1e9 / (double)res.expired;
+    res.bytes_per_timer = (double)sizeof(poll_sleeper);
+
+    delete[] sleepers;
+    return res;
+}
+
+static const int SLEEPS = 8;
+
+struct sleep_arg
+{
+    uint64_t      seed;
+    poll_sleeper* sleeper;
+};
+
+static co_timer_wheel g_sleep_wheel;
+
+static void sleep_wheel(coro* co, void*, sleep_arg* arg)
+{
+    co_locals_begin(co);
+        co_timer timer;
+        int      i;
+    co_locals_end(co);
+
+    co_begin(co);
+    co_timer_init(&locals.timer);
+    for(locals.i = 0; locals.i < SLEEPS; ++locals.i)
+        co_timer_sleep(co, &g_sleep_wheel, &locals.timer, bench_range(&arg->seed, 1 * MS, 50 * MS));
+    co_end(co);
+}
+
+static uint64_t g_sleep_now;
+
+static void sleep_poll(coro* co, void*, sleep_arg* arg)
+{
+    co_locals_begin(co);
+        int i;
+    co_locals_end(co);
+
+    co_begin(co);
+    for(locals.i = 0; locals.i < SLEEPS; ++locals.i)
+    {
+        arg->sleeper->deadline = g_sleep_now + bench_range(&arg->seed, 1 * MS, 50 * MS);
+        arg->sleeper->sleeping = true;
+        co_wait(co);
+    }
+    co_end(co);
+}
+
+static double run_sleep(bool wheel, uint32_t cnt)
+{
+    co_sched sched;
+    co_sched_init(&sched, 512, nullptr);
+    co_timer_wheel_init(&g_sleep_wheel, WHEEL_TICK, 0);
+
+    std::vector<poll_sleeper> sleepers(cnt);
+    std::vector<coro*>        cos(cnt);
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        sleep_arg arg = { 0x2545f4914f6cdd1dull + i, &sleepers[i] };
+        sleepers[i].sleeping = false;
+        cos[i] = co_sched_spawn(&sched, wheel ? (co_func)sleep_wheel : (co_func)sleep_poll, arg);
+    }
+
+    double t0 = now_sec();
+    uint64_t seed = 1;
+    g_sleep_now = 0;
+    co_sched_run(&sched);
+    while(co_sched_live(&sched) > 0)
+    {
+        g_sleep_now += next_host_tick(&seed);
+        if(wheel)
+            co_timer_advance(&g_sleep_wheel, g_sleep_now);
+        else
+        {
+            for(uint32_t i = 0; i < cnt; ++i)
+            {
+                if(sleepers[i].sleeping && sleepers[i].deadline <= g_sleep_now)
+                {
+                    sleepers[i].sleeping = false;
+                    co_sched_wake(cos[i]);
+                }
+            }
+        }
+        co_sched_run(&sched);
+    }
+    double t1 = now_sec();
+
+    co_sched_destroy(&sched);
+    return (t1 - t0) * 1e9 / ((double)cnt * SLEEPS);
+}
+
+int main(int argc, const char** argv)
+{
+    uint32_t max_timers = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+
+    std::vector<char> csv;
+    char line[256];
+    int  len;
+
+    printf("%-6s %-8s %9s %10s %10s %10s %11s %11s %11s %10s\n",
+           "impl", "dist", "timers", "start-ns", "cancel-ns", "expire-ns", "late-p50us", "late-p99us", "late-maxus", "bytes");
+    bench_workload w;
+    for(uint32_t cnt = 1000; cnt <= max_timers && cnt != 0; cnt *= 10)
+    {
+        for(int dist = DIST_UNIFORM; dist <= DIST_CANCEL; ++dist)
+        {
+            make_workload(&w, (bench_dist)dist, cnt);
+            for(int impl = 0; impl < 2; ++impl)
+            {
+                const char* name = impl == 0 ? "wheel" : "poll";
+                if(impl == 1 && poll_too_expensive(&w))
+                {
+                    printf("%-6s %-8s %9u %10s\n", name, dist_names[dist], cnt, "skipped");
+                    continue;
+                }
+                bench_result res = impl == 0 ? run_wheel(&w) : run_poll(&w);
+                printf("%-6s %-8s %9u %10.1f %10.1f %10.1f %11.0f %11.0f %11.0f %10.1f\n",
+                       name, dist_names[dist], cnt, res.start_ns, res.cancel_ns, res.expire_ns,
+                       res.late_p50_us, res.late_p99_us, res.late_max_us, res.bytes_per_timer);
+                len = snprintf(line, sizeof(line), "timer,%s,%s,%u,%.1f,%.1f,%.1f,%.0f,%.0f,%.0f,%.1f\n",
+                               name, dist_names[dist], cnt, res.start_ns, res.cancel_ns, res.expire_ns,
+                               res.late_p50_us, res.late_p99_us, res.late_max_us, res.bytes_per_timer);
+                csv.insert(csv.end(), line, line + len);
+            }
+        }
+    }
+
+    printf("\n%-6s %11s %13s\n", "impl", "coroutines", "ns/sleep");
+    for(uint32_t cnt = 1000; cnt <= 100000; cnt *= 10)
+    {
+        for(int impl = 0; impl < 2; ++impl)
+        {
+            const char* name = impl == 0 ? "wheel" : "poll";
+            double ns = run_sleep(impl == 0, cnt);
+            printf("%-6s %11u %13.1f\n", name, cnt, ns);
+            len = snprintf(line, sizeof(line), "sleep,%s,%u,%.1f\n", name, cnt, ns);
+            csv.insert(csv.end(), line, line + len);
+        }
+    }
+
+    printf("\n");
+    fwrite(csv.data(), 1, csv.size(), stdout);
+    return 0;
+}
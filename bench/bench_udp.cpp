@@ -0,0 +1,244 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Loopback benchmark of udp echo, packets/sec for a co_udp endpoint doing one recvmmsg()
+    and one sendmmsg() per batch vs. a coroutine doing one recvfrom() and one sendto() per
+    packet on the same reactor.
+
+    usage: bench_udp [packets] [burst]
+
+    The client runs on the same thread and sends bursts of 'burst' packets with sendmmsg()
+    and drains the replies before sending the next burst.
+*/
+
+#if defined(__linux__)
+
+#include "../coro_udp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static double now_sec()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int udp_socket(sockaddr_in* addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(addr, 0, sizeof(sockaddr_in));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sockaddr_in);
+    int bufsize = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    if(fd < 0 || bind(fd, (sockaddr*)addr, sizeof(sockaddr_in)) != 0 || getsockname(fd, (sockaddr*)addr, &len) != 0)
+        return -1;
+    return fd;
+}
+
+static co_udp   g_udp;
+static co_io_fd g_plain;
+
+static void echo_batched(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        co_udp_packet* pkt = nullptr;
+    co_locals_end(co);
+
+    co_begin(co);
+    while(true)
+    {
+        co_udp_recv(co, &g_udp, locals.pkt);
+        if(locals.pkt == nullptr)
+            co_exit(co);
+        co_udp_send(&g_udp, locals.pkt->data, locals.pkt->len, &locals.pkt->addr, locals.pkt->addr_len);
+    }
+    co_end(co);
+}
+
+static void echo_plain(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        uint8_t          buf[CORO_UDP_MAX_PACKET];
+        sockaddr_storage addr;
+        socklen_t        addr_len;
+        ssize_t          res;
+    co_locals_end(co);
+
+    co_begin(co);
+    while(true)
+    {
+        locals.addr_len = sizeof(locals.addr);
+        locals.res = recvfrom(g_plain.fd, locals.buf, sizeof(locals.buf), MSG_DONTWAIT, (sockaddr*)&locals.addr, &locals.addr_len);
+        if(locals.res < 0)
+        {
+            if(errno != EAGAIN)
+                co_exit(co);
+            co_io_wait_readable(co, &g_plain);
+            continue;
+        }
+        sendto(g_plain.fd, locals.buf, (size_t)locals.res, MSG_DONTWAIT, (sockaddr*)&locals.addr, locals.addr_len);
+    }
+    co_end(co);
+}
+
+struct client
+{
+    int         fd;
+    sockaddr_in server;
+    mmsghdr     msgs[1024];
+    iovec       iovs[1024];
+    uint8_t     bufs[1024][64];
+};
+
+static client g_client;
+
+static double run(co_io* io, co_sched* sched, bool batched, int packets, int burst)
+{
+    client* c = &g_client;
+    int sent = 0;
+    int received = 0;
+
+    double start = now_sec();
+    while(received < packets)
+    {
+        int n = packets - sent < burst ? packets - sent : burst;
+        for(int i = 0; i < n; ++i)
+        {
+            c->iovs[i].iov_len = 64;
+            c->msgs[i].msg_hdr.msg_name    = &c->server;
+            c->msgs[i].msg_hdr.msg_namelen = sizeof(c->server);
+        }
+        if(n > 0)
+            sent += sendmmsg(c->fd, c->msgs, (unsigned)n, 0);
+
+        int got = 0;
+        while(got < n)
+        {
+            co_io_poll(io, 0);
+            co_sched_run(sched);
+            if(batched)
+                co_udp_flush(&g_udp);
+
+            for(int i = 0; i < n; ++i)
+            {
+                c->iovs[i].iov_len = 64;
+                c->msgs[i].msg_hdr.msg_name = nullptr;
+            }
+            int res = recvmmsg(c->fd, c->msgs, (unsigned)(n - got), MSG_DONTWAIT, nullptr);
+            if(res > 0)
+                got += res;
+        }
+        received += got;
+    }
+    return now_sec() - start;
+}
+
+static void report(const char* name, int packets, double t, uint64_t syscalls)
+{
+    printf("%-10s %10.0f packets/s %8.2f packets/server-syscall\n", name, packets / t, (double)packets * 2.0 / (double)syscalls);
+}
+
+int main(int argc, const char** argv)
+{
+    int packets = argc > 1 ? atoi(argv[1]) : 1000000;
+    int burst   = argc > 2 ? atoi(argv[2]) : 256;
+    if(burst > 1024)
+        burst = 1024;
+
+    sockaddr_in client_addr;
+    g_client.fd = udp_socket(&client_addr);
+    for(int i = 0; i < 1024; ++i)
+    {
+        g_client.iovs[i].iov_base       = g_client.bufs[i];
+        g_client.msgs[i].msg_hdr.msg_iov    = &g_client.iovs[i];
+        g_client.msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    printf("%d packets of 64 bytes, bursts of %d, batch %d\n", packets, burst, CORO_UDP_BATCH);
+
+    {
+        co_io io;
+        co_io_init(&io);
+        int fd = udp_socket(&g_client.server);
+        co_io_add(&io, &g_plain, fd);
+
+        co_sched sched;
+        co_sched_init(&sched, 4096, nullptr);
+        co_sched_spawn(&sched, echo_plain);
+
+        // one recvfrom() and one sendto() per packet, not counting recvfrom() returning EAGAIN.
+        double t = run(&io, &sched, false, packets, burst);
+        report("plain", packets, t, (uint64_t)packets * 2);
+
+        co_sched_destroy(&sched);
+        co_io_destroy(&io);
+        close(fd);
+    }
+
+    {
+        co_io io;
+        co_io_init(&io);
+        int fd = udp_socket(&g_client.server);
+        co_udp_init(&g_udp, &io, fd);
+
+        co_sched sched;
+        co_sched_init(&sched, 4096, nullptr);
+        co_sched_spawn(&sched, echo_batched);
+
+        double t = run(&io, &sched, true, packets, burst);
+        report("batched", packets, t, g_udp.recv_calls + g_udp.send_calls);
+
+        co_sched_destroy(&sched);
+        co_udp_destroy(&g_udp, &io);
+        co_io_destroy(&io);
+        close(fd);
+    }
+
+    close(g_client.fd);
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("bench_udp is linux-only\n");
+    return 0;
+}
+
+#endif
@@ -154,6 +154,76 @@
  * This flag will be cleared at the next call to co_resume().
  * 
  * 
+ * SENDING VALUES INTO A COROUTINE:
+ * 
+ * The userdata passed to co_resume() is seen by all frames in the coroutine, if you instead
+ * want to deliver a value to the point where the coroutine is currently suspended use
+ * co_resume_with() together with co_yield_recv().
+ * 
+ * void my_consumer(coro* co, void*, void*)
+ * {
+ *     co_locals_begin(co);
+ *         int value = 0;
+ *     co_locals_end(co);
+ * 
+ *     co_begin(co);
+ * 
+ *     while(true)
+ *     {
+ *         co_yield_recv(co, locals.value);
+ *         // ... use locals.value ...
+ *     }
+ * 
+ *     co_end(co);
+ * }
+ * 
+ * int value = 1337;
+ * co_resume_with(&co, userdata, &value);
+ * 
+ * The value is received by the frame that is currently executing, i.e. the "leaf" of the 
+ * chain of co_call():s.
+ * 
+ * 
+ * CONTEXT:
+ * 
+ * When CORO_CONTEXT_SIZE is defined > 0 each coroutine has a small, CORO_CONTEXT_SIZE bytes,
+ * context-block for request-scoped data such as request-ids, deadlines or trace-spans. It
+ * lives in the root coro so all frames of the coroutine, no matter how deep in co_call():s
+ * they are, reach it with co_context() as one pointer-load without it being passed as an
+ * argument.
+ * 
+ * struct request_ctx { uint64_t request_id; uint64_t deadline; };
+ * 
+ * co_context<request_ctx>(&co)->request_id = 1337;
+ * 
+ * void deep_in_a_call(coro* co, void*, void*)
+ * {
+ *     if(now() > co_context<request_ctx>(co)->deadline)
+ *         co_exit(co);
+ *     ...
+ * }
+ * 
+ * The context-block is zeroed by co_init(). co_context_copy() copies it between coroutines,
+ * coroutines spawned via coro_sched.h get a copy of the context of the spawning coroutine.
+ * 
+ * 
+ * COROUTINE-LOCAL STORAGE:
+ * 
+ * Per-coroutine values for systems that want to attach data to a coroutine without keeping a
+ * side-table keyed on the coro, enabled by defining CORO_LOCAL_SLOTS > 0. Keys are registered
+ * once at startup and each coro has an array of CORO_LOCAL_SLOTS pointers so getting a value
+ * is an indexed load.
+ * 
+ * static co_local_key g_trace_key = co_local_key_create(trace_free);
+ * 
+ * co_local_set(co, g_trace_key, new_trace());
+ * trace* t = (trace*)co_local_get(co, g_trace_key);
+ * 
+ * Values are nullptr after co_init() and are NOT inherited by spawned coroutines.
+ * co_local_release() calls the destructor of each key on non-null values, coro_sched.h does
+ * that when a coroutine is freed.
+ * 
+ * 
  * RUNNING OUT OF STACK
  * 
  * If your coroutine is running out of stackspace the coroutine will yield and co_stack_overflowed()
@@ -201,6 +271,35 @@
 #  define CORO_TRACK_MAX_STACK_USAGE 0
 #endif
 
+/**
+ * Define CORO_CONTEXT_SIZE to the size in bytes of the context-block stored in each coro to
+ * enable co_context(), defaults to 0. Every coro grows by CORO_CONTEXT_SIZE bytes and
+ * co_context_copy() copies all of them. Must be the same in all translation-units.
+ */
+#if !defined(CORO_CONTEXT_SIZE)
+#  define CORO_CONTEXT_SIZE 0
+#endif
+
+/**
+ * Define CORO_LOCAL_SLOTS to the number of coroutine-local storage slots in each coro to
+ * enable co_local_get()/co_local_set(), defaults to 0. Every coro grows by
+ * CORO_LOCAL_SLOTS * sizeof(void*) bytes and co_init() has to clear them. Must be the same
+ * in all translation-units.
+ */
+#if !defined(CORO_LOCAL_SLOTS)
+#  define CORO_LOCAL_SLOTS 0
+#endif
+
+/**
+ * Define CORO_FRAME_HOOKS to 1 to be able to install callbacks that are called each time a
+ * frame, the root-function or a co_call():ed function, starts and stops executing with
+ * co_set_frame_hooks(), defaults to 0. Only affects code in the translation-units where it
+ * is defined.
+ */
+#if !defined(CORO_FRAME_HOOKS)
+#  define CORO_FRAME_HOOKS 0
+#endif
+
 
 ////////////////////////////////////////////////////////////////
 //                         PUBLIC API                         //
@@ -282,9 +381,20 @@ struct coro
     uint8_t*   stack        {nullptr};
     void*      userdata     {nullptr};
 
+    const void* recv_value  {nullptr};
+    int         recv_size   {0};
+
 #if CORO_TRACK_MAX_STACK_USAGE
     int        stack_use_max {0};
 #endif
+
+#if CORO_CONTEXT_SIZE > 0
+    alignas(8) uint8_t context[CORO_CONTEXT_SIZE];
+#endif
+
+#if CORO_LOCAL_SLOTS > 0
+    void*      local_slots[CORO_LOCAL_SLOTS];
+#endif
 };
 
 /**
@@ -342,6 +452,31 @@ static inline void co_init( coro* co, void* stack, int stack_size, co_func func,
  */
 static inline void co_resume( coro* co, void* userdata );
 
+/**
+ * Resume execution of coroutine and deliver a value to the co_yield_recv() the coroutine
+ * is currently suspended in.
+ * 
+ * The value is copied with memcpy into the receiving variable in the coroutine and the
+ * size of the receiving variable must match value_size. The value only need to be valid
+ * for the duration of the call.
+ * 
+ * @note if the coroutine has not been resumed before or is suspended in a co_yield(),
+ *       co_wait() or co_call() the value will be ignored, the same as send() on a
+ *       python generator.
+ * 
+ * @param userdata passed to all invocation of co_func in coro, same as co_resume().
+ * @param value ptr to the value to deliver.
+ * @param value_size size of data pointed to by value.
+ */
+static inline void co_resume_with( coro* co, void* userdata, const void* value, int value_size );
+
+/**
+ * Resume execution of coroutine and deliver a value, value_size is sizeof(T).
+ * @see co_resume_with() for doc.
+ */
+template<typename T>
+static inline void co_resume_with( coro* co, void* userdata, const T* value );
+
 /**
  * Returns true if the coroutine has completed.
  */
@@ -358,6 +493,74 @@ static inline bool co_stack_overflowed( coro* co ) { return co->call.root->overf
  */
 static inline bool co_waiting( coro* co ) { return co->waiting == 1; }
 
+#if CORO_CONTEXT_SIZE > 0
+/**
+ * Return the context-block of the coroutine as a T, co can be the coro of any frame in the
+ * coroutine. T need to be trivially copyable and fit in CORO_CONTEXT_SIZE bytes.
+ */
+template<typename T>
+static inline T* co_context( coro* co );
+
+/**
+ * Copy the context-block of src to dst.
+ */
+static inline void co_context_copy( coro* dst, coro* src );
+#endif
+
+#if CORO_LOCAL_SLOTS > 0
+typedef int  co_local_key;
+typedef void (*co_local_dtor)(void* value);
+
+/**
+ * Register a key for coroutine-local storage, keys are shared by all coroutines and can not
+ * be unregistered. Not thread-safe, register keys at startup.
+ *
+ * @param dtor called on non-null values by co_local_release(), can be nullptr.
+ * @return the key or -1 if all CORO_LOCAL_SLOTS keys are already registered.
+ */
+static inline co_local_key co_local_key_create( co_local_dtor dtor );
+
+/**
+ * Get/set the value of key for coroutine, co can be the coro of any frame in the coroutine.
+ */
+static inline void* co_local_get( coro* co, co_local_key key );
+static inline void  co_local_set( coro* co, co_local_key key, void* value );
+
+/**
+ * Call the destructors of all keys with non-null values in coroutine and clear the values.
+ */
+static inline void co_local_release( coro* co );
+#endif
+
+#if CORO_FRAME_HOOKS
+typedef void (*co_frame_hook)( coro* co, co_func func, void* userdata );
+
+/**
+ * Install callbacks called before and after each time a frame executes, on this thread only.
+ * A co_resume() of a coroutine in a co_call() gives enter/exit of the root-function with the
+ * enter/exit of each function in the call-chain nested within it. Pass nullptr to remove.
+ */
+static inline void co_set_frame_hooks( co_frame_hook enter, co_frame_hook exit, void* userdata );
+#endif
+
+/**
+ * One frame in the logical call-chain of a coroutine, @see co_backtrace().
+ */
+struct co_frame_info
+{
+    co_func func;
+    int     line;   ///< line the frame is suspended at, 0 if it has not run yet and CORO_STATE_COMPLETED when done.
+};
+
+/**
+ * Walk the logical call-chain of a coroutine, from the root-function to the innermost
+ * co_call(). Only reads the coroutine so it is valid to call from a signal-handler.
+ *
+ * @param frames filled with at most max_frames frames.
+ * @return the depth of the call-chain, may be larger than max_frames.
+ */
+static inline int co_backtrace( coro* co, co_frame_info* frames, int max_frames );
+
 /**
  * Return the amount of bytes currently used by the stack of the coro, -1 if the coro
  * has no stack.
@@ -398,6 +601,21 @@ static inline void* co_replace_stack( coro* co, void* stack, int stack_size );
  */
 #define co_wait(co)
 
+/**
+ * Yield execution of coroutine and receive a value when resumed via co_resume_with(), the
+ * value will be copied into 'out'.
+ * If the coroutine was resumed via co_resume(), or via co_resume_with() with a value of another
+ * size than 'out', 'out' will be left untouched. The size mismatch also triggers CORO_ASSERT().
+ * 
+ * @note as 'out' is assigned after the yield it should be a local declared with
+ *       co_locals_begin()/co_locals_end() or an argument.
+ * 
+ * @example
+ * 
+ * co_yield_recv(co, locals.my_int);
+ */
+#define co_yield_recv(co, out)
+
 /**
  * Perform a sub-call of another coroutine from current coroutine.
  * If coroutine returns without yielding this call will not yeald however if the called function
@@ -462,6 +680,7 @@ static inline void* co_replace_stack( coro* co, void* stack, int stack_size );
 #undef co_exit
 #undef co_yield
 #undef co_wait
+#undef co_yield_recv
 #undef co_call
 #undef co_locals_begin
 #undef co_locals_end
@@ -557,10 +776,18 @@ static inline void co_init( coro*   co,
     co->stack_top  = (uint8_t*)stack;
     co->stack_size = stack_size;
     co->userdata    = nullptr;
+    co->recv_value  = nullptr;
+    co->recv_size   = 0;
 
 #if CORO_TRACK_MAX_STACK_USAGE
     co->stack_use_max = 0;
 #endif
+#if CORO_CONTEXT_SIZE > 0
+    memset(co->context, 0, sizeof(co->context));
+#endif
+#if CORO_LOCAL_SLOTS > 0
+    memset(co->local_slots, 0, sizeof(co->local_slots));
+#endif
 
     _co_init_call_state(&co->call, co, func, arg, arg_size, arg_align);
     CORO_ASSERT(co->overflow == 0, "Out of stack when allocating data for argument in co_init(), can't handle out of stack in a good way here!");
@@ -580,9 +807,107 @@ static inline void co_init( coro* co, void* stack, int stack_size, co_func func,
     co_init( co, stack, stack_size, func, &arg, sizeof(T), alignof(T) );
 }
 
+#if CORO_CONTEXT_SIZE > 0
+template<typename T>
+static inline T* co_context( coro* co )
+{
+    static_assert(sizeof(T) <= CORO_CONTEXT_SIZE, "type do not fit in the context-block, increase CORO_CONTEXT_SIZE!");
+    static_assert(alignof(T) <= 8, "type need to be aligned to at most 8 bytes to be stored in the context-block!");
+    return (T*)(void*)co->call.root->context;
+}
+
+static inline void co_context_copy( coro* dst, coro* src )
+{
+    memcpy(dst->call.root->context, src->call.root->context, CORO_CONTEXT_SIZE);
+}
+#endif
+
+#if CORO_LOCAL_SLOTS > 0
+struct _co_local_registry
+{
+    int           cnt;
+    co_local_dtor dtors[CORO_LOCAL_SLOTS];
+};
+
+// not static as there need to be one registry shared by all translation-units.
+inline _co_local_registry& _co_local_keys()
+{
+    static _co_local_registry registry;
+    return registry;
+}
+
+static inline co_local_key co_local_key_create( co_local_dtor dtor )
+{
+    _co_local_registry& keys = _co_local_keys();
+    if(keys.cnt >= CORO_LOCAL_SLOTS)
+        return -1;
+    keys.dtors[keys.cnt] = dtor;
+    return keys.cnt++;
+}
+
+static inline void* co_local_get( coro* co, co_local_key key )
+{
+    CORO_ASSERT(key >= 0 && key < CORO_LOCAL_SLOTS, "invalid coroutine-local key!");
+    return co->call.root->local_slots[key];
+}
+
+static inline void co_local_set( coro* co, co_local_key key, void* value )
+{
+    CORO_ASSERT(key >= 0 && key < CORO_LOCAL_SLOTS, "invalid coroutine-local key!");
+    co->call.root->local_slots[key] = value;
+}
+
+static inline void co_local_release( coro* co )
+{
+    _co_local_registry& keys = _co_local_keys();
+    void** slots = co->call.root->local_slots;
+    for(int i = 0; i < keys.cnt; ++i)
+    {
+        void* value = slots[i];
+        slots[i] = nullptr;
+        if(value != nullptr && keys.dtors[i] != nullptr)
+            keys.dtors[i](value);
+    }
+}
+#endif
+
+#if CORO_FRAME_HOOKS
+struct _co_frame_hook_state
+{
+    co_frame_hook enter;
+    co_frame_hook exit;
+    void*         userdata;
+};
+
+// not static as there need to be one set of hooks shared by all translation-units.
+inline _co_frame_hook_state& _co_frame_hooks()
+{
+    static thread_local _co_frame_hook_state hooks;
+    return hooks;
+}
+
+static inline void co_set_frame_hooks( co_frame_hook enter, co_frame_hook exit, void* userdata )
+{
+    _co_frame_hook_state& hooks = _co_frame_hooks();
+    hooks.enter    = enter;
+    hooks.exit     = exit;
+    hooks.userdata = userdata;
+}
+#endif
+
 static inline void _co_invoke_callback(_coro_call_state* call)
 {
+#if CORO_FRAME_HOOKS
+    _co_frame_hook_state& hooks = _co_frame_hooks();
+    co_func func = call->func;
+    if(hooks.enter)
+        hooks.enter((coro*)call, func, hooks.userdata);
     call->func((coro*)call, call->root->userdata, _co_stack_offset_to_ptr(call, call->call_args));
+    if(hooks.exit)
+        hooks.exit((coro*)call, func, hooks.userdata);
+#else
+    call->func((coro*)call, call->root->userdata, _co_stack_offset_to_ptr(call, call->call_args));
+#endif
 }
 
 static inline void co_resume(coro* co, void* userdata)
@@ -594,8 +919,42 @@ static inline void co_resume(coro* co, void* userdata)
     co->executing = 1;
     co->userdata  = userdata;
     _co_invoke_callback(&co->call);
-    co->userdata  = nullptr;
-    co->executing = 0;
+    co->userdata   = nullptr;
+    co->recv_value = nullptr;
+    co->recv_size  = 0;
+    co->executing  = 0;
+}
+
+static inline void co_resume_with( coro* co, void* userdata, const void* value, int value_size )
+{
+    co->recv_value = value;
+    co->recv_size  = value_size;
+    co_resume(co, userdata);
+}
+
+template<typename T>
+static inline void co_resume_with( coro* co, void* userdata, const T* value )
+{
+    co_resume_with(co, userdata, value, (int)sizeof(T));
+}
+
+static inline int co_backtrace( coro* co, co_frame_info* frames, int max_frames )
+{
+    int depth = 0;
+    _coro_call_state* call = &co->call.root->call;
+    while(true)
+    {
+        if(depth < max_frames)
+        {
+            frames[depth].func = call->func;
+            // co_call() and other macros with custom labels offset the line with multiples of 100000.
+            frames[depth].line = call->state >= 0 ? call->state % 100000 : call->state;
+        }
+        ++depth;
+        if(call->sub_call == 0xFFFFFFFF)
+            return depth;
+        call = (_coro_call_state*)_co_stack_offset_to_ptr(call, call->sub_call);
+    }
 }
 
 static inline bool _co_sub_call(_coro_call_state* call)
@@ -655,6 +1014,20 @@ static inline void* co_replace_stack( coro* co, void* stack, int stack_size )
 #define co_wait(co) \
     do { co->call.root->waiting = 1; co_yield(co); } while(0)
 
+static inline void _co_recv(coro* co, void* out, size_t out_size)
+{
+    coro* root = co->call.root;
+    if(root->recv_value == nullptr)
+        return;
+    CORO_ASSERT((size_t)root->recv_size == out_size, "size of value passed to co_resume_with() do not match the receiving variable in co_yield_recv()!");
+    // with asserts disabled a mismatching value is ignored instead of read out of bounds.
+    if((size_t)root->recv_size == out_size)
+        memcpy(out, root->recv_value, out_size);
+}
+
+#define co_yield_recv(co, out) \
+    do { co_yield(co); _co_recv(co, &(out), sizeof(out)); } while(0)
+
 static inline bool _co_call(coro* co, co_func to_call, void* arg, int arg_size, int arg_align )
 {
     _coro_call_state* sub_call = (_coro_call_state*)_co_stack_alloc(&co->call, sizeof(_coro_call_state), alignof(_coro_call_state));
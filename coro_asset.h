@@ -0,0 +1,345 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Prioritised streaming of assets for coroutines run by coro_sched.h.
+ *
+ * A coroutine requests a read with co_load_asset() and is parked until the read has
+ * completed. The host calls co_asset_queue_update() with the amount of reads it is willing
+ * to issue this frame and the queue will issue the pending reads with the highest priority
+ * first, merging reads of adjacent ranges in the same file into one preadv() and wake the
+ * waiting coroutines.
+ *
+ * void load_texture(coro* co, void*, void* arg)
+ * {
+ *     co_locals_begin(co);
+ *         co_asset_request req;
+ *         uint8_t          header[128];
+ *     co_locals_end(co);
+ *
+ *     co_begin(co);
+ *
+ *     co_asset_request_init(&locals.req, "level1.pak", 4096, locals.header, sizeof(locals.header), 10);
+ *     co_load_asset(co, &g_asset_queue, &locals.req);
+ *
+ *     if(locals.req.result < 0)
+ *         co_exit(co); // failed to read!
+ *
+ *     // ... use header ...
+ *
+ *     co_end(co);
+ * }
+ *
+ * // in the main-loop
+ * co_sched_step(&sched);
+ * co_asset_queue_update(&g_asset_queue, 8);
+ *
+ * PRIORITIES:
+ *
+ * The 'prio' of a pending request can be changed at any time by writing to it directly, all
+ * pending requests are ordered by their current priority at each co_asset_queue_update().
+ * Higher values are loaded first.
+ *
+ * CANCELLATION:
+ *
+ * Requests from coroutines that have been cancelled with co_sched_cancel() are dropped
+ * without being read at the next co_asset_queue_update().
+ *
+ * @note the request, path and destination-buffer need to be valid until the request has
+ *       completed. It is valid to store them in the locals of the waiting coroutine as the
+ *       stack of a parked coroutine is never replaced.
+ *
+ * @note reads are performed synchronously on the thread calling co_asset_queue_update() and
+ *       are only implemented for posix-platforms.
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_ASSET_MAX_MERGE to configure max amount of requests that can be merged
+ * into one read, defaults to 16.
+ */
+#if !defined(CORO_ASSET_MAX_MERGE)
+#  define CORO_ASSET_MAX_MERGE 16
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+struct co_asset_request
+{
+    const char*       path;
+    uint64_t          offset;
+    void*             dst;
+    size_t            size;
+    int               prio;     ///< higher is loaded first, can be changed while pending.
+    int64_t           result;   ///< bytes read or -errno when the request has completed.
+    coro*             waiter;
+    co_asset_request* next;
+    uint32_t          in_batch;
+};
+
+struct co_asset_queue
+{
+    co_asset_request* pending;
+    uint32_t          pending_cnt;
+
+    uint64_t          reads;      ///< number of reads issued.
+    uint64_t          completed;  ///< number of requests completed by reads.
+    uint64_t          dropped;    ///< number of requests dropped due to cancellation.
+};
+
+/**
+ * Initialize queue.
+ */
+static inline void co_asset_queue_init( co_asset_queue* queue );
+
+/**
+ * Initialize request to read size bytes at offset in file at path into dst.
+ */
+static inline void co_asset_request_init( co_asset_request* req, const char* path, uint64_t offset, void* dst, size_t size, int prio );
+
+/**
+ * Push request to queue and park the coroutine until the request has completed, the result
+ * is available in req->result when the coroutine is resumed.
+ */
+#define co_load_asset(co, queue, req)
+
+/**
+ * Drop requests from cancelled coroutines and issue up to max_reads reads, highest priority
+ * first, waking all coroutines whose request completed.
+ *
+ * @return number of reads issued.
+ */
+static inline uint32_t co_asset_queue_update( co_asset_queue* queue, uint32_t max_reads );
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_load_asset
+
+static inline void co_asset_queue_init( co_asset_queue* queue )
+{
+    queue->pending     = nullptr;
+    queue->pending_cnt = 0;
+    queue->reads       = 0;
+    queue->completed   = 0;
+    queue->dropped     = 0;
+}
+
+static inline void co_asset_request_init( co_asset_request* req, const char* path, uint64_t offset, void* dst, size_t size, int prio )
+{
+    req->path     = path;
+    req->offset   = offset;
+    req->dst      = dst;
+    req->size     = size;
+    req->prio     = prio;
+    req->result   = 0;
+    req->waiter   = nullptr;
+    req->next     = nullptr;
+    req->in_batch = 0;
+}
+
+static inline void _co_asset_push( co_asset_queue* queue, co_asset_request* req, coro* co )
+{
+    req->waiter   = co->call.root;
+    req->in_batch = 0;
+    co_sched_wait_reason(co, "asset_load");
+    req->next     = queue->pending;
+    queue->pending = req;
+    ++queue->pending_cnt;
+}
+
+#define co_load_asset(co, queue, req) \
+    do { _co_asset_push((queue), (req), co); co_wait(co); } while(0)
+
+static inline void _co_asset_complete( co_asset_request* req, int64_t result )
+{
+    req->result = result;
+    co_sched_wake(req->waiter);
+}
+
+// merge-sort of pending-list on priority, highest first.
+static inline co_asset_request* _co_asset_sort( co_asset_request* list, uint32_t cnt )
+{
+    if(cnt <= 1)
+        return list;
+
+    uint32_t half = cnt / 2;
+    co_asset_request* mid = list;
+    for(uint32_t i = 1; i < half; ++i)
+        mid = mid->next;
+    co_asset_request* second = mid->next;
+    mid->next = nullptr;
+
+    co_asset_request* a = _co_asset_sort(list, half);
+    co_asset_request* b = _co_asset_sort(second, cnt - half);
+
+    co_asset_request*  head = nullptr;
+    co_asset_request** tail = &head;
+    while(a && b)
+    {
+        co_asset_request** take = a->prio >= b->prio ? &a : &b;
+        *tail = *take;
+        tail  = &(*take)->next;
+        *take = (*take)->next;
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+static inline void _co_asset_read_batch( co_asset_queue* queue, co_asset_request** batch, uint32_t cnt )
+{
+    struct iovec iov[CORO_ASSET_MAX_MERGE];
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        iov[i].iov_base = batch[i]->dst;
+        iov[i].iov_len  = batch[i]->size;
+    }
+
+    int64_t res = -ENOENT;
+    int fd = open(batch[0]->path, O_RDONLY);
+    if(fd >= 0)
+    {
+        ssize_t bytes = preadv(fd, iov, (int)cnt, (off_t)batch[0]->offset);
+        res = bytes < 0 ? -(int64_t)errno : (int64_t)bytes;
+        close(fd);
+    }
+    else
+        res = -(int64_t)errno;
+
+    ++queue->reads;
+    queue->completed += cnt;
+
+    // distribute the bytes read over the merged requests, a short read gives the requests
+    // at the end fewer bytes than requested.
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        co_asset_request* req = batch[i];
+        if(res < 0)
+            _co_asset_complete(req, res);
+        else
+        {
+            int64_t got = res < (int64_t)req->size ? res : (int64_t)req->size;
+            res -= got;
+            _co_asset_complete(req, got);
+        }
+    }
+}
+
+static inline uint32_t co_asset_queue_update( co_asset_queue* queue, uint32_t max_reads )
+{
+    // drop requests from cancelled coroutines.
+    co_asset_request** it = &queue->pending;
+    while(*it)
+    {
+        co_asset_request* req = *it;
+        if(co_sched_cancelled(req->waiter))
+        {
+            *it = req->next;
+            --queue->pending_cnt;
+            ++queue->dropped;
+            _co_asset_complete(req, -ECANCELED);
+        }
+        else
+            it = &req->next;
+    }
+
+    queue->pending = _co_asset_sort(queue->pending, queue->pending_cnt);
+
+    uint32_t reads = 0;
+    while(queue->pending && reads < max_reads)
+    {
+        co_asset_request* top = queue->pending;
+
+        // collect pending requests to the same file as the top request...
+        co_asset_request* cand[CORO_ASSET_MAX_MERGE * 2];
+        uint32_t cand_cnt = 0;
+        cand[cand_cnt++] = top;
+        for(co_asset_request* req = top->next; req && cand_cnt < CORO_ASSET_MAX_MERGE * 2; req = req->next)
+            if(strcmp(req->path, top->path) == 0)
+                cand[cand_cnt++] = req;
+
+        // ... sort them by offset ...
+        for(uint32_t i = 1; i < cand_cnt; ++i)
+            for(uint32_t j = i; j > 0 && cand[j]->offset < cand[j-1]->offset; --j)
+            {
+                co_asset_request* tmp = cand[j];
+                cand[j]   = cand[j-1];
+                cand[j-1] = tmp;
+            }
+
+        // ... and extend the read from the top request in both directions as long as the
+        // ranges are adjacent.
+        uint32_t lo = 0;
+        while(cand[lo] != top)
+            ++lo;
+        uint32_t hi = lo;
+        while(hi + 1 < cand_cnt && hi - lo + 1 < CORO_ASSET_MAX_MERGE && cand[hi+1]->offset == cand[hi]->offset + cand[hi]->size)
+            ++hi;
+        while(lo > 0 && hi - lo + 1 < CORO_ASSET_MAX_MERGE && cand[lo-1]->offset + cand[lo-1]->size == cand[lo]->offset)
+            --lo;
+
+        for(uint32_t i = lo; i <= hi; ++i)
+            cand[i]->in_batch = 1;
+
+        it = &queue->pending;
+        while(*it)
+        {
+            if((*it)->in_batch)
+            {
+                *it = (*it)->next;
+                --queue->pending_cnt;
+            }
+            else
+                it = &(*it)->next;
+        }
+
+        _co_asset_read_batch(queue, cand + lo, hi - lo + 1);
+        ++reads;
+    }
+
+    return reads;
+}
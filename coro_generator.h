@@ -0,0 +1,326 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Generators and lazy generator-combinators on top of coro.h
+ *
+ *
+ * GENERATORS:
+ *
+ * A generator is a normal co_func that produces values with co_gen_yield(), values can be
+ * produced from any sub-call made with co_call() as well.
+ *
+ * void count_to_10(coro* co, void*, void*)
+ * {
+ *     co_locals_begin(co);
+ *         int i = 0;
+ *     co_locals_end(co);
+ *
+ *     co_begin(co);
+ *
+ *     for(; locals.i < 10; ++locals.i)
+ *         co_gen_yield(co, locals.i);
+ *
+ *     co_end(co);
+ * }
+ *
+ * coro co;
+ * co_init(&co, stack, sizeof(stack), count_to_10);
+ *
+ * int value;
+ * while(co_gen_next(&co, &value))
+ *     printf("%d\n", value);
+ *
+ *
+ * COMBINATORS:
+ *
+ * Generators can be wrapped in combinators that are evaluated lazily as values are pulled
+ * from the outermost stage. The combinators are plain structs that are composed at compile
+ * time so all stages are inlined into one co_gen_next() of the outermost stage and only the
+ * innermost source(s) are actual coroutines that need to be co_resume():d. No stage allocates
+ * memory or buffers values.
+ *
+ * auto evens_squared = co_gen_map(co_gen_filter(co_gen_from<int>(&co),
+ *                                               [](int v) { return v % 2 == 0; }),
+ *                                 [](int v) { return v * v; });
+ * int value;
+ * while(co_gen_next(evens_squared, &value))
+ *     printf("%d\n", value);
+ *
+ * Available combinators:
+ *   co_gen_from<T>(co)       - source from a generator-coroutine producing T.
+ *   co_gen_map(src, f)       - f(v) for each value.
+ *   co_gen_filter(src, pred) - only values where pred(v) is true.
+ *   co_gen_take(src, n)      - only the first n values.
+ *   co_gen_zip(a, b)         - std::pair of values from a and b until any of them ends.
+ *   co_gen_chain(a, b)       - all values from a followed by all values from b.
+ *   co_gen_flat_map(src, f)  - f(v) returns a new stage for each value, all values of that
+ *                              stage is produced before the next value is pulled from src.
+ *
+ * All stages can be used with co_gen_next() and any struct that has a 'value_type' typedef
+ * and a matching co_gen_next() overload can be used as a stage.
+ */
+
+#pragma once
+
+#include "coro.h"
+
+#include <utility>     // std::pair, std::move
+#include <type_traits> // std::decay
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Produce a value from a generator-coroutine and yield, the value is copied to the caller
+ * of co_gen_next() with memcpy.
+ *
+ * @note value must be of the same type as the one passed to co_gen_next().
+ */
+#define co_gen_yield(co, value)
+
+/**
+ * Resume generator until it produces a value or completes.
+ *
+ * @note a coroutine that yields without producing a value via co_yield() will be resumed
+ *       again. If the coroutine co_wait():s or overflows its stack false will be returned
+ *       and it is up to the caller to check co_waiting()/co_stack_overflowed() and call
+ *       co_gen_next() again. Combinators treat false as end-of-stream so generators used
+ *       as sources in combinators should not co_wait().
+ *
+ * @param co generator to resume.
+ * @param out value produced by generator will be written here.
+ * @return true if a value was produced, false if generator completed, waits or overflowed.
+ */
+template<typename T>
+static inline bool co_gen_next( coro* co, T* out );
+
+/**
+ * Source stage that pulls values from a generator-coroutine.
+ */
+template<typename T>
+struct co_gen_source
+{
+    typedef T value_type;
+    coro* co;
+};
+
+template<typename T>
+static inline co_gen_source<T> co_gen_from( coro* co ) { co_gen_source<T> s; s.co = co; return s; }
+
+template<typename Src, typename F>
+struct co_gen_map_stage
+{
+    typedef typename std::decay<decltype(std::declval<F>()(std::declval<typename Src::value_type>()))>::type value_type;
+    Src src;
+    F   func;
+};
+
+template<typename Src, typename F>
+static inline co_gen_map_stage<Src, F> co_gen_map( Src src, F func ) { return co_gen_map_stage<Src, F>{ std::move(src), std::move(func) }; }
+
+template<typename Src, typename F>
+struct co_gen_filter_stage
+{
+    typedef typename Src::value_type value_type;
+    Src src;
+    F   pred;
+};
+
+template<typename Src, typename F>
+static inline co_gen_filter_stage<Src, F> co_gen_filter( Src src, F pred ) { return co_gen_filter_stage<Src, F>{ std::move(src), std::move(pred) }; }
+
+template<typename Src>
+struct co_gen_take_stage
+{
+    typedef typename Src::value_type value_type;
+    Src    src;
+    size_t left;
+};
+
+template<typename Src>
+static inline co_gen_take_stage<Src> co_gen_take( Src src, size_t n ) { return co_gen_take_stage<Src>{ std::move(src), n }; }
+
+template<typename A, typename B>
+struct co_gen_zip_stage
+{
+    typedef std::pair<typename A::value_type, typename B::value_type> value_type;
+    A a;
+    B b;
+};
+
+template<typename A, typename B>
+static inline co_gen_zip_stage<A, B> co_gen_zip( A a, B b ) { return co_gen_zip_stage<A, B>{ std::move(a), std::move(b) }; }
+
+template<typename A, typename B>
+struct co_gen_chain_stage
+{
+    typedef typename A::value_type value_type;
+    A    a;
+    B    b;
+    bool a_done;
+};
+
+template<typename A, typename B>
+static inline co_gen_chain_stage<A, B> co_gen_chain( A a, B b ) { return co_gen_chain_stage<A, B>{ std::move(a), std::move(b), false }; }
+
+/**
+ * flat_map stage, the stage returned by 'func' is stored by value in this stage so no memory
+ * is allocated. The returned stage need to be default-constructible and move-assignable.
+ */
+template<typename Src, typename F>
+struct co_gen_flat_map_stage
+{
+    typedef typename std::decay<decltype(std::declval<F>()(std::declval<typename Src::value_type>()))>::type inner_type;
+    typedef typename inner_type::value_type value_type;
+    Src        src;
+    F          func;
+    inner_type inner;
+    bool       has_inner;
+};
+
+template<typename Src, typename F>
+static inline co_gen_flat_map_stage<Src, F> co_gen_flat_map( Src src, F func )
+{
+    return co_gen_flat_map_stage<Src, F>{ std::move(src), std::move(func), typename co_gen_flat_map_stage<Src, F>::inner_type(), false };
+}
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_gen_yield
+
+/**
+ * Passed as userdata to the generator from co_gen_next().
+ */
+struct _co_gen_slot
+{
+    void*  out;
+    size_t out_size;
+    bool   has_value;
+};
+
+static inline void _co_gen_emit( void* userdata, const void* value, size_t value_size )
+{
+    _co_gen_slot* slot = (_co_gen_slot*)userdata;
+    CORO_ASSERT(slot != nullptr, "generator need to be resumed with co_gen_next()!");
+    CORO_ASSERT(slot->out_size == value_size, "type passed to co_gen_yield() do not match the one passed to co_gen_next()!");
+    memcpy(slot->out, value, value_size);
+    slot->has_value = true;
+}
+
+#define co_gen_yield(co, value) \
+    do { _co_gen_emit(co->call.root->userdata, &(value), sizeof(value)); co_yield(co); } while(0)
+
+template<typename T>
+static inline bool co_gen_next( coro* co, T* out )
+{
+    _co_gen_slot slot = { out, sizeof(T), false };
+    while(!slot.has_value && !co_completed(co))
+    {
+        co_resume(co, &slot);
+        if(co_waiting(co) || co_stack_overflowed(co))
+            break;
+    }
+    return slot.has_value;
+}
+
+template<typename T>
+static inline bool co_gen_next( co_gen_source<T>& s, T* out )
+{
+    return co_gen_next(s.co, out);
+}
+
+template<typename Src, typename F>
+static inline bool co_gen_next( co_gen_map_stage<Src, F>& s, typename co_gen_map_stage<Src, F>::value_type* out )
+{
+    typename Src::value_type v;
+    if(!co_gen_next(s.src, &v))
+        return false;
+    *out = s.func(v);
+    return true;
+}
+
+template<typename Src, typename F>
+static inline bool co_gen_next( co_gen_filter_stage<Src, F>& s, typename Src::value_type* out )
+{
+    while(co_gen_next(s.src, out))
+        if(s.pred(*out))
+            return true;
+    return false;
+}
+
+template<typename Src>
+static inline bool co_gen_next( co_gen_take_stage<Src>& s, typename Src::value_type* out )
+{
+    if(s.left == 0)
+        return false;
+    if(!co_gen_next(s.src, out))
+        return false;
+    --s.left;
+    return true;
+}
+
+template<typename A, typename B>
+static inline bool co_gen_next( co_gen_zip_stage<A, B>& s, typename co_gen_zip_stage<A, B>::value_type* out )
+{
+    return co_gen_next(s.a, &out->first) && co_gen_next(s.b, &out->second);
+}
+
+template<typename A, typename B>
+static inline bool co_gen_next( co_gen_chain_stage<A, B>& s, typename A::value_type* out )
+{
+    if(!s.a_done)
+    {
+        if(co_gen_next(s.a, out))
+            return true;
+        s.a_done = true;
+    }
+    return co_gen_next(s.b, out);
+}
+
+template<typename Src, typename F>
+static inline bool co_gen_next( co_gen_flat_map_stage<Src, F>& s, typename co_gen_flat_map_stage<Src, F>::value_type* out )
+{
+    while(true)
+    {
+        if(s.has_inner && co_gen_next(s.inner, out))
+            return true;
+
+        typename Src::value_type v;
+        if(!co_gen_next(s.src, &v))
+            return false;
+        s.inner     = s.func(v);
+        s.has_inner = true;
+    }
+}
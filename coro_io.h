@@ -0,0 +1,381 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Reactor for non-blocking file-descriptors for coroutines run by coro_sched.h, linux-only
+ * and implemented with edge-triggered epoll.
+ *
+ * co_io io;
+ * co_io_init(&io);
+ *
+ * co_io_fd conn;
+ * co_io_add(&io, &conn, socket_fd);
+ *
+ * // in a coroutine, buffer and size need to be locals or arguments as they are evaluated
+ * // again after the coroutine has been resumed.
+ * co_io_read(co, &conn, locals.buffer, sizeof(locals.buffer), locals.bytes_read);
+ *
+ * // main-loop
+ * while(co_sched_live(&sched) > 0)
+ * {
+ *     co_sched_run(&sched);
+ *     co_io_poll(&io, -1);
+ * }
+ *
+ * Only one coroutine at a time may wait for a fd to be readable and one for it to be writable.
+ *
+ * BUSY-POLLING:
+ *
+ * For latency-critical paths co_io_run_busy() replaces the main-loop above with one that never
+ * sleeps. It interleaves one co_sched_step() with one non-blocking co_io_poll(), trading a full
+ * core for not having to wait for the kernel to wake the thread up. It is intended to run on
+ * a thread pinned to an isolated cpu. co_io_set_busy_poll() also makes the kernel busy-poll
+ * the device queue of a socket when it is read and no data is available.
+ *
+ * ZERO-COPY TRANSFERS:
+ *
+ * co_io_sendfile() and co_io_splice() move data between fds inside the kernel without copying
+ * it through a userspace buffer, for example to serve a file on a socket:
+ *
+ * // locals.offset is an off_t advanced by the kernel, locals.left the bytes still to send.
+ * while(locals.left > 0)
+ * {
+ *     co_io_sendfile(co, &conn, file_fd, locals.offset, locals.left, locals.sent);
+ *     if(locals.sent <= 0)
+ *         break;
+ *     locals.left -= (size_t)locals.sent;
+ * }
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_IO_MAX_EVENTS to configure the max number of events handled per co_io_poll(),
+ * defaults to 256.
+ */
+#if !defined(CORO_IO_MAX_EVENTS)
+#  define CORO_IO_MAX_EVENTS 256
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+/**
+ * State for one fd registered with a reactor.
+ */
+struct co_io_fd
+{
+    int      fd;
+    coro*    reader;        ///< coroutine waiting for fd to be readable.
+    coro*    writer;        ///< coroutine waiting for fd to be writable.
+    uint32_t rd_ready : 1;  ///< fd got readable while no-one was waiting.
+    uint32_t wr_ready : 1;  ///< fd got writable while no-one was waiting.
+};
+
+struct co_io
+{
+    int      epfd;
+    uint64_t polls;    ///< number of calls to co_io_poll().
+    uint64_t wakeups;  ///< number of coroutines woken by co_io_poll().
+};
+
+/**
+ * Initialize reactor.
+ * @return false on failure, errno is set.
+ */
+static inline bool co_io_init( co_io* io );
+
+/**
+ * Destroy reactor, fds registered with the reactor are not closed.
+ */
+static inline void co_io_destroy( co_io* io );
+
+/**
+ * Register fd with reactor and make it non-blocking.
+ * @return false on failure, errno is set.
+ */
+static inline bool co_io_add( co_io* io, co_io_fd* f, int fd );
+
+/**
+ * Unregister fd from reactor, the fd is not closed.
+ */
+static inline void co_io_remove( co_io* io, co_io_fd* f );
+
+/**
+ * Wait for events for at most timeout_ms milliseconds (-1 = infinite, 0 = don't block) and
+ * wake the coroutines waiting on the fds that got ready.
+ *
+ * @return number of coroutines woken.
+ */
+static inline int co_io_poll( co_io* io, int timeout_ms );
+
+/**
+ * Run coroutines in sched and poll io without ever blocking until there are no live
+ * coroutines or *stop is set, stop can be nullptr and may be set from another thread.
+ */
+static inline void co_io_run_busy( co_io* io, co_sched* sched, const bool* stop );
+
+/**
+ * Set SO_BUSY_POLL on a socket, usec is how long a read may busy-poll the device queue.
+ * Values above net.core.busy_read require CAP_NET_ADMIN.
+ *
+ * @return false on failure, errno is set.
+ */
+static inline bool co_io_set_busy_poll( int fd, int usec );
+
+/**
+ * Park coroutine until f is readable/writable.
+ */
+#define co_io_wait_readable(co, f)
+#define co_io_wait_writable(co, f)
+
+/**
+ * read()/write() on f, parking the coroutine while the call would block. res is assigned
+ * the result of the call, i.e. bytes read/written or -1 on error with errno set.
+ */
+#define co_io_read(co, f, buf, len, res)
+#define co_io_write(co, f, buf, len, res)
+
+/**
+ * sendfile() count bytes from in_fd, starting at and advancing the off_t offset, to f, parking
+ * the coroutine while f is not writable. in_fd need to support mmap(), i.e. be a regular file.
+ * res is assigned the result of the call, i.e. bytes sent or -1 on error with errno set.
+ */
+#define co_io_sendfile(co, f, in_fd, offset, count, res)
+
+/**
+ * splice() len bytes from in to out where at least one of them need to be a pipe, parking the
+ * coroutine while in is not readable or out is not writable. res is assigned the result of
+ * the call, i.e. bytes moved, 0 at end of input or -1 on error with errno set.
+ */
+#define co_io_splice(co, in, out, len, res)
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_io_wait_readable
+#undef co_io_wait_writable
+#undef co_io_read
+#undef co_io_write
+#undef co_io_sendfile
+#undef co_io_splice
+
+static inline bool co_io_init( co_io* io )
+{
+    io->epfd    = epoll_create1(EPOLL_CLOEXEC);
+    io->polls   = 0;
+    io->wakeups = 0;
+    return io->epfd >= 0;
+}
+
+static inline void co_io_destroy( co_io* io )
+{
+    if(io->epfd >= 0)
+        close(io->epfd);
+    io->epfd = -1;
+}
+
+static inline bool co_io_add( co_io* io, co_io_fd* f, int fd )
+{
+    f->fd       = fd;
+    f->reader   = nullptr;
+    f->writer   = nullptr;
+    f->rd_ready = 0;
+    f->wr_ready = 0;
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return false;
+
+    epoll_event ev;
+    ev.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = f;
+    return epoll_ctl(io->epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static inline void co_io_remove( co_io* io, co_io_fd* f )
+{
+    epoll_ctl(io->epfd, EPOLL_CTL_DEL, f->fd, nullptr);
+}
+
+static inline int co_io_poll( co_io* io, int timeout_ms )
+{
+    epoll_event events[CORO_IO_MAX_EVENTS];
+    int cnt = epoll_wait(io->epfd, events, CORO_IO_MAX_EVENTS, timeout_ms);
+    ++io->polls;
+
+    int woken = 0;
+    for(int i = 0; i < cnt; ++i)
+    {
+        co_io_fd* f = (co_io_fd*)events[i].data.ptr;
+        uint32_t  e = events[i].events;
+
+        if(e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            if(f->reader)
+            {
+                coro* co = f->reader;
+                f->reader = nullptr;
+                co_sched_wake(co);
+                ++woken;
+            }
+            else
+                f->rd_ready = 1;
+        }
+        if(e & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        {
+            if(f->writer)
+            {
+                coro* co = f->writer;
+                f->writer = nullptr;
+                co_sched_wake(co);
+                ++woken;
+            }
+            else
+                f->wr_ready = 1;
+        }
+    }
+    io->wakeups += (uint64_t)woken;
+    return woken;
+}
+
+static inline void co_io_run_busy( co_io* io, co_sched* sched, const bool* stop )
+{
+    while(co_sched_live(sched) > 0 && (stop == nullptr || !__atomic_load_n(stop, __ATOMIC_RELAXED)))
+    {
+        co_sched_step(sched);
+        co_io_poll(io, 0);
+    }
+}
+
+static inline bool co_io_set_busy_poll( int fd, int usec )
+{
+#if defined(SO_BUSY_POLL)
+    return setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == 0;
+#else
+    (void)fd; (void)usec;
+    errno = ENOTSUP;
+    return false;
+#endif
+}
+
+/**
+ * Returns true if the coroutine need to wait, false if the fd got ready while no-one was
+ * waiting and the operation should just be retried.
+ */
+static inline bool _co_io_arm_read( co_io_fd* f, coro* co )
+{
+    if(f->rd_ready)
+    {
+        f->rd_ready = 0;
+        return false;
+    }
+    CORO_ASSERT(f->reader == nullptr, "only one coroutine can wait for a fd to be readable!");
+    f->reader = co->call.root;
+    co_sched_wait_reason(co, "io_read");
+    return true;
+}
+
+static inline bool _co_io_arm_write( co_io_fd* f, coro* co )
+{
+    if(f->wr_ready)
+    {
+        f->wr_ready = 0;
+        return false;
+    }
+    CORO_ASSERT(f->writer == nullptr, "only one coroutine can wait for a fd to be writable!");
+    f->writer = co->call.root;
+    co_sched_wait_reason(co, "io_write");
+    return true;
+}
+
+#define co_io_wait_readable(co, f) \
+    do { if(_co_io_arm_read((f), co)) co_wait(co); } while(0)
+
+#define co_io_wait_writable(co, f) \
+    do { if(_co_io_arm_write((f), co)) co_wait(co); } while(0)
+
+#define co_io_read(co, f, buf, len, res)                                        \
+    do {                                                                        \
+        while(((res) = read((f)->fd, (buf), (len))) < 0 && errno == EAGAIN)     \
+            co_io_wait_readable(co, f);                                         \
+    } while(0)
+
+#define co_io_write(co, f, buf, len, res)                                       \
+    do {                                                                        \
+        while(((res) = write((f)->fd, (buf), (len))) < 0 && errno == EAGAIN)    \
+            co_io_wait_writable(co, f);                                         \
+    } while(0)
+
+#define co_io_sendfile(co, f, in_fd, offset, count, res)                                  \
+    do {                                                                                  \
+        while(((res) = sendfile((f)->fd, (in_fd), &(offset), (count))) < 0 && errno == EAGAIN) \
+            co_io_wait_writable(co, f);                                                   \
+    } while(0)
+
+/**
+ * splice() do not tell which side that would block, check in with poll() and wait for in if
+ * it has no data, otherwise for out.
+ */
+static inline bool _co_io_arm_splice( co_io_fd* in, co_io_fd* out, coro* co )
+{
+    pollfd pfd;
+    pfd.fd      = in->fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    if(poll(&pfd, 1, 0) == 0)
+        return _co_io_arm_read(in, co);
+    return _co_io_arm_write(out, co);
+}
+
+#define co_io_splice(co, in, out, len, res)                                                         \
+    do {                                                                                            \
+        while(((res) = splice((in)->fd, nullptr, (out)->fd, nullptr, (len), SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 && errno == EAGAIN) \
+            if(_co_io_arm_splice((in), (out), co))                                                  \
+                co_wait(co);                                                                        \
+    } while(0)
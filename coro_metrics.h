@@ -0,0 +1,309 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * OpenMetrics text exposition of the counters from coro_stats.h, posix-only.
+ *
+ * Each scheduler publishes its counters to a co_stats page from its own thread, the exporter
+ * reads all slots of the page, from any thread or even another process, and renders them with
+ * one 'sched' label per scheduler. Serving the text, for example over http, is left to the
+ * user.
+ *
+ * char buf[64 * 1024];
+ * int len = co_metrics_render(&stats, buf, sizeof(buf));
+ * if(len >= 0)
+ *     send(client_fd, buf, (size_t)len, 0);
+ *
+ * or for a single scheduler on its own thread, without a page:
+ *
+ * co_stats_values values;
+ * co_stats_collect(&sched, &values);
+ * const char* name = "main";
+ * co_metrics_render_values(&values, &name, 1, buf, sizeof(buf));
+ *
+ * Rendered metrics, all with the label sched:
+ *
+ *   coro_live, coro_ready                gauges, coroutines alive and in ready-queues.
+ *   coro_resumes_total, coro_parks_total counters.
+ *   coro_stack_bytes                     gauge, memory used by stacks of live coroutines.
+ *   coro_stack_grows_total               counter, stacks grown after overflow.
+ *   coro_spawn_rejected_total            counter, spawns failed due to co_sched_set_limits().
+ *   coro_spawn_parked_total              counter, co_spawn() parked due to limits.
+ *   coro_pool_hits_total, coro_pooled    spawns reusing a pooled stack and current pool size.
+ *   coro_timers_pending                  gauge, timers started in the wheel added with
+ *                                        co_stats_add_timers(), 0 if there is none.
+ *   coro_timers_started_total,           counters of the same wheel.
+ *   coro_timers_cancelled_total,
+ *   coro_timers_expired_total,
+ *   coro_timers_cascaded_total
+ *   coro_wait_seconds                    histogram of time parked, per wait-reason in label
+ *                                        'reason', @see co_sched_wait_reason().
+ */
+
+#pragma once
+
+#include "coro_stats.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h> // offsetof
+#include <stdio.h>
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Render cnt sets of values, values[i] labeled with names[i], to buf.
+ *
+ * @return bytes written, excluding the terminating zero, or -1 if buf is too small.
+ */
+static inline int co_metrics_render_values( const co_stats_values* values, const char* const* names, uint32_t cnt, char* buf, size_t size );
+
+/**
+ * Render all schedulers in page to buf.
+ *
+ * @return bytes written, excluding the terminating zero, -1 if buf is too small or -2 if a
+ *         slot could not be read as it was being written, @see co_stats_read().
+ */
+static inline int co_metrics_render( co_stats* stats, char* buf, size_t size );
+
+/**
+ * Render all schedulers in page and write it to fd, blocking until all is written. Rendering
+ * is retried a few times if a slot is being written.
+ *
+ * @return false on error, errno is set. EBUSY if a slot stayed unreadable, for example as its
+ *         scheduler died while publishing.
+ */
+static inline bool co_metrics_write_fd( co_stats* stats, int fd );
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+struct _co_metrics_out
+{
+    char*  buf;
+    size_t size;
+    size_t used;
+    bool   overflow;
+};
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+static inline void _co_metrics_printf( _co_metrics_out* out, const char* fmt, ... )
+{
+    if(out->overflow)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(out->buf + out->used, out->size - out->used, fmt, args);
+    va_end(args);
+    if(len < 0 || (size_t)len >= out->size - out->used)
+        out->overflow = true;
+    else
+        out->used += (size_t)len;
+}
+
+/**
+ * Write label-value with '\', '"' and newline escaped.
+ */
+static inline void _co_metrics_label( _co_metrics_out* out, const char* name, const char* value )
+{
+    _co_metrics_printf(out, "%s=\"", name);
+    for(; *value; ++value)
+    {
+        switch(*value)
+        {
+            case '\\': _co_metrics_printf(out, "\\\\"); break;
+            case '"':  _co_metrics_printf(out, "\\\""); break;
+            case '\n': _co_metrics_printf(out, "\\n");  break;
+            default:   _co_metrics_printf(out, "%c", *value); break;
+        }
+    }
+    _co_metrics_printf(out, "\"");
+}
+
+static inline void _co_metrics_family( _co_metrics_out* out, const char* name, const char* type, const char* help )
+{
+    _co_metrics_printf(out, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static inline void _co_metrics_sample( _co_metrics_out* out, const char* name, const char* sched, uint64_t value )
+{
+    _co_metrics_printf(out, "%s{", name);
+    _co_metrics_label(out, "sched", sched);
+    _co_metrics_printf(out, "} %llu\n", (unsigned long long)value);
+}
+
+static inline int co_metrics_render_values( const co_stats_values* values, const char* const* names, uint32_t cnt, char* buf, size_t size )
+{
+    _co_metrics_out out;
+    out.buf      = buf;
+    out.size     = size;
+    out.used     = 0;
+    out.overflow = size == 0;
+
+    struct family
+    {
+        const char* name;
+        const char* sample;
+        const char* type;
+        const char* help;
+        size_t      offset;
+    };
+    static const family families[] = {
+        { "coro_live",             "coro_live",                   "gauge",   "Coroutines owned by the scheduler.",             offsetof(co_stats_values, live) },
+        { "coro_ready",            "coro_ready",                  "gauge",   "Coroutines in ready-queues.",                    offsetof(co_stats_values, ready) },
+        { "coro_resumes",          "coro_resumes_total",          "counter", "Coroutine resumes.",                             offsetof(co_stats_values, resumes) },
+        { "coro_parks",            "coro_parks_total",            "counter", "Coroutines parked waiting for a wake.",          offsetof(co_stats_values, parks) },
+        { "coro_stack_bytes",      "coro_stack_bytes",            "gauge",   "Memory used by stacks of live coroutines.",      offsetof(co_stats_values, stack_bytes) },
+        { "coro_stack_grows",      "coro_stack_grows_total",      "counter", "Stacks grown after overflow.",                   offsetof(co_stats_values, stack_grows) },
+        { "coro_spawn_rejected",   "coro_spawn_rejected_total",   "counter", "Spawns rejected by admission limits.",           offsetof(co_stats_values, spawn_rejected) },
+        { "coro_spawn_parked",     "coro_spawn_parked_total",     "counter", "co_spawn() parked by admission limits.",         offsetof(co_stats_values, spawn_parked) },
+        { "coro_pool_hits",        "coro_pool_hits_total",        "counter", "Spawns that reused a pooled task and stack.",    offsetof(co_stats_values, pool_hits) },
+        { "coro_pooled",           "coro_pooled",                 "gauge",   "Tasks and stacks kept in the pool.",             offsetof(co_stats_values, pooled) },
+        { "coro_timers_pending",   "coro_timers_pending",         "gauge",   "Timers started and not yet fired or cancelled.", offsetof(co_stats_values, timers_pending) },
+        { "coro_timers_started",   "coro_timers_started_total",   "counter", "Timers started.",                                offsetof(co_stats_values, timers_started) },
+        { "coro_timers_cancelled", "coro_timers_cancelled_total", "counter", "Timers cancelled before firing.",                offsetof(co_stats_values, timers_cancelled) },
+        { "coro_timers_expired",   "coro_timers_expired_total",   "counter", "Timers fired.",                                  offsetof(co_stats_values, timers_expired) },
+        { "coro_timers_cascaded",  "coro_timers_cascaded_total",  "counter", "Timers moved to a lower level of the wheel.",    offsetof(co_stats_values, timers_cascaded) },
+    };
+
+    for(size_t f = 0; f < sizeof(families) / sizeof(families[0]); ++f)
+    {
+        _co_metrics_family(&out, families[f].name, families[f].type, families[f].help);
+        for(uint32_t i = 0; i < cnt; ++i)
+        {
+            uint64_t value;
+            memcpy(&value, (const uint8_t*)&values[i] + families[f].offset, sizeof(value));
+            _co_metrics_sample(&out, families[f].sample, names[i], value);
+        }
+    }
+
+    _co_metrics_family(&out, "coro_wait_seconds", "histogram", "Time coroutines were parked until woken, by wait-reason.");
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        const co_stats_values* v = &values[i];
+        for(uint32_t r = 0; r < v->reason_cnt && r < CO_STATS_MAX_REASONS; ++r)
+        {
+            static const char* bounds[CO_SCHED_WAIT_BUCKETS] = { "1e-06", "1e-05", "0.0001", "0.001", "0.01", "0.1", "1.0", "10.0", "+Inf" };
+            uint64_t cumulative = 0;
+            for(uint32_t b = 0; b < CO_SCHED_WAIT_BUCKETS; ++b)
+            {
+                cumulative += v->reason_buckets[r][b];
+                _co_metrics_printf(&out, "coro_wait_seconds_bucket{");
+                _co_metrics_label(&out, "sched", names[i]);
+                _co_metrics_printf(&out, ",");
+                _co_metrics_label(&out, "reason", v->reasons[r]);
+                _co_metrics_printf(&out, ",le=\"%s\"} %llu\n", bounds[b], (unsigned long long)cumulative);
+            }
+            _co_metrics_printf(&out, "coro_wait_seconds_count{");
+            _co_metrics_label(&out, "sched", names[i]);
+            _co_metrics_printf(&out, ",");
+            _co_metrics_label(&out, "reason", v->reasons[r]);
+            _co_metrics_printf(&out, "} %llu\n", (unsigned long long)v->reason_wakes[r]);
+            _co_metrics_printf(&out, "coro_wait_seconds_sum{");
+            _co_metrics_label(&out, "sched", names[i]);
+            _co_metrics_printf(&out, ",");
+            _co_metrics_label(&out, "reason", v->reasons[r]);
+            _co_metrics_printf(&out, "} %.9f\n", (double)v->reason_wait_ns[r] / 1e9);
+        }
+    }
+    _co_metrics_printf(&out, "# EOF\n");
+
+    return out.overflow ? -1 : (int)out.used;
+}
+
+static inline int co_metrics_render( co_stats* stats, char* buf, size_t size )
+{
+    co_stats_values values[CORO_STATS_MAX_SCHEDS];
+    const char*     names[CORO_STATS_MAX_SCHEDS];
+    uint32_t cnt = __atomic_load_n(&stats->page->slot_cnt, __ATOMIC_ACQUIRE);
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        if(!co_stats_read(&stats->page->slots[i], &values[i]))
+            return -2;
+        names[i] = stats->page->slots[i].name;
+    }
+    return co_metrics_render_values(values, names, cnt, buf, size);
+}
+
+static inline bool co_metrics_write_fd( co_stats* stats, int fd )
+{
+    size_t size  = 16 * 1024;
+    char*  buf   = (char*)CORO_SCHED_ALLOC(size);
+    int    len   = co_metrics_render(stats, buf, size);
+    int    tries = 0;
+    while(len < 0)
+    {
+        if(len == -2)
+        {
+            // a slot is being written, only the values changed so retry with the same buffer.
+            if(++tries == 16)
+            {
+                CORO_SCHED_FREE(buf);
+                errno = EBUSY;
+                return false;
+            }
+        }
+        else
+        {
+            size *= 2;
+            if(size > 64 * 1024 * 1024)
+            {
+                CORO_SCHED_FREE(buf);
+                errno = ENOBUFS;
+                return false;
+            }
+            CORO_SCHED_FREE(buf);
+            buf = (char*)CORO_SCHED_ALLOC(size);
+        }
+        len = co_metrics_render(stats, buf, size);
+    }
+
+    size_t written = 0;
+    while(written < (size_t)len)
+    {
+        ssize_t res = write(fd, buf + written, (size_t)len - written);
+        if(res < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            CORO_SCHED_FREE(buf);
+            return false;
+        }
+        written += (size_t)res;
+    }
+    CORO_SCHED_FREE(buf);
+    return true;
+}
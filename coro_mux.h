@@ -0,0 +1,530 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Client-side multiplexing of requests from many coroutines over a few stream-connections.
+ *
+ * Each connection is served by one writer- and one reader-coroutine. Requests are tagged
+ * with a correlation-id and queued on the connection with the least outstanding requests,
+ * the writer batches all queued requests into one writev() and the reader matches responses
+ * to the parked callers via the id, responses can arrive in any order.
+ *
+ * Frames on the wire, in both directions, are a co_mux_header followed by 'size' bytes of
+ * payload, in host byte-order as this is intended for local backends.
+ *
+ * co_mux mux;
+ * co_mux_init(&mux, &io, &sched, fds, fd_cnt);
+ *
+ * static void my_coroutine(coro* co, void*, void*)
+ * {
+ *     co_locals_begin(co);
+ *         co_mux_request req;
+ *         char           resp[256];
+ *     co_locals_end(co);
+ *
+ *     co_begin(co);
+ *
+ *     co_mux_request_init(&locals.req, "ping", 4, locals.resp, sizeof(locals.resp));
+ *     co_mux_call(co, &mux, &locals.req);
+ *
+ *     if(locals.req.result >= 0)
+ *         ; // locals.req.result bytes of response is in locals.resp
+ *
+ *     co_end(co);
+ * }
+ *
+ * @note the request and all buffers it point to need to be valid until the call has
+ *       completed, storing them in locals is valid as the stack of a parked coroutine is
+ *       never replaced.
+ */
+
+#pragma once
+
+#include "coro_io.h"
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_MUX_MAX_BATCH to configure max number of requests written by one writev(),
+ * defaults to 64.
+ */
+#if !defined(CORO_MUX_MAX_BATCH)
+#  define CORO_MUX_MAX_BATCH 64
+#endif
+
+/**
+ * Define CORO_MUX_READ_BUFFER to configure size of the read-buffer of each connection, this
+ * is also the max size of a response-frame, defaults to 64KB.
+ */
+#if !defined(CORO_MUX_READ_BUFFER)
+#  define CORO_MUX_READ_BUFFER (64 * 1024)
+#endif
+
+/**
+ * Define CORO_MUX_INFLIGHT_BUCKETS to configure size of the hash-table used to find in-flight
+ * requests on each connection, needs to be a power of 2, defaults to 256.
+ */
+#if !defined(CORO_MUX_INFLIGHT_BUCKETS)
+#  define CORO_MUX_INFLIGHT_BUCKETS 256
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+struct co_mux_header
+{
+    uint32_t size;
+    uint32_t id;
+};
+
+struct co_mux_request
+{
+    const void*     data;
+    uint32_t        size;
+    void*           resp;
+    uint32_t        resp_cap;
+    int32_t         result;   ///< size of response or -errno, -EMSGSIZE if response did not fit in resp.
+
+    uint32_t        id;
+    coro*           waiter;
+    co_mux_request* next;
+    co_mux_header   header;
+};
+
+struct co_mux;
+
+struct co_mux_conn
+{
+    co_io_fd         io_fd;
+    co_mux*          mux;
+
+    co_mux_request*  out_head;      ///< requests waiting to be written.
+    co_mux_request*  out_tail;
+    uint32_t         out_cnt;
+    uint32_t         inflight_cnt;
+    co_mux_request*  inflight[CORO_MUX_INFLIGHT_BUCKETS];
+
+    coro*            writer;        ///< writer-coroutine if it is parked waiting for requests.
+    coro*            tasks[2];      ///< writer- and reader-coroutine as spawned.
+    uint32_t         closed : 1;
+
+    struct iovec     iov[CORO_MUX_MAX_BATCH * 2];
+    int              iov_cnt;
+    int              iov_pos;
+
+    uint32_t         rbuf_len;
+    uint8_t          rbuf[CORO_MUX_READ_BUFFER];
+};
+
+struct co_mux
+{
+    co_io*       io;
+    co_sched*    sched;
+    co_mux_conn* conns;
+    uint32_t     conn_cnt;
+    uint32_t     next_id;
+
+    uint64_t     writev_calls;
+    uint64_t     requests;
+    uint64_t     responses;
+};
+
+/**
+ * Initialize multiplexer over fd_cnt connected stream-sockets, the fds are registered with io
+ * and a reader- and writer-coroutine is spawned per connection in sched.
+ *
+ * @return false if any fd could not be registered with io or the coroutines could not be
+ *         spawned, nothing is then left registered or spawned and co_mux_destroy() is a no-op.
+ */
+static inline bool co_mux_init( co_mux* mux, co_io* io, co_sched* sched, const int* fds, uint32_t fd_cnt );
+
+/**
+ * Shutdown all connections, all requests not yet completed fail with -EPIPE and the reader-
+ * and writer-coroutines exit the next time the scheduler and reactor is run.
+ */
+static inline void co_mux_close( co_mux* mux );
+
+/**
+ * Free memory used by mux, call after co_mux_close() when all its coroutines has exited.
+ * The fds are not closed.
+ */
+static inline void co_mux_destroy( co_mux* mux );
+
+static inline void co_mux_request_init( co_mux_request* req, const void* data, uint32_t size, void* resp, uint32_t resp_cap );
+
+/**
+ * Send request and park the coroutine until the response has arrived, the result is available
+ * in req->result when the coroutine is resumed.
+ */
+#define co_mux_call(co, mux, req)
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_mux_call
+
+static inline void co_mux_request_init( co_mux_request* req, const void* data, uint32_t size, void* resp, uint32_t resp_cap )
+{
+    req->data     = data;
+    req->size     = size;
+    req->resp     = resp;
+    req->resp_cap = resp_cap;
+    req->result   = 0;
+    req->id       = 0;
+    req->waiter   = nullptr;
+    req->next     = nullptr;
+}
+
+static inline void _co_mux_complete( co_mux_request* req, int32_t result )
+{
+    req->result = result;
+    co_sched_wake(req->waiter);
+}
+
+static inline void _co_mux_fail_all( co_mux_conn* conn )
+{
+    conn->closed = 1;
+    while(co_mux_request* req = conn->out_head)
+    {
+        conn->out_head = req->next;
+        _co_mux_complete(req, -EPIPE);
+    }
+    conn->out_tail = nullptr;
+    conn->out_cnt  = 0;
+
+    for(uint32_t i = 0; i < CORO_MUX_INFLIGHT_BUCKETS; ++i)
+    {
+        while(co_mux_request* req = conn->inflight[i])
+        {
+            conn->inflight[i] = req->next;
+            _co_mux_complete(req, -EPIPE);
+        }
+    }
+    conn->inflight_cnt = 0;
+
+    if(conn->writer)
+    {
+        coro* writer = conn->writer;
+        conn->writer = nullptr;
+        co_sched_wake(writer);
+    }
+}
+
+static inline void _co_mux_submit( co_mux* mux, co_mux_request* req, coro* co )
+{
+    req->waiter = co->call.root;
+    req->id     = mux->next_id++;
+    co_sched_wait_reason(co, "mux_request");
+    req->next   = nullptr;
+    ++mux->requests;
+
+    // pick the connection with least outstanding requests.
+    co_mux_conn* conn = nullptr;
+    uint32_t best = 0xFFFFFFFF;
+    for(uint32_t i = 0; i < mux->conn_cnt; ++i)
+    {
+        co_mux_conn* c = &mux->conns[i];
+        uint32_t outstanding = c->out_cnt + c->inflight_cnt;
+        if(!c->closed && outstanding < best)
+        {
+            best = outstanding;
+            conn = c;
+        }
+    }
+
+    if(conn == nullptr)
+    {
+        _co_mux_complete(req, -EPIPE);
+        return;
+    }
+
+    if(conn->out_tail)
+        conn->out_tail->next = req;
+    else
+        conn->out_head = req;
+    conn->out_tail = req;
+    ++conn->out_cnt;
+
+    if(conn->writer)
+    {
+        coro* writer = conn->writer;
+        conn->writer = nullptr;
+        co_sched_wake(writer);
+    }
+}
+
+#define co_mux_call(co, mux, req) \
+    do { _co_mux_submit((mux), (req), co); co_wait(co); } while(0)
+
+/**
+ * Move queued requests to in-flight and setup iovs for them.
+ */
+static inline void _co_mux_build_batch( co_mux_conn* conn )
+{
+    conn->iov_cnt = 0;
+    conn->iov_pos = 0;
+    for(int i = 0; i < CORO_MUX_MAX_BATCH && conn->out_head; ++i)
+    {
+        co_mux_request* req = conn->out_head;
+        conn->out_head = req->next;
+        --conn->out_cnt;
+
+        req->header.size = req->size;
+        req->header.id   = req->id;
+        conn->iov[conn->iov_cnt].iov_base   = &req->header;
+        conn->iov[conn->iov_cnt++].iov_len  = sizeof(co_mux_header);
+        conn->iov[conn->iov_cnt].iov_base   = (void*)req->data;
+        conn->iov[conn->iov_cnt++].iov_len  = req->size;
+
+        co_mux_request** bucket = &conn->inflight[req->id & (CORO_MUX_INFLIGHT_BUCKETS - 1)];
+        req->next = *bucket;
+        *bucket   = req;
+        ++conn->inflight_cnt;
+    }
+    if(conn->out_head == nullptr)
+        conn->out_tail = nullptr;
+}
+
+/**
+ * Advance iovs by bytes written.
+ */
+static inline void _co_mux_consume_iov( co_mux_conn* conn, size_t bytes )
+{
+    while(bytes > 0)
+    {
+        struct iovec* v = &conn->iov[conn->iov_pos];
+        if(bytes >= v->iov_len)
+        {
+            bytes -= v->iov_len;
+            ++conn->iov_pos;
+        }
+        else
+        {
+            v->iov_base = (uint8_t*)v->iov_base + bytes;
+            v->iov_len -= bytes;
+            bytes = 0;
+        }
+    }
+}
+
+static inline void _co_mux_writer( coro* co, void*, void* arg )
+{
+    co_mux_conn* conn = *(co_mux_conn**)arg;
+
+    co_locals_begin(co);
+        ssize_t res = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    while(!conn->closed)
+    {
+        if(conn->out_head == nullptr)
+        {
+            conn->writer = co->call.root;
+            co_wait(co);
+            continue;
+        }
+
+        _co_mux_build_batch(conn);
+        while(conn->iov_pos < conn->iov_cnt && !conn->closed)
+        {
+            locals.res = writev(conn->io_fd.fd, conn->iov + conn->iov_pos, conn->iov_cnt - conn->iov_pos);
+            ++conn->mux->writev_calls;
+            if(locals.res < 0)
+            {
+                if(errno != EAGAIN)
+                {
+                    _co_mux_fail_all(conn);
+                    break;
+                }
+                co_io_wait_writable(co, &conn->io_fd);
+            }
+            else
+                _co_mux_consume_iov(conn, (size_t)locals.res);
+        }
+    }
+
+    co_end(co);
+}
+
+static inline co_mux_request* _co_mux_take_inflight( co_mux_conn* conn, uint32_t id )
+{
+    co_mux_request** it = &conn->inflight[id & (CORO_MUX_INFLIGHT_BUCKETS - 1)];
+    while(*it && (*it)->id != id)
+        it = &(*it)->next;
+    co_mux_request* req = *it;
+    if(req)
+    {
+        *it = req->next;
+        --conn->inflight_cnt;
+    }
+    return req;
+}
+
+/**
+ * Dispatch all complete frames in read-buffer, returns false if the stream is corrupt.
+ */
+static inline bool _co_mux_dispatch( co_mux_conn* conn )
+{
+    uint32_t pos = 0;
+    while(conn->rbuf_len - pos >= sizeof(co_mux_header))
+    {
+        co_mux_header hdr;
+        memcpy(&hdr, conn->rbuf + pos, sizeof(hdr));
+        if(hdr.size > CORO_MUX_READ_BUFFER - sizeof(co_mux_header))
+            return false;
+        if(conn->rbuf_len - pos - sizeof(co_mux_header) < hdr.size)
+            break;
+
+        const uint8_t* payload = conn->rbuf + pos + sizeof(co_mux_header);
+        pos += (uint32_t)sizeof(co_mux_header) + hdr.size;
+
+        co_mux_request* req = _co_mux_take_inflight(conn, hdr.id);
+        if(req == nullptr)
+            continue; // unknown id, drop it.
+
+        ++conn->mux->responses;
+        if(hdr.size > req->resp_cap)
+            _co_mux_complete(req, -EMSGSIZE);
+        else
+        {
+            memcpy(req->resp, payload, hdr.size);
+            _co_mux_complete(req, (int32_t)hdr.size);
+        }
+    }
+
+    conn->rbuf_len -= pos;
+    memmove(conn->rbuf, conn->rbuf + pos, conn->rbuf_len);
+    return true;
+}
+
+static inline void _co_mux_reader( coro* co, void*, void* arg )
+{
+    co_mux_conn* conn = *(co_mux_conn**)arg;
+
+    co_locals_begin(co);
+        ssize_t res = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    while(!conn->closed)
+    {
+        co_io_read(co, &conn->io_fd, conn->rbuf + conn->rbuf_len, CORO_MUX_READ_BUFFER - conn->rbuf_len, locals.res);
+        if(locals.res <= 0)
+        {
+            _co_mux_fail_all(conn);
+            break;
+        }
+
+        conn->rbuf_len += (uint32_t)locals.res;
+        if(!_co_mux_dispatch(conn))
+            _co_mux_fail_all(conn);
+    }
+
+    co_end(co);
+}
+
+static inline bool co_mux_init( co_mux* mux, co_io* io, co_sched* sched, const int* fds, uint32_t fd_cnt )
+{
+    mux->io           = io;
+    mux->sched        = sched;
+    mux->conn_cnt     = fd_cnt;
+    mux->next_id      = 1;
+    mux->writev_calls = 0;
+    mux->requests     = 0;
+    mux->responses    = 0;
+    mux->conns        = (co_mux_conn*)CORO_SCHED_ALLOC(sizeof(co_mux_conn) * fd_cnt);
+
+    uint32_t added = 0;
+    for(; added < fd_cnt; ++added)
+    {
+        co_mux_conn* conn = &mux->conns[added];
+        memset(conn, 0, sizeof(co_mux_conn));
+        conn->mux = mux;
+        if(!co_io_add(io, &conn->io_fd, fds[added]))
+            break;
+    }
+
+    uint32_t spawned = 0;
+    if(added == fd_cnt)
+    {
+        for(; spawned < fd_cnt; ++spawned)
+        {
+            co_mux_conn* conn = &mux->conns[spawned];
+            conn->tasks[0] = co_sched_spawn(sched, _co_mux_writer, conn);
+            conn->tasks[1] = conn->tasks[0] ? co_sched_spawn(sched, _co_mux_reader, conn) : nullptr;
+            if(conn->tasks[1] == nullptr)
+                break;
+        }
+    }
+    if(spawned == fd_cnt)
+        return true;
+
+    // undo the partial init, coroutines that was spawned are still in the ready-queue and
+    // are freed without being resumed when cancelled.
+    for(uint32_t i = 0; i <= spawned && i < fd_cnt; ++i)
+        for(int t = 0; t < 2; ++t)
+            if(mux->conns[i].tasks[t])
+                co_sched_cancel(mux->conns[i].tasks[t]);
+    for(uint32_t i = 0; i < added; ++i)
+        co_io_remove(io, &mux->conns[i].io_fd);
+    CORO_SCHED_FREE(mux->conns);
+    mux->conns    = nullptr;
+    mux->conn_cnt = 0;
+    return false;
+}
+
+static inline void co_mux_close( co_mux* mux )
+{
+    for(uint32_t i = 0; i < mux->conn_cnt; ++i)
+    {
+        co_mux_conn* conn = &mux->conns[i];
+        shutdown(conn->io_fd.fd, SHUT_RDWR);
+        _co_mux_fail_all(conn);
+    }
+}
+
+static inline void co_mux_destroy( co_mux* mux )
+{
+    for(uint32_t i = 0; i < mux->conn_cnt; ++i)
+        co_io_remove(mux->io, &mux->conns[i].io_fd);
+    CORO_SCHED_FREE(mux->conns);
+}
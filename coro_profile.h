@@ -0,0 +1,411 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Profiler attributing hardware performance counters to each co_func, linux-only.
+ *
+ * Counters are read with perf_event_open() each time a frame starts or stops executing, i.e.
+ * at co_resume() entry and exit and at each co_call() and return, and the difference is
+ * charged to the function that was executing. Counts are exclusive, a function is not charged
+ * for the functions it co_call():s, and time between resumes is not charged to anything.
+ *
+ * Requires CORO_FRAME_HOOKS to be defined to 1 in all translation-units that resume the
+ * coroutines to profile, before including any coro-header.
+ *
+ * #define CORO_FRAME_HOOKS 1
+ * #include "coro_profile.h"
+ *
+ * co_profile prof;
+ * co_profile_init(&prof);
+ * co_profile_begin(&prof);
+ * co_sched_run(&sched);
+ * co_profile_end(&prof);
+ *
+ * char report[8192];
+ * co_profile_report(&prof, report, sizeof(report));
+ * co_profile_destroy(&prof);
+ *
+ * Counters that can't be opened, for example in virtual machines or if perf_event_paranoid
+ * forbids it, are reported as unavailable and the profiler falls back to count invocations
+ * and wall-time per function. Counting is per thread, the profiler measures the thread that
+ * called co_profile_init() and its hooks are only installed on the thread calling
+ * co_profile_begin().
+ *
+ * @note reading the counters is a syscall per frame-transition, expect resumes to become a
+ *       few microseconds slower while profiling.
+ */
+
+#pragma once
+
+#if !CORO_FRAME_HOOKS
+#  error "coro_profile.h requires CORO_FRAME_HOOKS to be defined to 1 before including any coro-header"
+#endif
+
+#include "coro.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_PROFILE_MAX_FUNCS to configure the max number of distinct co_funcs tracked,
+ * defaults to 256. Need to be a power of 2.
+ */
+#if !defined(CORO_PROFILE_MAX_FUNCS)
+#  define CORO_PROFILE_MAX_FUNCS 256
+#endif
+
+/**
+ * Define CORO_PROFILE_MAX_DEPTH to configure the max depth of co_call():s tracked, deeper
+ * frames are charged to the frame at max depth, defaults to 64.
+ */
+#if !defined(CORO_PROFILE_MAX_DEPTH)
+#  define CORO_PROFILE_MAX_DEPTH 64
+#endif
+
+/**
+ * Define CORO_PROFILE_FUNC_NAME(func) to an expression returning a name of a co_func, or
+ * nullptr, to use in reports. Functions are written as addresses otherwise.
+ */
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+enum co_profile_counter
+{
+    CO_PROFILE_CYCLES,
+    CO_PROFILE_INSTRUCTIONS,
+    CO_PROFILE_CACHE_MISSES,
+    CO_PROFILE_BRANCH_MISSES,
+    CO_PROFILE_TIME_NS,         ///< wall-time, always available.
+
+    CO_PROFILE_COUNTERS
+};
+
+struct co_profile_entry
+{
+    co_func  func;              ///< nullptr for unused entries.
+    uint64_t invocations;       ///< number of times the function has started executing.
+    uint64_t counters[CO_PROFILE_COUNTERS];
+};
+
+struct co_profile
+{
+    int      group_fd;                       ///< -1 if no hardware counter could be opened.
+    int      fds[CO_PROFILE_TIME_NS];
+    int      read_index[CO_PROFILE_TIME_NS]; ///< index of counter in a group-read, -1 if unavailable.
+    uint32_t open_cnt;
+
+    uint64_t last[CO_PROFILE_COUNTERS];      ///< counters at last transition.
+    uint32_t stack[CORO_PROFILE_MAX_DEPTH];    ///< entry-index of executing frames.
+    uint32_t depth;
+    uint32_t overflow_depth;                 ///< frames deeper than CORO_PROFILE_MAX_DEPTH.
+
+    co_profile_entry entries[CORO_PROFILE_MAX_FUNCS];
+    uint32_t         entry_cnt;
+    uint64_t         dropped;                ///< transitions of functions that did not fit in entries.
+};
+
+/**
+ * Initialize profiler and open the counters for the calling thread.
+ *
+ * @return true if any hardware counter could be opened, if not the profiler still works but
+ *         only counts invocations and time.
+ */
+static inline bool co_profile_init( co_profile* prof );
+
+/**
+ * Close counters.
+ */
+static inline void co_profile_destroy( co_profile* prof );
+
+/**
+ * Returns true if counter could be opened.
+ */
+static inline bool co_profile_available( const co_profile* prof, co_profile_counter counter );
+
+/**
+ * Install/remove the frame-hooks for this thread, @see co_set_frame_hooks().
+ */
+static inline void co_profile_begin( co_profile* prof );
+static inline void co_profile_end( co_profile* prof );
+
+/**
+ * Clear all accumulated counters.
+ */
+static inline void co_profile_reset( co_profile* prof );
+
+/**
+ * Write a table of all profiled functions, most time first, with invocations, time, cycles,
+ * instructions, instructions per cycle and cache- and branch-misses per 1000 instructions.
+ *
+ * @return bytes written, excluding the terminating zero, or -1 if buf is too small.
+ */
+static inline int co_profile_report( const co_profile* prof, char* buf, size_t size );
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+static inline int _co_profile_open( uint64_t config, int group_fd )
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = config;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static inline bool co_profile_init( co_profile* prof )
+{
+    static const uint64_t configs[CO_PROFILE_TIME_NS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    memset(prof, 0, sizeof(co_profile));
+    prof->group_fd = -1;
+    for(int i = 0; i < CO_PROFILE_TIME_NS; ++i)
+    {
+        // the first counter that can be opened leads the group so all are read with one read().
+        prof->fds[i]        = _co_profile_open(configs[i], prof->group_fd);
+        prof->read_index[i] = -1;
+        if(prof->fds[i] < 0)
+            continue;
+        if(prof->group_fd < 0)
+            prof->group_fd = prof->fds[i];
+        prof->read_index[i] = (int)prof->open_cnt++;
+    }
+    return prof->group_fd >= 0;
+}
+
+static inline void co_profile_destroy( co_profile* prof )
+{
+    for(int i = 0; i < CO_PROFILE_TIME_NS; ++i)
+        if(prof->fds[i] >= 0)
+            close(prof->fds[i]);
+    prof->group_fd = -1;
+}
+
+static inline bool co_profile_available( const co_profile* prof, co_profile_counter counter )
+{
+    return counter == CO_PROFILE_TIME_NS || prof->read_index[counter] >= 0;
+}
+
+static inline void co_profile_reset( co_profile* prof )
+{
+    memset(prof->entries, 0, sizeof(prof->entries));
+    prof->entry_cnt = 0;
+    prof->dropped   = 0;
+    prof->depth     = 0;
+    prof->overflow_depth = 0;
+}
+
+static inline void _co_profile_sample( co_profile* prof, uint64_t* out )
+{
+    if(prof->group_fd >= 0)
+    {
+        uint64_t values[1 + CO_PROFILE_TIME_NS];
+        if(read(prof->group_fd, values, sizeof(values)) > 0)
+        {
+            for(int i = 0; i < CO_PROFILE_TIME_NS; ++i)
+                out[i] = prof->read_index[i] >= 0 ? values[1 + prof->read_index[i]] : 0;
+        }
+    }
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    out[CO_PROFILE_TIME_NS] = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint32_t _co_profile_entry( co_profile* prof, co_func func )
+{
+    // open addressing on the function-pointer, CORO_PROFILE_MAX_FUNCS marks "not found".
+    uint32_t mask = CORO_PROFILE_MAX_FUNCS - 1;
+    uint64_t hash = (uint64_t)(uintptr_t)func * 0x9E3779B97F4A7C15ull;
+    uint32_t idx  = (uint32_t)(hash >> 32) & mask;
+    for(uint32_t probe = 0; probe < CORO_PROFILE_MAX_FUNCS; ++probe, idx = (idx + 1) & mask)
+    {
+        co_profile_entry* e = &prof->entries[idx];
+        if(e->func == func)
+            return idx;
+        if(e->func == nullptr)
+        {
+            e->func = func;
+            ++prof->entry_cnt;
+            return idx;
+        }
+    }
+    return CORO_PROFILE_MAX_FUNCS;
+}
+
+/**
+ * Charge counters since the last transition to the executing frame, if any.
+ */
+static inline void _co_profile_charge( co_profile* prof )
+{
+    // counters that fail to read count as unchanged.
+    uint64_t now[CO_PROFILE_COUNTERS];
+    memcpy(now, prof->last, sizeof(now));
+    _co_profile_sample(prof, now);
+    if(prof->depth > 0 && prof->stack[prof->depth - 1] < CORO_PROFILE_MAX_FUNCS)
+    {
+        co_profile_entry* e = &prof->entries[prof->stack[prof->depth - 1]];
+        for(int i = 0; i < CO_PROFILE_COUNTERS; ++i)
+            e->counters[i] += now[i] - prof->last[i];
+    }
+    memcpy(prof->last, now, sizeof(now));
+}
+
+static inline void _co_profile_enter( coro*, co_func func, void* userdata )
+{
+    co_profile* prof = (co_profile*)userdata;
+    _co_profile_charge(prof);
+    if(prof->depth == CORO_PROFILE_MAX_DEPTH)
+    {
+        ++prof->overflow_depth;
+        return;
+    }
+    uint32_t idx = _co_profile_entry(prof, func);
+    if(idx < CORO_PROFILE_MAX_FUNCS)
+        ++prof->entries[idx].invocations;
+    else
+        ++prof->dropped;
+    prof->stack[prof->depth++] = idx;
+}
+
+static inline void _co_profile_exit( coro*, co_func, void* userdata )
+{
+    co_profile* prof = (co_profile*)userdata;
+    _co_profile_charge(prof);
+    if(prof->overflow_depth > 0)
+        --prof->overflow_depth;
+    else if(prof->depth > 0) // hooks might have been installed mid-resume.
+        --prof->depth;
+}
+
+static inline void co_profile_begin( co_profile* prof )
+{
+    prof->depth          = 0;
+    prof->overflow_depth = 0;
+    co_set_frame_hooks(_co_profile_enter, _co_profile_exit, prof);
+}
+
+static inline void co_profile_end( co_profile* )
+{
+    co_set_frame_hooks(nullptr, nullptr, nullptr);
+}
+
+static inline int co_profile_report( const co_profile* prof, char* buf, size_t size )
+{
+    // sort entries by time, most first.
+    const co_profile_entry* sorted[CORO_PROFILE_MAX_FUNCS];
+    uint32_t cnt = 0;
+    for(uint32_t i = 0; i < CORO_PROFILE_MAX_FUNCS; ++i)
+    {
+        const co_profile_entry* e = &prof->entries[i];
+        if(e->func == nullptr)
+            continue;
+        uint32_t at = cnt++;
+        while(at > 0 && sorted[at - 1]->counters[CO_PROFILE_TIME_NS] < e->counters[CO_PROFILE_TIME_NS])
+        {
+            sorted[at] = sorted[at - 1];
+            --at;
+        }
+        sorted[at] = e;
+    }
+
+    bool has_cycles   = co_profile_available(prof, CO_PROFILE_CYCLES);
+    bool has_instr    = co_profile_available(prof, CO_PROFILE_INSTRUCTIONS);
+    bool has_cache    = co_profile_available(prof, CO_PROFILE_CACHE_MISSES);
+    bool has_branches = co_profile_available(prof, CO_PROFILE_BRANCH_MISSES);
+
+    size_t used = 0;
+    int len = snprintf(buf, size, "%-24s %12s %12s %14s %14s %6s %14s %14s\n",
+                       "func", "invocations", "time ms", "cycles", "instructions", "ipc", "cache-miss/ki", "branch-miss/ki");
+    if(len < 0 || (size_t)len >= size)
+        return -1;
+    used += (size_t)len;
+
+    for(uint32_t i = 0; i < cnt; ++i)
+    {
+        const co_profile_entry* e = sorted[i];
+        const uint64_t*         c = e->counters;
+
+        char name[32];
+        const char* func_name = nullptr;
+#if defined(CORO_PROFILE_FUNC_NAME)
+        func_name = CORO_PROFILE_FUNC_NAME(e->func);
+#endif
+        if(func_name == nullptr)
+        {
+            snprintf(name, sizeof(name), "0x%llx", (unsigned long long)(uintptr_t)e->func);
+            func_name = name;
+        }
+
+        char cycles[24] = "-", instr[24] = "-", ipc[16] = "-", cache[24] = "-", branches[24] = "-";
+        double kinstr = (double)c[CO_PROFILE_INSTRUCTIONS] / 1000.0;
+        if(has_cycles)
+            snprintf(cycles, sizeof(cycles), "%llu", (unsigned long long)c[CO_PROFILE_CYCLES]);
+        if(has_instr)
+            snprintf(instr, sizeof(instr), "%llu", (unsigned long long)c[CO_PROFILE_INSTRUCTIONS]);
+        if(has_cycles && has_instr && c[CO_PROFILE_CYCLES] > 0)
+            snprintf(ipc, sizeof(ipc), "%.2f", (double)c[CO_PROFILE_INSTRUCTIONS] / (double)c[CO_PROFILE_CYCLES]);
+        if(has_cache && has_instr && kinstr > 0.0)
+            snprintf(cache, sizeof(cache), "%.3f", (double)c[CO_PROFILE_CACHE_MISSES] / kinstr);
+        if(has_branches && has_instr && kinstr > 0.0)
+            snprintf(branches, sizeof(branches), "%.3f", (double)c[CO_PROFILE_BRANCH_MISSES] / kinstr);
+
+        len = snprintf(buf + used, size - used, "%-24.24s %12llu %12.3f %14s %14s %6s %14s %14s\n",
+                       func_name,
+                       (unsigned long long)e->invocations,
+                       (double)c[CO_PROFILE_TIME_NS] / 1e6,
+                       cycles, instr, ipc, cache, branches);
+        if(len < 0 || (size_t)len >= size - used)
+            return -1;
+        used += (size_t)len;
+    }
+    return (int)used;
+}
@@ -0,0 +1,1374 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Minimal scheduler on top of coro.h that owns coroutines and their stacks and resumes
+ * them in fifo-order.
+ *
+ * co_sched sched;
+ * co_sched_init(&sched, 1024, nullptr);
+ *
+ * co_sched_spawn(&sched, my_coroutine);
+ * co_sched_spawn(&sched, my_other_coroutine, my_arg);
+ *
+ * while(co_sched_live(&sched) > 0)
+ * {
+ *     co_sched_step(&sched);
+ *     // ... update systems that wakes waiting coroutines ...
+ * }
+ *
+ * co_sched_destroy(&sched);
+ *
+ * After each resume a coroutine will be:
+ * - completed: the coroutine and its stack is freed.
+ * - overflowed its stack: the stack is doubled and the coroutine is put back in the ready-queue.
+ * - waiting via co_wait(): the coroutine is "parked" and will not be resumed until some other
+ *   system calls co_sched_wake() on it.
+ * - yielded via co_yield() or co_call(): put back last in the ready-queue.
+ *
+ * WAITING:
+ *
+ * A system that want to suspend a coroutine until something happens stores the root coro
+ * (co->call.root) in some list of its own and calls co_wait(). When the event occurs the
+ * system calls co_sched_wake() on the stored coro. It is valid to call co_sched_wake() on the
+ * coroutine while it is still executing, it will then be put back in the ready-queue directly
+ * when it co_wait():s.
+ *
+ * A scheduler is not thread-safe, all calls on it and its coroutines need to be made from the
+ * thread running it, except co_sched_wake_remote() that is used to wake a parked coroutine
+ * from another thread. The wake is handed over through a lock-free inbox in the scheduler
+ * and takes effect at the start of the next co_sched_step() on the owning thread.
+ *
+ * CANCELLATION:
+ *
+ * co_sched_cancel() flags a coroutine as cancelled, it will never be resumed again and is
+ * freed when it is popped from the ready-queue or, if it is parked, when the system it is
+ * waiting on calls co_sched_wake() on it. Systems holding waiting coroutines should check
+ * co_sched_cancelled() and drop work for cancelled coroutines.
+ *
+ * @note as with the rest of coro no destructors are run on locals or arguments of cancelled
+ *       coroutines.
+ *
+ * GROUPS:
+ *
+ * Coroutines can be spawned into a co_sched_group, for example one per tenant, with
+ * co_sched_spawn_in(). Each group has its own ready-queue and the scheduler picks the group
+ * to resume from with deficit-round-robin. Each round a group with ready coroutines gets a
+ * quantum of weight * CORO_SCHED_QUANTUM and is charged for each resume, so groups get their
+ * share of resumes according to their weights no matter how many coroutines they have ready.
+ * A scheduling decision is O(1), amortized over the cost of the resumes if CORO_SCHED_CLOCK
+ * is used.
+ *
+ * co_sched_group tenant_a, tenant_b;
+ * co_sched_group_init(&tenant_a, 3); // gets 3 resumes for each resume of tenant_b
+ * co_sched_group_init(&tenant_b, 1);
+ * co_sched_spawn_in(&sched, &tenant_a, handle_request, req);
+ *
+ * Coroutines spawned with co_sched_spawn() go into the group of the coroutine currently
+ * executing in the scheduler, so everything a tenant spawns is accounted to that tenant.
+ * Outside of a coroutine they go into the default group of the scheduler that has weight 1.
+ * Groups need to outlive all coroutines spawned into them.
+ *
+ * ADMISSION CONTROL:
+ *
+ * co_sched_set_limits() bounds the number of live coroutines and/or the memory used by their
+ * stacks. When a limit is reached co_sched_spawn() fails by returning nullptr while co_spawn(),
+ * that is used from within a coroutine, parks the spawning coroutine until enough coroutines
+ * have completed to let the new one in. Bounding the work in progress this way pushes back on
+ * whatever produces the work instead of letting the ready-queues and memory grow without limit.
+ *
+ * void accept_loop(coro* co, void*, void*)
+ * {
+ *     ...
+ *     co_spawn(co, handle_connection, locals.conn);  // parks while the scheduler is full.
+ * }
+ *
+ * @note a stack that grows on overflow is always grown, the stack-limit is only checked on
+ *       spawn so the stack memory in use may go above the limit.
+ *
+ * STACK POOL:
+ *
+ * Tasks and stacks of default_stack_size are kept in a pool when coroutines complete and
+ * reused by the next spawn, so that spawning short-lived coroutines, for example a
+ * fire-and-forget notification with co_spawn() from within a coroutine, don't hit the
+ * allocator. Stacks that have been grown due to overflow are freed. Up to CORO_SCHED_POOL_MAX
+ * entries are kept and co_sched_pool_reserve() can be used to fill the pool up front.
+ *
+ * REGISTRY:
+ *
+ * With CORO_SCHED_REGISTRY defined to 1 all live coroutines of a scheduler are kept in an
+ * intrusive list so that a misbehaving process can be inspected. co_sched_dump_json()
+ * writes one entry per coroutine with its root-function, logical call-chain, stack usage,
+ * state, what it is waiting for and for how long and its group. Keeping the registry costs
+ * two pointer-updates per spawn/free and a CORO_SCHED_REGISTRY_CLOCK() read each time a
+ * coroutine is parked and each time it is woken, the walk is only done when a dump is made.
+ *
+ * Systems that park coroutines tag them with co_sched_wait_reason(), set a name on groups to
+ * get it in the dump. To dump from a signal-handler, request a dump that is then written by
+ * the scheduler-thread at the start of the next co_sched_step():
+ *
+ * static co_sched g_sched;
+ * static void on_sigusr1(int) { co_sched_request_dump(&g_sched); }
+ * static void write_stderr(const char* data, size_t size, void*) { fwrite(data, 1, size, stderr); }
+ *
+ * co_sched_set_dump_target(&g_sched, write_stderr, nullptr);
+ * signal(SIGUSR1, on_sigusr1);
+ */
+
+#pragma once
+
+#include "coro.h"
+
+#if defined(_MSC_VER)
+#  include <intrin.h> // _InterlockedExchange() etc.
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_SCHED_ALLOC/CORO_SCHED_FREE to override how memory for coroutines and stacks
+ * are allocated, defaults to malloc()/free().
+ */
+#if !defined(CORO_SCHED_ALLOC)
+#  include <stdlib.h>
+#  define CORO_SCHED_ALLOC(size) malloc(size)
+#  define CORO_SCHED_FREE(ptr)   free(ptr)
+#endif
+
+/**
+ * Define CORO_SCHED_POOL_MAX to configure the max number of task/stack pairs kept in the pool
+ * of a scheduler, defaults to 64.
+ */
+#if !defined(CORO_SCHED_POOL_MAX)
+#  define CORO_SCHED_POOL_MAX 64
+#endif
+
+/**
+ * Define CORO_SCHED_CLOCK() to an expression returning an uint64_t timestamp, for example
+ * __rdtsc(), to charge groups the time each resume took instead of 1 per resume.
+ * CORO_SCHED_QUANTUM is the cost a group of weight 1 may use per round, defaults to 1 which
+ * is one resume. When CORO_SCHED_CLOCK() is used it should be a few typical resumes in clock
+ * units.
+ */
+#if !defined(CORO_SCHED_QUANTUM)
+#  define CORO_SCHED_QUANTUM 1
+#endif
+
+/**
+ * Define CORO_SCHED_REGISTRY to 1 to keep a registry of live coroutines and per wait-reason
+ * park/wake statistics, @see REGISTRY above, defaults to 0. Need to be the same in all
+ * translation units.
+ *
+ * CORO_SCHED_REGISTRY_CLOCK() returns a timestamp in nanoseconds used to track for how long
+ * coroutines have been parked, defaults to std::chrono::steady_clock.
+ *
+ * CORO_SCHED_FUNC_NAME(func) can be defined to an expression returning a name of a co_func,
+ * or nullptr, to use in dumps. Functions are written as addresses otherwise.
+ */
+#if !defined(CORO_SCHED_REGISTRY)
+#  define CORO_SCHED_REGISTRY 0
+#endif
+
+/**
+ * Define CORO_SCHED_WAIT_REASONS to configure how many distinct wait-reasons, @see
+ * co_sched_wait_reason(), that are counted per scheduler, defaults to 16. Parks with reasons
+ * beyond that are counted as "other".
+ */
+#if !defined(CORO_SCHED_WAIT_REASONS)
+#  define CORO_SCHED_WAIT_REASONS 16
+#endif
+
+#if CORO_SCHED_REGISTRY && !defined(CORO_SCHED_REGISTRY_CLOCK)
+#  include <chrono>
+#  define CORO_SCHED_REGISTRY_CLOCK() ((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count())
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+struct co_sched;
+struct co_sched_task;
+
+/**
+ * Group of coroutines scheduled with deficit-round-robin, @see GROUPS above.
+ */
+struct co_sched_group
+{
+    co_sched_task*  ready_head;
+    co_sched_task*  ready_tail;
+    uint32_t        ready_cnt;       ///< sampled by watchdogs.
+    uint32_t        live;            ///< number of coroutines in group, ready or parked.
+    uint32_t        weight;
+    int64_t         deficit;         ///< cost left this round.
+    co_sched_group* next;            ///< next group in the round.
+    uint32_t        active : 1;      ///< group is in the round, i.e. has ready coroutines.
+
+    uint64_t        resumes;         ///< total number of resumes, sampled by watchdogs.
+    uint64_t        cost;            ///< total cost charged, same as resumes if CORO_SCHED_CLOCK is not defined.
+
+    const char*     name;            ///< optional, used in registry dumps.
+};
+
+/**
+ * Coroutine owned by a scheduler, 'co' need to be the first member so that the root coro
+ * of a coroutine can be cast to the task.
+ */
+struct co_sched_task
+{
+    coro            co;
+    co_sched*       sched;
+    co_sched_group* group;
+    co_sched_task*  next;           ///< next task in ready-queue.
+    co_sched_task*  remote_next;    ///< next task in the remote-wake inbox.
+    uint32_t        remote_pending; ///< task is in the remote-wake inbox, accessed atomically.
+
+    uint32_t       ready     : 1;   ///< task is in the ready-queue.
+    uint32_t       woken     : 1;   ///< co_sched_wake() was called while task was executing.
+    uint32_t       cancelled : 1;
+    uint32_t       admission : 1;   ///< task is parked in co_spawn() waiting for admission.
+    uint32_t       zombie    : 1;   ///< freed with a remote wake in flight, released by the drain.
+
+#if CORO_SCHED_REGISTRY
+    co_sched_task* live_prev;       ///< registry of live tasks.
+    co_sched_task* live_next;
+    const char*    wait_reason;     ///< set with co_sched_wait_reason(), cleared when woken.
+    uint64_t       parked_at;       ///< CORO_SCHED_REGISTRY_CLOCK() when last parked.
+    uint32_t       wait_stat;       ///< index in wait_stats of the scheduler when last parked.
+#endif
+};
+
+enum
+{
+    /**
+     * Number of buckets in wait-time histograms, upper bounds are 1us, 10us ... 10s and the
+     * last bucket counts everything above that.
+     */
+    CO_SCHED_WAIT_BUCKETS = 9
+};
+
+/**
+ * Number of parks with a specific wait-reason and how long they waited until woken.
+ */
+struct co_sched_wait_stat
+{
+    const char* reason;  ///< nullptr for parks without a reason.
+    uint64_t    parks;
+    uint64_t    wakes;
+    uint64_t    wait_ns;                        ///< total time waited by all wakes.
+    uint64_t    buckets[CO_SCHED_WAIT_BUCKETS]; ///< wakes by wait-time, not cumulative.
+};
+
+/**
+ * Called with chunks of a dump, @see co_sched_dump_json().
+ */
+typedef void (*co_sched_dump_func)( const char* data, size_t size, void* userdata );
+
+struct co_sched
+{
+    co_sched_group  default_group;
+    co_sched_group* round_head;         ///< groups with ready tasks in deficit-round-robin order.
+    co_sched_group* round_tail;
+    co_sched_task*  current;            ///< task currently being resumed, if any.
+    uint64_t        resume_seq;         ///< incremented at the start of each resume, sampled by watchdogs.
+    uint32_t        ready_cnt;          ///< number of ready tasks in all groups, sampled by watchdogs.
+    co_sched_task*  remote_head;        ///< inbox of co_sched_wake_remote(), lifo, accessed atomically.
+    uint64_t        remote_wakes;       ///< number of wakes received through the inbox.
+    uint32_t        live;               ///< number of tasks owned by the scheduler, ready or parked.
+    int             default_stack_size;
+    void*           userdata;           ///< passed as userdata to all co_resume().
+
+    uint32_t        max_live;           ///< 0 = no limit.
+    size_t          max_stack_bytes;    ///< 0 = no limit.
+    size_t          stack_bytes;        ///< memory used by stacks of live tasks.
+    co_sched_task*  admission_head;     ///< tasks parked in co_spawn() in fifo-order.
+    co_sched_task*  admission_tail;
+    uint64_t        spawn_rejected;     ///< number of co_sched_spawn() that failed due to the limits.
+    uint64_t        spawn_parked;       ///< number of times co_spawn() parked the spawning coroutine.
+
+    co_sched_task*  pool;               ///< completed tasks kept with their stack for reuse.
+    uint32_t        pool_cnt;
+    uint64_t        pool_hits;          ///< spawns that reused a task and stack from the pool.
+
+    uint64_t        stack_grows;        ///< number of times a stack has been grown after overflow.
+    uint64_t        parks;              ///< number of times a coroutine has been parked.
+
+#if CORO_SCHED_REGISTRY
+    co_sched_wait_stat wait_stats[CORO_SCHED_WAIT_REASONS]; ///< parks by wait-reason, in order of first use.
+    uint32_t           wait_stat_cnt;
+    co_sched_task*     live_head;       ///< all live tasks, most recently spawned first.
+    co_sched_dump_func dump_func;       ///< target for dumps requested with co_sched_request_dump().
+    void*              dump_userdata;
+    volatile uint32_t  dump_requested;
+#endif
+};
+
+/**
+ * Initialize scheduler.
+ *
+ * @param default_stack_size size of stack allocated for each spawned coroutine.
+ * @param userdata passed as userdata to co_resume() of all coroutines.
+ */
+static inline void co_sched_init( co_sched* sched, int default_stack_size, void* userdata );
+
+/**
+ * Destroy scheduler, freeing all coroutines in the ready-queue.
+ *
+ * @note it is up to the user to make sure that no coroutines are parked in other systems.
+ */
+static inline void co_sched_destroy( co_sched* sched );
+
+/**
+ * Set limits used for admission control, 0 means no limit.
+ *
+ * @param max_live max number of live coroutines.
+ * @param max_stack_bytes max memory used by the stacks of live coroutines.
+ */
+static inline void co_sched_set_limits( co_sched* sched, uint32_t max_live, size_t max_stack_bytes );
+
+/**
+ * Allocate tasks and stacks up front so that the pool holds at least cnt of them, cnt is
+ * clamped to CORO_SCHED_POOL_MAX.
+ */
+static inline void co_sched_pool_reserve( co_sched* sched, uint32_t cnt );
+
+/**
+ * Initialize group with weight, weight need to be at least 1.
+ */
+static inline void co_sched_group_init( co_sched_group* group, uint32_t weight );
+
+/**
+ * Create a new coroutine owned by the scheduler and put it in the ready-queue of its group.
+ * co_sched_spawn() puts it in the group of the currently executing coroutine, or the default
+ * group, and co_sched_spawn_in() in the passed group.
+ *
+ * @return the created coroutine or nullptr if spawning it would go above the limits set with
+ *         co_sched_set_limits().
+ */
+static inline coro* co_sched_spawn( co_sched* sched, co_func func, void* arg, int arg_size, int arg_align );
+static inline coro* co_sched_spawn( co_sched* sched, co_func func );
+template<typename T>
+static inline coro* co_sched_spawn( co_sched* sched, co_func func, T& arg );
+
+static inline coro* co_sched_spawn_in( co_sched* sched, co_sched_group* group, co_func func, void* arg, int arg_size, int arg_align );
+static inline coro* co_sched_spawn_in( co_sched* sched, co_sched_group* group, co_func func );
+template<typename T>
+static inline coro* co_sched_spawn_in( co_sched* sched, co_sched_group* group, co_func func, T& arg );
+
+/**
+ * Spawn a detached coroutine in the scheduler and group of the coroutine co from within co,
+ * using a pooled stack. The caller continues directly unless the new coroutine do not fit
+ * within the limits set with co_sched_set_limits(), then co is parked until it does.
+ * Arguments after co is the same as for co_sched_spawn().
+ *
+ * @note arguments are evaluated after co has been resumed and should be locals or arguments.
+ */
+#define co_spawn(co, func, ...)
+
+/**
+ * Do as many resumes as there were coroutines ready when co_sched_step() was called. With
+ * only one group in use that is resuming each of them once.
+ *
+ * @return number of coroutines resumed.
+ */
+static inline uint32_t co_sched_step( co_sched* sched );
+
+/**
+ * Call co_sched_step() until there are no ready coroutines left.
+ */
+static inline void co_sched_run( co_sched* sched );
+
+/**
+ * Number of coroutines owned by the scheduler, both ready and parked.
+ */
+static inline uint32_t co_sched_live( co_sched* sched ) { return sched->live; }
+
+/**
+ * Put a parked coroutine back into the ready-queue of its scheduler.
+ *
+ * @param co any coro in the coroutine, i.e. it is valid to pass the co from within a sub-call.
+ */
+static inline void co_sched_wake( coro* co );
+
+/**
+ * Wake a parked coroutine from a thread other than the one running its scheduler, the
+ * coroutine is put in the ready-queue at the start of the next co_sched_step(). Waking a
+ * coroutine that already has a remote wake pending is a no-op, as is a wake of a coroutine
+ * that is ready when the wake is drained.
+ *
+ * The coroutine may complete or be cancelled while the wake is in flight, its memory is then
+ * kept until the wake has been drained. The caller still need to make sure that the coroutine
+ * has not been freed when the call starts.
+ *
+ * Memory written before the call is visible to the coroutine when it is resumed.
+ */
+static inline void co_sched_wake_remote( coro* co );
+
+/**
+ * Flag coroutine as cancelled, @see CANCELLATION above.
+ */
+static inline void co_sched_cancel( coro* co );
+
+/**
+ * Returns true if co_sched_cancel() has been called on coroutine.
+ */
+static inline bool co_sched_cancelled( coro* co );
+
+/**
+ * Return the scheduler that owns co.
+ */
+static inline co_sched* co_sched_of( coro* co );
+
+/**
+ * Return the group of co.
+ */
+static inline co_sched_group* co_sched_group_of( coro* co );
+
+/**
+ * Tag coroutine with what it is about to wait for, shown in registry dumps while it is parked.
+ * reason need to be a string that outlives the wait, for example a literal. No-op if
+ * CORO_SCHED_REGISTRY is 0.
+ *
+ * @param co any coro in the coroutine.
+ */
+static inline void co_sched_wait_reason( coro* co, const char* reason );
+
+#if CORO_SCHED_REGISTRY
+/**
+ * Write all live coroutines of the scheduler as json to func, in one or more chunks.
+ *
+ * {"live":2,"ready":1,"coroutines":[
+ *   {"id":"0x...","func":"handle_conn","group":"tenant_a","state":"parked","wait":"io_read",
+ *    "parked_ns":1520000,"stack_used":312,"stack_size":1024,"cancelled":false,
+ *    "calls":[{"func":"handle_conn","line":120},{"func":"read_request","line":64}]},
+ *   ...]}
+ *
+ * state is one of "running", "ready", "parked" or "admission". parked_ns is only written
+ * for parked coroutines. Must be called from the thread running the scheduler.
+ */
+static inline void co_sched_dump_json( co_sched* sched, co_sched_dump_func func, void* userdata );
+
+/**
+ * Set where dumps requested with co_sched_request_dump() are written.
+ */
+static inline void co_sched_set_dump_target( co_sched* sched, co_sched_dump_func func, void* userdata );
+
+/**
+ * Request a dump to the dump-target at the start of the next co_sched_step(), safe to call
+ * from a signal-handler or another thread.
+ */
+static inline void co_sched_request_dump( co_sched* sched );
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_spawn
+
+// store to a member that is sampled from other threads.
+#if defined(_MSC_VER)
+#  define _CO_SCHED_PUBLISH(var, value) (*(volatile decltype(var)*)&(var) = (value))
+#else
+#  define _CO_SCHED_PUBLISH(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#endif
+
+// atomics used by the remote-wake inbox, the Interlocked-functions are full barriers.
+#if defined(_MSC_VER)
+static inline uint32_t _co_sched_xchg_u32( uint32_t* ptr, uint32_t value )
+{
+    return (uint32_t)_InterlockedExchange((volatile long*)ptr, (long)value);
+}
+
+static inline co_sched_task* _co_sched_load_task( co_sched_task** ptr )
+{
+    return (co_sched_task*)_InterlockedCompareExchangePointer((void* volatile*)ptr, nullptr, nullptr);
+}
+
+static inline co_sched_task* _co_sched_xchg_task( co_sched_task** ptr, co_sched_task* value )
+{
+    return (co_sched_task*)_InterlockedExchangePointer((void* volatile*)ptr, value);
+}
+
+static inline bool _co_sched_cas_task( co_sched_task** ptr, co_sched_task** expected, co_sched_task* value )
+{
+    co_sched_task* prev = (co_sched_task*)_InterlockedCompareExchangePointer((void* volatile*)ptr, value, *expected);
+    if(prev == *expected)
+        return true;
+    *expected = prev;
+    return false;
+}
+#else
+static inline uint32_t _co_sched_xchg_u32( uint32_t* ptr, uint32_t value )
+{
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline co_sched_task* _co_sched_load_task( co_sched_task** ptr )
+{
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline co_sched_task* _co_sched_xchg_task( co_sched_task** ptr, co_sched_task* value )
+{
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQUIRE);
+}
+
+static inline bool _co_sched_cas_task( co_sched_task** ptr, co_sched_task** expected, co_sched_task* value )
+{
+    return __atomic_compare_exchange_n(ptr, expected, value, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+#endif
+
+static inline co_sched_task* _co_sched_task( coro* co )
+{
+    return (co_sched_task*)co->call.root;
+}
+
+static inline co_sched* co_sched_of( coro* co )
+{
+    return _co_sched_task(co)->sched;
+}
+
+static inline bool co_sched_cancelled( coro* co )
+{
+    return _co_sched_task(co)->cancelled == 1;
+}
+
+static inline co_sched_group* co_sched_group_of( coro* co )
+{
+    return _co_sched_task(co)->group;
+}
+
+static inline void co_sched_group_init( co_sched_group* group, uint32_t weight )
+{
+    CORO_ASSERT(weight > 0, "group weight need to be at least 1!");
+    group->ready_head = nullptr;
+    group->ready_tail = nullptr;
+    group->ready_cnt  = 0;
+    group->live       = 0;
+    group->weight     = weight;
+    group->deficit    = 0;
+    group->next       = nullptr;
+    group->active     = 0;
+    group->resumes    = 0;
+    group->cost       = 0;
+    group->name       = nullptr;
+}
+
+static inline void co_sched_init( co_sched* sched, int default_stack_size, void* userdata )
+{
+    co_sched_group_init(&sched->default_group, 1);
+    sched->default_group.name = "default";
+    sched->round_head = nullptr;
+    sched->round_tail = nullptr;
+    sched->current    = nullptr;
+    sched->resume_seq = 0;
+    sched->ready_cnt  = 0;
+    sched->remote_head  = nullptr;
+    sched->remote_wakes = 0;
+    sched->live       = 0;
+    sched->default_stack_size = default_stack_size;
+    sched->userdata   = userdata;
+    sched->max_live        = 0;
+    sched->max_stack_bytes = 0;
+    sched->stack_bytes     = 0;
+    sched->admission_head  = nullptr;
+    sched->admission_tail  = nullptr;
+    sched->spawn_rejected  = 0;
+    sched->spawn_parked    = 0;
+    sched->pool            = nullptr;
+    sched->pool_cnt        = 0;
+    sched->pool_hits       = 0;
+    sched->stack_grows     = 0;
+    sched->parks           = 0;
+#if CORO_SCHED_REGISTRY
+    sched->wait_stat_cnt   = 0;
+    sched->live_head       = nullptr;
+    sched->dump_func       = nullptr;
+    sched->dump_userdata   = nullptr;
+    sched->dump_requested  = 0;
+#endif
+}
+
+static inline bool _co_sched_admit( co_sched* sched )
+{
+    if(sched->max_live > 0 && sched->live >= sched->max_live)
+        return false;
+    if(sched->max_stack_bytes > 0 && sched->stack_bytes + (size_t)sched->default_stack_size > sched->max_stack_bytes)
+        return false;
+    return true;
+}
+
+static inline int64_t _co_sched_quantum( co_sched_group* group )
+{
+    return (int64_t)group->weight * (int64_t)CORO_SCHED_QUANTUM;
+}
+
+static inline void _co_sched_round_push( co_sched* sched, co_sched_group* group )
+{
+    group->next = nullptr;
+    if(sched->round_tail)
+        sched->round_tail->next = group;
+    else
+        sched->round_head = group;
+    sched->round_tail = group;
+}
+
+static inline co_sched_group* _co_sched_round_pop( co_sched* sched )
+{
+    co_sched_group* group = sched->round_head;
+    sched->round_head = group->next;
+    if(sched->round_head == nullptr)
+        sched->round_tail = nullptr;
+    group->next = nullptr;
+    return group;
+}
+
+static inline void _co_sched_push( co_sched* sched, co_sched_task* task )
+{
+    CORO_ASSERT(task->ready == 0, "task is already in the ready-queue!");
+    co_sched_group* group = task->group;
+    task->ready = 1;
+    task->next  = nullptr;
+    if(group->ready_tail)
+        group->ready_tail->next = task;
+    else
+        group->ready_head = task;
+    group->ready_tail = task;
+    _CO_SCHED_PUBLISH(group->ready_cnt, group->ready_cnt + 1);
+    _CO_SCHED_PUBLISH(sched->ready_cnt, sched->ready_cnt + 1);
+
+    if(!group->active)
+    {
+        // joins last in the round with a new quantum unless it is still in debt from earlier
+        // rounds.
+        group->active = 1;
+        if(group->deficit <= 0)
+            group->deficit += _co_sched_quantum(group);
+        _co_sched_round_push(sched, group);
+    }
+}
+
+static inline co_sched_task* _co_sched_pop( co_sched* sched )
+{
+    if(sched->round_head == nullptr)
+        return nullptr;
+
+    // a group that has used its share of this round goes last with a new quantum.
+    while(sched->round_head->deficit <= 0)
+    {
+        co_sched_group* group = _co_sched_round_pop(sched);
+        group->deficit += _co_sched_quantum(group);
+        _co_sched_round_push(sched, group);
+    }
+
+    co_sched_group* group = sched->round_head;
+    co_sched_task*  task  = group->ready_head;
+    group->ready_head = task->next;
+    if(group->ready_head == nullptr)
+        group->ready_tail = nullptr;
+    _CO_SCHED_PUBLISH(group->ready_cnt, group->ready_cnt - 1);
+    _CO_SCHED_PUBLISH(sched->ready_cnt, sched->ready_cnt - 1);
+    task->ready = 0;
+    task->next  = nullptr;
+    return task;
+}
+
+/**
+ * Called after the task popped from the group first in the round has been handled, the group
+ * leave the round when it has no more ready tasks. The group is left in the round while its
+ * task is resumed so that a task that yields keeps the rest of the quantum of its group.
+ */
+static inline void _co_sched_round_update( co_sched* sched, co_sched_group* group )
+{
+    if(group->ready_cnt > 0)
+        return;
+    CORO_ASSERT(sched->round_head == group, "only the group first in the round can be updated!");
+    _co_sched_round_pop(sched);
+    group->active = 0;
+    // idle groups do not bank unused quantum, but keep any debt.
+    if(group->deficit > 0)
+        group->deficit = 0;
+}
+
+static inline co_sched_task* _co_sched_admission_pop( co_sched* sched )
+{
+    co_sched_task* task = sched->admission_head;
+    if(task == nullptr)
+        return nullptr;
+    sched->admission_head = task->next;
+    if(sched->admission_head == nullptr)
+        sched->admission_tail = nullptr;
+    task->next      = nullptr;
+    task->admission = 0;
+    return task;
+}
+
+static inline void _co_sched_admission_remove( co_sched* sched, co_sched_task* task )
+{
+    co_sched_task* prev = nullptr;
+    for(co_sched_task* it = sched->admission_head; it != task; it = it->next)
+        prev = it;
+    if(prev)
+        prev->next = task->next;
+    else
+        sched->admission_head = task->next;
+    if(sched->admission_tail == task)
+        sched->admission_tail = prev;
+    task->next      = nullptr;
+    task->admission = 0;
+}
+
+/**
+ * Return memory of a task that is no longer referenced by the scheduler to the pool or free it.
+ */
+static inline void _co_sched_release( co_sched* sched, co_sched_task* task )
+{
+    if(task->co.stack_size == sched->default_stack_size && sched->pool_cnt < CORO_SCHED_POOL_MAX)
+    {
+        task->next  = sched->pool;
+        sched->pool = task;
+        ++sched->pool_cnt;
+    }
+    else
+    {
+        CORO_SCHED_FREE(task->co.stack);
+        CORO_SCHED_FREE(task);
+    }
+}
+
+static inline void _co_sched_free( co_sched* sched, co_sched_task* task )
+{
+#if CORO_LOCAL_SLOTS > 0
+    co_local_release(&task->co);
+#endif
+#if CORO_SCHED_REGISTRY
+    if(task->live_prev)
+        task->live_prev->live_next = task->live_next;
+    else
+        sched->live_head = task->live_next;
+    if(task->live_next)
+        task->live_next->live_prev = task->live_prev;
+#endif
+    --task->group->live;
+    sched->stack_bytes -= (size_t)task->co.stack_size;
+    --sched->live;
+
+    // the task is still linked in the remote-wake inbox, the drain releases it.
+    if(_co_sched_xchg_u32(&task->remote_pending, 1u) != 0)
+        task->zombie = 1;
+    else
+        _co_sched_release(sched, task);
+
+    // let the first coroutine waiting in co_spawn() retry.
+    if(sched->admission_head && _co_sched_admit(sched))
+        co_sched_wake(&_co_sched_admission_pop(sched)->co);
+}
+
+static inline void _co_sched_drain_remote( co_sched* sched );
+
+static inline void co_sched_destroy( co_sched* sched )
+{
+    sched->max_live        = 0;
+    sched->max_stack_bytes = 0;
+    _co_sched_drain_remote(sched); // release tasks freed with a remote wake in flight.
+    while(co_sched_task* task = _co_sched_admission_pop(sched))
+        _co_sched_free(sched, task);
+    while(co_sched_task* task = _co_sched_pop(sched))
+    {
+        co_sched_group* group = task->group;
+        _co_sched_free(sched, task);
+        _co_sched_round_update(sched, group);
+    }
+    while(co_sched_task* task = sched->pool)
+    {
+        sched->pool = task->next;
+        CORO_SCHED_FREE(task->co.stack);
+        CORO_SCHED_FREE(task);
+    }
+    sched->pool_cnt = 0;
+}
+
+static inline void co_sched_pool_reserve( co_sched* sched, uint32_t cnt )
+{
+    if(cnt > CORO_SCHED_POOL_MAX)
+        cnt = CORO_SCHED_POOL_MAX;
+    while(sched->pool_cnt < cnt)
+    {
+        co_sched_task* task = (co_sched_task*)CORO_SCHED_ALLOC(sizeof(co_sched_task));
+        task->co.stack      = (uint8_t*)CORO_SCHED_ALLOC((size_t)sched->default_stack_size);
+        task->co.stack_size = sched->default_stack_size;
+        task->next  = sched->pool;
+        sched->pool = task;
+        ++sched->pool_cnt;
+    }
+}
+
+static inline void co_sched_set_limits( co_sched* sched, uint32_t max_live, size_t max_stack_bytes )
+{
+    sched->max_live        = max_live;
+    sched->max_stack_bytes = max_stack_bytes;
+    while(sched->admission_head && _co_sched_admit(sched))
+        co_sched_wake(&_co_sched_admission_pop(sched)->co);
+}
+
+static inline coro* co_sched_spawn_in( co_sched* sched, co_sched_group* group, co_func func, void* arg, int arg_size, int arg_align )
+{
+    if(!_co_sched_admit(sched))
+    {
+        ++sched->spawn_rejected;
+        return nullptr;
+    }
+
+    co_sched_task* task;
+    void*          stack;
+    if(sched->pool && sched->pool->co.stack_size == sched->default_stack_size)
+    {
+        task        = sched->pool;
+        stack       = task->co.stack;
+        sched->pool = task->next;
+        --sched->pool_cnt;
+        ++sched->pool_hits;
+    }
+    else
+    {
+        task  = (co_sched_task*)CORO_SCHED_ALLOC(sizeof(co_sched_task));
+        stack = CORO_SCHED_ALLOC((size_t)sched->default_stack_size);
+    }
+    new (task) co_sched_task;
+    co_init(&task->co, stack, sched->default_stack_size, func, arg, arg_size, arg_align);
+    task->sched     = sched;
+    task->group     = group;
+    task->next      = nullptr;
+    task->remote_next    = nullptr;
+    task->remote_pending = 0;
+    task->ready     = 0;
+    task->woken     = 0;
+    task->cancelled = 0;
+    task->admission = 0;
+    task->zombie    = 0;
+#if CORO_CONTEXT_SIZE > 0
+    // children inherit the context of the coroutine spawning them.
+    if(sched->current)
+        co_context_copy(&task->co, &sched->current->co);
+#endif
+#if CORO_SCHED_REGISTRY
+    task->live_prev   = nullptr;
+    task->live_next   = sched->live_head;
+    task->wait_reason = nullptr;
+    task->parked_at   = 0;
+    task->wait_stat   = 0;
+    if(sched->live_head)
+        sched->live_head->live_prev = task;
+    sched->live_head = task;
+#endif
+    ++group->live;
+    ++sched->live;
+    sched->stack_bytes += (size_t)sched->default_stack_size;
+    _co_sched_push(sched, task);
+    return &task->co;
+}
+
+static inline coro* co_sched_spawn_in( co_sched* sched, co_sched_group* group, co_func func )
+{
+    return co_sched_spawn_in(sched, group, func, nullptr, 0, 0);
+}
+
+template<typename T>
+static inline coro* co_sched_spawn_in( co_sched* sched, co_sched_group* group, co_func func, T& arg )
+{
+    return co_sched_spawn_in(sched, group, func, &arg, sizeof(T), alignof(T));
+}
+
+static inline co_sched_group* _co_sched_spawn_group( co_sched* sched )
+{
+    return sched->current ? sched->current->group : &sched->default_group;
+}
+
+static inline coro* co_sched_spawn( co_sched* sched, co_func func, void* arg, int arg_size, int arg_align )
+{
+    return co_sched_spawn_in(sched, _co_sched_spawn_group(sched), func, arg, arg_size, arg_align);
+}
+
+static inline coro* co_sched_spawn( co_sched* sched, co_func func )
+{
+    return co_sched_spawn_in(sched, _co_sched_spawn_group(sched), func, nullptr, 0, 0);
+}
+
+template<typename T>
+static inline coro* co_sched_spawn( co_sched* sched, co_func func, T& arg )
+{
+    return co_sched_spawn_in(sched, _co_sched_spawn_group(sched), func, &arg, sizeof(T), alignof(T));
+}
+
+#if CORO_SCHED_REGISTRY
+static inline uint32_t _co_sched_count_wait( co_sched* sched, const char* reason )
+{
+    // few distinct reasons and they are literals, so a linear search comparing pointers.
+    uint32_t i = 0;
+    for(; i < sched->wait_stat_cnt; ++i)
+        if(sched->wait_stats[i].reason == reason)
+            break;
+    if(i == sched->wait_stat_cnt)
+    {
+        // the last entry is kept for everything that do not fit.
+        if(i == CORO_SCHED_WAIT_REASONS)
+            i = CORO_SCHED_WAIT_REASONS - 1;
+        else
+        {
+            memset(&sched->wait_stats[i], 0, sizeof(co_sched_wait_stat));
+            sched->wait_stats[i].reason = i == CORO_SCHED_WAIT_REASONS - 1 ? "other" : reason;
+            ++sched->wait_stat_cnt;
+        }
+    }
+    ++sched->wait_stats[i].parks;
+    return i;
+}
+
+static inline void _co_sched_count_wake( co_sched* sched, co_sched_task* task )
+{
+    co_sched_wait_stat* stat = &sched->wait_stats[task->wait_stat];
+    uint64_t now     = CORO_SCHED_REGISTRY_CLOCK();
+    uint64_t wait_ns = now > task->parked_at ? now - task->parked_at : 0;
+
+    uint32_t bucket = 0;
+    for(uint64_t bound = 1000; bucket < CO_SCHED_WAIT_BUCKETS - 1 && wait_ns > bound; bound *= 10)
+        ++bucket;
+
+    ++stat->wakes;
+    stat->wait_ns += wait_ns;
+    ++stat->buckets[bucket];
+}
+#endif
+
+static inline void co_sched_wait_reason( coro* co, const char* reason )
+{
+#if CORO_SCHED_REGISTRY
+    _co_sched_task(co)->wait_reason = reason;
+#else
+    (void)co; (void)reason;
+#endif
+}
+
+static inline void co_sched_wake( coro* co )
+{
+    co_sched_task* task = _co_sched_task(co);
+    // parked in co_spawn(), the scheduler wakes it when there is room.
+    if(task->admission)
+        return;
+#if CORO_SCHED_REGISTRY
+    task->wait_reason = nullptr;
+#endif
+    if(task->co.executing)
+    {
+        task->woken = 1;
+        return;
+    }
+    if(task->cancelled)
+    {
+        _co_sched_free(task->sched, task);
+        return;
+    }
+#if CORO_SCHED_REGISTRY
+    _co_sched_count_wake(task->sched, task);
+#endif
+    _co_sched_push(task->sched, task);
+}
+
+static inline void co_sched_wake_remote( coro* co )
+{
+    co_sched_task* task  = _co_sched_task(co);
+    co_sched*      sched = task->sched;
+    if(_co_sched_xchg_u32(&task->remote_pending, 1u) != 0)
+        return;
+
+    co_sched_task* head = _co_sched_load_task(&sched->remote_head);
+    do
+        task->remote_next = head;
+    while(!_co_sched_cas_task(&sched->remote_head, &head, task));
+}
+
+/**
+ * Move all tasks woken with co_sched_wake_remote() to the ready-queue, in the order they were
+ * woken.
+ */
+static inline void _co_sched_drain_remote( co_sched* sched )
+{
+    if(_co_sched_load_task(&sched->remote_head) == nullptr)
+        return;
+
+    // the consumer takes the whole list so there is no aba-problem, reverse it to get fifo.
+    co_sched_task* lifo = _co_sched_xchg_task(&sched->remote_head, nullptr);
+    co_sched_task* fifo = nullptr;
+    while(lifo)
+    {
+        co_sched_task* next = lifo->remote_next;
+        lifo->remote_next = fifo;
+        fifo = lifo;
+        lifo = next;
+    }
+    while(fifo)
+    {
+        co_sched_task* task = fifo;
+        fifo = task->remote_next;
+        task->remote_next = nullptr;
+        _co_sched_xchg_u32(&task->remote_pending, 0u);
+        ++sched->remote_wakes;
+        if(task->zombie)
+            _co_sched_release(sched, task);
+        else if(!task->ready)
+            co_sched_wake(&task->co);
+    }
+}
+
+static inline void co_sched_cancel( coro* co )
+{
+    co_sched_task* task = _co_sched_task(co);
+    task->cancelled = 1;
+
+    // parked in the scheduler itself, no other system will wake it.
+    if(task->admission)
+    {
+        _co_sched_admission_remove(task->sched, task);
+        _co_sched_free(task->sched, task);
+    }
+}
+
+/**
+ * Returns true if a coroutine may be spawned, otherwise co is queued for admission and will be
+ * woken when it should retry.
+ */
+static inline bool _co_sched_spawn_admit( coro* co )
+{
+    co_sched_task* task  = _co_sched_task(co);
+    co_sched*      sched = task->sched;
+    if(_co_sched_admit(sched))
+        return true;
+
+    // still queued, i.e. resumed without being admitted, keep the place in the queue.
+    if(task->admission)
+        return false;
+
+    ++sched->spawn_parked;
+    co_sched_wait_reason(co, "admission");
+    task->admission = 1;
+    task->next      = nullptr;
+    if(sched->admission_tail)
+        sched->admission_tail->next = task;
+    else
+        sched->admission_head = task;
+    sched->admission_tail = task;
+    return false;
+}
+
+#define co_spawn(co, func, ...)                                                  \
+    do {                                                                         \
+        while(!_co_sched_spawn_admit(co))                                        \
+            co_wait(co);                                                         \
+        co_sched_spawn_in(co_sched_of(co), co_sched_group_of(co), func, ##__VA_ARGS__); \
+    } while(0)
+
+static inline void _co_sched_resume( co_sched* sched, co_sched_task* task )
+{
+    coro* co = &task->co;
+    co_sched_group* group = task->group;
+    task->woken = 0;
+
+    // current and resume_seq may be read by a watchdog on another thread. resume_seq is bumped
+    // first so that a watchdog that sees the new current also sees that a new resume started.
+    _CO_SCHED_PUBLISH(sched->resume_seq, sched->resume_seq + 1);
+    _CO_SCHED_PUBLISH(sched->current, task);
+#if defined(CORO_SCHED_CLOCK)
+    uint64_t start = CORO_SCHED_CLOCK();
+    co_resume(co, sched->userdata);
+    int64_t cost = (int64_t)(CORO_SCHED_CLOCK() - start);
+#else
+    co_resume(co, sched->userdata);
+    int64_t cost = 1;
+#endif
+    _CO_SCHED_PUBLISH(sched->current, (co_sched_task*)nullptr);
+
+    group->deficit -= cost;
+    group->cost    += (uint64_t)cost;
+    _CO_SCHED_PUBLISH(group->resumes, group->resumes + 1);
+
+    if(co_completed(co))
+    {
+        _co_sched_free(sched, task);
+        return;
+    }
+
+    if(co_stack_overflowed(co))
+    {
+        int   new_size  = co->stack_size * 2;
+        ++sched->stack_grows;
+        sched->stack_bytes += (size_t)(new_size - co->stack_size);
+        void* old_stack = co_replace_stack(co, CORO_SCHED_ALLOC((size_t)new_size), new_size);
+        CORO_SCHED_FREE(old_stack);
+    }
+    else if(co_waiting(co) && !task->woken)
+    {
+        ++sched->parks;
+#if CORO_SCHED_REGISTRY
+        task->parked_at = CORO_SCHED_REGISTRY_CLOCK();
+        task->wait_stat = _co_sched_count_wait(sched, task->wait_reason);
+#endif
+        return; // parked until co_sched_wake()
+    }
+
+    _co_sched_push(sched, task);
+}
+
+static inline uint32_t co_sched_step( co_sched* sched )
+{
+#if CORO_SCHED_REGISTRY
+    if(sched->dump_requested)
+    {
+        sched->dump_requested = 0;
+        if(sched->dump_func)
+            co_sched_dump_json(sched, sched->dump_func, sched->dump_userdata);
+    }
+#endif
+    _co_sched_drain_remote(sched);
+    uint32_t to_run = sched->ready_cnt;
+    for(uint32_t i = 0; i < to_run; ++i)
+    {
+        co_sched_task*  task  = _co_sched_pop(sched);
+        co_sched_group* group = task->group;
+        if(task->cancelled)
+            _co_sched_free(sched, task);
+        else
+            _co_sched_resume(sched, task);
+        _co_sched_round_update(sched, group);
+    }
+    return to_run;
+}
+
+static inline void co_sched_run( co_sched* sched )
+{
+    while(co_sched_step(sched) > 0) {}
+}
+
+#if CORO_SCHED_REGISTRY
+
+/**
+ * Buffered writer used when dumping, data is passed to func in chunks of the buffer size.
+ */
+struct _co_sched_json
+{
+    co_sched_dump_func func;
+    void*              userdata;
+    size_t             used;
+    char               buf[1024];
+};
+
+static inline void _co_sched_json_flush( _co_sched_json* json )
+{
+    if(json->used > 0)
+        json->func(json->buf, json->used, json->userdata);
+    json->used = 0;
+}
+
+static inline void _co_sched_json_put( _co_sched_json* json, const char* str, size_t len )
+{
+    while(len > 0)
+    {
+        if(json->used == sizeof(json->buf))
+            _co_sched_json_flush(json);
+        size_t n = sizeof(json->buf) - json->used;
+        if(n > len)
+            n = len;
+        memcpy(json->buf + json->used, str, n);
+        json->used += n;
+        str        += n;
+        len        -= n;
+    }
+}
+
+static inline void _co_sched_json_raw( _co_sched_json* json, const char* str )
+{
+    _co_sched_json_put(json, str, strlen(str));
+}
+
+static inline void _co_sched_json_uint( _co_sched_json* json, uint64_t value )
+{
+    char  tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* it  = end;
+    do { *--it = (char)('0' + value % 10); value /= 10; } while(value > 0);
+    _co_sched_json_put(json, it, (size_t)(end - it));
+}
+
+static inline void _co_sched_json_ptr( _co_sched_json* json, const void* ptr )
+{
+    static const char hex[] = "0123456789abcdef";
+    char      tmp[2 + sizeof(uintptr_t) * 2 + 2];
+    char*     end   = tmp + sizeof(tmp);
+    char*     it    = end;
+    uintptr_t value = (uintptr_t)ptr;
+    *--it = '"';
+    do { *--it = hex[value & 0xF]; value >>= 4; } while(value > 0);
+    *--it = 'x';
+    *--it = '0';
+    *--it = '"';
+    _co_sched_json_put(json, it, (size_t)(end - it));
+}
+
+static inline void _co_sched_json_str( _co_sched_json* json, const char* str )
+{
+    static const char hex[] = "0123456789abcdef";
+    _co_sched_json_put(json, "\"", 1);
+    for(; *str; ++str)
+    {
+        unsigned char c = (unsigned char)*str;
+        if(c == '"' || c == '\\')
+        {
+            char esc[2] = { '\\', (char)c };
+            _co_sched_json_put(json, esc, 2);
+        }
+        else if(c < 0x20)
+        {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+            _co_sched_json_put(json, esc, 6);
+        }
+        else
+            _co_sched_json_put(json, str, 1);
+    }
+    _co_sched_json_put(json, "\"", 1);
+}
+
+static inline void _co_sched_json_func( _co_sched_json* json, co_func func )
+{
+#if defined(CORO_SCHED_FUNC_NAME)
+    const char* name = CORO_SCHED_FUNC_NAME(func);
+    if(name != nullptr)
+    {
+        _co_sched_json_str(json, name);
+        return;
+    }
+#endif
+    _co_sched_json_ptr(json, (const void*)(uintptr_t)func);
+}
+
+static inline const char* _co_sched_task_state( co_sched* sched, co_sched_task* task )
+{
+    if(task == sched->current) return "running";
+    if(task->ready)            return "ready";
+    if(task->admission)        return "admission";
+    return "parked";
+}
+
+static inline void co_sched_dump_json( co_sched* sched, co_sched_dump_func func, void* userdata )
+{
+    _co_sched_json json;
+    json.func     = func;
+    json.userdata = userdata;
+    json.used     = 0;
+
+    uint64_t now = CORO_SCHED_REGISTRY_CLOCK();
+
+    _co_sched_json_raw(&json, "{\"live\":");
+    _co_sched_json_uint(&json, sched->live);
+    _co_sched_json_raw(&json, ",\"ready\":");
+    _co_sched_json_uint(&json, sched->ready_cnt);
+    _co_sched_json_raw(&json, ",\"coroutines\":[");
+
+    for(co_sched_task* task = sched->live_head; task != nullptr; task = task->live_next)
+    {
+        coro*       co    = &task->co;
+        const char* state = _co_sched_task_state(sched, task);
+        bool        parked = task != sched->current && !task->ready;
+
+        _co_sched_json_raw(&json, task == sched->live_head ? "\n{\"id\":" : ",\n{\"id\":");
+        _co_sched_json_ptr(&json, task);
+        _co_sched_json_raw(&json, ",\"func\":");
+        _co_sched_json_func(&json, co->call.func);
+        _co_sched_json_raw(&json, ",\"group\":");
+        if(task->group->name)
+            _co_sched_json_str(&json, task->group->name);
+        else
+            _co_sched_json_ptr(&json, task->group);
+        _co_sched_json_raw(&json, ",\"state\":");
+        _co_sched_json_str(&json, state);
+        if(parked)
+        {
+            _co_sched_json_raw(&json, ",\"wait\":");
+            if(task->wait_reason)
+                _co_sched_json_str(&json, task->wait_reason);
+            else
+                _co_sched_json_raw(&json, "null");
+            _co_sched_json_raw(&json, ",\"parked_ns\":");
+            _co_sched_json_uint(&json, now > task->parked_at ? now - task->parked_at : 0);
+        }
+        _co_sched_json_raw(&json, ",\"stack_used\":");
+        _co_sched_json_uint(&json, (uint64_t)co_stack_usage(co));
+        _co_sched_json_raw(&json, ",\"stack_size\":");
+        _co_sched_json_uint(&json, (uint64_t)co->stack_size);
+        _co_sched_json_raw(&json, task->cancelled ? ",\"cancelled\":true" : ",\"cancelled\":false");
+
+        _co_sched_json_raw(&json, ",\"calls\":[");
+        co_frame_info frames[32];
+        int depth = co_backtrace(co, frames, 32);
+        if(depth > 32)
+            depth = 32;
+        for(int i = 0; i < depth; ++i)
+        {
+            _co_sched_json_raw(&json, i == 0 ? "{\"func\":" : ",{\"func\":");
+            _co_sched_json_func(&json, frames[i].func);
+            _co_sched_json_raw(&json, ",\"line\":");
+            if(frames[i].line < 0)
+                _co_sched_json_raw(&json, "-1");
+            else
+                _co_sched_json_uint(&json, (uint64_t)frames[i].line);
+            _co_sched_json_raw(&json, "}");
+        }
+        _co_sched_json_raw(&json, "]}");
+    }
+    _co_sched_json_raw(&json, "]}\n");
+    _co_sched_json_flush(&json);
+}
+
+static inline void co_sched_set_dump_target( co_sched* sched, co_sched_dump_func func, void* userdata )
+{
+    sched->dump_func     = func;
+    sched->dump_userdata = userdata;
+}
+
+static inline void co_sched_request_dump( co_sched* sched )
+{
+    _CO_SCHED_PUBLISH(sched->dump_requested, 1u);
+}
+
+#endif // CORO_SCHED_REGISTRY
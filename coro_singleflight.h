@@ -0,0 +1,524 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Singleflight, coalescing of concurrent loads of the same key, for coroutines run by
+ * coro_sched.h with an optional read-through LRU-cache.
+ *
+ * The first coroutine requesting a key that is not in the cache becomes the "leader" and
+ * co_call():s the loader, all other coroutines requesting the same key while the load is
+ * in flight are parked and receive the result of the leaders load when it completes.
+ *
+ * static void load_texture(coro* co, void*, void* arg)
+ * {
+ *     co_sf_flight* flight = *(co_sf_flight**)arg;
+ *
+ *     co_begin(co);
+ *
+ *     // ... load flight->key, this is a normal co_func and can yield/wait ...
+ *
+ *     flight->value  = the_loaded_texture;
+ *     flight->status = 0; // != 0 means failure, failed loads are not cached.
+ *
+ *     co_end(co);
+ * }
+ *
+ * static void use_texture(coro* co, void*, void*)
+ * {
+ *     co_locals_begin(co);
+ *         co_sf_result tex;
+ *     co_locals_end(co);
+ *
+ *     co_begin(co);
+ *
+ *     co_singleflight(co, &g_textures, texture_key, load_texture, locals.tex);
+ *     if(locals.tex.status == 0)
+ *         use(locals.tex.value);
+ *
+ *     co_end(co);
+ * }
+ *
+ * Values are opaque void* owned by the user, if a cache is attached values are handed to
+ * the eviction-callback of the cache when they are evicted.
+ *
+ * If the leader is cancelled with co_sched_cancel() while it is loading, the load is failed
+ * when the leader is freed and all waiters are woken with value nullptr and status
+ * -ECANCELED. A loader that handed the co_sf_flight* to something else must not touch it
+ * after the leader has been cancelled.
+ *
+ * @note detecting cancelled leaders uses one coroutine-local key, see CORO_LOCAL_SLOTS in
+ *       coro.h. If CORO_LOCAL_SLOTS is 0 or all keys are taken, cancelling a leader will leave
+ *       its waiters parked forever.
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+
+#include <errno.h>
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Called by the cache when a value is evicted or when the cache is destroyed.
+ */
+typedef void(*co_lru_evict_func)(uint64_t key, void* value, void* userdata);
+
+struct co_lru_entry
+{
+    uint64_t      key;
+    void*         value;
+    co_lru_entry* prev;       ///< lru-list, head is most recently used.
+    co_lru_entry* next;
+    co_lru_entry* hash_next;
+};
+
+/**
+ * Fixed capacity LRU-cache mapping uint64_t keys to void*.
+ */
+struct co_lru
+{
+    co_lru_entry*     entries;
+    co_lru_entry**    buckets;
+    co_lru_entry*     free_list;
+    co_lru_entry*     head;
+    co_lru_entry*     tail;
+    uint32_t          bucket_mask;
+    uint32_t          count;
+    uint32_t          capacity;
+    co_lru_evict_func evict;
+    void*             evict_userdata;
+
+    uint64_t          hits;
+    uint64_t          misses;
+};
+
+/**
+ * Initialize cache with room for capacity values, a capacity of 0 is treated as 1.
+ */
+static inline void co_lru_init( co_lru* lru, uint32_t capacity, co_lru_evict_func evict, void* evict_userdata );
+
+/**
+ * Destroy cache, calling evict on all values in the cache.
+ */
+static inline void co_lru_destroy( co_lru* lru );
+
+/**
+ * Lookup key and mark it as most recently used.
+ *
+ * @return true if key was found.
+ */
+static inline bool co_lru_get( co_lru* lru, uint64_t key, void** value );
+
+/**
+ * Insert or replace value for key, evicting the least recently used value if the cache is full.
+ */
+static inline void co_lru_put( co_lru* lru, uint64_t key, void* value );
+
+struct co_sf_result;
+struct co_singleflight_table;
+
+/**
+ * One in-flight load, passed as argument to the loader.
+ */
+struct co_sf_flight
+{
+    uint64_t      key;
+    void*         value;   ///< to be set by loader.
+    int           status;  ///< to be set by loader, 0 on success.
+
+    coro*                  leader;
+    co_sf_result*          waiters;
+    co_sf_flight*          next;
+    co_singleflight_table* sf;
+    co_sf_flight*          outer;   ///< flight the leader was already leading when this one started.
+};
+
+/**
+ * Result of co_singleflight(), need to be stored in locals of the calling coroutine.
+ */
+struct co_sf_result
+{
+    void*         value  {nullptr};
+    int           status {0};
+    bool          shared {false};   ///< true if result came from another coroutines load or the cache.
+
+    co_sf_flight* _flight {nullptr};
+    co_sf_result* _next   {nullptr};
+    coro*         _waiter {nullptr};
+};
+
+struct co_singleflight_table
+{
+    co_sf_flight** buckets;
+    co_sf_flight*  free_list;
+    uint32_t       bucket_mask;
+    uint32_t       in_flight;
+    co_lru*        cache;
+
+    uint64_t       loads;    ///< number of loads performed.
+    uint64_t       coalesced;///< number of requests that waited on another coroutines load.
+};
+
+/**
+ * Initialize table.
+ *
+ * @param bucket_cnt number of hash-buckets for in-flight keys, rounded up to power of 2.
+ * @param cache optional cache to read from and insert successful loads to, can be null.
+ */
+static inline void co_singleflight_init( co_singleflight_table* sf, uint32_t bucket_cnt, co_lru* cache );
+
+/**
+ * Destroy table, there should be no loads in flight.
+ */
+static inline void co_singleflight_destroy( co_singleflight_table* sf );
+
+/**
+ * Get the value for key, either from the attached cache, by waiting on a load already in
+ * flight or by co_call():ing loader with a co_sf_flight* as argument.
+ *
+ * @param co current coroutine.
+ * @param sf co_singleflight_table* to use.
+ * @param key uint64_t key, evaluated multiple times.
+ * @param loader co_func used to load value if not cached or in flight.
+ * @param out co_sf_result in locals of the calling coroutine.
+ */
+#define co_singleflight(co, sf, key, loader, out)
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_singleflight
+
+static inline uint32_t _co_sf_hash( uint64_t key )
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static inline uint32_t _co_sf_pow2( uint32_t v )
+{
+    uint32_t p = 1;
+    while(p < v)
+        p <<= 1;
+    return p;
+}
+
+static inline void co_lru_init( co_lru* lru, uint32_t capacity, co_lru_evict_func evict, void* evict_userdata )
+{
+    if(capacity == 0)
+        capacity = 1;
+    uint32_t bucket_cnt = _co_sf_pow2(capacity * 2);
+    lru->entries     = (co_lru_entry*)CORO_SCHED_ALLOC(sizeof(co_lru_entry) * capacity);
+    lru->buckets     = (co_lru_entry**)CORO_SCHED_ALLOC(sizeof(co_lru_entry*) * bucket_cnt);
+    lru->bucket_mask = bucket_cnt - 1;
+    lru->count       = 0;
+    lru->capacity    = capacity;
+    lru->head        = nullptr;
+    lru->tail        = nullptr;
+    lru->free_list   = nullptr;
+    lru->evict       = evict;
+    lru->evict_userdata = evict_userdata;
+    lru->hits        = 0;
+    lru->misses      = 0;
+    memset(lru->buckets, 0, sizeof(co_lru_entry*) * bucket_cnt);
+    for(uint32_t i = 0; i < capacity; ++i)
+    {
+        lru->entries[i].next = lru->free_list;
+        lru->free_list = &lru->entries[i];
+    }
+}
+
+static inline void co_lru_destroy( co_lru* lru )
+{
+    if(lru->evict)
+        for(co_lru_entry* e = lru->head; e; e = e->next)
+            lru->evict(e->key, e->value, lru->evict_userdata);
+    CORO_SCHED_FREE(lru->entries);
+    CORO_SCHED_FREE(lru->buckets);
+}
+
+static inline void _co_lru_unlink( co_lru* lru, co_lru_entry* e )
+{
+    if(e->prev) e->prev->next = e->next; else lru->head = e->next;
+    if(e->next) e->next->prev = e->prev; else lru->tail = e->prev;
+}
+
+static inline void _co_lru_link_front( co_lru* lru, co_lru_entry* e )
+{
+    e->prev = nullptr;
+    e->next = lru->head;
+    if(lru->head) lru->head->prev = e; else lru->tail = e;
+    lru->head = e;
+}
+
+static inline co_lru_entry** _co_lru_find( co_lru* lru, uint64_t key )
+{
+    co_lru_entry** it = &lru->buckets[_co_sf_hash(key) & lru->bucket_mask];
+    while(*it && (*it)->key != key)
+        it = &(*it)->hash_next;
+    return it;
+}
+
+static inline bool co_lru_get( co_lru* lru, uint64_t key, void** value )
+{
+    co_lru_entry* e = *_co_lru_find(lru, key);
+    if(e == nullptr)
+    {
+        ++lru->misses;
+        return false;
+    }
+    ++lru->hits;
+    _co_lru_unlink(lru, e);
+    _co_lru_link_front(lru, e);
+    *value = e->value;
+    return true;
+}
+
+static inline void co_lru_put( co_lru* lru, uint64_t key, void* value )
+{
+    co_lru_entry** slot = _co_lru_find(lru, key);
+    co_lru_entry*  e    = *slot;
+    if(e != nullptr)
+    {
+        if(lru->evict && e->value != value)
+            lru->evict(e->key, e->value, lru->evict_userdata);
+        e->value = value;
+        _co_lru_unlink(lru, e);
+        _co_lru_link_front(lru, e);
+        return;
+    }
+
+    if(lru->free_list == nullptr)
+    {
+        co_lru_entry* victim = lru->tail;
+        _co_lru_unlink(lru, victim);
+        co_lru_entry** it = _co_lru_find(lru, victim->key);
+        *it = victim->hash_next;
+        if(lru->evict)
+            lru->evict(victim->key, victim->value, lru->evict_userdata);
+        victim->next   = nullptr;
+        lru->free_list = victim;
+        --lru->count;
+
+        // the victim might have been in the same bucket, find slot again.
+        slot = _co_lru_find(lru, key);
+    }
+
+    e = lru->free_list;
+    lru->free_list = e->next;
+    e->key       = key;
+    e->value     = value;
+    e->hash_next = nullptr;
+    *slot = e;
+    _co_lru_link_front(lru, e);
+    ++lru->count;
+}
+
+static inline void co_singleflight_init( co_singleflight_table* sf, uint32_t bucket_cnt, co_lru* cache )
+{
+    bucket_cnt = _co_sf_pow2(bucket_cnt);
+    sf->buckets     = (co_sf_flight**)CORO_SCHED_ALLOC(sizeof(co_sf_flight*) * bucket_cnt);
+    sf->bucket_mask = bucket_cnt - 1;
+    sf->free_list   = nullptr;
+    sf->in_flight   = 0;
+    sf->cache       = cache;
+    sf->loads       = 0;
+    sf->coalesced   = 0;
+    memset(sf->buckets, 0, sizeof(co_sf_flight*) * bucket_cnt);
+}
+
+static inline void co_singleflight_destroy( co_singleflight_table* sf )
+{
+    CORO_ASSERT(sf->in_flight == 0, "destroying singleflight-table with loads in flight!");
+    while(co_sf_flight* f = sf->free_list)
+    {
+        sf->free_list = f->next;
+        CORO_SCHED_FREE(f);
+    }
+    CORO_SCHED_FREE(sf->buckets);
+}
+
+static inline co_sf_flight** _co_sf_find( co_singleflight_table* sf, uint64_t key )
+{
+    co_sf_flight** it = &sf->buckets[_co_sf_hash(key) & sf->bucket_mask];
+    while(*it && (*it)->key != key)
+        it = &(*it)->next;
+    return it;
+}
+
+static inline void _co_sf_complete( co_singleflight_table* sf, co_sf_flight* f )
+{
+    if(sf->cache && f->status == 0)
+        co_lru_put(sf->cache, f->key, f->value);
+
+    co_sf_flight** slot = _co_sf_find(sf, f->key);
+    *slot = f->next;
+    --sf->in_flight;
+
+    co_sf_result* w = f->waiters;
+    while(w)
+    {
+        // read next before waking as waking a cancelled coroutine frees its stack.
+        co_sf_result* next = w->_next;
+        w->value  = f->value;
+        w->status = f->status;
+        w->shared = true;
+        co_sched_wake(w->_waiter);
+        w = next;
+    }
+
+    f->next = sf->free_list;
+    sf->free_list = f;
+}
+
+#if CORO_LOCAL_SLOTS > 0
+// called by co_local_release() if a leader is freed while loading, i.e. it was cancelled.
+// not static as the key below need to refer to the same function in all translation-units.
+inline void _co_sf_leader_freed( void* value )
+{
+    co_sf_flight* f = (co_sf_flight*)value;
+    while(f)
+    {
+        co_sf_flight* outer = f->outer;
+        f->value  = nullptr;
+        f->status = -ECANCELED;
+        _co_sf_complete(f->sf, f);
+        f = outer;
+    }
+}
+
+inline co_local_key _co_sf_leader_key()
+{
+    static co_local_key key = co_local_key_create(_co_sf_leader_freed);
+    return key;
+}
+#endif
+
+/**
+ * Returns false if the value was found in the cache, otherwise out->_flight is set if the
+ * calling coroutine is the leader and null if it should wait.
+ */
+static inline bool _co_sf_begin( co_singleflight_table* sf, uint64_t key, co_sf_result* out, coro* co )
+{
+    coro* root = co->call.root;
+
+    // re-entered after a stack-overflow in the co_call() to the loader.
+    if(out->_flight != nullptr && out->_flight->leader == root)
+        return true;
+
+    if(sf->cache && co_lru_get(sf->cache, key, &out->value))
+    {
+        out->status = 0;
+        out->shared = true;
+        return false;
+    }
+
+    co_sf_flight** slot = _co_sf_find(sf, key);
+    if(*slot != nullptr)
+    {
+        co_sf_flight* f = *slot;
+        out->_flight = nullptr;
+        out->_waiter = root;
+        out->_next   = f->waiters;
+        f->waiters   = out;
+        ++sf->coalesced;
+        co_sched_wait_reason(co, "singleflight");
+        return true;
+    }
+
+    co_sf_flight* f = sf->free_list;
+    if(f)
+        sf->free_list = f->next;
+    else
+        f = (co_sf_flight*)CORO_SCHED_ALLOC(sizeof(co_sf_flight));
+    f->key     = key;
+    f->value   = nullptr;
+    f->status  = 0;
+    f->leader  = root;
+    f->waiters = nullptr;
+    f->next    = nullptr;
+    f->sf      = sf;
+    f->outer   = nullptr;
+    *slot = f;
+    ++sf->in_flight;
+    ++sf->loads;
+    out->_flight = f;
+
+#if CORO_LOCAL_SLOTS > 0
+    co_local_key leader_key = _co_sf_leader_key();
+    if(leader_key >= 0)
+    {
+        f->outer = (co_sf_flight*)co_local_get(root, leader_key);
+        co_local_set(root, leader_key, f);
+    }
+#endif
+    return true;
+}
+
+static inline void _co_sf_finish( co_singleflight_table* sf, co_sf_result* out )
+{
+    co_sf_flight* f = out->_flight;
+    out->_flight = nullptr;
+    out->value   = f->value;
+    out->status  = f->status;
+    out->shared  = false;
+
+#if CORO_LOCAL_SLOTS > 0
+    co_local_key leader_key = _co_sf_leader_key();
+    if(leader_key >= 0)
+        co_local_set(f->leader, leader_key, f->outer);
+#endif
+
+    _co_sf_complete(sf, f);
+}
+
+#define co_singleflight(co, sf, key, loader, out)                                          \
+    do {                                                                                   \
+        if(_co_sf_begin((sf), (key), &(out), co))                                          \
+        {                                                                                  \
+            if((out)._flight == nullptr)                                                   \
+            {                                                                              \
+                co->call.root->waiting = 1;                                                \
+                co->call.state = __LINE__ + 200000; return; case __LINE__ + 200000: {}     \
+            }                                                                              \
+            else                                                                           \
+            {                                                                              \
+                co_call(co, (loader), (out)._flight);                                      \
+                _co_sf_finish((sf), &(out));                                               \
+            }                                                                              \
+        }                                                                                  \
+    } while(0)
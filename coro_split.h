@@ -0,0 +1,395 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Generator splitting a memory-mapped file into lines or delimiter-separated records
+ * without copying any data.
+ *
+ * co_split_source src;
+ * if(!co_split_open(&src, "my_log.txt", '\n'))
+ *     return;
+ *
+ * co_split_source* src_ptr = &src;
+ * coro co;
+ * co_init(&co, stack, sizeof(stack), co_split_gen, src_ptr);
+ *
+ * co_split_record line;
+ * while(co_gen_next(&co, &line))
+ *     printf("%.*s\n", (int)line.len, line.str);
+ *
+ * co_split_close(&src);
+ *
+ * The records point straight into the mapped file and are valid until co_split_close().
+ * A record does not include its delimiter and the last record in a file without a trailing
+ * delimiter is produced as well. No special handling of '\r' is done.
+ *
+ * A co_split_source is also a stage that can be used directly with the combinators in
+ * coro_generator.h, skipping the co_resume() per record.
+ *
+ * Delimiters are searched with AVX2 or SSE2 when available, the AVX2-path is selected at
+ * runtime on gcc/clang, with a scalar memchr() fallback.
+ */
+
+#pragma once
+
+#include "coro_generator.h"
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if !defined(WIN32_LEAN_AND_MEAN)
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_SPLIT_SIMD to select implementation used to search for delimiters.
+ * 0 = scalar, 1 = SSE2, 2 = SSE2 and AVX2 if supported by the cpu at runtime.
+ * Defaults to the best supported by the target.
+ */
+#if !defined(CORO_SPLIT_SIMD)
+#  if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#    define CORO_SPLIT_SIMD 2
+#  else
+#    define CORO_SPLIT_SIMD 0
+#  endif
+#endif
+
+#if CORO_SPLIT_SIMD >= 1
+#  include <emmintrin.h>
+#endif
+#if CORO_SPLIT_SIMD >= 2
+#  include <immintrin.h>
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+/**
+ * One record produced by the splitter, points into the split data.
+ */
+struct co_split_record
+{
+    const char* str;
+    size_t      len;
+};
+
+/**
+ * Source of records, either a memory-mapped file opened with co_split_open() or a memory
+ * buffer passed to co_split_init_mem().
+ */
+struct co_split_source
+{
+    typedef co_split_record value_type;
+
+    const char* data;
+    size_t      size;
+    size_t      pos;
+    char        delim;
+
+#if defined(_WIN32)
+    HANDLE      file;
+    HANDLE      mapping;
+#else
+    int         fd;
+#endif
+};
+
+/**
+ * Memory-map file at path and prepare to split it on delim. The mapping is hinted for
+ * sequential read-ahead.
+ *
+ * @return false if the file could not be opened or mapped.
+ */
+static inline bool co_split_open( co_split_source* src, const char* path, char delim );
+
+/**
+ * Prepare to split a memory-buffer on delim, data need to be valid as long as the
+ * produced records are used.
+ */
+static inline void co_split_init_mem( co_split_source* src, const char* data, size_t size, char delim );
+
+/**
+ * Unmap file opened with co_split_open(), invalidates all records produced from src.
+ */
+static inline void co_split_close( co_split_source* src );
+
+/**
+ * Get next record from source without going via a coroutine.
+ *
+ * @return false when there are no more records.
+ */
+static inline bool co_split_next( co_split_source* src, co_split_record* out );
+
+/**
+ * Generator-coroutine producing a co_split_record per record in the co_split_source*
+ * passed as argument, to be used with co_gen_next().
+ */
+static inline void co_split_gen( coro* co, void* userdata, void* arg );
+
+/**
+ * Find first occurrence of delim in [begin, end), returns end if not found.
+ */
+static inline const char* co_split_find( const char* begin, const char* end, char delim );
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+static inline const char* _co_split_find_scalar( const char* begin, const char* end, char delim )
+{
+    const char* found = (const char*)memchr(begin, delim, (size_t)(end - begin));
+    return found ? found : end;
+}
+
+#if CORO_SPLIT_SIMD >= 1
+static inline int _co_split_ctz32( uint32_t v )
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, v);
+    return (int)i;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+static inline const char* _co_split_find_sse2( const char* begin, const char* end, char delim )
+{
+    const __m128i needle = _mm_set1_epi8(delim);
+    while(end - begin >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)begin);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if(mask != 0)
+            return begin + _co_split_ctz32((uint32_t)mask);
+        begin += 16;
+    }
+    return _co_split_find_scalar(begin, end, delim);
+}
+#endif
+
+#if CORO_SPLIT_SIMD >= 2
+#  if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#  endif
+static inline const char* _co_split_find_avx2( const char* begin, const char* end, char delim )
+{
+    const __m256i needle = _mm256_set1_epi8(delim);
+    while(end - begin >= 64)
+    {
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)begin);
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(begin + 32));
+        uint32_t m0 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b0, needle));
+        uint32_t m1 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b1, needle));
+        if(m0 != 0)
+            return begin + _co_split_ctz32(m0);
+        if(m1 != 0)
+            return begin + 32 + _co_split_ctz32(m1);
+        begin += 64;
+    }
+    return _co_split_find_sse2(begin, end, delim);
+}
+
+static inline bool _co_split_has_avx2()
+{
+#  if defined(__AVX2__)
+    return true;
+#  elif defined(__GNUC__) || defined(__clang__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+#  else
+    return false;
+#  endif
+}
+#endif
+
+static inline const char* co_split_find( const char* begin, const char* end, char delim )
+{
+#if CORO_SPLIT_SIMD >= 2
+    if(_co_split_has_avx2())
+        return _co_split_find_avx2(begin, end, delim);
+#endif
+#if CORO_SPLIT_SIMD >= 1
+    return _co_split_find_sse2(begin, end, delim);
+#else
+    return _co_split_find_scalar(begin, end, delim);
+#endif
+}
+
+static inline void co_split_init_mem( co_split_source* src, const char* data, size_t size, char delim )
+{
+    src->data  = data;
+    src->size  = size;
+    src->pos   = 0;
+    src->delim = delim;
+#if defined(_WIN32)
+    src->file    = INVALID_HANDLE_VALUE;
+    src->mapping = nullptr;
+#else
+    src->fd = -1;
+#endif
+}
+
+static inline bool co_split_open( co_split_source* src, const char* path, char delim )
+{
+    co_split_init_mem(src, nullptr, 0, delim);
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    src->file = file;
+    if(size.QuadPart == 0)
+        return true;
+
+    src->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(src->mapping == nullptr)
+    {
+        co_split_close(src);
+        return false;
+    }
+
+    src->data = (const char*)MapViewOfFile(src->mapping, FILE_MAP_READ, 0, 0, 0);
+    src->size = (size_t)size.QuadPart;
+    if(src->data == nullptr)
+    {
+        co_split_close(src);
+        return false;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    src->fd = fd;
+    if(st.st_size == 0)
+        return true;
+
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+    {
+        co_split_close(src);
+        return false;
+    }
+
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    src->data = (const char*)data;
+    src->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+static inline void co_split_close( co_split_source* src )
+{
+#if defined(_WIN32)
+    if(src->mapping != nullptr)
+    {
+        if(src->data)
+            UnmapViewOfFile(src->data);
+        CloseHandle(src->mapping);
+    }
+    if(src->file != INVALID_HANDLE_VALUE)
+        CloseHandle(src->file);
+#else
+    if(src->fd >= 0)
+    {
+        if(src->data)
+            munmap((void*)src->data, src->size);
+        close(src->fd);
+    }
+#endif
+    co_split_init_mem(src, nullptr, 0, src->delim);
+}
+
+static inline bool co_split_next( co_split_source* src, co_split_record* out )
+{
+    if(src->pos >= src->size)
+        return false;
+
+    const char* begin = src->data + src->pos;
+    const char* end   = src->data + src->size;
+    const char* found = co_split_find(begin, end, src->delim);
+
+    out->str = begin;
+    out->len = (size_t)(found - begin);
+    src->pos = (size_t)(found - src->data) + (found != end ? 1 : 0);
+    return true;
+}
+
+static inline bool co_gen_next( co_split_source& src, co_split_record* out )
+{
+    return co_split_next(&src, out);
+}
+
+static inline void co_split_gen( coro* co, void*, void* arg )
+{
+    co_split_source* src = *(co_split_source**)arg;
+
+    co_locals_begin(co);
+        co_split_record rec;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    while(co_split_next(src, &locals.rec))
+        co_gen_yield(co, locals.rec);
+
+    co_end(co);
+}
@@ -0,0 +1,422 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Live statistics of schedulers from coro_sched.h published in a shared-memory page, posix-only.
+ *
+ * A process creates a named page and publishes the counters of its schedulers into it at
+ * whatever rate it likes, for example once per loop or every few milliseconds. Another
+ * process, for example the co_top tool, can attach to the page read-only and sample it
+ * without the publishing process noticing.
+ *
+ * co_stats stats;
+ * co_stats_create(&stats, "/my_service");
+ * co_stats_slot* slot = co_stats_add(&stats, &sched, "main");
+ *
+ * while(running)
+ * {
+ *     co_sched_step(&sched);
+ *     co_io_poll(&io, 1);
+ *     co_stats_publish(&stats, slot);
+ * }
+ *
+ * co_stats_destroy(&stats);
+ *
+ * Each slot is protected by a seqlock, publishing is only relaxed stores to the page and
+ * readers retry if they sampled a slot while it was written. Each slot need to be published
+ * from the thread running its scheduler.
+ *
+ * Published counters are all totals since the scheduler was initialized, except for live,
+ * ready and stack_bytes that are current values, rates are computed by the reader.
+ *
+ * A co_timer_wheel from coro_timer.h driven by the same thread can be published with the
+ * scheduler with co_stats_add_timers(), its counters are published as timers_*.
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+#include "coro_timer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_STATS_MAX_SCHEDS to configure the number of schedulers that can be published to
+ * one page, defaults to 16. Need to be the same in the publisher and all readers.
+ */
+#if !defined(CORO_STATS_MAX_SCHEDS)
+#  define CORO_STATS_MAX_SCHEDS 16
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+enum
+{
+    CO_STATS_MAGIC       = 0x636f7374, // 'cost'
+    CO_STATS_VERSION     = 2,
+    CO_STATS_NAME_LEN    = 32,
+    CO_STATS_MAX_REASONS = CORO_SCHED_WAIT_REASONS
+};
+
+/**
+ * Counters of one scheduler, as copied out of the page with co_stats_read().
+ */
+struct co_stats_values
+{
+    uint64_t live;
+    uint64_t ready;
+    uint64_t resumes;
+    uint64_t parks;
+    uint64_t spawn_rejected;
+    uint64_t spawn_parked;
+    uint64_t pool_hits;
+    uint64_t pooled;        ///< task/stack pairs currently in the pool.
+    uint64_t stack_bytes;
+    uint64_t stack_grows;
+    uint64_t timers_pending;   ///< timers currently started in the attached wheel, if any.
+    uint64_t timers_started;
+    uint64_t timers_cancelled;
+    uint64_t timers_expired;
+    uint64_t timers_cascaded;
+    uint64_t publishes;     ///< number of times the slot has been published.
+
+    uint32_t reason_cnt;    ///< per wait-reason counters, 0 unless CORO_SCHED_REGISTRY is 1.
+    char     reasons[CO_STATS_MAX_REASONS][CO_STATS_NAME_LEN];
+    uint64_t reason_parks[CO_STATS_MAX_REASONS];
+    uint64_t reason_wakes[CO_STATS_MAX_REASONS];
+    uint64_t reason_wait_ns[CO_STATS_MAX_REASONS];
+    uint64_t reason_buckets[CO_STATS_MAX_REASONS][CO_SCHED_WAIT_BUCKETS];  ///< @see co_sched_wait_stat.
+};
+
+/**
+ * Slot in the shared page, one per scheduler.
+ */
+struct co_stats_slot
+{
+    uint64_t        seq;    ///< seqlock, odd while the slot is written.
+    char            name[CO_STATS_NAME_LEN];
+    co_stats_values values;
+};
+
+/**
+ * Layout of the shared page.
+ */
+struct co_stats_page
+{
+    uint32_t      magic;
+    uint32_t      version;
+    uint32_t      pid;
+    uint32_t      slot_cnt;
+    co_stats_slot slots[CORO_STATS_MAX_SCHEDS];
+};
+
+/**
+ * Publisher or reader of a page, the scheduler pointers are kept in the process and never
+ * published.
+ */
+struct co_stats
+{
+    co_stats_page*  page;
+    co_sched*       scheds[CORO_STATS_MAX_SCHEDS];
+    co_timer_wheel* wheels[CORO_STATS_MAX_SCHEDS];
+    char           name[CO_STATS_NAME_LEN];
+    bool           owner;
+};
+
+/**
+ * Create, or re-create, a shared page with name, a name as passed to shm_open(), i.e.
+ * "/something".
+ */
+static inline bool co_stats_create( co_stats* stats, const char* name );
+
+/**
+ * Unmap page and remove it if it was created with co_stats_create().
+ */
+static inline void co_stats_destroy( co_stats* stats );
+
+/**
+ * Add a scheduler to the page, name is truncated to CO_STATS_NAME_LEN - 1.
+ *
+ * @return slot to pass to co_stats_publish() or nullptr if the page is full.
+ */
+static inline co_stats_slot* co_stats_add( co_stats* stats, co_sched* sched, const char* name );
+
+/**
+ * Publish the counters of wheel together with the scheduler of slot, wheel need to be driven
+ * by the thread publishing slot. Pass nullptr to detach.
+ */
+static inline void co_stats_add_timers( co_stats* stats, co_stats_slot* slot, co_timer_wheel* wheel );
+
+/**
+ * Publish the current counters of the scheduler added with slot.
+ */
+static inline void co_stats_publish( co_stats* stats, co_stats_slot* slot );
+
+/**
+ * Copy the current counters of sched to out, without a page. Need to be called from the
+ * thread running sched.
+ */
+static inline void co_stats_collect( co_sched* sched, co_stats_values* out );
+
+/**
+ * Copy the current counters of sched and wheel to out, without a page. Need to be called
+ * from the thread running sched and wheel.
+ */
+static inline void co_stats_collect( co_sched* sched, co_timer_wheel* wheel, co_stats_values* out );
+
+/**
+ * Attach read-only to a page created by another, or the same, process.
+ */
+static inline bool co_stats_attach( co_stats* stats, const char* name );
+
+/**
+ * Copy consistent values of slot out of the page, retrying while the slot is being written.
+ *
+ * @return false if no consistent copy could be made in a reasonable amount of tries.
+ */
+static inline bool co_stats_read( const co_stats_slot* slot, co_stats_values* out );
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+static inline void _co_stats_copy_name( char* dst, const char* src )
+{
+    size_t len = strlen(src);
+    if(len > CO_STATS_NAME_LEN - 1)
+        len = CO_STATS_NAME_LEN - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static inline bool co_stats_create( co_stats* stats, const char* name )
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+    if(ftruncate(fd, (off_t)sizeof(co_stats_page)) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* mem = mmap(nullptr, sizeof(co_stats_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return false;
+    }
+
+    stats->page  = (co_stats_page*)mem;
+    stats->owner = true;
+    _co_stats_copy_name(stats->name, name);
+    memset(stats->scheds, 0, sizeof(stats->scheds));
+    memset(stats->wheels, 0, sizeof(stats->wheels));
+
+    // ftruncate() zero-fills the page, publish the header last so readers only see a valid page.
+    stats->page->version  = CO_STATS_VERSION;
+    stats->page->pid      = (uint32_t)getpid();
+    stats->page->slot_cnt = 0;
+    __atomic_store_n(&stats->page->magic, (uint32_t)CO_STATS_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+static inline void co_stats_destroy( co_stats* stats )
+{
+    munmap(stats->page, sizeof(co_stats_page));
+    if(stats->owner)
+        shm_unlink(stats->name);
+    stats->page = nullptr;
+}
+
+static inline co_stats_slot* co_stats_add( co_stats* stats, co_sched* sched, const char* name )
+{
+    co_stats_page* page = stats->page;
+    uint32_t idx = page->slot_cnt;
+    if(idx == CORO_STATS_MAX_SCHEDS)
+        return nullptr;
+
+    co_stats_slot* slot = &page->slots[idx];
+    _co_stats_copy_name(slot->name, name);
+    stats->scheds[idx] = sched;
+    __atomic_store_n(&page->slot_cnt, idx + 1, __ATOMIC_RELEASE);
+    return slot;
+}
+
+static inline void co_stats_add_timers( co_stats* stats, co_stats_slot* slot, co_timer_wheel* wheel )
+{
+    stats->wheels[slot - stats->page->slots] = wheel;
+}
+
+#define _CO_STATS_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+/**
+ * Copy counters of sched and wheel, if any, to v, all stores are relaxed so that this can be
+ * used to write to the shared page.
+ */
+static inline void _co_stats_fill( co_sched* sched, co_timer_wheel* wheel, co_stats_values* v )
+{
+    _CO_STATS_STORE(v->live,           (uint64_t)sched->live);
+    _CO_STATS_STORE(v->ready,          (uint64_t)sched->ready_cnt);
+    _CO_STATS_STORE(v->resumes,        sched->resume_seq);
+    _CO_STATS_STORE(v->parks,          sched->parks);
+    _CO_STATS_STORE(v->spawn_rejected, sched->spawn_rejected);
+    _CO_STATS_STORE(v->spawn_parked,   sched->spawn_parked);
+    _CO_STATS_STORE(v->pool_hits,      sched->pool_hits);
+    _CO_STATS_STORE(v->pooled,         (uint64_t)sched->pool_cnt);
+    _CO_STATS_STORE(v->stack_bytes,    (uint64_t)sched->stack_bytes);
+    _CO_STATS_STORE(v->stack_grows,    sched->stack_grows);
+
+    if(wheel)
+    {
+        _CO_STATS_STORE(v->timers_pending,   (uint64_t)wheel->pending);
+        _CO_STATS_STORE(v->timers_started,   wheel->started);
+        _CO_STATS_STORE(v->timers_cancelled, wheel->cancelled);
+        _CO_STATS_STORE(v->timers_expired,   wheel->expired);
+        _CO_STATS_STORE(v->timers_cascaded,  wheel->cascaded);
+    }
+
+#if CORO_SCHED_REGISTRY
+    // reasons only get added, so names only need to be written once.
+    uint32_t reason_cnt = v->reason_cnt;
+    for(uint32_t i = reason_cnt; i < sched->wait_stat_cnt; ++i)
+    {
+        const char* reason = sched->wait_stats[i].reason ? sched->wait_stats[i].reason : "none";
+        size_t len = strlen(reason);
+        if(len > CO_STATS_NAME_LEN - 1)
+            len = CO_STATS_NAME_LEN - 1;
+        for(size_t c = 0; c < CO_STATS_NAME_LEN; ++c)
+            _CO_STATS_STORE(v->reasons[i][c], c < len ? reason[c] : '\0');
+    }
+    for(uint32_t i = 0; i < sched->wait_stat_cnt; ++i)
+    {
+        const co_sched_wait_stat* stat = &sched->wait_stats[i];
+        _CO_STATS_STORE(v->reason_parks[i],   stat->parks);
+        _CO_STATS_STORE(v->reason_wakes[i],   stat->wakes);
+        _CO_STATS_STORE(v->reason_wait_ns[i], stat->wait_ns);
+        for(uint32_t b = 0; b < CO_SCHED_WAIT_BUCKETS; ++b)
+            _CO_STATS_STORE(v->reason_buckets[i][b], stat->buckets[b]);
+    }
+    _CO_STATS_STORE(v->reason_cnt, sched->wait_stat_cnt);
+#endif
+}
+
+static inline void co_stats_publish( co_stats* stats, co_stats_slot* slot )
+{
+    co_stats_values* v = &slot->values;
+
+    uint64_t seq = slot->seq;
+    _CO_STATS_STORE(slot->seq, seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    size_t idx = (size_t)(slot - stats->page->slots);
+    _co_stats_fill(stats->scheds[idx], stats->wheels[idx], v);
+    _CO_STATS_STORE(v->publishes, v->publishes + 1);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    _CO_STATS_STORE(slot->seq, seq + 2);
+}
+
+static inline void co_stats_collect( co_sched* sched, co_timer_wheel* wheel, co_stats_values* out )
+{
+    memset(out, 0, sizeof(co_stats_values));
+    _co_stats_fill(sched, wheel, out);
+}
+
+static inline void co_stats_collect( co_sched* sched, co_stats_values* out )
+{
+    co_stats_collect(sched, nullptr, out);
+}
+
+#undef _CO_STATS_STORE
+
+static inline bool co_stats_attach( co_stats* stats, const char* name )
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(co_stats_page))
+    {
+        close(fd);
+        return false;
+    }
+    void* mem = mmap(nullptr, sizeof(co_stats_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mem == MAP_FAILED)
+        return false;
+
+    co_stats_page* page = (co_stats_page*)mem;
+    if(__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != CO_STATS_MAGIC || page->version != CO_STATS_VERSION)
+    {
+        munmap(mem, sizeof(co_stats_page));
+        return false;
+    }
+
+    stats->page  = page;
+    stats->owner = false;
+    _co_stats_copy_name(stats->name, name);
+    memset(stats->scheds, 0, sizeof(stats->scheds));
+    memset(stats->wheels, 0, sizeof(stats->wheels));
+    return true;
+}
+
+static inline bool co_stats_read( const co_stats_slot* slot, co_stats_values* out )
+{
+    for(int tries = 0; tries < 1000; ++tries)
+    {
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+            continue;
+
+        // byte-wise relaxed loads, the copy may be torn and is only used if seq is unchanged.
+        const uint8_t* src = (const uint8_t*)&slot->values;
+        uint8_t*       dst = (uint8_t*)out;
+        for(size_t i = 0; i < sizeof(co_stats_values); ++i)
+            dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            return true;
+    }
+    return false;
+}
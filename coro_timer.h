@@ -0,0 +1,436 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Timers for coroutines from coro_sched.h, implemented as a hierarchical timing-wheel.
+ *
+ * co_timer_wheel wheel;
+ * co_timer_wheel_init(&wheel, 1000000, now_ns()); // 1ms resolution
+ *
+ * void blinker(coro* co, void*, void*)
+ * {
+ *     co_locals_begin(co);
+ *         co_timer timer;
+ *     co_locals_end(co);
+ *
+ *     co_begin(co);
+ *     while(true)
+ *     {
+ *         toggle_led();
+ *         co_timer_sleep(co, &wheel, &locals.timer, 500 * 1000000ull);
+ *     }
+ *     co_end(co);
+ * }
+ *
+ * while(co_sched_live(&sched) > 0)
+ * {
+ *     co_timer_advance(&wheel, now_ns());
+ *     co_sched_step(&sched);
+ * }
+ *
+ * Starting and cancelling a timer is O(1). co_timer_advance() is O(1) per expired timer and
+ * per occupied slot passed, timers further away than 256 ticks are moved closer to expiry
+ * a few times during their lifetime ("cascading"). Timers fire on the first
+ * co_timer_advance() at or after the tick of their deadline, so they fire at most one tick
+ * late and never early, relative to the time passed to co_timer_advance().
+ *
+ * Timers are intrusive, the co_timer struct is owned by the user, for example as a local in
+ * the coroutine, and no memory is allocated by the wheel.
+ *
+ * @note a timer in the locals of a coroutine is moved if the stack is replaced, i.e. if the
+ *       stack grows via coro_sched.h. Locals of a coroutine that is parked in
+ *       co_timer_sleep() are fine as the stack does not grow while parked, but a timer used
+ *       as a timeout while the coroutine keeps running need to be placed in memory that is
+ *       not moved.
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+enum
+{
+    CO_TIMER_SLOT_BITS = 8,
+    CO_TIMER_SLOTS     = 1 << CO_TIMER_SLOT_BITS,
+    CO_TIMER_LEVELS    = 4  ///< covers 2^32 ticks, timers further away are clamped and re-cascaded.
+};
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+struct co_timer;
+
+typedef void (*co_timer_func)( co_timer* timer, void* userdata );
+
+struct co_timer_link
+{
+    co_timer_link* next;
+    co_timer_link* prev;
+};
+
+struct co_timer
+{
+    co_timer_link link;      ///< needs to be first.
+    uint64_t      expires;   ///< tick the timer expires at.
+    co_timer_func func;      ///< called on expiry if set, otherwise waiter is woken.
+    union
+    {
+        coro*     waiter;
+        void*     userdata;
+    };
+};
+
+struct co_timer_wheel
+{
+    co_timer_link slots[CO_TIMER_LEVELS][CO_TIMER_SLOTS];
+    uint64_t      occupied[CO_TIMER_LEVELS][CO_TIMER_SLOTS / 64];  ///< bitmap of non-empty slots.
+    uint64_t      now;       ///< current tick, all timers expiring at or before it have fired.
+    uint64_t      tick_ns;
+    uint64_t      base_ns;   ///< time of tick 0.
+    uint32_t      pending;   ///< number of started timers.
+
+    uint64_t      started;
+    uint64_t      cancelled;
+    uint64_t      expired;
+    uint64_t      cascaded;  ///< number of times a timer has been moved to a lower level.
+};
+
+/**
+ * Initialize wheel with a resolution of tick_ns and the current time now_ns, in any unit as
+ * long as it is the same in all calls.
+ */
+static inline void co_timer_wheel_init( co_timer_wheel* wheel, uint64_t tick_ns, uint64_t now_ns );
+
+/**
+ * Initialize timer, a timer need to be initialized once before it is started.
+ */
+static inline void co_timer_init( co_timer* timer );
+
+/**
+ * Start timer to fire at deadline_ns. On expiry func is called with userdata or, for the
+ * overload taking a coroutine, the coroutine is woken with co_sched_wake(). Starting a timer
+ * that is already pending restarts it.
+ */
+static inline void co_timer_start( co_timer_wheel* wheel, co_timer* timer, uint64_t deadline_ns, co_timer_func func, void* userdata );
+static inline void co_timer_start( co_timer_wheel* wheel, co_timer* timer, uint64_t deadline_ns, coro* waiter );
+
+/**
+ * Stop a pending timer.
+ *
+ * @return true if the timer was pending, false if it had already fired or was never started.
+ */
+static inline bool co_timer_cancel( co_timer_wheel* wheel, co_timer* timer );
+
+/**
+ * Returns true if timer is started and has not fired or been cancelled.
+ */
+static inline bool co_timer_pending( const co_timer* timer ) { return timer->link.next != nullptr; }
+
+/**
+ * Advance the wheel to now_ns, firing all timers with a deadline before that.
+ *
+ * @return number of fired timers.
+ */
+static inline uint32_t co_timer_advance( co_timer_wheel* wheel, uint64_t now_ns );
+
+/**
+ * Time from now_ns until the wheel may need to be advanced, for use as a timeout when
+ * blocking in a reactor. Never later than the next timer, but may be earlier when timers
+ * need to be cascaded. Returns max_ns if there are no timers.
+ */
+static inline uint64_t co_timer_next_ns( co_timer_wheel* wheel, uint64_t now_ns, uint64_t max_ns );
+
+/**
+ * Park coroutine until duration_ns has passed since the time last passed to the wheel,
+ * timer need to be a co_timer that is initialized and not pending.
+ */
+#define co_timer_sleep(co, wheel, timer, duration_ns)
+
+/**
+ * Park coroutine until deadline_ns. If the coroutine is woken before the deadline by
+ * something else the timer is cancelled when it resumes.
+ */
+#define co_timer_sleep_until(co, wheel, timer, deadline_ns)
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_timer_sleep
+#undef co_timer_sleep_until
+
+static inline void co_timer_wheel_init( co_timer_wheel* wheel, uint64_t tick_ns, uint64_t now_ns )
+{
+    CORO_ASSERT(tick_ns > 0, "tick_ns need to be at least 1!");
+    for(int l = 0; l < CO_TIMER_LEVELS; ++l)
+        for(int s = 0; s < CO_TIMER_SLOTS; ++s)
+            wheel->slots[l][s].next = wheel->slots[l][s].prev = &wheel->slots[l][s];
+    memset(wheel->occupied, 0, sizeof(wheel->occupied));
+    wheel->now       = 0;
+    wheel->tick_ns   = tick_ns;
+    wheel->base_ns   = now_ns;
+    wheel->pending   = 0;
+    wheel->started   = 0;
+    wheel->cancelled = 0;
+    wheel->expired   = 0;
+    wheel->cascaded  = 0;
+}
+
+static inline void co_timer_init( co_timer* timer )
+{
+    timer->link.next = nullptr;
+    timer->link.prev = nullptr;
+    timer->expires   = 0;
+    timer->func      = nullptr;
+    timer->waiter    = nullptr;
+}
+
+static inline void _co_timer_unlink( co_timer_wheel* wheel, co_timer* timer )
+{
+    co_timer_link* next = timer->link.next;
+    co_timer_link* prev = timer->link.prev;
+    next->prev = prev;
+    prev->next = next;
+    timer->link.next = nullptr;
+    timer->link.prev = nullptr;
+
+    // the slot is empty when the list points back at the sentinel, the timer may also be
+    // in a local list during co_timer_advance() in which case the bit is already cleared.
+    if(next == prev)
+    {
+        co_timer_link* first = &wheel->slots[0][0];
+        co_timer_link* last  = &wheel->slots[CO_TIMER_LEVELS - 1][CO_TIMER_SLOTS - 1];
+        if(next >= first && next <= last)
+        {
+            size_t idx = (size_t)(next - first);
+            wheel->occupied[idx / CO_TIMER_SLOTS][(idx % CO_TIMER_SLOTS) / 64] &= ~(1ull << (idx % 64));
+        }
+    }
+}
+
+/**
+ * Link timer in the slot of its expiry-tick, relative to the current tick of the wheel. Timers
+ * expiring at the current tick end up in the level 0 slot that is about to be processed when
+ * cascading.
+ */
+static inline void _co_timer_link( co_timer_wheel* wheel, co_timer* timer )
+{
+    // the level is picked so that the slot is reached before the timer expires, it is then
+    // cascaded to lower levels until it ends up in level 0.
+    int level = 0;
+    while(level < CO_TIMER_LEVELS - 1 && (timer->expires >> (CO_TIMER_SLOT_BITS * (level + 1))) != (wheel->now >> (CO_TIMER_SLOT_BITS * (level + 1))))
+        ++level;
+    uint32_t slot = (uint32_t)(timer->expires >> (CO_TIMER_SLOT_BITS * level)) & (CO_TIMER_SLOTS - 1);
+
+    co_timer_link* head = &wheel->slots[level][slot];
+    timer->link.next = head;
+    timer->link.prev = head->prev;
+    head->prev->next = &timer->link;
+    head->prev       = &timer->link;
+    wheel->occupied[level][slot / 64] |= 1ull << (slot % 64);
+}
+
+static inline uint64_t _co_timer_tick( co_timer_wheel* wheel, uint64_t ns )
+{
+    if(ns <= wheel->base_ns)
+        return 0;
+    // round up so that timers never fire before their deadline.
+    return (ns - wheel->base_ns + wheel->tick_ns - 1) / wheel->tick_ns;
+}
+
+static inline void co_timer_start( co_timer_wheel* wheel, co_timer* timer, uint64_t deadline_ns, co_timer_func func, void* userdata )
+{
+    if(co_timer_pending(timer))
+        co_timer_cancel(wheel, timer);
+    const uint64_t max_delta = (1ull << (CO_TIMER_SLOT_BITS * CO_TIMER_LEVELS)) - 1;
+    timer->expires  = _co_timer_tick(wheel, deadline_ns);
+    if(timer->expires <= wheel->now)
+        timer->expires = wheel->now + 1;
+    if(timer->expires - wheel->now > max_delta)
+        timer->expires = wheel->now + max_delta;
+    timer->func     = func;
+    timer->userdata = userdata;
+    _co_timer_link(wheel, timer);
+    ++wheel->pending;
+    ++wheel->started;
+}
+
+static inline void co_timer_start( co_timer_wheel* wheel, co_timer* timer, uint64_t deadline_ns, coro* waiter )
+{
+    co_timer_start(wheel, timer, deadline_ns, nullptr, waiter->call.root);
+}
+
+static inline bool co_timer_cancel( co_timer_wheel* wheel, co_timer* timer )
+{
+    if(!co_timer_pending(timer))
+        return false;
+    _co_timer_unlink(wheel, timer);
+    --wheel->pending;
+    ++wheel->cancelled;
+    return true;
+}
+
+/**
+ * Move all timers from a slot to a local list, clearing the slot.
+ */
+static inline void _co_timer_take_slot( co_timer_wheel* wheel, int level, uint32_t slot, co_timer_link* list )
+{
+    co_timer_link* head = &wheel->slots[level][slot];
+    if(head->next == head)
+    {
+        list->next = list->prev = list;
+        return;
+    }
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    head->next = head->prev = head;
+    wheel->occupied[level][slot / 64] &= ~(1ull << (slot % 64));
+}
+
+static inline void _co_timer_cascade( co_timer_wheel* wheel, int level )
+{
+    uint32_t slot = (uint32_t)(wheel->now >> (CO_TIMER_SLOT_BITS * level)) & (CO_TIMER_SLOTS - 1);
+    co_timer_link list;
+    _co_timer_take_slot(wheel, level, slot, &list);
+    while(list.next != &list)
+    {
+        co_timer* timer = (co_timer*)list.next;
+        list.next = timer->link.next;
+        list.next->prev = &list;
+        _co_timer_link(wheel, timer);
+        ++wheel->cascaded;
+    }
+}
+
+/**
+ * Returns the next tick that has timers in level 0 or where higher levels need to be cascaded.
+ */
+static inline uint64_t _co_timer_next_tick( co_timer_wheel* wheel )
+{
+    uint64_t tick = wheel->now + 1;
+    uint32_t from = (uint32_t)tick & (CO_TIMER_SLOTS - 1);
+    if(from == 0)
+        return tick;
+
+    for(uint32_t word = from / 64; word < CO_TIMER_SLOTS / 64; ++word)
+    {
+        uint64_t bits = wheel->occupied[0][word];
+        if(word == from / 64)
+            bits &= ~0ull << (from % 64);
+        if(bits != 0)
+        {
+#if defined(_MSC_VER)
+            unsigned long bit;
+            _BitScanForward64(&bit, bits);
+#else
+            uint32_t bit = (uint32_t)__builtin_ctzll(bits);
+#endif
+            return (tick & ~(uint64_t)(CO_TIMER_SLOTS - 1)) + word * 64 + bit;
+        }
+    }
+    return (wheel->now | (CO_TIMER_SLOTS - 1)) + 1;
+}
+
+static inline uint32_t co_timer_advance( co_timer_wheel* wheel, uint64_t now_ns )
+{
+    uint64_t target = now_ns <= wheel->base_ns ? 0 : (now_ns - wheel->base_ns) / wheel->tick_ns;
+    uint32_t fired  = 0;
+
+    while(wheel->now < target)
+    {
+        // skip empty slots, no timers can expire before the next tick returned.
+        uint64_t tick = wheel->pending == 0 ? target + 1 : _co_timer_next_tick(wheel);
+        if(tick > target)
+        {
+            wheel->now = target;
+            break;
+        }
+        wheel->now = tick;
+
+        if((tick & (CO_TIMER_SLOTS - 1)) == 0)
+        {
+            // start of a new rotation, pull down timers from higher levels.
+            for(int level = 1; level < CO_TIMER_LEVELS; ++level)
+            {
+                _co_timer_cascade(wheel, level);
+                if(((tick >> (CO_TIMER_SLOT_BITS * level)) & (CO_TIMER_SLOTS - 1)) != 0)
+                    break;
+            }
+        }
+
+        co_timer_link list;
+        _co_timer_take_slot(wheel, 0, (uint32_t)tick & (CO_TIMER_SLOTS - 1), &list);
+        while(list.next != &list)
+        {
+            co_timer* timer = (co_timer*)list.next;
+            _co_timer_unlink(wheel, timer);
+            --wheel->pending;
+            ++wheel->expired;
+            ++fired;
+            if(timer->func)
+                timer->func(timer, timer->userdata);
+            else
+                co_sched_wake(timer->waiter);
+        }
+    }
+    return fired;
+}
+
+static inline uint64_t co_timer_next_ns( co_timer_wheel* wheel, uint64_t now_ns, uint64_t max_ns )
+{
+    if(wheel->pending == 0)
+        return max_ns;
+
+    uint64_t at_ns = wheel->base_ns + _co_timer_next_tick(wheel) * wheel->tick_ns;
+    if(at_ns <= now_ns)
+        return 0;
+    return at_ns - now_ns < max_ns ? at_ns - now_ns : max_ns;
+}
+
+static inline uint64_t _co_timer_now_ns( co_timer_wheel* wheel )
+{
+    return wheel->base_ns + wheel->now * wheel->tick_ns;
+}
+
+// the timer is cancelled after the wait in case the coroutine was woken by something else.
+#define co_timer_sleep_until(co, wheel, timer, deadline_ns) \
+    do { co_sched_wait_reason(co, "timer"); co_timer_start((wheel), (timer), (deadline_ns), co->call.root); co_wait(co); co_timer_cancel((wheel), (timer)); } while(0)
+
+#define co_timer_sleep(co, wheel, timer, duration_ns) \
+    co_timer_sleep_until(co, wheel, timer, _co_timer_now_ns(wheel) + (duration_ns))
@@ -0,0 +1,309 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Batched UDP endpoint for the coro_io.h reactor, linux-only.
+ *
+ * Received datagrams are drained with one recvmmsg() into a batch of up to CORO_UDP_BATCH
+ * packets and handed out one at a time with co_udp_recv(), so a coroutine consuming the
+ * endpoint only does a syscall per batch and not per packet. Replies are queued with
+ * co_udp_send() from any coroutine and sent with one sendmmsg() per co_udp_flush(), usually
+ * called once per tick of the main-loop.
+ *
+ * co_udp udp;
+ * co_udp_init(&udp, &io, udp_socket);
+ *
+ * void ingest(coro* co, void*, void*)
+ * {
+ *     co_locals_begin(co);
+ *         co_udp_packet* pkt;
+ *     co_locals_end(co);
+ *
+ *     co_begin(co);
+ *     while(true)
+ *     {
+ *         co_udp_recv(co, &udp, locals.pkt);
+ *         if(locals.pkt == nullptr)
+ *             co_exit(co); // error, errno is set.
+ *         // dispatch to per-flow state by locals.pkt->addr or reply directly.
+ *         co_udp_send(&udp, locals.pkt->data, locals.pkt->len, &locals.pkt->addr, locals.pkt->addr_len);
+ *     }
+ *     co_end(co);
+ * }
+ *
+ * // main-loop
+ * while(co_sched_live(&sched) > 0)
+ * {
+ *     co_sched_run(&sched);
+ *     co_udp_flush(&udp);
+ *     co_io_poll(&io, -1);
+ * }
+ *
+ * @note a packet returned by co_udp_recv() is valid until the next call to co_udp_recv().
+ */
+
+#pragma once
+
+#include "coro_io.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_UDP_BATCH to configure max number of packets received per recvmmsg() and sent
+ * per sendmmsg(), defaults to 64.
+ */
+#if !defined(CORO_UDP_BATCH)
+#  define CORO_UDP_BATCH 64
+#endif
+
+/**
+ * Define CORO_UDP_MAX_PACKET to configure max size of a packet, bigger packets are truncated
+ * on receive and rejected by co_udp_send(), defaults to 2048.
+ */
+#if !defined(CORO_UDP_MAX_PACKET)
+#  define CORO_UDP_MAX_PACKET 2048
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+struct co_udp_packet
+{
+    uint8_t*         data;
+    uint32_t         len;
+    sockaddr_storage addr;
+    socklen_t        addr_len;
+};
+
+struct co_udp
+{
+    co_io_fd      f;
+
+    co_udp_packet packets[CORO_UDP_BATCH];   ///< received batch.
+    mmsghdr       rmsgs[CORO_UDP_BATCH];
+    iovec         riovs[CORO_UDP_BATCH];
+    uint32_t      rpos;
+    uint32_t      rcnt;
+
+    co_udp_packet out[CORO_UDP_BATCH];       ///< queued replies.
+    mmsghdr       smsgs[CORO_UDP_BATCH];
+    iovec         siovs[CORO_UDP_BATCH];
+    uint32_t      scnt;
+
+    uint8_t*      bufs;                      ///< packet-memory for both received and queued packets.
+
+    uint64_t      recv_calls;   ///< number of recvmmsg() calls returning packets.
+    uint64_t      send_calls;   ///< number of sendmmsg() calls.
+    uint64_t      packets_in;
+    uint64_t      packets_out;
+    uint64_t      dropped;      ///< queued replies that could not be sent.
+};
+
+/**
+ * Initialize endpoint on a bound udp-socket and register it with io, the socket is made
+ * non-blocking. The endpoint is big, allocate it statically or on the heap.
+ *
+ * @return false on failure, errno is set.
+ */
+static inline bool co_udp_init( co_udp* udp, co_io* io, int fd );
+
+/**
+ * Unregister endpoint from io and free its memory, the socket is not closed.
+ */
+static inline void co_udp_destroy( co_udp* udp, co_io* io );
+
+/**
+ * Queue a datagram to addr, it is copied and sent by the next co_udp_flush(). If the queue is
+ * full it is flushed first.
+ *
+ * @return false if len is bigger than CORO_UDP_MAX_PACKET.
+ */
+static inline bool co_udp_send( co_udp* udp, const void* data, uint32_t len, const void* addr, socklen_t addr_len );
+
+/**
+ * Send all queued datagrams with one sendmmsg(). Datagrams that can't be sent since the
+ * socket-buffer is full is dropped as udp would drop them anyway.
+ *
+ * @return number of datagrams sent.
+ */
+static inline int co_udp_flush( co_udp* udp );
+
+/**
+ * Get next received packet, receives a new batch if the current one is consumed and parks
+ * the coroutine while there is nothing to receive. pkt is a co_udp_packet*, set to nullptr on
+ * error with errno set.
+ */
+#define co_udp_recv(co, udp, pkt)
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_udp_recv
+
+static inline bool co_udp_init( co_udp* udp, co_io* io, int fd )
+{
+    memset(udp, 0, sizeof(co_udp));
+    udp->bufs = (uint8_t*)CORO_SCHED_ALLOC((size_t)CORO_UDP_BATCH * 2 * CORO_UDP_MAX_PACKET);
+    if(udp->bufs == nullptr)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    for(uint32_t i = 0; i < CORO_UDP_BATCH; ++i)
+    {
+        udp->packets[i].data = udp->bufs + (size_t)i * CORO_UDP_MAX_PACKET;
+        udp->out[i].data     = udp->bufs + (size_t)(CORO_UDP_BATCH + i) * CORO_UDP_MAX_PACKET;
+
+        udp->riovs[i].iov_base            = udp->packets[i].data;
+        udp->rmsgs[i].msg_hdr.msg_name    = &udp->packets[i].addr;
+        udp->rmsgs[i].msg_hdr.msg_iov     = &udp->riovs[i];
+        udp->rmsgs[i].msg_hdr.msg_iovlen  = 1;
+
+        udp->siovs[i].iov_base            = udp->out[i].data;
+        udp->smsgs[i].msg_hdr.msg_name    = &udp->out[i].addr;
+        udp->smsgs[i].msg_hdr.msg_iov     = &udp->siovs[i];
+        udp->smsgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    if(!co_io_add(io, &udp->f, fd))
+    {
+        int err = errno;
+        CORO_SCHED_FREE(udp->bufs);
+        udp->bufs = nullptr;
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+static inline void co_udp_destroy( co_udp* udp, co_io* io )
+{
+    co_io_remove(io, &udp->f);
+    CORO_SCHED_FREE(udp->bufs);
+    udp->bufs = nullptr;
+}
+
+static inline int co_udp_flush( co_udp* udp )
+{
+    uint32_t pos  = 0;
+    int      sent = 0;
+    while(pos < udp->scnt)
+    {
+        int res = sendmmsg(udp->f.fd, udp->smsgs + pos, udp->scnt - pos, MSG_DONTWAIT);
+        ++udp->send_calls;
+        if(res < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                break;
+            // error for the first datagram in the batch (like unreachable), skip it and send
+            // the rest.
+            ++udp->dropped;
+            ++pos;
+            continue;
+        }
+        pos  += (uint32_t)res;
+        sent += res;
+    }
+    udp->packets_out += (uint64_t)sent;
+    udp->dropped     += (uint64_t)(udp->scnt - pos);
+    udp->scnt = 0;
+    return sent;
+}
+
+static inline bool co_udp_send( co_udp* udp, const void* data, uint32_t len, const void* addr, socklen_t addr_len )
+{
+    if(len > CORO_UDP_MAX_PACKET || addr_len > sizeof(sockaddr_storage))
+        return false;
+    if(udp->scnt == CORO_UDP_BATCH)
+        co_udp_flush(udp);
+
+    uint32_t i = udp->scnt++;
+    co_udp_packet* pkt = &udp->out[i];
+    memcpy(pkt->data, data, len);
+    memcpy(&pkt->addr, addr, addr_len);
+    pkt->len      = len;
+    pkt->addr_len = addr_len;
+    udp->siovs[i].iov_len             = len;
+    udp->smsgs[i].msg_hdr.msg_namelen = addr_len;
+    return true;
+}
+
+/**
+ * Returns next packet in batch or receives a new batch, nullptr with errno == EAGAIN if
+ * there was nothing to receive.
+ */
+static inline co_udp_packet* _co_udp_next( co_udp* udp )
+{
+    if(udp->rpos < udp->rcnt)
+        return &udp->packets[udp->rpos++];
+
+    for(uint32_t i = 0; i < CORO_UDP_BATCH; ++i)
+    {
+        udp->riovs[i].iov_len             = CORO_UDP_MAX_PACKET;
+        udp->rmsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+    }
+
+    int res;
+    while((res = recvmmsg(udp->f.fd, udp->rmsgs, CORO_UDP_BATCH, MSG_DONTWAIT, nullptr)) < 0 && errno == EINTR)
+        ;
+    if(res <= 0)
+    {
+        udp->rpos = udp->rcnt = 0;
+        if(res == 0)
+            errno = EAGAIN;
+        return nullptr;
+    }
+
+    for(int i = 0; i < res; ++i)
+    {
+        udp->packets[i].len      = udp->rmsgs[i].msg_len;
+        udp->packets[i].addr_len = udp->rmsgs[i].msg_hdr.msg_namelen;
+    }
+    ++udp->recv_calls;
+    udp->packets_in += (uint64_t)res;
+    udp->rcnt = (uint32_t)res;
+    udp->rpos = 1;
+    return &udp->packets[0];
+}
+
+#define co_udp_recv(co, udp, pkt) \
+    do { while(((pkt) = _co_udp_next(udp)) == nullptr && errno == EAGAIN) co_io_wait_readable(co, &(udp)->f); } while(0)
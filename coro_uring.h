@@ -0,0 +1,841 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * io_uring-backend for coroutines run by coro_sched.h, linux-only and implemented directly
+ * on top of the io_uring syscalls so there is no dependency on liburing. Requires kernel
+ * headers and a kernel of at least 6.0 for provided buffer-rings and multishot recv.
+ *
+ * Single-shot operations park the coroutine until the operation has completed:
+ *
+ * co_locals_begin(co);
+ *     co_uring_op op;
+ *     char        buffer[512];
+ * co_locals_end(co);
+ *
+ * co_begin(co);
+ * co_uring_read(co, &ring, &locals.op, fd, locals.buffer, sizeof(locals.buffer), 0);
+ * if(locals.op.res < 0)
+ *     ; // failed, -errno
+ *
+ * // main-loop
+ * while(co_sched_live(&sched) > 0)
+ * {
+ *     co_sched_run(&sched);
+ *     co_uring_poll(&ring, true);
+ * }
+ *
+ * REGISTERED BUFFERS:
+ *
+ * Buffers registered with co_uring_register_buffers() are pinned once, co_uring_read_fixed()
+ * and co_uring_write_fixed() can then use them without the kernel pinning the pages for
+ * each operation.
+ *
+ * PROVIDED BUFFER-RINGS:
+ *
+ * A co_uring_buf_ring is a group of equally sized buffers shared with the kernel, a recv
+ * using a buffer-ring picks a buffer when data arrives rather than when the recv is
+ * submitted. Connections that are idle will therefore not hold any buffer-memory. The
+ * buffer used is found via co_uring_buf_ptr() and need to be handed back to the kernel with
+ * co_uring_buf_return() when it has been consumed.
+ *
+ * ZERO-COPY SEND:
+ *
+ * co_uring_send_zc() sends directly from the user buffer without copying it into the kernel.
+ * The kernel posts the result of the send first and a notification when it no longer
+ * references the buffer, the coroutine stays parked until the notification so the buffer can
+ * be reused or freed as soon as co_uring_send_zc() returns. Zero-copy is only a win for large
+ * sends, for small ones the page pinning cost more than the copy.
+ *
+ * BUSY-POLLING:
+ *
+ * co_uring_run_busy() never sleeps, it interleaves one co_sched_step() with one non-blocking
+ * co_uring_poll(). Completions are read from memory shared with the kernel so polling only
+ * enters the kernel when there is something to submit. Initializing the ring with
+ * IORING_SETUP_SQPOLL also removes that syscall since a kernel-thread picks up submissions.
+ *
+ * MULTISHOT:
+ *
+ * co_uring_recv_multishot() and co_uring_accept_multishot() submits one operation that
+ * produce a stream of completions. The completions are queued in a co_uring_multishot and
+ * consumed with co_uring_multishot_next() that parks the coroutine until a completion is
+ * available. When the kernel ends the stream, for example with -ENOBUFS when the buffer-ring
+ * is empty, co_uring_multishot_active() returns false and the operation need to be submitted
+ * again.
+ *
+ * If the consumer falls behind and CORO_URING_MULTISHOT_QUEUE completions are queued the
+ * operation is cancelled, completions that arrive before the cancel has taken effect are
+ * kept in a heap-allocated spill-queue so that no accepted fd or buffer-id is lost. The stream
+ * then ends as if the kernel had ended it and the operation need to be submitted again.
+ *
+ * @note co_uring_op:s can be stored in locals since the stack of a parked coroutine is never
+ *       replaced. co_uring_multishot:s however receive completions while the coroutine is
+ *       running and must NOT be stored on the coroutine stack.
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_URING_MULTISHOT_QUEUE to configure max number of completions queued in a
+ * co_uring_multishot, needs to be a power of 2 and for multishot recv at least as big as the
+ * buffer-ring used, defaults to 256.
+ */
+#if !defined(CORO_URING_MULTISHOT_QUEUE)
+#  define CORO_URING_MULTISHOT_QUEUE 256
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+struct co_uring
+{
+    int                  fd;
+    uint32_t             sq_entries;
+    uint32_t*            sq_head;
+    uint32_t*            sq_tail;
+    uint32_t*            sq_mask;
+    uint32_t*            sq_array;
+    uint32_t*            sq_flags;
+    io_uring_sqe*        sqes;
+    uint32_t             sq_local_tail;   ///< sqes prepared but not yet published to the kernel.
+
+    uint32_t*            cq_head;
+    uint32_t*            cq_tail;
+    uint32_t*            cq_mask;
+    io_uring_cqe*        cqes;
+
+    void*                sq_ring_ptr;
+    size_t               sq_ring_size;
+    void*                cq_ring_ptr;
+    size_t               cq_ring_size;
+    size_t               sqes_size;
+    uint32_t             setup_flags;
+    uint32_t             features;     ///< IORING_FEAT_* reported by the kernel.
+
+    uint64_t             submits;      ///< number of io_uring_enter() calls.
+    uint64_t             completions;  ///< number of cqes processed.
+    uint64_t             cq_flushes;   ///< number of io_uring_enter() calls to flush an overflowed cq.
+};
+
+/**
+ * Single-shot operation.
+ */
+struct co_uring_op
+{
+    int32_t  res;     ///< result of operation, -errno on failure.
+    uint32_t flags;   ///< cqe-flags, contains buffer-id if a buffer-ring was used.
+    coro*    waiter;
+};
+
+struct co_uring_cqe_item
+{
+    int32_t  res;
+    uint32_t flags;
+};
+
+/**
+ * State of a multishot-operation, must not be stored on the stack of a coroutine.
+ */
+struct co_uring_multishot
+{
+    co_uring_cqe_item  items[CORO_URING_MULTISHOT_QUEUE];
+    uint32_t           head;
+    uint32_t           tail;
+    coro*              waiter;
+    co_uring*          ring;          ///< ring the operation was submitted on, used to cancel it.
+    co_uring_cqe_item* spill;         ///< completions that did not fit in items, consumed after them.
+    uint32_t           spill_head;
+    uint32_t           spill_tail;
+    uint32_t           spill_cap;
+    uint32_t           overflows;     ///< number of times the operation was cancelled due to a full queue.
+    uint32_t           active    : 1;
+    uint32_t           cancelled : 1; ///< cancel has been submitted.
+};
+
+/**
+ * Group of provided buffers.
+ */
+struct co_uring_buf_ring
+{
+    io_uring_buf_ring* ring;
+    uint8_t*           bufs;
+    uint32_t           entries;
+    uint32_t           buf_size;
+    uint16_t           bgid;
+    uint16_t           tail;
+};
+
+/**
+ * Initialize ring with room for entries submissions.
+ *
+ * @param flags IORING_SETUP_*-flags passed to io_uring_setup().
+ * @return false on failure, errno is set.
+ */
+static inline bool co_uring_init( co_uring* ring, uint32_t entries, uint32_t flags );
+
+static inline void co_uring_destroy( co_uring* ring );
+
+/**
+ * Submit all prepared operations and process all available completions, waking the
+ * coroutines whose operations completed. Completions held back by the kernel because the cq
+ * overflowed are flushed and processed as well.
+ *
+ * @param wait block until at least one completion is available.
+ * @return number of completions processed.
+ */
+static inline int co_uring_poll( co_uring* ring, bool wait );
+
+/**
+ * Run coroutines in sched and poll ring without ever blocking until there are no live
+ * coroutines or *stop is set, stop can be nullptr and may be set from another thread.
+ */
+static inline void co_uring_run_busy( co_uring* ring, co_sched* sched, const bool* stop );
+
+/**
+ * Get a sqe to prepare a custom operation, submitted at the next co_uring_poll().
+ * Use together with co_uring_await() to park a coroutine until the operation completes.
+ */
+static inline io_uring_sqe* co_uring_get_sqe( co_uring* ring );
+
+/**
+ * Register buffers to be used by co_uring_read_fixed()/co_uring_write_fixed().
+ */
+static inline bool co_uring_register_buffers( co_uring* ring, const struct iovec* iovs, uint32_t cnt );
+static inline bool co_uring_unregister_buffers( co_uring* ring );
+
+/**
+ * Create and register a buffer-ring of 'entries' buffers of buf_size bytes each with
+ * group-id bgid, entries need to be a power of 2.
+ */
+static inline bool co_uring_buf_ring_init( co_uring* ring, co_uring_buf_ring* br, uint16_t bgid, uint32_t entries, uint32_t buf_size );
+static inline void co_uring_buf_ring_destroy( co_uring* ring, co_uring_buf_ring* br );
+
+/**
+ * Get buffer selected by the kernel for a completion with IORING_CQE_F_BUFFER set.
+ */
+static inline uint8_t* co_uring_buf_ptr( co_uring_buf_ring* br, uint32_t cqe_flags );
+
+/**
+ * Hand back the buffer used by a completion to the kernel.
+ */
+static inline void co_uring_buf_return( co_uring_buf_ring* br, uint32_t cqe_flags );
+
+/**
+ * Start multishot recv on fd using buffers from br, each received chunk is one completion.
+ */
+static inline void co_uring_recv_multishot( co_uring* ring, co_uring_multishot* ms, int fd, co_uring_buf_ring* br );
+
+/**
+ * Start multishot accept on listening socket fd, each accepted fd is one completion.
+ */
+static inline void co_uring_accept_multishot( co_uring* ring, co_uring_multishot* ms, int fd );
+
+/**
+ * Returns false when the kernel has ended the multishot-operation.
+ */
+static inline bool co_uring_multishot_active( co_uring_multishot* ms ) { return ms->active == 1; }
+
+/**
+ * Park coroutine until the operation prepared on sqe completes.
+ */
+#define co_uring_await(co, ring, op, sqe)
+
+/**
+ * Single-shot operations, park the coroutine until complete. Result in op->res.
+ */
+#define co_uring_read(co, ring, op, fd, buf, len, off)
+#define co_uring_write(co, ring, op, fd, buf, len, off)
+#define co_uring_read_fixed(co, ring, op, fd, buf, len, off, buf_index)
+#define co_uring_write_fixed(co, ring, op, fd, buf, len, off, buf_index)
+#define co_uring_recv(co, ring, op, fd, buf, len)
+#define co_uring_send(co, ring, op, fd, buf, len)
+
+/**
+ * Zero-copy send, parks the coroutine until the send has completed AND the kernel is done
+ * with buf. Result in op->res.
+ */
+#define co_uring_send_zc(co, ring, op, fd, buf, len)
+
+/**
+ * splice() len bytes from fd_in to fd_out where at least one of them need to be a pipe,
+ * off_in/off_out of -1 uses and advances the file position. Result in op->res.
+ */
+#define co_uring_splice(co, ring, op, fd_in, off_in, fd_out, off_out, len)
+
+/**
+ * Single-shot recv with a buffer picked from br at completion, use co_uring_buf_ptr() on
+ * op->flags to get the buffer.
+ */
+#define co_uring_recv_select(co, ring, op, fd, br)
+
+/**
+ * Get next completion from multishot-operation, parking the coroutine until one is available.
+ * If the operation has ended and all completions has been consumed item.res is -ENODATA.
+ */
+#define co_uring_multishot_next(co, ms, item)
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+#undef co_uring_await
+#undef co_uring_read
+#undef co_uring_write
+#undef co_uring_read_fixed
+#undef co_uring_write_fixed
+#undef co_uring_recv
+#undef co_uring_send
+#undef co_uring_send_zc
+#undef co_uring_splice
+#undef co_uring_recv_select
+#undef co_uring_multishot_next
+
+// user_data of multishot-operations are tagged with the lowest bit.
+#define _CO_URING_MULTISHOT_TAG 1ull
+
+static inline int _co_uring_setup( uint32_t entries, io_uring_params* p )
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int _co_uring_enter( int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags )
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static inline int _co_uring_register( int fd, uint32_t opcode, const void* arg, uint32_t nr_args )
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline bool co_uring_init( co_uring* ring, uint32_t entries, uint32_t flags )
+{
+    memset(ring, 0, sizeof(co_uring));
+
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    ring->fd = _co_uring_setup(entries, &p);
+    if(ring->fd < 0)
+        return false;
+
+    ring->setup_flags  = flags;
+    ring->features     = p.features;
+    ring->sq_entries   = p.sq_entries;
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring_ptr = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring_ptr == MAP_FAILED)
+    {
+        close(ring->fd);
+        return false;
+    }
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring_ptr = ring->sq_ring_ptr;
+    else
+    {
+        ring->cq_ring_ptr = mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring_ptr == MAP_FAILED)
+        {
+            munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+            close(ring->fd);
+            return false;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe*)mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        if(ring->cq_ring_ptr != ring->sq_ring_ptr)
+            munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+        munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+        close(ring->fd);
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)ring->sq_ring_ptr;
+    uint8_t* cq = (uint8_t*)ring->cq_ring_ptr;
+    ring->sq_head  = (uint32_t*)(sq + p.sq_off.head);
+    ring->sq_tail  = (uint32_t*)(sq + p.sq_off.tail);
+    ring->sq_mask  = (uint32_t*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(sq + p.sq_off.array);
+    ring->sq_flags = (uint32_t*)(sq + p.sq_off.flags);
+    ring->cq_head  = (uint32_t*)(cq + p.cq_off.head);
+    ring->cq_tail  = (uint32_t*)(cq + p.cq_off.tail);
+    ring->cq_mask  = (uint32_t*)(cq + p.cq_off.ring_mask);
+    ring->cqes     = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+    return true;
+}
+
+static inline void co_uring_destroy( co_uring* ring )
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring_ptr != ring->sq_ring_ptr)
+        munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+/**
+ * Publish prepared sqes to the kernel and enter, returns result of io_uring_enter().
+ */
+static inline int _co_uring_submit( co_uring* ring, uint32_t min_complete )
+{
+    uint32_t tail      = __atomic_load_n(ring->sq_tail, __ATOMIC_RELAXED);
+    uint32_t to_submit = ring->sq_local_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if(ring->setup_flags & IORING_SETUP_SQPOLL)
+    {
+        // with SQPOLL the kernel-thread picks up the sqes, only enter if it sleeps or to wait.
+        // the store to the tail must not be reordered after the load of the flags or a wakeup
+        // can be missed, same as io_uring_smp_mb() in liburing.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        else if(min_complete == 0)
+            return (int)to_submit;
+    }
+    else if(to_submit == 0 && min_complete == 0)
+        return 0;
+
+    ++ring->submits;
+    int res;
+    do
+    {
+        res = _co_uring_enter(ring->fd, to_submit, min_complete, flags);
+    } while(res < 0 && errno == EINTR);
+    return res;
+}
+
+static inline io_uring_sqe* co_uring_get_sqe( co_uring* ring )
+{
+    uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(ring->sq_local_tail - head >= ring->sq_entries)
+    {
+        _co_uring_submit(ring, 0);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        CORO_ASSERT(ring->sq_local_tail - head < ring->sq_entries, "io_uring submission queue is full!");
+    }
+
+    uint32_t idx = ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    ++ring->sq_local_tail;
+
+    io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    return sqe;
+}
+
+static inline void _co_uring_multishot_cancel( co_uring_multishot* ms );
+
+/**
+ * Queue is full, cancel the operation and keep completions that are already on their way.
+ * Items in the spill-queue are always newer than the ones in items.
+ */
+static inline co_uring_cqe_item* _co_uring_multishot_spill( co_uring_multishot* ms )
+{
+    if(!ms->cancelled)
+    {
+        ++ms->overflows;
+        _co_uring_multishot_cancel(ms);
+    }
+    if(ms->spill_tail == ms->spill_cap)
+    {
+        uint32_t used = ms->spill_tail - ms->spill_head;
+        uint32_t cap  = used * 2 < 16 ? 16 : used * 2;
+        co_uring_cqe_item* spill = (co_uring_cqe_item*)CORO_SCHED_ALLOC(sizeof(co_uring_cqe_item) * cap);
+        if(used > 0)
+            memcpy(spill, ms->spill + ms->spill_head, sizeof(co_uring_cqe_item) * used);
+        CORO_SCHED_FREE(ms->spill);
+        ms->spill      = spill;
+        ms->spill_head = 0;
+        ms->spill_tail = used;
+        ms->spill_cap  = cap;
+    }
+    return &ms->spill[ms->spill_tail++];
+}
+
+static inline void _co_uring_complete( uint64_t user_data, int32_t res, uint32_t flags )
+{
+    if(user_data & _CO_URING_MULTISHOT_TAG)
+    {
+        co_uring_multishot* ms = (co_uring_multishot*)(uintptr_t)(user_data & ~_CO_URING_MULTISHOT_TAG);
+        co_uring_cqe_item* item;
+        if(ms->spill_head == ms->spill_tail && ms->tail - ms->head < CORO_URING_MULTISHOT_QUEUE)
+            item = &ms->items[ms->tail++ & (CORO_URING_MULTISHOT_QUEUE - 1)];
+        else
+            item = _co_uring_multishot_spill(ms);
+        item->res   = res;
+        item->flags = flags;
+        if(!(flags & IORING_CQE_F_MORE))
+            ms->active = 0;
+        if(ms->waiter)
+        {
+            coro* waiter = ms->waiter;
+            ms->waiter = nullptr;
+            co_sched_wake(waiter);
+        }
+        return;
+    }
+
+    co_uring_op* op = (co_uring_op*)(uintptr_t)user_data;
+
+    // zero-copy sends complete in two steps, the result with IORING_CQE_F_MORE set and a
+    // notification when the buffer has been released. Keep the coroutine parked until the
+    // notification and don't let the notification overwrite the result.
+    if(flags & IORING_CQE_F_NOTIF)
+    {
+        co_sched_wake(op->waiter);
+        return;
+    }
+    op->res   = res;
+    op->flags = flags;
+    if(!(flags & IORING_CQE_F_MORE))
+        co_sched_wake(op->waiter);
+}
+
+static inline int co_uring_poll( co_uring* ring, bool wait )
+{
+    uint32_t head = *ring->cq_head;
+    bool has_cqes = head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    _co_uring_submit(ring, wait && !has_cqes ? 1 : 0);
+
+    int processed = 0;
+    uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail)
+    {
+        io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int32_t  res       = cqe->res;
+        uint32_t flags     = cqe->flags;
+        ++head;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        // completions without user_data are ignored.
+        if(user_data != 0)
+            _co_uring_complete(user_data, res, flags);
+        ++processed;
+
+        if(head == tail)
+        {
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+            // cqes that did not fit in the cq are kept by the kernel and only moved to the cq
+            // when entering with IORING_ENTER_GETEVENTS, that would otherwise not happen while
+            // there is nothing to submit.
+            if(head == tail && (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+            {
+                ++ring->submits;
+                ++ring->cq_flushes;
+                while(_co_uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {}
+                tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+    ring->completions += (uint64_t)processed;
+    return processed;
+}
+
+static inline void co_uring_run_busy( co_uring* ring, co_sched* sched, const bool* stop )
+{
+    while(co_sched_live(sched) > 0 && (stop == nullptr || !__atomic_load_n(stop, __ATOMIC_RELAXED)))
+    {
+        co_sched_step(sched);
+        co_uring_poll(ring, false);
+    }
+}
+
+static inline void _co_uring_prep_op( co_uring_op* op, io_uring_sqe* sqe, coro* co )
+{
+    op->res    = 0;
+    op->flags  = 0;
+    op->waiter = co->call.root;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    co_sched_wait_reason(co, "uring");
+}
+
+static inline io_uring_sqe* _co_uring_prep_rw( co_uring* ring, uint8_t opcode, int fd, const void* buf, size_t len, uint64_t off )
+{
+    io_uring_sqe* sqe = co_uring_get_sqe(ring);
+    sqe->opcode = opcode;
+    sqe->fd     = fd;
+    sqe->addr   = (uint64_t)(uintptr_t)buf;
+    sqe->len    = (uint32_t)len;
+    sqe->off    = off;
+    return sqe;
+}
+
+static inline io_uring_sqe* _co_uring_prep_fixed( co_uring* ring, uint8_t opcode, int fd, const void* buf, size_t len, uint64_t off, uint16_t buf_index )
+{
+    io_uring_sqe* sqe = _co_uring_prep_rw(ring, opcode, fd, buf, len, off);
+    sqe->buf_index = buf_index;
+    return sqe;
+}
+
+static inline io_uring_sqe* _co_uring_prep_recv_select( co_uring* ring, int fd, co_uring_buf_ring* br )
+{
+    io_uring_sqe* sqe = _co_uring_prep_rw(ring, IORING_OP_RECV, fd, nullptr, 0, 0);
+    sqe->flags    |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = br->bgid;
+    return sqe;
+}
+
+static inline io_uring_sqe* _co_uring_prep_splice( co_uring* ring, int fd_in, int64_t off_in, int fd_out, int64_t off_out, size_t len )
+{
+    io_uring_sqe* sqe = _co_uring_prep_rw(ring, IORING_OP_SPLICE, fd_out, nullptr, len, (uint64_t)off_out);
+    sqe->splice_fd_in  = fd_in;
+    sqe->splice_off_in = (uint64_t)off_in;
+    sqe->splice_flags  = SPLICE_F_MOVE;
+    return sqe;
+}
+
+static inline bool co_uring_register_buffers( co_uring* ring, const struct iovec* iovs, uint32_t cnt )
+{
+    return _co_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, cnt) == 0;
+}
+
+static inline bool co_uring_unregister_buffers( co_uring* ring )
+{
+    return _co_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) == 0;
+}
+
+static inline void _co_uring_buf_add( co_uring_buf_ring* br, uint16_t bid, uint32_t offset )
+{
+    // index the ring memory directly, in C++ __DECLARE_FLEX_ARRAY() puts an empty struct in
+    // front of 'bufs' in io_uring_buf_ring and shifts the array 8 bytes from where the kernel
+    // expects it.
+    io_uring_buf* buf = (io_uring_buf*)(void*)br->ring + ((uint32_t)(br->tail + offset) & (br->entries - 1));
+    buf->addr = (uint64_t)(uintptr_t)(br->bufs + (size_t)bid * br->buf_size);
+    buf->len  = br->buf_size;
+    buf->bid  = bid;
+}
+
+static inline void _co_uring_buf_publish( co_uring_buf_ring* br, uint16_t count )
+{
+    br->tail = (uint16_t)(br->tail + count);
+    __atomic_store_n(&br->ring->tail, br->tail, __ATOMIC_RELEASE);
+}
+
+static inline bool co_uring_buf_ring_init( co_uring* ring, co_uring_buf_ring* br, uint16_t bgid, uint32_t entries, uint32_t buf_size )
+{
+    CORO_ASSERT((entries & (entries - 1)) == 0, "buffer-ring entries need to be a power of 2!");
+
+    size_t ring_size = entries * sizeof(io_uring_buf);
+    void* mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        return false;
+
+    br->ring     = (io_uring_buf_ring*)mem;
+    br->entries  = entries;
+    br->buf_size = buf_size;
+    br->bgid     = bgid;
+    br->tail     = 0;
+    br->bufs     = (uint8_t*)CORO_SCHED_ALLOC((size_t)entries * buf_size);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = entries;
+    reg.bgid         = bgid;
+    if(_co_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        int err = errno;
+        munmap(mem, ring_size);
+        CORO_SCHED_FREE(br->bufs);
+        errno = err;
+        return false;
+    }
+
+    for(uint32_t i = 0; i < entries; ++i)
+        _co_uring_buf_add(br, (uint16_t)i, i);
+    _co_uring_buf_publish(br, (uint16_t)entries);
+    return true;
+}
+
+static inline void co_uring_buf_ring_destroy( co_uring* ring, co_uring_buf_ring* br )
+{
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    _co_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(br->ring, br->entries * sizeof(io_uring_buf));
+    CORO_SCHED_FREE(br->bufs);
+}
+
+static inline uint8_t* co_uring_buf_ptr( co_uring_buf_ring* br, uint32_t cqe_flags )
+{
+    CORO_ASSERT(cqe_flags & IORING_CQE_F_BUFFER, "completion did not use a buffer from a buffer-ring!");
+    return br->bufs + (size_t)(cqe_flags >> IORING_CQE_BUFFER_SHIFT) * br->buf_size;
+}
+
+static inline void co_uring_buf_return( co_uring_buf_ring* br, uint32_t cqe_flags )
+{
+    CORO_ASSERT(cqe_flags & IORING_CQE_F_BUFFER, "completion did not use a buffer from a buffer-ring!");
+    _co_uring_buf_add(br, (uint16_t)(cqe_flags >> IORING_CQE_BUFFER_SHIFT), 0);
+    _co_uring_buf_publish(br, 1);
+}
+
+static inline void _co_uring_multishot_start( co_uring* ring, co_uring_multishot* ms, io_uring_sqe* sqe )
+{
+    ms->head       = 0;
+    ms->tail       = 0;
+    ms->waiter     = nullptr;
+    ms->ring       = ring;
+    ms->spill      = nullptr;
+    ms->spill_head = 0;
+    ms->spill_tail = 0;
+    ms->spill_cap  = 0;
+    ms->active     = 1;
+    ms->cancelled  = 0;
+    sqe->user_data = (uint64_t)(uintptr_t)ms | _CO_URING_MULTISHOT_TAG;
+}
+
+static inline void _co_uring_multishot_cancel( co_uring_multishot* ms )
+{
+    // the cancel itself completes without user_data and is ignored, the multishot-operation
+    // completes with -ECANCELED and without IORING_CQE_F_MORE.
+    io_uring_sqe* sqe = co_uring_get_sqe(ms->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd     = -1;
+    sqe->addr   = (uint64_t)(uintptr_t)ms | _CO_URING_MULTISHOT_TAG;
+    ms->cancelled = 1;
+}
+
+static inline void co_uring_recv_multishot( co_uring* ring, co_uring_multishot* ms, int fd, co_uring_buf_ring* br )
+{
+    io_uring_sqe* sqe = _co_uring_prep_recv_select(ring, fd, br);
+    sqe->ioprio |= IORING_RECV_MULTISHOT;
+    _co_uring_multishot_start(ring, ms, sqe);
+}
+
+static inline void co_uring_accept_multishot( co_uring* ring, co_uring_multishot* ms, int fd )
+{
+    io_uring_sqe* sqe = _co_uring_prep_rw(ring, IORING_OP_ACCEPT, fd, nullptr, 0, 0);
+    sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    _co_uring_multishot_start(ring, ms, sqe);
+}
+
+/**
+ * Pop next completion, returns false if the coroutine need to wait for one.
+ */
+static inline bool _co_uring_multishot_pop( co_uring_multishot* ms, co_uring_cqe_item* item, coro* co )
+{
+    if(ms->head != ms->tail)
+    {
+        *item = ms->items[ms->head++ & (CORO_URING_MULTISHOT_QUEUE - 1)];
+        return true;
+    }
+    if(ms->spill_head != ms->spill_tail)
+    {
+        *item = ms->spill[ms->spill_head++];
+        if(ms->spill_head == ms->spill_tail)
+        {
+            CORO_SCHED_FREE(ms->spill);
+            ms->spill      = nullptr;
+            ms->spill_head = 0;
+            ms->spill_tail = 0;
+            ms->spill_cap  = 0;
+        }
+        return true;
+    }
+    if(!ms->active)
+    {
+        item->res   = -ENODATA;
+        item->flags = 0;
+        return true;
+    }
+    CORO_ASSERT(ms->waiter == nullptr, "only one coroutine can consume a multishot-operation!");
+    ms->waiter = co->call.root;
+    co_sched_wait_reason(co, "uring_multishot");
+    return false;
+}
+
+#define co_uring_await(co, ring, op, sqe) \
+    do { _co_uring_prep_op((op), (sqe), co); co_wait(co); } while(0)
+
+#define co_uring_read(co, ring, op, fd, buf, len, off) \
+    co_uring_await(co, ring, op, _co_uring_prep_rw((ring), IORING_OP_READ, (fd), (buf), (len), (off)))
+
+#define co_uring_write(co, ring, op, fd, buf, len, off) \
+    co_uring_await(co, ring, op, _co_uring_prep_rw((ring), IORING_OP_WRITE, (fd), (buf), (len), (off)))
+
+#define co_uring_read_fixed(co, ring, op, fd, buf, len, off, buf_index) \
+    co_uring_await(co, ring, op, _co_uring_prep_fixed((ring), IORING_OP_READ_FIXED, (fd), (buf), (len), (off), (buf_index)))
+
+#define co_uring_write_fixed(co, ring, op, fd, buf, len, off, buf_index) \
+    co_uring_await(co, ring, op, _co_uring_prep_fixed((ring), IORING_OP_WRITE_FIXED, (fd), (buf), (len), (off), (buf_index)))
+
+#define co_uring_recv(co, ring, op, fd, buf, len) \
+    co_uring_await(co, ring, op, _co_uring_prep_rw((ring), IORING_OP_RECV, (fd), (buf), (len), 0))
+
+#define co_uring_send(co, ring, op, fd, buf, len) \
+    co_uring_await(co, ring, op, _co_uring_prep_rw((ring), IORING_OP_SEND, (fd), (buf), (len), 0))
+
+#define co_uring_send_zc(co, ring, op, fd, buf, len) \
+    co_uring_await(co, ring, op, _co_uring_prep_rw((ring), IORING_OP_SEND_ZC, (fd), (buf), (len), 0))
+
+#define co_uring_splice(co, ring, op, fd_in, off_in, fd_out, off_out, len) \
+    co_uring_await(co, ring, op, _co_uring_prep_splice((ring), (fd_in), (off_in), (fd_out), (off_out), (len)))
+
+#define co_uring_recv_select(co, ring, op, fd, br) \
+    co_uring_await(co, ring, op, _co_uring_prep_recv_select((ring), (fd), (br)))
+
+#define co_uring_multishot_next(co, ms, item) \
+    do { while(!_co_uring_multishot_pop((ms), &(item), co)) co_wait(co); } while(0)
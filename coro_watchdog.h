@@ -0,0 +1,409 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/**
+ * Watchdog for schedulers from coro_sched.h, posix-only.
+ *
+ * A monitor-thread samples the schedulers added to the watchdog and reports:
+ * - stalled resumes, a coroutine that has been executing for longer than a threshold without
+ *   returning to the scheduler, for example a loop that forgot to yield.
+ * - starvation, a group of coroutines, @see GROUPS in coro_sched.h, that has had coroutines
+ *   ready without any of them being resumed for longer than a threshold. For example when the
+ *   thread is blocked outside of the scheduler or when other groups get rounds that are too
+ *   long.
+ *
+ * void on_stall(const co_watchdog_report* report, void* userdata)
+ * {
+ *     // called on the monitor-thread!
+ *     fprintf(stderr, "%s for %llu ms\n", report->kind == CO_WATCHDOG_STALLED_RESUME ? "stall" : "starving",
+ *             (unsigned long long)(report->duration_ns / 1000000));
+ * }
+ *
+ * co_watchdog wd;
+ * co_watchdog_init(&wd, 50, 200, on_stall, nullptr); // stall after 50ms, starving after 200ms
+ * co_watchdog_add(&wd, &sched);                      // call on the thread running sched
+ * co_watchdog_add_group(&wd, &sched, &tenant_a);     // default group is added with sched
+ * co_watchdog_start(&wd);
+ *
+ * The cost for the scheduler is one store per resume, all timekeeping is done by the
+ * monitor-thread by noticing that the resume-sequence of a scheduler, or the resume-count of
+ * a group with ready coroutines, has not changed between samples. Durations are therefore
+ * only accurate to the sampling interval, which is a quarter of the smallest threshold.
+ *
+ * LOGICAL BACKTRACES:
+ *
+ * The monitor-thread can't safely inspect a coroutine that is executing on another thread.
+ * Set a signal with co_watchdog_set_signal() and it is sent to the thread running a stalled
+ * resume, from a handler on that thread co_backtrace() on co_watchdog_current() gives the
+ * call-chain of the coroutine that is stuck.
+ */
+
+#pragma once
+
+#include "coro_sched.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+
+////////////////////////////////////////////////////////////////
+//                           CONFIG                           //
+////////////////////////////////////////////////////////////////
+
+/**
+ * Define CORO_WATCHDOG_MAX_SCHEDS to configure max number of schedulers that can be added to
+ * a watchdog, defaults to 64.
+ */
+#if !defined(CORO_WATCHDOG_MAX_SCHEDS)
+#  define CORO_WATCHDOG_MAX_SCHEDS 64
+#endif
+
+/**
+ * Define CORO_WATCHDOG_MAX_GROUPS to configure max number of groups, including the default
+ * group of each scheduler, that can be added to a watchdog, defaults to 128.
+ */
+#if !defined(CORO_WATCHDOG_MAX_GROUPS)
+#  define CORO_WATCHDOG_MAX_GROUPS 128
+#endif
+
+
+////////////////////////////////////////////////////////////////
+//                         PUBLIC API                         //
+////////////////////////////////////////////////////////////////
+
+enum co_watchdog_kind
+{
+    CO_WATCHDOG_STALLED_RESUME,  ///< a resume has been running for longer than the threshold.
+    CO_WATCHDOG_STARVING         ///< ready coroutines have not been resumed for longer than the threshold.
+};
+
+struct co_watchdog_report
+{
+    co_watchdog_kind kind;
+    co_sched*        sched;
+    coro*            co;           ///< coroutine being resumed, only set for stalled resumes. Do not dereference.
+    co_sched_group*  group;        ///< group that is starving, nullptr if the whole scheduler is. Do not dereference.
+    uint64_t         duration_ns;  ///< how long the scheduler or group has been stuck.
+    uint32_t         ready_cnt;    ///< coroutines in the ready-queue of the scheduler or group when sampled.
+};
+
+typedef void (*co_watchdog_func)( const co_watchdog_report* report, void* userdata );
+
+struct co_watchdog_entry
+{
+    co_sched* sched;
+    pthread_t thread;
+    uint64_t  seq;          ///< resume_seq at last sample.
+    uint64_t  seq_time;     ///< time when resume_seq was last seen changing.
+    uint32_t  reported : 1; ///< current stall has been reported.
+    uint32_t  starving : 1; ///< current starvation of the whole scheduler has been reported.
+};
+
+struct co_watchdog_group_entry
+{
+    co_sched_group* group;
+    uint32_t        sched;        ///< index of the entry of the scheduler running the group.
+    uint64_t        resumes;      ///< resumes of group at last sample.
+    uint64_t        resumes_time; ///< time when resumes was last seen changing or the group had nothing ready.
+    uint32_t        starving : 1; ///< current starvation has been reported.
+};
+
+struct co_watchdog
+{
+    co_watchdog_entry entries[CORO_WATCHDOG_MAX_SCHEDS];
+    uint32_t          cnt;
+    co_watchdog_group_entry groups[CORO_WATCHDOG_MAX_GROUPS];
+    uint32_t          group_cnt;
+    uint64_t          stall_ns;
+    uint64_t          starve_ns;
+    co_watchdog_func  func;
+    void*             userdata;
+    int               signal;
+
+    pthread_t         monitor;
+    bool              running;
+    uint64_t          reports;  ///< total number of reports made.
+};
+
+/**
+ * Initialize watchdog.
+ *
+ * @param stall_ms report resumes running longer than this, 0 to disable.
+ * @param starve_ms report ready-queues not progressing for longer than this, 0 to disable.
+ * @param func called from the monitor-thread for each stall/starvation, once per occurrence.
+ */
+static inline void co_watchdog_init( co_watchdog* wd, uint32_t stall_ms, uint32_t starve_ms, co_watchdog_func func, void* userdata );
+
+/**
+ * Send signo to the thread running a stalled resume when it is reported, 0 to disable.
+ */
+static inline void co_watchdog_set_signal( co_watchdog* wd, int signo );
+
+/**
+ * Add scheduler and its default group to watchdog, need to be called from the thread that
+ * will run the scheduler and before co_watchdog_start().
+ *
+ * @return false if CORO_WATCHDOG_MAX_SCHEDS schedulers has already been added.
+ */
+static inline bool co_watchdog_add( co_watchdog* wd, co_sched* sched );
+
+/**
+ * Watch group, run by sched, for starvation. The default group of a scheduler is added by
+ * co_watchdog_add(). The group need to stay alive until the watchdog is stopped.
+ *
+ * @return false if sched has not been added or CORO_WATCHDOG_MAX_GROUPS groups has already
+ *         been added.
+ */
+static inline bool co_watchdog_add_group( co_watchdog* wd, co_sched* sched, co_sched_group* group );
+
+/**
+ * Start/stop the monitor-thread.
+ */
+static inline bool co_watchdog_start( co_watchdog* wd );
+static inline void co_watchdog_stop( co_watchdog* wd );
+
+/**
+ * Sample all schedulers at time now_ns, in CLOCK_MONOTONIC nanoseconds, and report. This is
+ * what the monitor-thread calls, it can also be called manually instead of starting the thread.
+ */
+static inline void co_watchdog_check( co_watchdog* wd, uint64_t now_ns );
+
+/**
+ * Return the coroutine currently being resumed by sched or nullptr, safe to use from a
+ * signal-handler on the thread running the scheduler.
+ */
+static inline coro* co_watchdog_current( co_sched* sched );
+
+
+////////////////////////////////////////////////////////////////
+//                       IMPLEMENTATION                       //
+////////////////////////////////////////////////////////////////
+
+static inline uint64_t _co_watchdog_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void co_watchdog_init( co_watchdog* wd, uint32_t stall_ms, uint32_t starve_ms, co_watchdog_func func, void* userdata )
+{
+    wd->cnt       = 0;
+    wd->group_cnt = 0;
+    wd->stall_ns  = (uint64_t)stall_ms * 1000000ull;
+    wd->starve_ns = (uint64_t)starve_ms * 1000000ull;
+    wd->func      = func;
+    wd->userdata  = userdata;
+    wd->signal    = 0;
+    wd->running   = false;
+    wd->reports   = 0;
+}
+
+static inline void co_watchdog_set_signal( co_watchdog* wd, int signo )
+{
+    wd->signal = signo;
+}
+
+static inline bool co_watchdog_add( co_watchdog* wd, co_sched* sched )
+{
+    if(wd->cnt == CORO_WATCHDOG_MAX_SCHEDS || wd->group_cnt == CORO_WATCHDOG_MAX_GROUPS)
+        return false;
+    co_watchdog_entry* e = &wd->entries[wd->cnt++];
+    e->sched    = sched;
+    e->thread   = pthread_self();
+    e->seq      = __atomic_load_n(&sched->resume_seq, __ATOMIC_ACQUIRE);
+    e->seq_time = _co_watchdog_now();
+    e->reported = 0;
+    e->starving = 0;
+    return co_watchdog_add_group(wd, sched, &sched->default_group);
+}
+
+static inline bool co_watchdog_add_group( co_watchdog* wd, co_sched* sched, co_sched_group* group )
+{
+    if(wd->group_cnt == CORO_WATCHDOG_MAX_GROUPS)
+        return false;
+    for(uint32_t i = 0; i < wd->cnt; ++i)
+    {
+        if(wd->entries[i].sched != sched)
+            continue;
+        co_watchdog_group_entry* g = &wd->groups[wd->group_cnt++];
+        g->group        = group;
+        g->sched        = i;
+        g->resumes      = __atomic_load_n(&group->resumes, __ATOMIC_ACQUIRE);
+        g->resumes_time = _co_watchdog_now();
+        g->starving     = 0;
+        return true;
+    }
+    return false;
+}
+
+static inline coro* co_watchdog_current( co_sched* sched )
+{
+    co_sched_task* task = __atomic_load_n(&sched->current, __ATOMIC_ACQUIRE);
+    return task ? &task->co : nullptr;
+}
+
+static inline void _co_watchdog_report( co_watchdog* wd, co_watchdog_entry* e, co_watchdog_report* report )
+{
+    ++wd->reports;
+    if(report->kind == CO_WATCHDOG_STALLED_RESUME && wd->signal != 0)
+        pthread_kill(e->thread, wd->signal);
+    if(wd->func)
+        wd->func(report, wd->userdata);
+}
+
+static inline void co_watchdog_check( co_watchdog* wd, uint64_t now_ns )
+{
+    co_watchdog_report report;
+
+    for(uint32_t i = 0; i < wd->cnt; ++i)
+    {
+        co_watchdog_entry* e = &wd->entries[i];
+        co_sched* sched = e->sched;
+
+        uint64_t seq = __atomic_load_n(&sched->resume_seq, __ATOMIC_ACQUIRE);
+        if(seq != e->seq)
+        {
+            e->seq      = seq;
+            e->seq_time = now_ns;
+            e->reported = 0;
+            e->starving = 0;
+            continue;
+        }
+
+        uint64_t stuck   = now_ns - e->seq_time;
+        coro*    current = co_watchdog_current(sched);
+        uint32_t ready   = __atomic_load_n(&sched->ready_cnt, __ATOMIC_ACQUIRE);
+
+        // a resume may have started after resume_seq was loaded, it is only stalled if the
+        // sequence is unchanged after current was loaded.
+        if(__atomic_load_n(&sched->resume_seq, __ATOMIC_ACQUIRE) != seq)
+            continue;
+
+        report.sched       = sched;
+        report.co          = current;
+        report.group       = nullptr;
+        report.duration_ns = stuck;
+        report.ready_cnt   = ready;
+
+        if(current != nullptr && !e->reported && wd->stall_ns > 0 && stuck >= wd->stall_ns)
+        {
+            report.kind = CO_WATCHDOG_STALLED_RESUME;
+            e->reported = 1;
+        }
+        else if(current == nullptr && !e->starving && ready > 0 && wd->starve_ns > 0 && stuck >= wd->starve_ns)
+        {
+            report.kind = CO_WATCHDOG_STARVING;
+            e->starving = 1;
+        }
+        else
+            continue;
+
+        _co_watchdog_report(wd, e, &report);
+    }
+
+    // the scheduler may keep resuming other groups while one is starving, so groups are timed
+    // by their own resume-count.
+    for(uint32_t i = 0; i < wd->group_cnt; ++i)
+    {
+        co_watchdog_group_entry* g = &wd->groups[i];
+        co_watchdog_entry*       e = &wd->entries[g->sched];
+
+        uint64_t resumes = __atomic_load_n(&g->group->resumes, __ATOMIC_ACQUIRE);
+        uint32_t ready   = __atomic_load_n(&g->group->ready_cnt, __ATOMIC_ACQUIRE);
+        if(resumes != g->resumes || ready == 0)
+        {
+            g->resumes      = resumes;
+            g->resumes_time = now_ns;
+            g->starving     = 0;
+            continue;
+        }
+
+        // already reported as the whole scheduler starving.
+        if(g->starving || e->starving || wd->starve_ns == 0 || now_ns < g->resumes_time + wd->starve_ns)
+            continue;
+
+        report.kind        = CO_WATCHDOG_STARVING;
+        report.sched       = e->sched;
+        report.co          = nullptr;
+        report.group       = g->group;
+        report.duration_ns = now_ns - g->resumes_time;
+        report.ready_cnt   = ready;
+        g->starving = 1;
+        _co_watchdog_report(wd, e, &report);
+    }
+}
+
+static inline void* _co_watchdog_thread( void* arg )
+{
+    co_watchdog* wd = (co_watchdog*)arg;
+
+    uint64_t interval = wd->stall_ns;
+    if(interval == 0 || (wd->starve_ns > 0 && wd->starve_ns < interval))
+        interval = wd->starve_ns;
+    interval /= 4;
+    if(interval < 1000000)
+        interval = 1000000;
+
+    timespec sleep_time;
+    sleep_time.tv_sec  = (time_t)(interval / 1000000000ull);
+    sleep_time.tv_nsec = (long)(interval % 1000000000ull);
+
+    while(__atomic_load_n(&wd->running, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&sleep_time, nullptr);
+        co_watchdog_check(wd, _co_watchdog_now());
+    }
+    return nullptr;
+}
+
+static inline bool co_watchdog_start( co_watchdog* wd )
+{
+    uint64_t now = _co_watchdog_now();
+    for(uint32_t i = 0; i < wd->cnt; ++i)
+        wd->entries[i].seq_time = now;
+
+    __atomic_store_n(&wd->running, true, __ATOMIC_RELEASE);
+    if(pthread_create(&wd->monitor, nullptr, _co_watchdog_thread, wd) != 0)
+    {
+        wd->running = false;
+        return false;
+    }
+    return true;
+}
+
+static inline void co_watchdog_stop( co_watchdog* wd )
+{
+    if(!wd->running)
+        return;
+    __atomic_store_n(&wd->running, false, __ATOMIC_RELEASE);
+    pthread_join(wd->monitor, nullptr);
+}
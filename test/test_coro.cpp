@@ -546,6 +546,220 @@ int coro_stack_overflow_call_in_call()
     return 0;
 }
 
+int coro_resume_with()
+{
+    coro co;
+    uint8_t stack[256];
+    co_init(&co, stack, sizeof(stack), [](coro* co, void* userdata, void*) {
+        co_locals_begin(co);
+            int value = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        while(true)
+        {
+            co_yield_recv(co, locals.value);
+            *(int*)userdata += locals.value;
+            if(locals.value == 0)
+                break;
+        }
+
+        co_end(co);
+    });
+
+    int sum = 0;
+    int value = 1337;
+
+    // first resume will only run until the first co_yield_recv()
+    co_resume_with(&co, &sum, &value, sizeof(int));
+    ASSERT_EQ(0, sum);
+
+    co_resume_with(&co, &sum, &value, sizeof(int));
+    ASSERT_EQ(1337, sum);
+
+    // resuming without value leaves the received value untouched.
+    co_resume(&co, &sum);
+    ASSERT_EQ(1337 * 2, sum);
+
+    value = 0;
+    co_resume_with(&co, &sum, &value, sizeof(int));
+    ASSERT(co_completed(&co));
+    ASSERT_EQ(1337 * 2, sum);
+
+    return 0;
+}
+
+int coro_resume_with_in_sub_call()
+{
+    struct event
+    {
+        int   id;
+        float data;
+    };
+
+    struct result
+    {
+        int   cnt;
+        float sum;
+    } res = { 0, 0.0f };
+
+    coro co;
+    uint8_t stack[512];
+    co_init(&co, stack, sizeof(stack), [](coro* co, void*, void*) {
+        co_begin(co);
+
+        co_call(co, [](coro* co, void* userdata, void*) {
+            // userdata passed to co_resume_with() reaches the leaf together with the value.
+            result* res = (result*)userdata;
+
+            co_locals_begin(co);
+                event evt;
+            co_locals_end(co);
+
+            co_begin(co);
+
+            while(true)
+            {
+                co_yield_recv(co, locals.evt);
+                if(locals.evt.id < 0)
+                    co_exit(co);
+
+                ++res->cnt;
+                res->sum += locals.evt.data;
+            }
+
+            co_end(co);
+        });
+
+        co_end(co);
+    });
+
+    co_resume(&co, nullptr);
+    ASSERT(!co_completed(&co));
+
+    event e1 = { 1, 1.0f };
+    event e2 = { 2, 2.0f };
+    event e3 = { -1, 0.0f };
+    co_resume_with(&co, &res, &e1);
+    co_resume_with(&co, &res, &e2);
+    ASSERT_EQ(2, res.cnt);
+    ASSERT_EQ(3.0f, res.sum);
+    ASSERT(!co_completed(&co));
+
+    co_resume_with(&co, &res, &e3);
+    ASSERT(co_completed(&co));
+    ASSERT_EQ(2, res.cnt);
+
+    return 0;
+}
+
+struct test_request_ctx
+{
+    uint64_t request_id;
+    uint64_t deadline;
+};
+
+static void context_leaf(coro* co, void* userdata, void*)
+{
+    co_begin(co);
+        // reached through the root from a sub-call, nothing passed as arguments.
+        *(uint64_t*)userdata = co_context<test_request_ctx>(co)->request_id;
+        co_context<test_request_ctx>(co)->deadline = 4711;
+        co_yield(co);
+    co_end(co);
+}
+
+static void context_mid(coro* co, void*, void*)
+{
+    co_begin(co);
+        co_call(co, context_leaf);
+    co_end(co);
+}
+
+TEST coro_context()
+{
+    uint8_t stack[1024];
+    coro co;
+    co_init(&co, stack, sizeof(stack), [](coro* co, void*, void*) {
+        co_begin(co);
+            co_call(co, context_mid);
+        co_end(co);
+    });
+
+    ASSERT_EQ(0u, co_context<test_request_ctx>(&co)->request_id);
+    ASSERT_EQ(0u, co_context<test_request_ctx>(&co)->deadline);
+    co_context<test_request_ctx>(&co)->request_id = 1337;
+
+    uint64_t seen = 0;
+    co_resume(&co, &seen);
+    ASSERT_EQ(1337u, seen);
+    ASSERT_EQ(4711u, co_context<test_request_ctx>(&co)->deadline);
+
+    coro other;
+    co_init(&other, nullptr, 0, [](coro* co, void*, void*) { co_begin(co); co_end(co); });
+    co_context_copy(&other, &co);
+    ASSERT_EQ(1337u, co_context<test_request_ctx>(&other)->request_id);
+
+    co_resume(&co, &seen);
+    ASSERT(co_completed(&co));
+    return 0;
+}
+
+static int g_local_freed;
+static void local_free(void* value)
+{
+    g_local_freed += *(int*)value;
+}
+
+static co_local_key local_test_key()
+{
+    static co_local_key key = co_local_key_create(local_free);
+    return key;
+}
+
+static void local_leaf(coro* co, void*, void*)
+{
+    co_begin(co);
+        // the slot of the root is visible from a sub-call.
+        *(int*)co_local_get(co, local_test_key()) += 1;
+    co_end(co);
+}
+
+TEST coro_local_storage()
+{
+    co_local_key key = local_test_key();
+    ASSERT(key >= 0);
+
+    uint8_t stack[1024];
+    coro a, b;
+    co_init(&a, stack, sizeof(stack), [](coro* co, void*, void*) {
+        co_begin(co);
+            co_call(co, local_leaf);
+        co_end(co);
+    });
+    co_init(&b, nullptr, 0, [](coro* co, void*, void*) { co_begin(co); co_end(co); });
+
+    ASSERT(co_local_get(&a, key) == nullptr);
+    int value_a = 10, value_b = 20;
+    co_local_set(&a, key, &value_a);
+    co_local_set(&b, key, &value_b);
+
+    co_resume(&a, nullptr);
+    ASSERT(co_completed(&a));
+    ASSERT_EQ(11, value_a);
+    ASSERT_EQ(&value_b, co_local_get(&b, key));
+
+    g_local_freed = 0;
+    co_local_release(&a);
+    ASSERT_EQ(11, g_local_freed);
+    ASSERT(co_local_get(&a, key) == nullptr);
+    // released values are cleared so a second release is a no-op.
+    co_local_release(&a);
+    ASSERT_EQ(11, g_local_freed);
+    return 0;
+}
+
 GREATEST_SUITE( coro_tests )
 {
 	RUN_TEST( coro_basic );
@@ -562,13 +776,46 @@ GREATEST_SUITE( coro_tests )
     RUN_TEST( coro_stack_overflow_args_in_co_call );
     RUN_TEST( coro_stack_overflow_call );
     RUN_TEST( coro_stack_overflow_call_in_call );
+    RUN_TEST( coro_resume_with );
+    RUN_TEST( coro_resume_with_in_sub_call );
+    RUN_TEST( coro_context );
+    RUN_TEST( coro_local_storage );
 }
 
+void coro_generator_tests(void);
+void coro_split_tests(void);
+void coro_sched_tests(void);
+void coro_asset_tests(void);
+void coro_singleflight_tests(void);
+void coro_io_tests(void);
+void coro_mux_tests(void);
+void coro_uring_tests(void);
+void coro_udp_tests(void);
+void coro_watchdog_tests(void);
+void coro_stats_tests(void);
+void coro_metrics_tests(void);
+void coro_profile_tests(void);
+void coro_timer_tests(void);
+
 GREATEST_MAIN_DEFS();
 
 int main( int argc, char **argv )
 {
     GREATEST_MAIN_BEGIN();
     RUN_SUITE( coro_tests );
+    RUN_SUITE( coro_generator_tests );
+    RUN_SUITE( coro_split_tests );
+    RUN_SUITE( coro_sched_tests );
+    RUN_SUITE( coro_asset_tests );
+    RUN_SUITE( coro_singleflight_tests );
+    RUN_SUITE( coro_io_tests );
+    RUN_SUITE( coro_mux_tests );
+    RUN_SUITE( coro_uring_tests );
+    RUN_SUITE( coro_udp_tests );
+    RUN_SUITE( coro_watchdog_tests );
+    RUN_SUITE( coro_stats_tests );
+    RUN_SUITE( coro_metrics_tests );
+    RUN_SUITE( coro_profile_tests );
+    RUN_SUITE( coro_timer_tests );
     GREATEST_MAIN_END();
 }
@@ -0,0 +1,167 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if !defined(_WIN32)
+
+#include "../coro_asset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static char           g_asset_path[] = "/tmp/coro_asset_test_XXXXXX";
+static co_asset_queue g_asset_queue;
+
+struct asset_load_arg
+{
+    uint64_t offset;
+    size_t   size;
+    int      prio;
+    int      id;
+};
+
+struct asset_test_state
+{
+    int     order[8];
+    int     order_cnt;
+    uint8_t data[8][64];
+    int64_t result[8];
+};
+
+static void load_asset(coro* co, void* userdata, void* arg)
+{
+    asset_test_state* state = (asset_test_state*)userdata;
+    asset_load_arg*   a     = (asset_load_arg*)arg;
+
+    co_locals_begin(co);
+        co_asset_request req;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    co_asset_request_init(&locals.req, g_asset_path, a->offset, state->data[a->id], a->size, a->prio);
+    co_load_asset(co, &g_asset_queue, &locals.req);
+
+    state->order[state->order_cnt++] = a->id;
+    state->result[a->id] = locals.req.result;
+
+    co_end(co);
+}
+
+static bool write_asset_file()
+{
+    int fd = mkstemp(g_asset_path);
+    if(fd < 0)
+        return false;
+    uint8_t data[1024];
+    for(int i = 0; i < (int)sizeof(data); ++i)
+        data[i] = (uint8_t)(i / 4);
+    bool ok = write(fd, data, sizeof(data)) == (ssize_t)sizeof(data);
+    close(fd);
+    return ok;
+}
+
+TEST asset_prio_merge_cancel()
+{
+    ASSERT(write_asset_file());
+
+    asset_test_state state;
+    memset(&state, 0, sizeof(state));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, &state);
+    co_asset_queue_init(&g_asset_queue);
+
+    asset_load_arg a0 = {   0, 64, 1, 0 };
+    asset_load_arg a1 = { 512, 32, 5, 1 };
+    asset_load_arg a2 = {  64, 64, 1, 2 }; // adjacent to a0
+    asset_load_arg a3 = { 256, 16, 9, 3 }; // will be cancelled
+    asset_load_arg a4 = {1000, 64, 0, 4 }; // short read
+
+    co_sched_spawn(&sched, load_asset, a0);
+    co_sched_spawn(&sched, load_asset, a1);
+    co_sched_spawn(&sched, load_asset, a2);
+    coro* cancel_me = co_sched_spawn(&sched, load_asset, a3);
+    co_sched_spawn(&sched, load_asset, a4);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(5u, g_asset_queue.pending_cnt);
+
+    co_sched_cancel(cancel_me);
+
+    // a1 has highest prio after a3 was cancelled.
+    ASSERT_EQ(1u, co_asset_queue_update(&g_asset_queue, 1));
+    ASSERT_EQ(1u, g_asset_queue.dropped);
+    co_sched_run(&sched);
+    ASSERT_EQ(1, state.order_cnt);
+    ASSERT_EQ(1, state.order[0]);
+    ASSERT_EQ(32, state.result[1]);
+    ASSERT_EQ(128, state.data[1][0]);
+
+    // raise priority of a4 above a0/a2 while pending.
+    for(co_asset_request* req = g_asset_queue.pending; req; req = req->next)
+        if(req->offset == 1000)
+            req->prio = 3;
+
+    ASSERT_EQ(1u, co_asset_queue_update(&g_asset_queue, 1));
+    co_sched_run(&sched);
+    ASSERT_EQ(2, state.order_cnt);
+    ASSERT_EQ(4, state.order[1]);
+    ASSERT_EQ(24, state.result[4]);
+
+    // a0 and a2 should be merged into one read.
+    ASSERT_EQ(1u, co_asset_queue_update(&g_asset_queue, 8));
+    co_sched_run(&sched);
+    ASSERT_EQ(4, state.order_cnt);
+    ASSERT_EQ(64, state.result[0]);
+    ASSERT_EQ(64, state.result[2]);
+    ASSERT_EQ(0,  state.data[0][0]);
+    ASSERT_EQ(15, state.data[0][63]);
+    ASSERT_EQ(16, state.data[2][0]);
+    ASSERT_EQ(31, state.data[2][63]);
+
+    ASSERT_EQ(3u, g_asset_queue.reads);
+    ASSERT_EQ(4u, g_asset_queue.completed);
+    ASSERT_EQ(0u, g_asset_queue.pending_cnt);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+
+    unlink(g_asset_path);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_asset_tests )
+{
+#if !defined(_WIN32)
+    RUN_TEST( asset_prio_merge_cancel );
+#endif
+}
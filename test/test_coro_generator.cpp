@@ -0,0 +1,199 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+#include "../coro_generator.h"
+
+static void count_to_10(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        int i = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    for(; locals.i < 10; ++locals.i)
+        co_gen_yield(co, locals.i);
+
+    co_end(co);
+}
+
+static void yield_twice(coro* co, void*, void* arg)
+{
+    co_begin(co);
+        co_gen_yield(co, *(int*)arg);
+        co_gen_yield(co, *(int*)arg);
+    co_end(co);
+}
+
+// a user-defined stage that produces 'cnt' copies of 'value', used with flat_map.
+struct repeat_stage
+{
+    typedef int value_type;
+    int value;
+    int cnt;
+};
+
+static inline bool co_gen_next( repeat_stage& s, int* out )
+{
+    if(s.cnt == 0)
+        return false;
+    --s.cnt;
+    *out = s.value;
+    return true;
+}
+
+TEST generator_basic()
+{
+    uint8_t stack[256];
+    coro co;
+    co_init(&co, stack, sizeof(stack), count_to_10);
+
+    int expect = 0;
+    int value;
+    while(co_gen_next(&co, &value))
+        ASSERT_EQ(expect++, value);
+
+    ASSERT_EQ(10, expect);
+    ASSERT(co_completed(&co));
+    return 0;
+}
+
+TEST generator_yield_from_sub_call()
+{
+    uint8_t stack[256];
+    coro co;
+    co_init(&co, stack, sizeof(stack), [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            int v = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        for(; locals.v < 3; ++locals.v)
+            co_call(co, yield_twice, locals.v);
+
+        co_end(co);
+    });
+
+    int res[6];
+    int cnt = 0;
+    while(co_gen_next(&co, &res[cnt]))
+        ++cnt;
+
+    ASSERT_EQ(6, cnt);
+    for(int i = 0; i < 6; ++i)
+        ASSERT_EQ(i / 2, res[i]);
+    return 0;
+}
+
+TEST generator_map_filter_take()
+{
+    uint8_t stack[256];
+    coro co;
+    co_init(&co, stack, sizeof(stack), count_to_10);
+
+    auto gen = co_gen_take(co_gen_map(co_gen_filter(co_gen_from<int>(&co),
+                                                    [](int v) { return v % 2 == 1; }),
+                                      [](int v) { return (float)v * 0.5f; }), 3);
+
+    float value;
+    ASSERT(co_gen_next(gen, &value)); ASSERT_EQ(0.5f, value);
+    ASSERT(co_gen_next(gen, &value)); ASSERT_EQ(1.5f, value);
+    ASSERT(co_gen_next(gen, &value)); ASSERT_EQ(2.5f, value);
+    ASSERT_FALSE(co_gen_next(gen, &value));
+
+    // take should not have pulled more than needed from the source.
+    ASSERT_FALSE(co_completed(&co));
+    return 0;
+}
+
+TEST generator_zip_chain()
+{
+    uint8_t stack1[256];
+    uint8_t stack2[256];
+    coro co1;
+    coro co2;
+    co_init(&co1, stack1, sizeof(stack1), count_to_10);
+    co_init(&co2, stack2, sizeof(stack2), count_to_10);
+
+    auto zipped = co_gen_zip(co_gen_take(co_gen_from<int>(&co1), 4),
+                             co_gen_map(co_gen_from<int>(&co2), [](int v) { return v * 10; }));
+
+    std::pair<int, int> p;
+    int cnt = 0;
+    while(co_gen_next(zipped, &p))
+    {
+        ASSERT_EQ(cnt, p.first);
+        ASSERT_EQ(cnt * 10, p.second);
+        ++cnt;
+    }
+    ASSERT_EQ(4, cnt);
+
+    // chain the rest of both generators.
+    auto chained = co_gen_chain(co_gen_from<int>(&co1), co_gen_from<int>(&co2));
+    int sum = 0;
+    int value;
+    while(co_gen_next(chained, &value))
+        sum += value;
+
+    // zip stops at the first stage that ends so both co1 and co2 has 4..9 left.
+    ASSERT_EQ((4+5+6+7+8+9) * 2, sum);
+    return 0;
+}
+
+TEST generator_flat_map()
+{
+    uint8_t stack[256];
+    coro co;
+    co_init(&co, stack, sizeof(stack), count_to_10);
+
+    auto gen = co_gen_flat_map(co_gen_take(co_gen_from<int>(&co), 4),
+                               [](int v) { repeat_stage r; r.value = v; r.cnt = v; return r; });
+
+    int expect[] = { 1, 2, 2, 3, 3, 3 };
+    int cnt = 0;
+    int value;
+    while(co_gen_next(gen, &value))
+    {
+        ASSERT(cnt < 6);
+        ASSERT_EQ(expect[cnt++], value);
+    }
+    ASSERT_EQ(6, cnt);
+    return 0;
+}
+
+GREATEST_SUITE( coro_generator_tests )
+{
+    RUN_TEST( generator_basic );
+    RUN_TEST( generator_yield_from_sub_call );
+    RUN_TEST( generator_map_filter_take );
+    RUN_TEST( generator_zip_chain );
+    RUN_TEST( generator_flat_map );
+}
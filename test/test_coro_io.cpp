@@ -0,0 +1,330 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+// bigger than the socket-buffers so that the senders will have to wait for the reader.
+static const size_t IO_TEST_FILE_SIZE = 4 * 1024 * 1024;
+
+struct io_test_state
+{
+    co_io    io;
+    co_io_fd sock[2];
+    co_io_fd pipe[2];
+    co_io_fd file;     ///< regular files can't be added to epoll but are always ready.
+    uint8_t* expect;
+    uint8_t* received;
+    size_t   received_len;
+    int      error;
+};
+
+static io_test_state g_io;
+
+static int io_test_create_file(size_t size)
+{
+    char path[] = "/tmp/coro_io_test_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+        return -1;
+    unlink(path);
+
+    for(size_t i = 0; i < size; ++i)
+        g_io.expect[i] = (uint8_t)(i * 7 + (i >> 12));
+    if(write(fd, g_io.expect, size) != (ssize_t)size)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void io_test_reader(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        ssize_t res = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    while(g_io.received_len < IO_TEST_FILE_SIZE)
+    {
+        co_io_read(co, &g_io.sock[1], g_io.received + g_io.received_len, IO_TEST_FILE_SIZE - g_io.received_len, locals.res);
+        if(locals.res <= 0)
+        {
+            g_io.error = 1;
+            co_exit(co);
+        }
+        g_io.received_len += (size_t)locals.res;
+    }
+
+    co_end(co);
+}
+
+static void io_test_run(co_sched* sched)
+{
+    while(co_sched_live(sched) > 0)
+    {
+        co_sched_run(sched);
+        if(co_sched_live(sched) > 0 && co_io_poll(&g_io.io, 1000) == 0)
+            break;
+    }
+}
+
+static bool io_test_init()
+{
+    memset(&g_io, 0, sizeof(g_io));
+    g_io.expect   = (uint8_t*)malloc(IO_TEST_FILE_SIZE);
+    g_io.received = (uint8_t*)malloc(IO_TEST_FILE_SIZE);
+    g_io.file.fd  = io_test_create_file(IO_TEST_FILE_SIZE);
+
+    int sv[2];
+    if(g_io.file.fd < 0 || !co_io_init(&g_io.io) || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        return false;
+    return co_io_add(&g_io.io, &g_io.sock[0], sv[0]) && co_io_add(&g_io.io, &g_io.sock[1], sv[1]);
+}
+
+static void io_test_destroy()
+{
+    close(g_io.sock[0].fd);
+    close(g_io.sock[1].fd);
+    close(g_io.file.fd);
+    co_io_destroy(&g_io.io);
+    free(g_io.expect);
+    free(g_io.received);
+}
+
+TEST io_sendfile()
+{
+    ASSERT(io_test_init());
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            off_t   offset = 0;
+            size_t  left   = IO_TEST_FILE_SIZE;
+            ssize_t sent   = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        while(locals.left > 0)
+        {
+            co_io_sendfile(co, &g_io.sock[0], g_io.file.fd, locals.offset, locals.left, locals.sent);
+            if(locals.sent <= 0)
+            {
+                g_io.error = 1;
+                co_exit(co);
+            }
+            locals.left -= (size_t)locals.sent;
+        }
+        assert(locals.offset == (off_t)IO_TEST_FILE_SIZE);
+
+        co_end(co);
+    });
+    co_sched_spawn(&sched, io_test_reader);
+
+    io_test_run(&sched);
+
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(0, g_io.error);
+    ASSERT_EQ(IO_TEST_FILE_SIZE, g_io.received_len);
+    ASSERT_EQ(0, memcmp(g_io.expect, g_io.received, IO_TEST_FILE_SIZE));
+    // socket-buffers are smaller than the file, the sender must have been parked.
+    ASSERT(g_io.io.wakeups > 0);
+
+    co_sched_destroy(&sched);
+    io_test_destroy();
+    return 0;
+}
+
+TEST io_splice()
+{
+    ASSERT(io_test_init());
+
+    int p[2];
+    ASSERT_EQ(0, pipe(p));
+    ASSERT(co_io_add(&g_io.io, &g_io.pipe[0], p[0]));
+    ASSERT(co_io_add(&g_io.io, &g_io.pipe[1], p[1]));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    // file -> pipe, a regular file is always "ready" so this one only waits for the pipe.
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            size_t  left = IO_TEST_FILE_SIZE;
+            ssize_t res  = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        lseek(g_io.file.fd, 0, SEEK_SET);
+        while(locals.left > 0)
+        {
+            co_io_splice(co, &g_io.file, &g_io.pipe[1], locals.left, locals.res);
+            if(locals.res <= 0)
+            {
+                g_io.error = 1;
+                co_exit(co);
+            }
+            locals.left -= (size_t)locals.res;
+        }
+
+        co_end(co);
+    });
+
+    // pipe -> socket, waits both for the pipe to be readable and the socket to be writable.
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            size_t  left = IO_TEST_FILE_SIZE;
+            ssize_t res  = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        while(locals.left > 0)
+        {
+            co_io_splice(co, &g_io.pipe[0], &g_io.sock[0], locals.left, locals.res);
+            if(locals.res <= 0)
+            {
+                g_io.error = 1;
+                co_exit(co);
+            }
+            locals.left -= (size_t)locals.res;
+        }
+
+        co_end(co);
+    });
+    co_sched_spawn(&sched, io_test_reader);
+
+    io_test_run(&sched);
+
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(0, g_io.error);
+    ASSERT_EQ(IO_TEST_FILE_SIZE, g_io.received_len);
+    ASSERT_EQ(0, memcmp(g_io.expect, g_io.received, IO_TEST_FILE_SIZE));
+
+    close(p[0]);
+    close(p[1]);
+    co_sched_destroy(&sched);
+    io_test_destroy();
+    return 0;
+}
+
+TEST io_run_busy()
+{
+    ASSERT(io_test_init());
+    // 0 is always allowed, higher values than net.core.busy_read need CAP_NET_ADMIN.
+    ASSERT(co_io_set_busy_poll(g_io.sock[0].fd, 0));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    // ping-pong over the socketpair, both sides park on the reactor between each message.
+    static int s_pongs;
+    s_pongs = 0;
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            int     i   = 0;
+            char    c   = 0;
+            ssize_t res = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+        for(; locals.i < 100; ++locals.i)
+        {
+            co_io_write(co, &g_io.sock[0], "p", 1, locals.res);
+            co_io_read(co, &g_io.sock[0], &locals.c, 1, locals.res);
+            if(locals.res == 1)
+                ++s_pongs;
+        }
+        co_end(co);
+    });
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            int     i   = 0;
+            char    c   = 0;
+            ssize_t res = 0;
+        co_locals_end(co);
+
+        co_begin(co);
+        for(; locals.i < 100; ++locals.i)
+        {
+            co_io_read(co, &g_io.sock[1], &locals.c, 1, locals.res);
+            co_io_write(co, &g_io.sock[1], &locals.c, 1, locals.res);
+        }
+        co_end(co);
+    });
+
+    uint64_t polls = g_io.io.polls;
+    co_io_run_busy(&g_io.io, &sched, nullptr);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(100, s_pongs);
+    ASSERT(g_io.io.polls > polls);
+
+    // stop-flag makes it return with live coroutines.
+    static bool s_stop;
+    s_stop = false;
+    coro* parked = co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_begin(co);
+        s_stop = true;
+        co_wait(co);
+        co_end(co);
+    });
+    co_io_run_busy(&g_io.io, &sched, &s_stop);
+    ASSERT_EQ(1u, co_sched_live(&sched));
+    co_sched_cancel(parked);
+    co_sched_wake(parked);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+
+    co_sched_destroy(&sched);
+    io_test_destroy();
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_io_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( io_sendfile );
+    RUN_TEST( io_splice );
+    RUN_TEST( io_run_busy );
+#endif
+}
@@ -0,0 +1,184 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_metrics.h"
+
+#include <sys/socket.h>
+
+static void metrics_test_waiter(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_sched_wait_reason(co, "net \"rx\"");
+    co_wait(co);
+    co_end(co);
+}
+
+static bool metrics_test_has(const char* text, const char* line)
+{
+    return strstr(text, line) != nullptr;
+}
+
+static void metrics_test_timer_fired(co_timer*, void*)
+{
+}
+
+TEST metrics_render_values()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    coro* waiters[4];
+    for(int i = 0; i < 4; ++i)
+        waiters[i] = co_sched_spawn(&sched, metrics_test_waiter);
+    co_sched_run(&sched);
+    co_sched_wake(waiters[0]);
+    co_sched_wake(waiters[1]);
+    co_sched_run(&sched);
+
+    co_timer_wheel wheel;
+    co_timer_wheel_init(&wheel, 1000, 0);
+    co_timer timers[2];
+    for(int i = 0; i < 2; ++i)
+    {
+        co_timer_init(&timers[i]);
+        co_timer_start(&wheel, &timers[i], (uint64_t)(i + 1) * 1000, metrics_test_timer_fired, nullptr);
+    }
+    co_timer_advance(&wheel, 1000);
+
+    co_stats_values values;
+    co_stats_collect(&sched, &wheel, &values);
+    const char* name = "main";
+
+    static char buf[16 * 1024];
+    int len = co_metrics_render_values(&values, &name, 1, buf, sizeof(buf));
+    ASSERT(len > 0);
+    ASSERT_EQ((size_t)len, strlen(buf));
+
+    ASSERT(metrics_test_has(buf, "# TYPE coro_live gauge\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_live{sched=\"main\"} 2\n"));
+    ASSERT(metrics_test_has(buf, "# TYPE coro_resumes counter\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_resumes_total{sched=\"main\"} 6\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_parks_total{sched=\"main\"} 4\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_stack_bytes{sched=\"main\"} 512\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_pooled{sched=\"main\"} 2\n"));
+    ASSERT(metrics_test_has(buf, "# TYPE coro_timers_expired counter\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_timers_pending{sched=\"main\"} 1\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_timers_started_total{sched=\"main\"} 2\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_timers_expired_total{sched=\"main\"} 1\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_timers_cancelled_total{sched=\"main\"} 0\n"));
+#if CORO_SCHED_REGISTRY
+    ASSERT(metrics_test_has(buf, "# TYPE coro_wait_seconds histogram\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_wait_seconds_bucket{sched=\"main\",reason=\"net \\\"rx\\\"\",le=\"+Inf\"} 2\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_wait_seconds_count{sched=\"main\",reason=\"net \\\"rx\\\"\"} 2\n"));
+    ASSERT(metrics_test_has(buf, "\ncoro_wait_seconds_sum{sched=\"main\",reason=\"net \\\"rx\\\"\"} "));
+#endif
+    ASSERT(strcmp(buf + len - 6, "# EOF\n") == 0);
+
+    // too small buffer fails instead of truncating.
+    ASSERT_EQ(-1, co_metrics_render_values(&values, &name, 1, buf, (size_t)len));
+    ASSERT_EQ(len, co_metrics_render_values(&values, &name, 1, buf, (size_t)len + 1));
+
+    for(int i = 2; i < 4; ++i)
+        co_sched_wake(waiters[i]);
+    co_sched_run(&sched);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST metrics_write_fd()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/coro_metrics_test_%d", (int)getpid());
+
+    co_stats stats;
+    ASSERT(co_stats_create(&stats, name));
+
+    co_sched a, b;
+    co_sched_init(&a, 256, nullptr);
+    co_sched_init(&b, 256, nullptr);
+    co_stats_slot* slot_a = co_stats_add(&stats, &a, "worker-0");
+    co_stats_slot* slot_b = co_stats_add(&stats, &b, "worker-1");
+
+    coro* waiter = co_sched_spawn(&b, metrics_test_waiter);
+    co_sched_run(&b);
+    co_stats_publish(&stats, slot_a);
+    co_stats_publish(&stats, slot_b);
+
+    // unix-socket standing in for the connection of a scraper.
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    ASSERT(co_metrics_write_fd(&stats, fds[0]));
+    close(fds[0]);
+
+    static char received[16 * 1024];
+    size_t used = 0;
+    ssize_t res;
+    while((res = read(fds[1], received + used, sizeof(received) - 1 - used)) > 0)
+        used += (size_t)res;
+    received[used] = 0;
+    close(fds[1]);
+
+    static char expect[16 * 1024];
+    int len = co_metrics_render(&stats, expect, sizeof(expect));
+    ASSERT_EQ((size_t)len, used);
+    ASSERT_STR_EQ(expect, received);
+    ASSERT(metrics_test_has(received, "\ncoro_live{sched=\"worker-0\"} 0\ncoro_live{sched=\"worker-1\"} 1\n"));
+
+    // a slot left mid-write, as by a scheduler dying while publishing, is not a too small buffer.
+    __atomic_store_n(&slot_b->seq, slot_b->seq + 1, __ATOMIC_RELEASE);
+    ASSERT_EQ(-2, co_metrics_render(&stats, expect, sizeof(expect)));
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    errno = 0;
+    ASSERT_FALSE(co_metrics_write_fd(&stats, fds[0]));
+    ASSERT_EQ(EBUSY, errno);
+    close(fds[0]);
+    close(fds[1]);
+    __atomic_store_n(&slot_b->seq, slot_b->seq + 1, __ATOMIC_RELEASE);
+
+    co_sched_wake(waiter);
+    co_sched_run(&b);
+    co_sched_destroy(&a);
+    co_sched_destroy(&b);
+    co_stats_destroy(&stats);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_metrics_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( metrics_render_values );
+    RUN_TEST( metrics_write_fd );
+#endif
+}
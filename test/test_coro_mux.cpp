@@ -0,0 +1,280 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_mux.h"
+
+#include <stdio.h>
+
+// stand-in backend, responds to each request with the payload reversed. All frames received
+// in one read are responded to in reverse order to make sure responses are matched by id.
+struct mux_test_server
+{
+    co_io_fd f;
+    uint32_t in_len;
+    uint32_t out_len;
+    uint32_t out_pos;
+    uint8_t  in[16 * 1024];
+    uint8_t  out[16 * 1024];
+};
+
+static void mux_test_build_responses(mux_test_server* s)
+{
+    uint32_t frames[512];
+    uint32_t frame_cnt = 0;
+    uint32_t pos = 0;
+    while(s->in_len - pos >= sizeof(co_mux_header))
+    {
+        co_mux_header hdr;
+        memcpy(&hdr, s->in + pos, sizeof(hdr));
+        if(s->in_len - pos - sizeof(hdr) < hdr.size)
+            break;
+        frames[frame_cnt++] = pos;
+        pos += (uint32_t)sizeof(hdr) + hdr.size;
+    }
+
+    s->out_len = 0;
+    s->out_pos = 0;
+    while(frame_cnt > 0)
+    {
+        uint32_t at = frames[--frame_cnt];
+        co_mux_header hdr;
+        memcpy(&hdr, s->in + at, sizeof(hdr));
+        memcpy(s->out + s->out_len, &hdr, sizeof(hdr));
+        for(uint32_t i = 0; i < hdr.size; ++i)
+            s->out[s->out_len + sizeof(hdr) + i] = s->in[at + sizeof(hdr) + hdr.size - 1 - i];
+        s->out_len += (uint32_t)sizeof(hdr) + hdr.size;
+    }
+
+    s->in_len -= pos;
+    memmove(s->in, s->in + pos, s->in_len);
+}
+
+static void mux_test_server_func(coro* co, void*, void* arg)
+{
+    mux_test_server* s = *(mux_test_server**)arg;
+
+    co_locals_begin(co);
+        ssize_t res = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    while(true)
+    {
+        co_io_read(co, &s->f, s->in + s->in_len, sizeof(s->in) - s->in_len, locals.res);
+        if(locals.res <= 0)
+            co_exit(co);
+        s->in_len += (uint32_t)locals.res;
+
+        mux_test_build_responses(s);
+        while(s->out_pos < s->out_len)
+        {
+            co_io_write(co, &s->f, s->out + s->out_pos, s->out_len - s->out_pos, locals.res);
+            if(locals.res < 0)
+                co_exit(co);
+            s->out_pos += (uint32_t)locals.res;
+        }
+    }
+
+    co_end(co);
+}
+
+struct mux_test_state
+{
+    co_mux mux;
+    int    ok;
+    int    failed;
+};
+
+static void mux_test_client(coro* co, void* userdata, void* arg)
+{
+    mux_test_state* state = (mux_test_state*)userdata;
+
+    co_locals_begin(co);
+        co_mux_request req;
+        char           msg[32];
+        char           resp[32];
+    co_locals_end(co);
+
+    co_begin(co);
+
+    snprintf(locals.msg, sizeof(locals.msg), "request-%d", *(int*)arg);
+    co_mux_request_init(&locals.req, locals.msg, (uint32_t)strlen(locals.msg), locals.resp, sizeof(locals.resp));
+    co_mux_call(co, &state->mux, &locals.req);
+
+    if(locals.req.result != (int32_t)strlen(locals.msg))
+    {
+        ++state->failed;
+        co_exit(co);
+    }
+
+    for(int i = 0; i < locals.req.result; ++i)
+        if(locals.resp[i] != locals.msg[locals.req.result - 1 - i])
+        {
+            ++state->failed;
+            co_exit(co);
+        }
+    ++state->ok;
+
+    co_end(co);
+}
+
+TEST mux_many_coroutines_few_sockets()
+{
+    static const int CONNS   = 2;
+    static const int CLIENTS = 500;
+
+    co_io io;
+    ASSERT(co_io_init(&io));
+
+    static mux_test_state  state;
+    static mux_test_server servers[CONNS];
+    memset(&state, 0, sizeof(state));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, &state);
+
+    int client_fds[CONNS];
+    for(int i = 0; i < CONNS; ++i)
+    {
+        int sv[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+        client_fds[i] = sv[0];
+
+        memset(&servers[i], 0, sizeof(servers[i]));
+        ASSERT(co_io_add(&io, &servers[i].f, sv[1]));
+        mux_test_server* s = &servers[i];
+        co_sched_spawn(&sched, mux_test_server_func, s);
+    }
+
+    ASSERT(co_mux_init(&state.mux, &io, &sched, client_fds, CONNS));
+
+    for(int i = 0; i < CLIENTS; ++i)
+        co_sched_spawn(&sched, mux_test_client, i);
+
+    for(int i = 0; i < 1000 && state.ok + state.failed < CLIENTS; ++i)
+    {
+        co_sched_run(&sched);
+        co_io_poll(&io, 100);
+    }
+
+    ASSERT_EQ(0, state.failed);
+    ASSERT_EQ(CLIENTS, state.ok);
+    ASSERT_EQ((uint64_t)CLIENTS, state.mux.responses);
+
+    // requests from all clients spawned at once should have been batched.
+    ASSERT(state.mux.writev_calls < (uint64_t)CLIENTS / 10);
+
+    // shutting down fails new calls directly and makes the mux-coroutines and server exit.
+    co_mux_close(&state.mux);
+    int late_client = CLIENTS;
+    co_sched_spawn(&sched, mux_test_client, late_client);
+    for(int i = 0; i < 100 && co_sched_live(&sched) > 0; ++i)
+    {
+        co_sched_run(&sched);
+        co_io_poll(&io, 10);
+    }
+    ASSERT_EQ(1, state.failed);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+
+    co_mux_destroy(&state.mux);
+    for(int i = 0; i < CONNS; ++i)
+    {
+        close(client_fds[i]);
+        close(servers[i].f.fd);
+    }
+    co_io_destroy(&io);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+
+TEST mux_init_failure_cleans_up()
+{
+    co_io io;
+    ASSERT(co_io_init(&io));
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+    // second fd is invalid, the first one should be removed from io again.
+    static co_mux mux;
+    int fds[2] = { sv[0], -1 };
+    ASSERT_FALSE(co_mux_init(&mux, &io, &sched, fds, 2));
+    ASSERT(mux.conns == nullptr);
+    ASSERT_EQ(0u, mux.conn_cnt);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_mux_destroy(&mux);
+
+    co_io_fd f;
+    ASSERT(co_io_add(&io, &f, sv[0]));
+    co_io_remove(&io, &f);
+
+    // room for the writer but not the reader, the writer should be cancelled before it runs.
+    co_sched_set_limits(&sched, 1, 0);
+    ASSERT_FALSE(co_mux_init(&mux, &io, &sched, fds, 1));
+    ASSERT(mux.conns == nullptr);
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_mux_destroy(&mux);
+
+    co_sched_set_limits(&sched, 0, 0);
+    ASSERT(co_mux_init(&mux, &io, &sched, fds, 1));
+    ASSERT_EQ(2u, co_sched_live(&sched));
+    co_mux_close(&mux);
+    for(int i = 0; i < 100 && co_sched_live(&sched) > 0; ++i)
+    {
+        co_sched_run(&sched);
+        co_io_poll(&io, 10);
+    }
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_mux_destroy(&mux);
+
+    close(sv[0]);
+    close(sv[1]);
+    co_io_destroy(&io);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_mux_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( mux_many_coroutines_few_sockets );
+    RUN_TEST( mux_init_failure_cleans_up );
+#endif
+}
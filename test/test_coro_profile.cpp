@@ -0,0 +1,120 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#define CORO_FRAME_HOOKS 1
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_profile.h"
+#include "../coro_sched.h"
+
+static volatile uint64_t g_profile_sink;
+
+static void profile_busy(uint64_t iterations)
+{
+    for(uint64_t i = 0; i < iterations; ++i)
+        g_profile_sink = g_profile_sink + i;
+}
+
+static void profile_leaf(coro* co, void*, void*)
+{
+    co_begin(co);
+    profile_busy(200000);
+    co_yield(co);
+    profile_busy(200000);
+    co_end(co);
+}
+
+static void profile_root(coro* co, void*, void*)
+{
+    co_begin(co);
+    profile_busy(100);
+    co_call(co, profile_leaf);
+    co_call(co, profile_leaf);
+    co_end(co);
+}
+
+static co_profile g_prof;
+
+TEST profile_attributes_per_func()
+{
+    bool hw = co_profile_init(&g_prof);
+
+    co_sched sched;
+    co_sched_init(&sched, 1024, nullptr);
+    co_sched_spawn(&sched, profile_root);
+
+    co_profile_begin(&g_prof);
+    co_sched_run(&sched);
+    co_profile_end(&g_prof);
+    co_sched_destroy(&sched);
+
+    ASSERT_EQ(2u, g_prof.entry_cnt);
+    ASSERT_EQ(0u, g_prof.depth);
+
+    const co_profile_entry* root = nullptr;
+    const co_profile_entry* leaf = nullptr;
+    for(uint32_t i = 0; i < CORO_PROFILE_MAX_FUNCS; ++i)
+    {
+        if(g_prof.entries[i].func == profile_root) root = &g_prof.entries[i];
+        if(g_prof.entries[i].func == profile_leaf) leaf = &g_prof.entries[i];
+    }
+    ASSERT(root != nullptr && leaf != nullptr);
+
+    // 3 resumes of the root, the second call starts in the same resume as the first returns.
+    ASSERT_EQ(3u, root->invocations);
+    ASSERT_EQ(4u, leaf->invocations);
+
+    // the leaf does nearly all the work and the root is not charged for it.
+    ASSERT(leaf->counters[CO_PROFILE_TIME_NS] > root->counters[CO_PROFILE_TIME_NS]);
+    if(hw && co_profile_available(&g_prof, CO_PROFILE_INSTRUCTIONS))
+        ASSERT(leaf->counters[CO_PROFILE_INSTRUCTIONS] > 10 * root->counters[CO_PROFILE_INSTRUCTIONS]);
+
+    char report[4096];
+    int len = co_profile_report(&g_prof, report, sizeof(report));
+    ASSERT(len > 0);
+    ASSERT(strstr(report, "invocations") != nullptr);
+    ASSERT_EQ(-1, co_profile_report(&g_prof, report, 16));
+
+    co_profile_reset(&g_prof);
+    ASSERT_EQ(0u, g_prof.entry_cnt);
+    co_profile_destroy(&g_prof);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_profile_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( profile_attributes_per_func );
+#endif
+}
@@ -0,0 +1,783 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+#include "../coro_sched.h"
+
+#include <thread>
+
+struct sched_test_log
+{
+    int entries[16];
+    int cnt;
+};
+
+static void log_twice(coro* co, void* userdata, void* arg)
+{
+    sched_test_log* log = (sched_test_log*)userdata;
+    int id = *(int*)arg;
+
+    co_begin(co);
+        log->entries[log->cnt++] = id;
+        co_yield(co);
+        log->entries[log->cnt++] = id;
+    co_end(co);
+}
+
+TEST sched_fifo()
+{
+    sched_test_log log = {{0}, 0};
+    co_sched sched;
+    co_sched_init(&sched, 256, &log);
+
+    for(int i = 0; i < 3; ++i)
+        co_sched_spawn(&sched, log_twice, i);
+    ASSERT_EQ(3u, co_sched_live(&sched));
+
+    co_sched_run(&sched);
+
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(6, log.cnt);
+    int expect[] = { 0, 1, 2, 0, 1, 2 };
+    for(int i = 0; i < 6; ++i)
+        ASSERT_EQ(expect[i], log.entries[i]);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void recurse(coro* co, void*, void* arg)
+{
+    int depth = *(int*)arg;
+    int next_depth = depth - 1;
+
+    co_locals_begin(co);
+        uint8_t pad[64];
+    co_locals_end(co);
+
+    co_begin(co);
+        memset(locals.pad, depth, sizeof(locals.pad));
+        if(depth > 0)
+            co_call(co, recurse, next_depth);
+        for(int i = 0; i < (int)sizeof(locals.pad); ++i)
+            assert(locals.pad[i] == depth);
+    co_end(co);
+}
+
+TEST sched_grow_stack()
+{
+    co_sched sched;
+    co_sched_init(&sched, 64, nullptr);
+
+    int depth = 20;
+    coro* co = co_sched_spawn(&sched, recurse, depth);
+    co_sched_step(&sched);
+    ASSERT(co->stack_size > 64);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_park_and_wake()
+{
+    coro* parked = nullptr;
+    co_sched sched;
+    co_sched_init(&sched, 256, &parked);
+
+    co_sched_spawn(&sched, [](coro* co, void* userdata, void*) {
+        co_begin(co);
+            *(coro**)userdata = co->call.root;
+            co_wait(co);
+        co_end(co);
+    });
+
+    co_sched_run(&sched);
+    ASSERT(parked != nullptr);
+    ASSERT_EQ(1u, co_sched_live(&sched));
+    ASSERT_EQ(0u, co_sched_step(&sched));
+
+    co_sched_wake(parked);
+    ASSERT_EQ(1u, co_sched_step(&sched));
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_wake_while_executing()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_begin(co);
+            // a system completing the wait directly should not leave us parked.
+            co_sched_wake(co);
+            co_wait(co);
+        co_end(co);
+    });
+
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_cancel()
+{
+    coro* parked = nullptr;
+    co_sched sched;
+    co_sched_init(&sched, 256, &parked);
+
+    co_func park = [](coro* co, void* userdata, void*) {
+        co_begin(co);
+            *(coro**)userdata = co->call.root;
+            co_wait(co);
+            assert(false && "cancelled coroutine should not be resumed!");
+        co_end(co);
+    };
+
+    // cancel while in ready-queue.
+    coro* co = co_sched_spawn(&sched, park);
+    co_sched_cancel(co);
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT(parked == nullptr);
+
+    // cancel while parked.
+    co_sched_spawn(&sched, park);
+    co_sched_run(&sched);
+    ASSERT(parked != nullptr);
+    co_sched_cancel(parked);
+    ASSERT(co_sched_cancelled(parked));
+    co_sched_wake(parked);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static bool g_sched_spin_stop;
+
+static void spin(coro* co, void*, void*)
+{
+    co_begin(co);
+        while(!g_sched_spin_stop)
+            co_yield(co);
+    co_end(co);
+}
+
+TEST sched_group_weighted_share()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_group quiet, noisy;
+    co_sched_group_init(&quiet, 3);
+    co_sched_group_init(&noisy, 1);
+
+    // the noisy tenant has 10 times as many coroutines but a third of the weight.
+    g_sched_spin_stop = false;
+    for(int i = 0; i < 10; ++i)
+        co_sched_spawn_in(&sched, &quiet, spin);
+    for(int i = 0; i < 100; ++i)
+        co_sched_spawn_in(&sched, &noisy, spin);
+    ASSERT_EQ(10u, quiet.live);
+    ASSERT_EQ(100u, noisy.live);
+
+    for(int i = 0; i < 20; ++i)
+        co_sched_step(&sched);
+
+    ASSERT_EQ(20u * 110u, quiet.resumes + noisy.resumes);
+    ASSERT_EQ(quiet.resumes, quiet.cost);
+    // deficit-round-robin gives exactly 3 resumes to quiet for each of noisy.
+    ASSERT_EQ(3 * noisy.resumes, quiet.resumes);
+
+    g_sched_spin_stop = true;
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(0u, quiet.live);
+    ASSERT_EQ(0u, noisy.live);
+    ASSERT_FALSE(quiet.active);
+    ASSERT_FALSE(noisy.active);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_group_interleave()
+{
+    sched_test_log log = {{0}, 0};
+    co_sched sched;
+    co_sched_init(&sched, 256, &log);
+
+    co_sched_group a, b;
+    co_sched_group_init(&a, 2);
+    co_sched_group_init(&b, 1);
+
+    // one coroutine per group, both yield. a keeps the rest of its quantum over the yield.
+    int id_a = 1, id_b = 2;
+    co_sched_spawn_in(&sched, &a, log_twice, id_a);
+    co_sched_spawn_in(&sched, &b, log_twice, id_b);
+    co_sched_run(&sched);
+
+    ASSERT_EQ(4, log.cnt);
+    int expect[] = { 1, 1, 2, 2 };
+    for(int i = 0; i < 4; ++i)
+        ASSERT_EQ(expect[i], log.entries[i]);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void spawn_child(coro* co, void*, void*)
+{
+    co_begin(co);
+        co_sched_spawn(co_sched_of(co), spin);
+    co_end(co);
+}
+
+TEST sched_group_spawn_inherits()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_group group;
+    co_sched_group_init(&group, 1);
+
+    g_sched_spin_stop = true;
+    coro* parent = co_sched_spawn_in(&sched, &group, spawn_child);
+    ASSERT_EQ(&group, co_sched_group_of(parent));
+    co_sched_step(&sched);
+    // parent completed and its child is in the same group.
+    ASSERT_EQ(1u, group.live);
+    ASSERT_EQ(0u, sched.default_group.live);
+
+    // spawned outside of a coroutine goes into the default group.
+    co_sched_spawn(&sched, spin);
+    ASSERT_EQ(1u, sched.default_group.live);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_limit_rejects_spawn()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+    co_sched_set_limits(&sched, 2, 0);
+
+    g_sched_spin_stop = true;
+    ASSERT(co_sched_spawn(&sched, spin) != nullptr);
+    ASSERT(co_sched_spawn(&sched, spin) != nullptr);
+    ASSERT(co_sched_spawn(&sched, spin) == nullptr);
+    ASSERT_EQ(1u, sched.spawn_rejected);
+    ASSERT_EQ(512u, sched.stack_bytes);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, sched.stack_bytes);
+
+    // stack-limit, room for exactly 3 stacks.
+    co_sched_set_limits(&sched, 0, 3 * 256);
+    for(int i = 0; i < 3; ++i)
+        ASSERT(co_sched_spawn(&sched, spin) != nullptr);
+    ASSERT(co_sched_spawn(&sched, spin) == nullptr);
+
+    co_sched_run(&sched);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+struct sched_admission_state
+{
+    int      started;
+    int      running;
+    int      max_running;
+    uint32_t max_live;
+};
+
+static void admission_worker(coro* co, void* userdata, void*)
+{
+    sched_admission_state* s = (sched_admission_state*)userdata;
+
+    co_locals_begin(co);
+        int i = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+        ++s->started;
+        ++s->running;
+        if(s->running > s->max_running)
+            s->max_running = s->running;
+        if(co_sched_live(co_sched_of(co)) > s->max_live)
+            s->max_live = co_sched_live(co_sched_of(co));
+        for(; locals.i < 3; ++locals.i)
+            co_yield(co);
+        --s->running;
+    co_end(co);
+}
+
+static void admission_producer(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        int i = 0;
+    co_locals_end(co);
+
+    co_begin(co);
+        for(; locals.i < 10; ++locals.i)
+            co_spawn(co, admission_worker);
+    co_end(co);
+}
+
+TEST sched_co_spawn_parks_at_limit()
+{
+    sched_admission_state state;
+    memset(&state, 0, sizeof(state));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, &state);
+    // the producer counts as live, so only 2 workers at a time.
+    co_sched_set_limits(&sched, 3, 0);
+
+    co_sched_spawn(&sched, admission_producer);
+    co_sched_run(&sched);
+
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(10, state.started);
+    ASSERT_EQ(2, state.max_running);
+    ASSERT_EQ(3u, state.max_live);
+    ASSERT(sched.spawn_parked > 0);
+    ASSERT_EQ(0u, sched.spawn_rejected);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_cancel_while_waiting_for_admission()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+    co_sched_set_limits(&sched, 1, 0);
+
+    coro* producer = co_sched_spawn(&sched, admission_producer);
+    co_sched_step(&sched);
+    // the producer itself fills the scheduler and is parked waiting for admission.
+    ASSERT_EQ(1u, co_sched_live(&sched));
+    ASSERT_EQ(0u, sched.ready_cnt);
+
+    co_sched_cancel(producer);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT(sched.admission_head == nullptr);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_wake_while_waiting_for_admission()
+{
+    sched_admission_state state;
+    memset(&state, 0, sizeof(state));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, &state);
+    co_sched_set_limits(&sched, 2, 0);
+
+    coro* producer = co_sched_spawn(&sched, admission_producer);
+    co_sched_step(&sched);
+    ASSERT_EQ(2u, co_sched_live(&sched));
+    ASSERT(sched.admission_head != nullptr);
+
+    // wakes from other systems do not take the producer out of the admission-queue.
+    co_sched_wake(producer);
+    co_sched_wake_remote(producer);
+    co_sched_step(&sched);
+    ASSERT(sched.admission_head == (co_sched_task*)producer);
+    ASSERT(sched.admission_tail == (co_sched_task*)producer);
+    ASSERT(producer->waiting);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(10, state.started);
+    ASSERT_EQ(1, state.max_running);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST sched_pool_reuses_stacks()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+    co_sched_pool_reserve(&sched, 2);
+    ASSERT_EQ(2u, sched.pool_cnt);
+
+    g_sched_spin_stop = true;
+    coro* first[4];
+    for(int i = 0; i < 4; ++i)
+        first[i] = co_sched_spawn(&sched, spin);
+    ASSERT_EQ(2u, sched.pool_hits);
+    ASSERT_EQ(0u, sched.pool_cnt);
+    co_sched_run(&sched);
+    ASSERT_EQ(4u, sched.pool_cnt);
+
+    // the same tasks and stacks are handed out again.
+    for(int i = 0; i < 4; ++i)
+    {
+        coro* co = co_sched_spawn(&sched, spin);
+        bool reused = false;
+        for(int j = 0; j < 4; ++j)
+            reused |= co == first[j];
+        ASSERT(reused);
+    }
+    ASSERT_EQ(6u, sched.pool_hits);
+    co_sched_run(&sched);
+
+    // a grown stack is not put back in the pool.
+    uint32_t pooled = sched.pool_cnt;
+    int depth = 10;
+    co_sched_spawn(&sched, recurse, depth);
+    co_sched_run(&sched);
+    ASSERT_EQ(pooled - 1, sched.pool_cnt);
+
+    co_sched_destroy(&sched);
+    ASSERT_EQ(0u, sched.pool_cnt);
+    return 0;
+}
+
+static int g_sched_notified;
+static int g_sched_parent_continued;
+
+static void notify(coro* co, void*, void*)
+{
+    co_begin(co);
+        // parent did not wait for the notification to run.
+        assert(g_sched_parent_continued == 1);
+        ++g_sched_notified;
+    co_end(co);
+}
+
+static void fire_and_forget(coro* co, void*, void*)
+{
+    co_begin(co);
+        co_spawn(co, notify);
+        g_sched_parent_continued = 1;
+    co_end(co);
+}
+
+TEST sched_co_spawn_detached()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    g_sched_notified = 0;
+    g_sched_parent_continued = 0;
+    co_sched_spawn(&sched, fire_and_forget);
+    co_sched_step(&sched);
+    ASSERT_EQ(1, g_sched_parent_continued);
+    ASSERT_EQ(0, g_sched_notified);
+    // parent completed and its stack is ready for the next spawn.
+    ASSERT_EQ(1u, sched.pool_cnt);
+    ASSERT_EQ(1u, co_sched_live(&sched));
+
+    co_sched_run(&sched);
+    ASSERT_EQ(1, g_sched_notified);
+    ASSERT_EQ(2u, sched.pool_cnt);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void context_child(coro* co, void*, void*)
+{
+    co_begin(co);
+        *co_context<uint64_t>(co) += 1;
+        if(*co_context<uint64_t>(co) < 3)
+            co_spawn(co, context_child);
+        else
+            g_sched_notified = (int)*co_context<uint64_t>(co);
+    co_end(co);
+}
+
+TEST sched_spawn_inherits_context()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    g_sched_notified = 0;
+    coro* root = co_sched_spawn(&sched, context_child);
+    *co_context<uint64_t>(root) = 1;
+    co_sched_run(&sched);
+
+    // each child got a copy of its parents context, 1 -> 2 -> 3
+    ASSERT_EQ(3, g_sched_notified);
+
+    // spawned outside of a coroutine starts with an empty context, even when reusing a pooled task.
+    coro* fresh = co_sched_spawn(&sched, spin);
+    ASSERT_EQ(0u, *co_context<uint64_t>(fresh));
+
+    co_sched_run(&sched);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void local_counter_free(void* value)
+{
+    ++*(int*)value;
+}
+
+static co_local_key g_sched_local_key = co_local_key_create(local_counter_free);
+
+TEST sched_releases_locals()
+{
+    ASSERT(g_sched_local_key >= 0);
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    int freed = 0;
+    g_sched_spin_stop = true;
+    coro* done      = co_sched_spawn(&sched, spin);
+    coro* cancelled = co_sched_spawn(&sched, spin);
+    co_local_set(done, g_sched_local_key, &freed);
+    co_local_set(cancelled, g_sched_local_key, &freed);
+    co_sched_cancel(cancelled);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(2, freed);
+
+    // a pooled task starts with cleared slots.
+    coro* reused = co_sched_spawn(&sched, spin);
+    ASSERT(co_local_get(reused, g_sched_local_key) == nullptr);
+
+    co_sched_run(&sched);
+    co_sched_destroy(&sched);
+    ASSERT_EQ(2, freed);
+    return 0;
+}
+
+static int g_sched_remote_value;
+
+static void remote_waiter(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_wait(co);
+    g_sched_remote_value *= 2;
+    co_end(co);
+}
+
+TEST sched_wake_remote()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    // waking twice before the scheduler has seen it is one wake.
+    coro* waiter = co_sched_spawn(&sched, remote_waiter);
+    co_sched_run(&sched);
+    g_sched_remote_value = 1;
+    co_sched_wake_remote(waiter);
+    co_sched_wake_remote(waiter);
+    ASSERT_EQ(1u, co_sched_live(&sched));
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(1u, sched.remote_wakes);
+    ASSERT_EQ(2, g_sched_remote_value);
+
+    // data written by the waking thread is seen by the coroutine.
+    waiter = co_sched_spawn(&sched, remote_waiter);
+    co_sched_run(&sched);
+    std::thread other([waiter]() {
+        g_sched_remote_value = 21;
+        co_sched_wake_remote(waiter);
+    });
+    while(co_sched_live(&sched) > 0)
+        co_sched_step(&sched);
+    other.join();
+    ASSERT_EQ(42, g_sched_remote_value);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void remote_wake_self_and_exit(coro* co, void*, void*)
+{
+    co_begin(co);
+    // same as another thread waking the coroutine just before it completes.
+    co_sched_wake_remote(co);
+    co_end(co);
+}
+
+TEST sched_wake_remote_completed()
+{
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_spawn(&sched, remote_wake_self_and_exit);
+    co_sched_step(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(0u, sched.pool_cnt); // kept while the wake is in the inbox.
+
+    co_sched_step(&sched);
+    ASSERT_EQ(1u, sched.remote_wakes);
+    ASSERT_EQ(1u, sched.pool_cnt);
+
+    // the pooled task is reused with a clean inbox-state.
+    coro* waiter = co_sched_spawn(&sched, remote_waiter);
+    ASSERT_EQ(0u, sched.pool_cnt);
+    co_sched_run(&sched);
+    co_sched_wake_remote(waiter);
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(2u, sched.remote_wakes);
+
+    // freed by destroy while the wake is in flight.
+    co_sched_spawn(&sched, remote_wake_self_and_exit);
+    co_sched_step(&sched);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+#if CORO_SCHED_REGISTRY
+struct sched_test_dump
+{
+    char   buf[8192];
+    size_t used;
+    int    chunks;
+};
+
+static void sched_test_dump_write(const char* data, size_t size, void* userdata)
+{
+    sched_test_dump* dump = (sched_test_dump*)userdata;
+    if(dump->used + size < sizeof(dump->buf))
+    {
+        memcpy(dump->buf + dump->used, data, size);
+        dump->used += size;
+        dump->buf[dump->used] = 0;
+    }
+    ++dump->chunks;
+}
+
+static int sched_test_count(const char* str, const char* what)
+{
+    int cnt = 0;
+    for(const char* it = strstr(str, what); it; it = strstr(it + 1, what))
+        ++cnt;
+    return cnt;
+}
+
+static void registry_leaf(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_sched_wait_reason(co, "test \"event\"");
+    co_wait(co);
+    co_end(co);
+}
+
+static void registry_parks(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_call(co, registry_leaf);
+    co_end(co);
+}
+
+TEST sched_registry_dump()
+{
+    co_sched sched;
+    co_sched_init(&sched, 1024, nullptr);
+
+    co_sched_group tenant;
+    co_sched_group_init(&tenant, 1);
+    tenant.name = "tenant";
+
+    g_sched_spin_stop = false;
+    coro* parked = co_sched_spawn_in(&sched, &tenant, registry_parks);
+    co_sched_spawn(&sched, spin);
+    co_sched_step(&sched);
+
+    sched_test_dump dump;
+    dump.used   = 0;
+    dump.chunks = 0;
+    co_sched_dump_json(&sched, sched_test_dump_write, &dump);
+
+    ASSERT(strstr(dump.buf, "{\"live\":2,\"ready\":1,\"coroutines\":[") == dump.buf);
+    ASSERT_EQ(2, sched_test_count(dump.buf, "\"id\":"));
+    ASSERT_EQ(1, sched_test_count(dump.buf, "\"state\":\"parked\",\"wait\":\"test \\\"event\\\"\",\"parked_ns\":"));
+    ASSERT_EQ(1, sched_test_count(dump.buf, "\"group\":\"tenant\""));
+    ASSERT_EQ(1, sched_test_count(dump.buf, "\"group\":\"default\",\"state\":\"ready\","));
+    // parked coroutine is two calls deep, the spinning one is only its root.
+    ASSERT_EQ(3, sched_test_count(dump.buf, "\"line\":"));
+    ASSERT_EQ('\n', dump.buf[dump.used - 1]);
+
+    // a requested dump is written at the start of the next step, after that it is gone.
+    dump.used = 0;
+    co_sched_set_dump_target(&sched, sched_test_dump_write, &dump);
+    co_sched_request_dump(&sched);
+    g_sched_spin_stop = true;
+    co_sched_wake(parked);
+    co_sched_step(&sched);
+    ASSERT(dump.used > 0);
+    ASSERT_EQ(2, sched_test_count(dump.buf, "\"state\":\"ready\","));
+    ASSERT_EQ(0, sched_test_count(dump.buf, "\"wait\":"));
+
+    co_sched_run(&sched);
+
+    dump.used = 0;
+    co_sched_dump_json(&sched, sched_test_dump_write, &dump);
+    ASSERT_STR_EQ("{\"live\":0,\"ready\":0,\"coroutines\":[]}\n", dump.buf);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+#endif
+
+GREATEST_SUITE( coro_sched_tests )
+{
+    RUN_TEST( sched_fifo );
+    RUN_TEST( sched_grow_stack );
+    RUN_TEST( sched_park_and_wake );
+    RUN_TEST( sched_wake_while_executing );
+    RUN_TEST( sched_cancel );
+    RUN_TEST( sched_group_weighted_share );
+    RUN_TEST( sched_group_interleave );
+    RUN_TEST( sched_group_spawn_inherits );
+    RUN_TEST( sched_limit_rejects_spawn );
+    RUN_TEST( sched_co_spawn_parks_at_limit );
+    RUN_TEST( sched_cancel_while_waiting_for_admission );
+    RUN_TEST( sched_wake_while_waiting_for_admission );
+    RUN_TEST( sched_pool_reuses_stacks );
+    RUN_TEST( sched_co_spawn_detached );
+    RUN_TEST( sched_spawn_inherits_context );
+    RUN_TEST( sched_releases_locals );
+    RUN_TEST( sched_wake_remote );
+    RUN_TEST( sched_wake_remote_completed );
+#if CORO_SCHED_REGISTRY
+    RUN_TEST( sched_registry_dump );
+#endif
+}
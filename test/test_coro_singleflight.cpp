@@ -0,0 +1,286 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+#include "../coro_singleflight.h"
+
+struct sf_test_state
+{
+    co_singleflight_table sf;
+    coro*                 parked_loader;
+    int                   loads;
+    int                   got[8];
+    int                   got_status[8];
+    int                   got_cnt;
+};
+
+static sf_test_state g_sf;
+
+// loader that waits until the test wakes it to simulate an async backend.
+static void sf_loader(coro* co, void*, void* arg)
+{
+    co_sf_flight* flight = *(co_sf_flight**)arg;
+
+    co_begin(co);
+
+    ++g_sf.loads;
+    g_sf.parked_loader = co->call.root;
+    co_wait(co);
+
+    flight->value  = (void*)(uintptr_t)(flight->key * 10);
+    flight->status = flight->key == 13 ? -1 : 0;
+
+    co_end(co);
+}
+
+static void sf_get(coro* co, void*, void* arg)
+{
+    uint64_t key = *(uint64_t*)arg;
+
+    co_locals_begin(co);
+        co_sf_result res;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    co_singleflight(co, &g_sf.sf, key, sf_loader, locals.res);
+
+    g_sf.got[g_sf.got_cnt]        = (int)(uintptr_t)locals.res.value;
+    g_sf.got_status[g_sf.got_cnt] = locals.res.status;
+    ++g_sf.got_cnt;
+
+    co_end(co);
+}
+
+static void sf_reset(co_lru* cache)
+{
+    memset(&g_sf, 0, sizeof(g_sf));
+    co_singleflight_init(&g_sf.sf, 16, cache);
+}
+
+TEST singleflight_coalesce()
+{
+    co_lru cache;
+    co_lru_init(&cache, 4, nullptr, nullptr);
+    sf_reset(&cache);
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    uint64_t key = 7;
+    for(int i = 0; i < 4; ++i)
+        co_sched_spawn(&sched, sf_get, key);
+
+    co_sched_run(&sched);
+    ASSERT_EQ(1, g_sf.loads);
+    ASSERT_EQ(0, g_sf.got_cnt);
+    ASSERT_EQ(1u, g_sf.sf.in_flight);
+    ASSERT_EQ(3u, g_sf.sf.coalesced);
+
+    co_sched_wake(g_sf.parked_loader);
+    co_sched_run(&sched);
+    ASSERT_EQ(4, g_sf.got_cnt);
+    for(int i = 0; i < 4; ++i)
+        ASSERT_EQ(70, g_sf.got[i]);
+    ASSERT_EQ(0u, g_sf.sf.in_flight);
+
+    // now the value is cached and no load should be done.
+    co_sched_spawn(&sched, sf_get, key);
+    co_sched_run(&sched);
+    ASSERT_EQ(1, g_sf.loads);
+    ASSERT_EQ(5, g_sf.got_cnt);
+    ASSERT_EQ(70, g_sf.got[4]);
+    ASSERT_EQ(1u, cache.hits);
+
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_singleflight_destroy(&g_sf.sf);
+    co_lru_destroy(&cache);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST singleflight_error_not_cached()
+{
+    co_lru cache;
+    co_lru_init(&cache, 4, nullptr, nullptr);
+    sf_reset(&cache);
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    uint64_t key = 13;
+    for(int round = 0; round < 2; ++round)
+    {
+        co_sched_spawn(&sched, sf_get, key);
+        co_sched_spawn(&sched, sf_get, key);
+        co_sched_run(&sched);
+        co_sched_wake(g_sf.parked_loader);
+        co_sched_run(&sched);
+    }
+
+    // failed loads are shared with the waiters but never cached.
+    ASSERT_EQ(2, g_sf.loads);
+    ASSERT_EQ(4, g_sf.got_cnt);
+    for(int i = 0; i < 4; ++i)
+        ASSERT_EQ(-1, g_sf.got_status[i]);
+    ASSERT_EQ(0u, cache.count);
+
+    co_singleflight_destroy(&g_sf.sf);
+    co_lru_destroy(&cache);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST singleflight_cancelled_waiter_and_overflow()
+{
+    sf_reset(nullptr);
+
+    // a stack so small that the co_call() to the loader overflows.
+    co_sched sched;
+    co_sched_init(&sched, 48, nullptr);
+
+    uint64_t key = 3;
+    co_sched_spawn(&sched, sf_get, key);
+    coro* cancel_me = co_sched_spawn(&sched, sf_get, key);
+    co_sched_run(&sched);
+    ASSERT_EQ(1, g_sf.loads);
+
+    co_sched_cancel(cancel_me);
+    co_sched_wake(g_sf.parked_loader);
+    co_sched_run(&sched);
+
+    ASSERT_EQ(1, g_sf.got_cnt);
+    ASSERT_EQ(30, g_sf.got[0]);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_singleflight_destroy(&g_sf.sf);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST singleflight_cancelled_leader()
+{
+    co_lru cache;
+    co_lru_init(&cache, 4, nullptr, nullptr);
+    sf_reset(&cache);
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    uint64_t key = 5;
+    for(int i = 0; i < 3; ++i)
+        co_sched_spawn(&sched, sf_get, key);
+    co_sched_run(&sched);
+    ASSERT_EQ(1, g_sf.loads);
+
+    // cancel the leader while it is parked in the loader, waking it frees it.
+    co_sched_cancel(g_sf.parked_loader);
+    co_sched_wake(g_sf.parked_loader);
+    co_sched_run(&sched);
+
+    ASSERT_EQ(2, g_sf.got_cnt);
+    for(int i = 0; i < 2; ++i)
+    {
+        ASSERT_EQ(-ECANCELED, g_sf.got_status[i]);
+        ASSERT_EQ(0, g_sf.got[i]);
+    }
+    ASSERT_EQ(0u, g_sf.sf.in_flight);
+    ASSERT_EQ(0u, cache.count);
+
+    // the key is no longer in flight so the next request starts a new load.
+    co_sched_spawn(&sched, sf_get, key);
+    co_sched_run(&sched);
+    ASSERT_EQ(2, g_sf.loads);
+    co_sched_wake(g_sf.parked_loader);
+    co_sched_run(&sched);
+    ASSERT_EQ(3, g_sf.got_cnt);
+    ASSERT_EQ(50, g_sf.got[2]);
+
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    co_singleflight_destroy(&g_sf.sf);
+    co_lru_destroy(&cache);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void count_evict(uint64_t, void*, void* userdata)
+{
+    ++*(int*)userdata;
+}
+
+TEST lru_evict()
+{
+    int evicted = 0;
+    co_lru lru;
+    co_lru_init(&lru, 2, count_evict, &evicted);
+
+    void* v;
+    co_lru_put(&lru, 1, (void*)1);
+    co_lru_put(&lru, 2, (void*)2);
+    ASSERT(co_lru_get(&lru, 1, &v)); // 2 is now lru
+    co_lru_put(&lru, 3, (void*)3);
+    ASSERT_EQ(1, evicted);
+    ASSERT_FALSE(co_lru_get(&lru, 2, &v));
+    ASSERT(co_lru_get(&lru, 1, &v));
+    ASSERT_EQ((void*)1, v);
+    ASSERT(co_lru_get(&lru, 3, &v));
+    ASSERT_EQ((void*)3, v);
+
+    co_lru_destroy(&lru);
+    ASSERT_EQ(3, evicted);
+    return 0;
+}
+
+TEST lru_zero_capacity()
+{
+    int evicted = 0;
+    co_lru lru;
+    co_lru_init(&lru, 0, count_evict, &evicted);
+    ASSERT_EQ(1u, lru.capacity);
+
+    void* v;
+    co_lru_put(&lru, 1, (void*)1);
+    co_lru_put(&lru, 2, (void*)2);
+    ASSERT_EQ(1, evicted);
+    ASSERT(co_lru_get(&lru, 2, &v));
+    ASSERT_EQ((void*)2, v);
+
+    co_lru_destroy(&lru);
+    ASSERT_EQ(2, evicted);
+    return 0;
+}
+
+GREATEST_SUITE( coro_singleflight_tests )
+{
+    RUN_TEST( singleflight_coalesce );
+    RUN_TEST( singleflight_error_not_cached );
+    RUN_TEST( singleflight_cancelled_waiter_and_overflow );
+    RUN_TEST( singleflight_cancelled_leader );
+    RUN_TEST( lru_evict );
+    RUN_TEST( lru_zero_capacity );
+}
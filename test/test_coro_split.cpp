@@ -0,0 +1,174 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+#include "../coro_split.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+TEST split_find_all_offsets()
+{
+    // put the delimiter at every offset in a buffer longer than the widest simd-block to
+    // make sure that block- and tail-handling finds the same delimiter as scalar.
+    char buffer[200];
+    for(int delim_at = 0; delim_at <= (int)sizeof(buffer); ++delim_at)
+    {
+        memset(buffer, 'a', sizeof(buffer));
+        if(delim_at < (int)sizeof(buffer))
+            buffer[delim_at] = '\n';
+
+        for(int start = 0; start < 70; ++start)
+        {
+            const char* begin = buffer + start;
+            const char* end   = buffer + sizeof(buffer);
+            const char* expect = _co_split_find_scalar(begin, end, '\n');
+            ASSERT_EQ(expect, co_split_find(begin, end, '\n'));
+#if CORO_SPLIT_SIMD >= 1
+            ASSERT_EQ(expect, _co_split_find_sse2(begin, end, '\n'));
+#endif
+#if CORO_SPLIT_SIMD >= 2
+            if(_co_split_has_avx2())
+                ASSERT_EQ(expect, _co_split_find_avx2(begin, end, '\n'));
+#endif
+        }
+    }
+    return 0;
+}
+
+TEST split_mem_records()
+{
+    static const char DATA[] = "first\n\nthird record that is longer than one simd-block of 64 bytes for sure!\nlast";
+
+    co_split_source src;
+    co_split_init_mem(&src, DATA, sizeof(DATA) - 1, '\n');
+    co_split_source* src_ptr = &src;
+
+    uint8_t stack[256];
+    coro co;
+    co_init(&co, stack, sizeof(stack), co_split_gen, src_ptr);
+
+    co_split_record rec;
+    ASSERT(co_gen_next(&co, &rec));
+    ASSERT_EQ(5, (int)rec.len);
+    ASSERT_EQ(0, memcmp("first", rec.str, rec.len));
+    ASSERT_EQ(DATA, rec.str); // zero-copy!
+
+    ASSERT(co_gen_next(&co, &rec));
+    ASSERT_EQ(0, (int)rec.len);
+
+    ASSERT(co_gen_next(&co, &rec));
+    ASSERT_EQ(69, (int)rec.len);
+
+    // last record without trailing delimiter.
+    ASSERT(co_gen_next(&co, &rec));
+    ASSERT_EQ(4, (int)rec.len);
+    ASSERT_EQ(0, memcmp("last", rec.str, rec.len));
+
+    ASSERT_FALSE(co_gen_next(&co, &rec));
+    ASSERT(co_completed(&co));
+    return 0;
+}
+
+TEST split_as_combinator_stage()
+{
+    static const char DATA[] = "a,bb,,ccc,dddd,";
+
+    co_split_source src;
+    co_split_init_mem(&src, DATA, sizeof(DATA) - 1, ',');
+
+    auto lengths = co_gen_map(co_gen_filter(src, [](co_split_record r) { return r.len > 0; }),
+                              [](co_split_record r) { return (int)r.len; });
+
+    int expect = 1;
+    int len;
+    while(co_gen_next(lengths, &len))
+        ASSERT_EQ(expect++, len);
+    ASSERT_EQ(5, expect);
+    return 0;
+}
+
+#if !defined(_WIN32)
+TEST split_mapped_file()
+{
+    char path[] = "/tmp/coro_split_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT(fd >= 0);
+
+    // write lines of varying length so that records cross both simd-blocks and pages.
+    size_t expect_lines = 2000;
+    size_t expect_bytes = 0;
+    FILE* f = fdopen(fd, "wb");
+    for(size_t i = 0; i < expect_lines; ++i)
+    {
+        for(size_t c = 0; c < i % 300; ++c)
+            fputc('a' + (int)(c % 26), f);
+        fputc('\n', f);
+        expect_bytes += i % 300;
+    }
+    fclose(f);
+
+    co_split_source src;
+    ASSERT(co_split_open(&src, path, '\n'));
+    co_split_source* src_ptr = &src;
+
+    uint8_t stack[256];
+    coro co;
+    co_init(&co, stack, sizeof(stack), co_split_gen, src_ptr);
+
+    size_t lines = 0;
+    size_t bytes = 0;
+    co_split_record rec;
+    while(co_gen_next(&co, &rec))
+    {
+        ASSERT_EQ(lines % 300, rec.len);
+        ++lines;
+        bytes += rec.len;
+    }
+
+    co_split_close(&src);
+    unlink(path);
+
+    ASSERT_EQ(expect_lines, lines);
+    ASSERT_EQ(expect_bytes, bytes);
+
+    ASSERT_FALSE(co_split_open(&src, path, '\n'));
+    return 0;
+}
+#endif
+
+GREATEST_SUITE( coro_split_tests )
+{
+    RUN_TEST( split_find_all_offsets );
+    RUN_TEST( split_mem_records );
+    RUN_TEST( split_as_combinator_stage );
+#if !defined(_WIN32)
+    RUN_TEST( split_mapped_file );
+#endif
+}
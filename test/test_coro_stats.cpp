@@ -0,0 +1,150 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_stats.h"
+
+#include <stdio.h>
+
+static void stats_test_waiter(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_sched_wait_reason(co, "stats_test");
+    co_wait(co);
+    co_end(co);
+}
+
+static void stats_test_grow(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        uint8_t big[512];
+    co_locals_end(co);
+
+    co_begin(co);
+    locals.big[0] = 1;
+    co_end(co);
+}
+
+static void stats_test_timer_fired(co_timer*, void*)
+{
+}
+
+TEST stats_publish_and_read()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/coro_stats_test_%d", (int)getpid());
+
+    co_stats stats;
+    ASSERT(co_stats_create(&stats, name));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+    co_stats_slot* slot = co_stats_add(&stats, &sched, "main");
+    ASSERT(slot != nullptr);
+
+    coro* waiters[3];
+    for(int i = 0; i < 3; ++i)
+        waiters[i] = co_sched_spawn(&sched, stats_test_waiter);
+    co_sched_spawn(&sched, stats_test_grow);
+    co_sched_run(&sched);
+    co_stats_publish(&stats, slot);
+
+    co_stats reader;
+    ASSERT(co_stats_attach(&reader, name));
+    ASSERT_EQ((uint32_t)getpid(), reader.page->pid);
+    ASSERT_EQ(1u, reader.page->slot_cnt);
+    ASSERT_STR_EQ("main", reader.page->slots[0].name);
+
+    co_stats_values v;
+    ASSERT(co_stats_read(&reader.page->slots[0], &v));
+    ASSERT_EQ(3u, v.live);
+    ASSERT_EQ(0u, v.ready);
+    ASSERT_EQ(3u, v.parks);
+    ASSERT_EQ(1u, v.stack_grows);
+    ASSERT_EQ(5u, v.resumes); // 3 waiters + overflow and re-run of the grower.
+    ASSERT_EQ(3u * 256u, v.stack_bytes);
+    ASSERT_EQ(1u, v.publishes);
+#if CORO_SCHED_REGISTRY
+    ASSERT_EQ(1u, v.reason_cnt);
+    ASSERT_STR_EQ("stats_test", v.reasons[0]);
+    ASSERT_EQ(3u, v.reason_parks[0]);
+#endif
+
+    // reader sees new values on the next publish.
+    for(int i = 0; i < 3; ++i)
+        co_sched_wake(waiters[i]);
+    co_sched_run(&sched);
+    co_stats_publish(&stats, slot);
+    ASSERT(co_stats_read(&reader.page->slots[0], &v));
+    ASSERT_EQ(0u, v.live);
+    ASSERT_EQ(8u, v.resumes);
+    ASSERT_EQ(2u, v.publishes);
+
+    ASSERT_EQ(0u, v.timers_started);
+
+    // timer counters of an attached wheel are published with the scheduler.
+    co_timer_wheel wheel;
+    co_timer_wheel_init(&wheel, 1000, 0);
+    co_timer timers[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        co_timer_init(&timers[i]);
+        co_timer_start(&wheel, &timers[i], (uint64_t)(i + 1) * 1000000, stats_test_timer_fired, nullptr);
+    }
+    co_timer_cancel(&wheel, &timers[0]);
+    co_timer_advance(&wheel, 2000000);
+    co_stats_add_timers(&stats, slot, &wheel);
+    co_stats_publish(&stats, slot);
+    ASSERT(co_stats_read(&reader.page->slots[0], &v));
+    ASSERT_EQ(1u, v.timers_pending);
+    ASSERT_EQ(3u, v.timers_started);
+    ASSERT_EQ(1u, v.timers_cancelled);
+    ASSERT_EQ(1u, v.timers_expired);
+    ASSERT_EQ(wheel.cascaded, v.timers_cascaded);
+
+    co_stats_destroy(&reader);
+    co_stats_destroy(&stats);
+    co_sched_destroy(&sched);
+
+    // page is removed with its creator.
+    ASSERT_FALSE(co_stats_attach(&reader, name));
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_stats_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( stats_publish_and_read );
+#endif
+}
@@ -0,0 +1,216 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#include "../coro_timer.h"
+
+enum { TIMER_TEST_CNT = 2048 };
+
+static co_timer       timer_test_timers[TIMER_TEST_CNT];
+static uint64_t       timer_test_fired_at[TIMER_TEST_CNT];
+static co_timer_wheel timer_test_wheel;
+
+static void timer_test_record(co_timer* timer, void* userdata)
+{
+    co_timer_wheel* wheel = (co_timer_wheel*)userdata;
+    timer_test_fired_at[timer - timer_test_timers] = wheel->base_ns + wheel->now * wheel->tick_ns;
+}
+
+static uint32_t timer_test_rand(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+TEST timer_fire_within_one_tick()
+{
+    const uint64_t TICK = 1000;
+    co_timer_wheel* wheel = &timer_test_wheel;
+    co_timer_wheel_init(wheel, TICK, 5000);
+
+    // deadlines spread over all levels of the wheel, every third timer is cancelled.
+    uint32_t seed = 1234;
+    uint64_t deadline[TIMER_TEST_CNT];
+    for(int i = 0; i < TIMER_TEST_CNT; ++i)
+    {
+        uint32_t shift = timer_test_rand(&seed) % 26;
+        deadline[i] = 5000 + (uint64_t)(timer_test_rand(&seed) & ((1u << shift) - 1)) * 37;
+        timer_test_fired_at[i] = 0;
+        co_timer_init(&timer_test_timers[i]);
+        co_timer_start(wheel, &timer_test_timers[i], deadline[i], timer_test_record, wheel);
+    }
+    for(int i = 0; i < TIMER_TEST_CNT; i += 3)
+        ASSERT(co_timer_cancel(wheel, &timer_test_timers[i]));
+    ASSERT_FALSE(co_timer_cancel(wheel, &timer_test_timers[0]));
+
+    uint64_t now = 5000;
+    uint32_t fired = 0;
+    while(wheel->pending > 0)
+    {
+        uint64_t next = co_timer_next_ns(wheel, now, ~0ull);
+        ASSERT(next > 0);
+        now += next + timer_test_rand(&seed) % (TICK * 3);
+        fired += co_timer_advance(wheel, now);
+    }
+
+    ASSERT_EQ((uint32_t)(TIMER_TEST_CNT - (TIMER_TEST_CNT + 2) / 3), fired);
+    for(int i = 0; i < TIMER_TEST_CNT; ++i)
+    {
+        ASSERT_FALSE(co_timer_pending(&timer_test_timers[i]));
+        if(i % 3 == 0)
+        {
+            ASSERT_EQ(0u, timer_test_fired_at[i]);
+            continue;
+        }
+        // never early and never more than one tick late relative to the wheel.
+        ASSERT(timer_test_fired_at[i] >= deadline[i]);
+        ASSERT(timer_test_fired_at[i] <= deadline[i] + TICK);
+    }
+    ASSERT(wheel->cascaded > 0);
+    return 0;
+}
+
+TEST timer_restart_and_past_deadline()
+{
+    co_timer_wheel* wheel = &timer_test_wheel;
+    co_timer_wheel_init(wheel, 10, 0);
+
+    co_timer* t = &timer_test_timers[0];
+    co_timer_init(t);
+    timer_test_fired_at[0] = 0;
+
+    // restarting moves the deadline.
+    co_timer_start(wheel, t, 100, timer_test_record, wheel);
+    co_timer_start(wheel, t, 5000, timer_test_record, wheel);
+    ASSERT_EQ(1u, wheel->pending);
+    ASSERT_EQ(0u, co_timer_advance(wheel, 1000));
+    ASSERT_EQ(1u, co_timer_advance(wheel, 5000));
+    ASSERT_EQ(5000u, timer_test_fired_at[0]);
+
+    // deadline in the past fire on the next tick.
+    co_timer_start(wheel, t, 0, timer_test_record, wheel);
+    ASSERT_EQ(0u, co_timer_advance(wheel, 5009));
+    ASSERT_EQ(1u, co_timer_advance(wheel, 5010));
+    ASSERT_EQ(0u, wheel->pending);
+    return 0;
+}
+
+static int timer_test_order[8];
+static int timer_test_order_cnt = 0;
+
+static void timer_test_sleep_step(coro* co, void*, int* ms)
+{
+    co_locals_begin(co);
+        co_timer timer;
+    co_locals_end(co);
+
+    co_begin(co);
+    co_timer_init(&locals.timer);
+    co_timer_sleep(co, &timer_test_wheel, &locals.timer, (uint64_t)*ms * 1000000);
+    co_end(co);
+}
+
+static void timer_test_sleeper(coro* co, void*, int* ms)
+{
+    co_locals_begin(co);
+        int half;
+    co_locals_end(co);
+
+    co_begin(co);
+    // sleep in a sub-call to check that the root is woken.
+    locals.half = *ms / 2;
+    co_call(co, (co_func)timer_test_sleep_step, locals.half);
+    co_call(co, (co_func)timer_test_sleep_step, locals.half);
+    timer_test_order[timer_test_order_cnt++] = *ms;
+    co_end(co);
+}
+
+TEST timer_sleep_in_sched()
+{
+    co_sched sched;
+    co_sched_init(&sched, 1024, nullptr);
+    co_timer_wheel_init(&timer_test_wheel, 1000000, 0);
+    timer_test_order_cnt = 0;
+
+    int ms[4] = { 300, 100, 400, 200 };
+    for(int i = 0; i < 4; ++i)
+        co_sched_spawn(&sched, (co_func)timer_test_sleeper, ms[i]);
+
+    uint64_t now = 0;
+    co_sched_run(&sched);
+    while(co_sched_live(&sched) > 0)
+    {
+        now += co_timer_next_ns(&timer_test_wheel, now, 1000000000);
+        co_timer_advance(&timer_test_wheel, now);
+        co_sched_run(&sched);
+    }
+
+    ASSERT_EQ(4, timer_test_order_cnt);
+    ASSERT_EQ(100, timer_test_order[0]);
+    ASSERT_EQ(200, timer_test_order[1]);
+    ASSERT_EQ(300, timer_test_order[2]);
+    ASSERT_EQ(400, timer_test_order[3]);
+    ASSERT_EQ(400000000u, now);
+    ASSERT_EQ(8u, timer_test_wheel.expired);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST timer_sleep_woken_early()
+{
+    co_sched sched;
+    co_sched_init(&sched, 1024, nullptr);
+    co_timer_wheel_init(&timer_test_wheel, 1000000, 0);
+
+    int ms = 1000;
+    coro* sleeper = co_sched_spawn(&sched, (co_func)timer_test_sleep_step, ms);
+    co_sched_run(&sched);
+    ASSERT_EQ(1u, timer_test_wheel.pending);
+
+    // wake before the deadline, the timer in the finished coroutines locals must be gone.
+    co_sched_wake(sleeper);
+    co_sched_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(0u, timer_test_wheel.pending);
+    ASSERT_EQ(1u, timer_test_wheel.cancelled);
+    ASSERT_EQ(0u, co_timer_advance(&timer_test_wheel, 2000000000));
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+GREATEST_SUITE( coro_timer_tests )
+{
+    RUN_TEST( timer_fire_within_one_tick );
+    RUN_TEST( timer_restart_and_past_deadline );
+    RUN_TEST( timer_sleep_in_sched );
+    RUN_TEST( timer_sleep_woken_early );
+}
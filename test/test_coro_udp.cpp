@@ -0,0 +1,176 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_udp.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int udp_test_socket(sockaddr_in* addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(addr, 0, sizeof(sockaddr_in));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sockaddr_in);
+    if(fd < 0 || bind(fd, (sockaddr*)addr, sizeof(sockaddr_in)) != 0 || getsockname(fd, (sockaddr*)addr, &len) != 0)
+        return -1;
+    return fd;
+}
+
+static co_udp g_udp;
+static int    g_udp_echoed;
+
+static void udp_test_echo(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        co_udp_packet* pkt = nullptr;
+    co_locals_end(co);
+
+    co_begin(co);
+
+    while(true)
+    {
+        co_udp_recv(co, &g_udp, locals.pkt);
+        if(locals.pkt == nullptr || locals.pkt->len == 0)
+            co_exit(co);
+        // reply with the payload incremented by one.
+        for(uint32_t i = 0; i < locals.pkt->len; ++i)
+            ++locals.pkt->data[i];
+        co_udp_send(&g_udp, locals.pkt->data, locals.pkt->len, &locals.pkt->addr, locals.pkt->addr_len);
+        ++g_udp_echoed;
+    }
+
+    co_end(co);
+}
+
+TEST udp_batched_echo()
+{
+    static const int PACKETS = 200;
+
+    sockaddr_in server_addr, client_addr;
+    int server = udp_test_socket(&server_addr);
+    int client = udp_test_socket(&client_addr);
+    ASSERT(server >= 0 && client >= 0);
+
+    co_io io;
+    ASSERT(co_io_init(&io));
+    ASSERT(co_udp_init(&g_udp, &io, server));
+    g_udp_echoed = 0;
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+    co_sched_spawn(&sched, udp_test_echo);
+
+    // nothing to receive, echo parks.
+    co_sched_run(&sched);
+    ASSERT_EQ(1u, co_sched_live(&sched));
+
+    for(int i = 0; i < PACKETS; ++i)
+    {
+        uint8_t msg[4] = { (uint8_t)i, (uint8_t)(i + 1), (uint8_t)(i + 2), (uint8_t)(i + 3) };
+        ASSERT_EQ(4, sendto(client, msg, sizeof(msg), 0, (sockaddr*)&server_addr, sizeof(server_addr)));
+    }
+
+    while(g_udp_echoed < PACKETS)
+    {
+        ASSERT(co_io_poll(&io, 1000) > 0 || sched.ready_cnt > 0);
+        co_sched_run(&sched);
+        co_udp_flush(&g_udp);
+    }
+
+    ASSERT_EQ((uint64_t)PACKETS, g_udp.packets_in);
+    ASSERT_EQ((uint64_t)PACKETS, g_udp.packets_out);
+    ASSERT_EQ(0u, g_udp.dropped);
+    // all packets was queued before the endpoint was woken, so they are received in full batches.
+    ASSERT_EQ((uint64_t)((PACKETS + CORO_UDP_BATCH - 1) / CORO_UDP_BATCH), g_udp.recv_calls);
+    ASSERT(g_udp.send_calls <= g_udp.recv_calls);
+
+    for(int i = 0; i < PACKETS; ++i)
+    {
+        uint8_t msg[16];
+        sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ASSERT_EQ(4, recvfrom(client, msg, sizeof(msg), 0, (sockaddr*)&from, &from_len));
+        ASSERT_EQ(server_addr.sin_port, from.sin_port);
+        ASSERT_EQ((uint8_t)(i + 1), msg[0]);
+        ASSERT_EQ((uint8_t)(i + 4), msg[3]);
+    }
+
+    // an empty datagram stops the echo-coroutine.
+    ASSERT_EQ(0, sendto(client, nullptr, 0, 0, (sockaddr*)&server_addr, sizeof(server_addr)));
+    while(co_sched_live(&sched) > 0)
+    {
+        ASSERT(co_io_poll(&io, 1000) > 0);
+        co_sched_run(&sched);
+    }
+
+    co_sched_destroy(&sched);
+    co_udp_destroy(&g_udp, &io);
+    co_io_destroy(&io);
+    close(server);
+    close(client);
+    return 0;
+}
+
+TEST udp_send_rejects_oversized()
+{
+    sockaddr_in addr;
+    int fd = udp_test_socket(&addr);
+    ASSERT(fd >= 0);
+
+    co_io io;
+    ASSERT(co_io_init(&io));
+    ASSERT(co_udp_init(&g_udp, &io, fd));
+
+    static uint8_t big[CORO_UDP_MAX_PACKET + 1];
+    ASSERT_FALSE(co_udp_send(&g_udp, big, sizeof(big), &addr, sizeof(addr)));
+    ASSERT(co_udp_send(&g_udp, big, CORO_UDP_MAX_PACKET, &addr, sizeof(addr)));
+    ASSERT_EQ(1, co_udp_flush(&g_udp));
+    ASSERT_EQ(0, co_udp_flush(&g_udp));
+
+    co_udp_destroy(&g_udp, &io);
+    co_io_destroy(&io);
+    close(fd);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_udp_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( udp_batched_echo );
+    RUN_TEST( udp_send_rejects_oversized );
+#endif
+}
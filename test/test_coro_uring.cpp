@@ -0,0 +1,523 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+struct uring_test_state
+{
+    co_uring           ring;
+    co_uring_buf_ring  br;
+    co_uring_multishot ms;
+    int                fds[2];
+    int                received;
+    char               data[64];
+    int                data_len;
+    int                accepted[4];
+    int                accepted_cnt;
+    int                result;
+};
+
+static uring_test_state g_uring;
+
+static bool uring_test_init()
+{
+    memset(&g_uring, 0, sizeof(g_uring));
+    return co_uring_init(&g_uring.ring, 64, 0);
+}
+
+static void uring_test_run(co_sched* sched)
+{
+    for(int i = 0; i < 100 && co_sched_live(sched) > 0; ++i)
+    {
+        co_sched_run(sched);
+        co_uring_poll(&g_uring.ring, co_sched_live(sched) > 0);
+    }
+}
+
+TEST uring_read_write_fixed()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+
+    ASSERT_EQ(0, pipe(g_uring.fds));
+
+    static uint8_t fixed[2][64];
+    struct iovec iovs[2] = { { fixed[0], sizeof(fixed[0]) }, { fixed[1], sizeof(fixed[1]) } };
+    ASSERT(co_uring_register_buffers(&g_uring.ring, iovs, 2));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    // reader is spawned first and parks before anything is written.
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_op op;
+        co_locals_end(co);
+
+        co_begin(co);
+            co_uring_read_fixed(co, &g_uring.ring, &locals.op, g_uring.fds[0], fixed[1], sizeof(fixed[1]), 0, 1);
+            g_uring.result = locals.op.res;
+        co_end(co);
+    });
+
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_op op;
+        co_locals_end(co);
+
+        co_begin(co);
+            memcpy(fixed[0], "fixed-buffer", 12);
+            co_uring_write_fixed(co, &g_uring.ring, &locals.op, g_uring.fds[1], fixed[0], 12, 0, 0);
+            assert(locals.op.res == 12);
+        co_end(co);
+    });
+
+    uring_test_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(12, g_uring.result);
+    ASSERT_EQ(0, memcmp(fixed[1], "fixed-buffer", 12));
+
+    ASSERT(co_uring_unregister_buffers(&g_uring.ring));
+    close(g_uring.fds[0]);
+    close(g_uring.fds[1]);
+    co_uring_destroy(&g_uring.ring);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST uring_multishot_recv_buffer_ring()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+
+    if(!co_uring_buf_ring_init(&g_uring.ring, &g_uring.br, 1, 4, 16))
+    {
+        co_uring_destroy(&g_uring.ring);
+        SKIPm("provided buffer-rings not supported");
+    }
+
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, g_uring.fds));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_uring_recv_multishot(&g_uring.ring, &g_uring.ms, g_uring.fds[0], &g_uring.br);
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_cqe_item item;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        while(true)
+        {
+            co_uring_multishot_next(co, &g_uring.ms, locals.item);
+            if(locals.item.res <= 0)
+                break;
+
+            memcpy(g_uring.data + g_uring.data_len, co_uring_buf_ptr(&g_uring.br, locals.item.flags), (size_t)locals.item.res);
+            g_uring.data_len += locals.item.res;
+            ++g_uring.received;
+            co_uring_buf_return(&g_uring.br, locals.item.flags);
+        }
+
+        co_end(co);
+    });
+
+    // nothing is received yet, all buffers are still in the ring.
+    co_sched_run(&sched);
+    co_uring_poll(&g_uring.ring, false);
+    ASSERT_EQ(0, g_uring.received);
+
+    const char* msgs[] = { "hello", "multishot", "world" };
+    for(int i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ((ssize_t)strlen(msgs[i]), send(g_uring.fds[1], msgs[i], strlen(msgs[i]), 0));
+        co_uring_poll(&g_uring.ring, true);
+        co_sched_run(&sched);
+    }
+    ASSERT_EQ(3, g_uring.received);
+    ASSERT(co_uring_multishot_active(&g_uring.ms));
+    ASSERT_EQ(19, g_uring.data_len);
+    ASSERT_EQ(0, memcmp(g_uring.data, "hellomultishotworld", 19));
+
+    // closing the other end ends the stream.
+    close(g_uring.fds[1]);
+    uring_test_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_FALSE(co_uring_multishot_active(&g_uring.ms));
+
+    close(g_uring.fds[0]);
+    co_uring_buf_ring_destroy(&g_uring.ring, &g_uring.br);
+    co_uring_destroy(&g_uring.ring);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST uring_multishot_accept()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT(listener >= 0);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/coro_uring_test_%d", (int)getpid());
+    unlink(addr.sun_path);
+    ASSERT_EQ(0, bind(listener, (sockaddr*)&addr, sizeof(addr)));
+    ASSERT_EQ(0, listen(listener, 16));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_uring_accept_multishot(&g_uring.ring, &g_uring.ms, listener);
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_cqe_item item;
+        co_locals_end(co);
+
+        co_begin(co);
+
+        while(g_uring.accepted_cnt < 3)
+        {
+            co_uring_multishot_next(co, &g_uring.ms, locals.item);
+            if(locals.item.res < 0)
+                break;
+            g_uring.accepted[g_uring.accepted_cnt++] = locals.item.res;
+        }
+
+        co_end(co);
+    });
+
+    int clients[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        clients[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+        ASSERT_EQ(0, connect(clients[i], (sockaddr*)&addr, sizeof(addr)));
+    }
+
+    uring_test_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(3, g_uring.accepted_cnt);
+    ASSERT(co_uring_multishot_active(&g_uring.ms));
+
+    for(int i = 0; i < 3; ++i)
+    {
+        close(clients[i]);
+        close(g_uring.accepted[i]);
+    }
+    close(listener);
+    unlink(addr.sun_path);
+    co_uring_destroy(&g_uring.ring);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST uring_multishot_overflow()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+
+    // a nop is never submitted, completions are fed directly as if the kernel produced them.
+    co_uring_multishot* ms = &g_uring.ms;
+    io_uring_sqe* sqe = co_uring_get_sqe(&g_uring.ring);
+    sqe->opcode = IORING_OP_NOP;
+    _co_uring_multishot_start(&g_uring.ring, ms, sqe);
+    uint64_t user_data = sqe->user_data;
+
+    const int CNT = CORO_URING_MULTISHOT_QUEUE + 40;
+    for(int i = 0; i < CNT; ++i)
+        _co_uring_complete(user_data, i, IORING_CQE_F_MORE);
+    ASSERT_EQ(1u, ms->overflows);
+    ASSERT(ms->cancelled);
+    ASSERT_EQ(IORING_OP_ASYNC_CANCEL, g_uring.ring.sqes[(g_uring.ring.sq_local_tail - 1) & *g_uring.ring.sq_mask].opcode);
+
+    // consuming some makes room in the queue, newer completions still go after the spilled.
+    co_uring_cqe_item item;
+    for(int i = 0; i < 10; ++i)
+    {
+        ASSERT(_co_uring_multishot_pop(ms, &item, nullptr));
+        ASSERT_EQ(i, item.res);
+    }
+    _co_uring_complete(user_data, CNT, IORING_CQE_F_MORE);
+    _co_uring_complete(user_data, -ECANCELED, 0);
+    ASSERT_FALSE(co_uring_multishot_active(ms));
+
+    for(int i = 10; i <= CNT; ++i)
+    {
+        ASSERT(_co_uring_multishot_pop(ms, &item, nullptr));
+        ASSERT_EQ(i, item.res);
+    }
+    ASSERT(_co_uring_multishot_pop(ms, &item, nullptr));
+    ASSERT_EQ(-ECANCELED, item.res);
+    ASSERT_EQ(nullptr, ms->spill);
+    ASSERT(_co_uring_multishot_pop(ms, &item, nullptr));
+    ASSERT_EQ(-ENODATA, item.res);
+
+    co_uring_destroy(&g_uring.ring);
+    return 0;
+}
+
+TEST uring_cq_overflow()
+{
+    memset(&g_uring, 0, sizeof(g_uring));
+    // 4 sqes and 8 cqes.
+    if(!co_uring_init(&g_uring.ring, 4, 0))
+        SKIPm("io_uring not available");
+    if(!(g_uring.ring.features & IORING_FEAT_NODROP))
+    {
+        co_uring_destroy(&g_uring.ring);
+        SKIPm("kernel drops cqes on overflow");
+    }
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    const int CNT = 64;
+    for(int i = 0; i < CNT; ++i)
+        co_sched_spawn(&sched, [](coro* co, void*, void*) {
+            co_locals_begin(co);
+                co_uring_op op;
+            co_locals_end(co);
+
+            co_begin(co);
+                co_uring_await(co, &g_uring.ring, &locals.op, co_uring_get_sqe(&g_uring.ring));
+                ++g_uring.received;
+            co_end(co);
+        });
+
+    // nops complete while submitted, overrunning the cq long before they are reaped. Nothing
+    // is left to submit after the first step so only the overflow flush wakes the rest.
+    for(int i = 0; i < 100 && co_sched_live(&sched) > 0; ++i)
+    {
+        co_sched_step(&sched);
+        co_uring_poll(&g_uring.ring, false);
+    }
+    ASSERT_EQ(CNT, g_uring.received);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT(g_uring.ring.cq_flushes > 0);
+
+    co_sched_destroy(&sched);
+    co_uring_destroy(&g_uring.ring);
+    return 0;
+}
+
+static bool uring_test_tcp_pair(int fds[2])
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    bool ok = listener >= 0 &&
+              bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+              listen(listener, 1) == 0 &&
+              getsockname(listener, (sockaddr*)&addr, &addr_len) == 0 &&
+              (fds[0] = socket(AF_INET, SOCK_STREAM, 0)) >= 0 &&
+              connect(fds[0], (sockaddr*)&addr, sizeof(addr)) == 0 &&
+              (fds[1] = accept(listener, nullptr, nullptr)) >= 0;
+    if(listener >= 0)
+        close(listener);
+    return ok;
+}
+
+TEST uring_send_zc()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+    ASSERT(uring_test_tcp_pair(g_uring.fds));
+
+    static uint8_t payload[32 * 1024];
+    for(size_t i = 0; i < sizeof(payload); ++i)
+        payload[i] = (uint8_t)i;
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_op op;
+        co_locals_end(co);
+
+        co_begin(co);
+            co_uring_send_zc(co, &g_uring.ring, &locals.op, g_uring.fds[0], payload, sizeof(payload));
+            g_uring.result = locals.op.res;
+            // the notification has arrived when the coroutine is resumed, payload may be reused.
+            memset(payload, 0, sizeof(payload));
+        co_end(co);
+    });
+
+    uring_test_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    if(g_uring.result == -EINVAL || g_uring.result == -EOPNOTSUPP)
+    {
+        close(g_uring.fds[0]);
+        close(g_uring.fds[1]);
+        co_uring_destroy(&g_uring.ring);
+        SKIPm("zero-copy send not supported");
+    }
+    ASSERT_EQ((int)sizeof(payload), g_uring.result);
+
+    static uint8_t received[sizeof(payload)];
+    size_t received_len = 0;
+    while(received_len < sizeof(received))
+    {
+        ssize_t res = recv(g_uring.fds[1], received + received_len, sizeof(received) - received_len, 0);
+        ASSERT(res > 0);
+        received_len += (size_t)res;
+    }
+    for(size_t i = 0; i < sizeof(received); ++i)
+        ASSERT_EQ((uint8_t)i, received[i]);
+
+    close(g_uring.fds[0]);
+    close(g_uring.fds[1]);
+    co_uring_destroy(&g_uring.ring);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST uring_splice()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+
+    char path[] = "/tmp/coro_uring_splice_XXXXXX";
+    int file = mkstemp(path);
+    ASSERT(file >= 0);
+    unlink(path);
+    ASSERT_EQ(14, write(file, "spliced-buffer", 14));
+    ASSERT_EQ(0, pipe(g_uring.fds));
+
+    static int s_file;
+    s_file = file;
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_op op;
+        co_locals_end(co);
+
+        co_begin(co);
+            co_uring_splice(co, &g_uring.ring, &locals.op, s_file, 0, g_uring.fds[1], -1, 14);
+            g_uring.result = locals.op.res;
+        co_end(co);
+    });
+
+    uring_test_run(&sched);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(14, g_uring.result);
+
+    char buf[16];
+    ASSERT_EQ(14, read(g_uring.fds[0], buf, sizeof(buf)));
+    ASSERT_EQ(0, memcmp(buf, "spliced-buffer", 14));
+
+    close(file);
+    close(g_uring.fds[0]);
+    close(g_uring.fds[1]);
+    co_uring_destroy(&g_uring.ring);
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+TEST uring_run_busy()
+{
+    if(!uring_test_init())
+        SKIPm("io_uring not available");
+    ASSERT_EQ(0, pipe(g_uring.fds));
+
+    co_sched sched;
+    co_sched_init(&sched, 256, nullptr);
+
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_op op;
+            char        buf[8];
+        co_locals_end(co);
+
+        co_begin(co);
+            co_uring_read(co, &g_uring.ring, &locals.op, g_uring.fds[0], locals.buf, sizeof(locals.buf), (uint64_t)-1);
+            g_uring.result = locals.op.res;
+        co_end(co);
+    });
+    co_sched_spawn(&sched, [](coro* co, void*, void*) {
+        co_locals_begin(co);
+            co_uring_op op;
+        co_locals_end(co);
+
+        co_begin(co);
+            co_uring_write(co, &g_uring.ring, &locals.op, g_uring.fds[1], "busy", 4, (uint64_t)-1);
+        co_end(co);
+    });
+
+    uint64_t submits = g_uring.ring.submits;
+    co_uring_run_busy(&g_uring.ring, &sched, nullptr);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+    ASSERT_EQ(4, g_uring.result);
+    // polling while nothing is to be submitted don't enter the kernel.
+    ASSERT(g_uring.ring.submits - submits <= 2);
+
+    co_sched_destroy(&sched);
+    close(g_uring.fds[0]);
+    close(g_uring.fds[1]);
+    co_uring_destroy(&g_uring.ring);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_uring_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( uring_read_write_fixed );
+    RUN_TEST( uring_multishot_recv_buffer_ring );
+    RUN_TEST( uring_multishot_accept );
+    RUN_TEST( uring_multishot_overflow );
+    RUN_TEST( uring_cq_overflow );
+    RUN_TEST( uring_send_zc );
+    RUN_TEST( uring_splice );
+    RUN_TEST( uring_run_busy );
+#endif
+}
@@ -0,0 +1,252 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+#include "greatest.h"
+
+#if defined(__linux__)
+
+#include "../coro_watchdog.h"
+
+static co_watchdog        g_wd;
+static co_watchdog_report g_wd_last;
+static int                g_wd_reports;
+
+static void wd_test_report(const co_watchdog_report* report, void*)
+{
+    g_wd_last = *report;
+    __atomic_add_fetch(&g_wd_reports, 1, __ATOMIC_RELEASE);
+}
+
+static void wd_test_check_from_inside(coro* co, void*, void*)
+{
+    co_begin(co);
+
+    {
+        // pretend that this resume has been running for 60ms.
+        uint64_t now = _co_watchdog_now();
+        co_watchdog_check(&g_wd, now);
+        co_watchdog_check(&g_wd, now + 60 * 1000000ull);
+        co_watchdog_check(&g_wd, now + 90 * 1000000ull);
+    }
+
+    co_end(co);
+}
+
+TEST watchdog_reports_stalled_resume()
+{
+    co_sched sched;
+    co_sched_init(&sched, 2048, nullptr);
+
+    co_watchdog_init(&g_wd, 50, 0, wd_test_report, nullptr);
+    ASSERT(co_watchdog_add(&g_wd, &sched));
+    g_wd_reports = 0;
+
+    coro* task = co_sched_spawn(&sched, wd_test_check_from_inside);
+    ASSERT(task != nullptr);
+    co_sched_run(&sched);
+
+    // only reported once per stall.
+    ASSERT_EQ(1, g_wd_reports);
+    ASSERT_EQ(CO_WATCHDOG_STALLED_RESUME, g_wd_last.kind);
+    ASSERT_EQ(&sched, g_wd_last.sched);
+    ASSERT_EQ(task, g_wd_last.co);
+    ASSERT(g_wd_last.duration_ns >= 60 * 1000000ull);
+    ASSERT(co_watchdog_current(&sched) == nullptr);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static void wd_test_nop(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_end(co);
+}
+
+TEST watchdog_reports_starving()
+{
+    co_sched sched;
+    co_sched_init(&sched, 2048, nullptr);
+
+    co_watchdog_init(&g_wd, 0, 200, wd_test_report, nullptr);
+    ASSERT(co_watchdog_add(&g_wd, &sched));
+    g_wd_reports = 0;
+
+    uint64_t now = _co_watchdog_now();
+    co_watchdog_check(&g_wd, now + 300 * 1000000ull);
+    ASSERT_EQ(0, g_wd_reports); // nothing ready, not starving.
+
+    co_sched_spawn(&sched, wd_test_nop);
+    co_sched_spawn(&sched, wd_test_nop);
+    co_watchdog_check(&g_wd, now + 600 * 1000000ull);
+    ASSERT_EQ(1, g_wd_reports);
+    ASSERT_EQ(CO_WATCHDOG_STARVING, g_wd_last.kind);
+    ASSERT_EQ(2u, g_wd_last.ready_cnt);
+    ASSERT(g_wd_last.co == nullptr);
+    ASSERT(g_wd_last.group == nullptr); // the whole scheduler, not reported again per group.
+    co_watchdog_check(&g_wd, now + 700 * 1000000ull);
+    ASSERT_EQ(1, g_wd_reports); // only reported once.
+
+    // progress resets the watchdog.
+    co_sched_run(&sched);
+    co_sched_spawn(&sched, wd_test_nop);
+    now = _co_watchdog_now();
+    co_watchdog_check(&g_wd, now + 100 * 1000000ull);
+    ASSERT_EQ(1, g_wd_reports);
+    co_watchdog_check(&g_wd, now + 300 * 1000000ull);
+    ASSERT_EQ(2, g_wd_reports);
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static co_sched_group g_wd_busy_group;
+static co_sched_group g_wd_starved_group;
+static uint64_t       g_wd_start;
+
+static void wd_test_busy_group(coro* co, void*, void*)
+{
+    co_locals_begin(co);
+        int i;
+    co_locals_end(co);
+
+    co_begin(co);
+    // keeps the scheduler resuming while the other group waits for its turn.
+    for(locals.i = 1; locals.i <= 5; ++locals.i)
+    {
+        co_watchdog_check(&g_wd, g_wd_start + (uint64_t)locals.i * 100 * 1000000ull);
+        co_yield(co);
+    }
+    co_end(co);
+}
+
+TEST watchdog_reports_starving_group()
+{
+    co_sched sched;
+    co_sched_init(&sched, 2048, nullptr);
+    co_sched_group_init(&g_wd_busy_group, 1000);
+    co_sched_group_init(&g_wd_starved_group, 1);
+
+    co_watchdog_init(&g_wd, 0, 200, wd_test_report, nullptr);
+    ASSERT(co_watchdog_add(&g_wd, &sched));
+    ASSERT(co_watchdog_add_group(&g_wd, &sched, &g_wd_busy_group));
+    ASSERT(co_watchdog_add_group(&g_wd, &sched, &g_wd_starved_group));
+    ASSERT_FALSE(co_watchdog_add_group(&g_wd, (co_sched*)nullptr, &g_wd_starved_group));
+    g_wd_reports = 0;
+
+    g_wd_start = _co_watchdog_now();
+    co_sched_spawn_in(&sched, &g_wd_busy_group, wd_test_busy_group);
+    co_sched_spawn_in(&sched, &g_wd_starved_group, wd_test_nop);
+    co_sched_run(&sched);
+
+    // resume_seq changed on every check but the starved group still got reported, once.
+    ASSERT_EQ(1, g_wd_reports);
+    ASSERT_EQ(CO_WATCHDOG_STARVING, g_wd_last.kind);
+    ASSERT_EQ(&g_wd_starved_group, g_wd_last.group);
+    ASSERT(g_wd_last.duration_ns >= 200 * 1000000ull);
+    ASSERT_EQ(1u, g_wd_last.ready_cnt);
+    ASSERT_EQ(0u, co_sched_live(&sched));
+
+    co_sched_destroy(&sched);
+    return 0;
+}
+
+static co_sched      g_wd_sched;
+static co_frame_info g_wd_frames[4];
+static int           g_wd_depth;
+
+static void wd_test_signal(int)
+{
+    coro* co = co_watchdog_current(&g_wd_sched);
+    if(co != nullptr)
+        __atomic_store_n(&g_wd_depth, co_backtrace(co, g_wd_frames, 4), __ATOMIC_RELEASE);
+}
+
+static void wd_test_busy_leaf(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_yield(co);
+    // forgot to yield in this loop, spin until the watchdog has sampled a backtrace.
+    while(__atomic_load_n(&g_wd_depth, __ATOMIC_ACQUIRE) == 0) {}
+    co_end(co);
+}
+
+static void wd_test_busy_root(coro* co, void*, void*)
+{
+    co_begin(co);
+    co_call(co, wd_test_busy_leaf);
+    co_end(co);
+}
+
+TEST watchdog_signal_backtrace()
+{
+    struct sigaction sa;
+    struct sigaction old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = wd_test_signal;
+    sigemptyset(&sa.sa_mask);
+    ASSERT_EQ(0, sigaction(SIGUSR1, &sa, &old_sa));
+
+    co_sched_init(&g_wd_sched, 2048, nullptr);
+    g_wd_depth   = 0;
+    g_wd_reports = 0;
+
+    co_watchdog_init(&g_wd, 10, 0, wd_test_report, nullptr);
+    co_watchdog_set_signal(&g_wd, SIGUSR1);
+    ASSERT(co_watchdog_add(&g_wd, &g_wd_sched));
+    ASSERT(co_watchdog_start(&g_wd));
+
+    co_sched_spawn(&g_wd_sched, wd_test_busy_root);
+    co_sched_run(&g_wd_sched);
+
+    co_watchdog_stop(&g_wd);
+    sigaction(SIGUSR1, &old_sa, nullptr);
+
+    ASSERT(__atomic_load_n(&g_wd_reports, __ATOMIC_ACQUIRE) >= 1);
+    ASSERT_EQ(CO_WATCHDOG_STALLED_RESUME, g_wd_last.kind);
+    ASSERT_EQ(2, g_wd_depth);
+    ASSERT_EQ((co_func)wd_test_busy_root, g_wd_frames[0].func);
+    ASSERT_EQ((co_func)wd_test_busy_leaf, g_wd_frames[1].func);
+    ASSERT(g_wd_frames[1].line > 0); // suspended at the co_yield().
+
+    co_sched_destroy(&g_wd_sched);
+    return 0;
+}
+
+#endif
+
+GREATEST_SUITE( coro_watchdog_tests )
+{
+#if defined(__linux__)
+    RUN_TEST( watchdog_reports_stalled_resume );
+    RUN_TEST( watchdog_reports_starving );
+    RUN_TEST( watchdog_reports_starving_group );
+    RUN_TEST( watchdog_signal_backtrace );
+#endif
+}
@@ -0,0 +1,156 @@
+/*
+   Header implementing "protothreads" but with a stack to support
+   local-varible state, argument-passing and sub-coroutines.
+
+   version 1.0, november, 2018
+
+   Copyright (C) 2018- Fredrik Kihlander
+
+   https://github.com/wc-duck/coro
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+      claim that you wrote the original software. If you use this software
+      in a product, an acknowledgment in the product documentation would be
+      appreciated but is not required.
+   2. Altered source versions must be plainly marked as such, and must not be
+      misrepresented as being the original software.
+   3. This notice may not be removed or altered from any source distribution.
+
+   Fredrik Kihlander
+*/
+
+/*
+    Live view of the schedulers in a process publishing to a page with coro_stats.h.
+
+    usage: co_top <name> [interval_ms] [samples]
+
+    name is the name passed to co_stats_create() in the process, for example /my_service.
+    Attaches read-only and prints current values and rates since the last sample every
+    interval_ms, default 1000. Runs until killed or 'samples' samples has been printed.
+*/
+
+#if defined(__linux__)
+
+#include "../coro_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_sec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double rate(uint64_t curr, uint64_t prev, double dt)
+{
+    return curr >= prev ? (double)(curr - prev) / dt : 0.0;
+}
+
+static co_stats_values g_prev[CORO_STATS_MAX_SCHEDS];
+static co_stats_values g_curr[CORO_STATS_MAX_SCHEDS];
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s <name> [interval_ms] [samples]\n", argv[0]);
+        return 1;
+    }
+    int interval_ms = argc > 2 ? atoi(argv[2]) : 1000;
+    int samples     = argc > 3 ? atoi(argv[3]) : 0;
+    if(interval_ms <= 0)
+        interval_ms = 1000;
+
+    co_stats stats;
+    if(!co_stats_attach(&stats, argv[1]))
+    {
+        fprintf(stderr, "failed to attach to %s\n", argv[1]);
+        return 1;
+    }
+
+    bool   clear     = isatty(STDOUT_FILENO) != 0;
+    double prev_time = now_sec();
+    for(uint32_t i = 0; i < CORO_STATS_MAX_SCHEDS; ++i)
+        co_stats_read(&stats.page->slots[i], &g_prev[i]);
+
+    timespec interval;
+    interval.tv_sec  = interval_ms / 1000;
+    interval.tv_nsec = (long)(interval_ms % 1000) * 1000000;
+
+    for(int sample = 0; samples == 0 || sample < samples; ++sample)
+    {
+        nanosleep(&interval, nullptr);
+
+        double   time     = now_sec();
+        double   dt       = time - prev_time;
+        uint32_t slot_cnt = __atomic_load_n(&stats.page->slot_cnt, __ATOMIC_ACQUIRE);
+        prev_time = time;
+
+        if(clear)
+            printf("\x1b[H\x1b[2J");
+        printf("%s pid %u, %u schedulers, %.2fs\n\n", argv[1], stats.page->pid, slot_cnt, dt);
+        printf("%-16s %8s %8s %12s %12s %10s %8s %8s %10s\n",
+               "sched", "live", "ready", "resumes/s", "parks/s", "stack KB", "grows", "rejected", "pool-hit/s");
+
+        for(uint32_t i = 0; i < slot_cnt; ++i)
+        {
+            const co_stats_slot* slot = &stats.page->slots[i];
+            co_stats_values*     curr = &g_curr[i];
+            co_stats_values*     prev = &g_prev[i];
+            if(!co_stats_read(slot, curr))
+            {
+                printf("%-16.16s (busy)\n", slot->name);
+                continue;
+            }
+
+            printf("%-16.16s %8llu %8llu %12.0f %12.0f %10llu %8llu %8llu %10.0f\n",
+                   slot->name,
+                   (unsigned long long)curr->live,
+                   (unsigned long long)curr->ready,
+                   rate(curr->resumes, prev->resumes, dt),
+                   rate(curr->parks, prev->parks, dt),
+                   (unsigned long long)(curr->stack_bytes / 1024),
+                   (unsigned long long)curr->stack_grows,
+                   (unsigned long long)curr->spawn_rejected,
+                   rate(curr->pool_hits, prev->pool_hits, dt));
+
+            for(uint32_t r = 0; r < curr->reason_cnt && r < CO_STATS_MAX_REASONS; ++r)
+            {
+                uint64_t prev_parks = r < prev->reason_cnt ? prev->reason_parks[r] : 0;
+                printf("    %-24.24s %12.0f waits/s %14llu total\n",
+                       curr->reasons[r],
+                       rate(curr->reason_parks[r], prev_parks, dt),
+                       (unsigned long long)curr->reason_parks[r]);
+            }
+            *prev = *curr;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    co_stats_destroy(&stats);
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+
+int main()
+{
+    printf("co_top is linux-only\n");
+    return 0;
+}
+
+#endif